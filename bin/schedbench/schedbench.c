@@ -0,0 +1,150 @@
+/*
+ * Mixed-workload scheduler benchmark.
+ *
+ * An interactive process echoes characters typed into a pseudo-terminal,
+ * while a number of CPU-bound processes compute the Mandelbrot set, just as
+ * `mandelbrot` program does. The benchmark reports how long it takes for
+ * a character to come back, first on idle system, then under the load.
+ *
+ * Boot the kernel with `sched=rr` or `sched=fair` to compare scheduling
+ * classes.
+ */
+#include <err.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <util.h>
+#include <sys/wait.h>
+
+#define WIDTH 640
+#define HEIGHT 480
+
+#define MAX_HOGS 16
+
+/* Time between consecutive key strokes. */
+#define TYPING_DELAY_MS 20
+
+/* Keep the compiler from optimizing the computation away. */
+static volatile uint8_t image[WIDTH * HEIGHT];
+
+static int fun(float re, float im) {
+  float re0 = re, im0 = im;
+  unsigned int n = 0;
+  for (n = 0; n < 50; n++) {
+    float xt = re * re - im * im + re0;
+    im = 2 * im * re + im0;
+    re = xt;
+    if (im * im + re * re > 50000.0f)
+      break;
+  };
+  return (50 - n) * 250 / 50;
+}
+
+static __noreturn void mandelbrot(void) {
+  for (;;) {
+    for (unsigned int y = 0; y < HEIGHT; y++) {
+      for (unsigned int x = 0; x < WIDTH; x++) {
+        float re = (x / (float)WIDTH) * 2.0f - 1.0f;
+        float im = (y / (float)HEIGHT) * 2.0f - 1.0f;
+        im *= -1 * (HEIGHT / (float)WIDTH);
+        image[y * WIDTH + x] = fun((re - 0.25f) * 1.8f, im * 1.8f);
+      }
+    }
+  }
+}
+
+static __noreturn void echo(int fd) {
+  char c;
+
+  while (read(fd, &c, 1) == 1)
+    if (write(fd, &c, 1) != 1)
+      break;
+
+  exit(EXIT_FAILURE);
+}
+
+static int64_t now_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Types `samples` characters into pseudo-terminal `fd` and reports how long
+ * the echo took. */
+static void measure(int fd, int samples, int hogs) {
+  const struct timespec delay = {.tv_nsec = TYPING_DELAY_MS * 1000000};
+  int64_t min = 0, max = 0, sum = 0;
+
+  for (int i = 0; i < samples; i++) {
+    char c = 'a' + i % 26;
+
+    nanosleep(&delay, NULL);
+
+    int64_t start = now_us();
+    if (write(fd, &c, 1) != 1 || read(fd, &c, 1) != 1)
+      err(EXIT_FAILURE, "pty");
+    int64_t lat = now_us() - start;
+
+    if (i == 0 || lat < min)
+      min = lat;
+    if (lat > max)
+      max = lat;
+    sum += lat;
+  }
+
+  printf("%2d mandelbrot(s): tty latency min %lld us, avg %lld us, "
+         "max %lld us\n",
+         hogs, (long long)min, (long long)(sum / samples), (long long)max);
+}
+
+int main(int argc, char **argv) {
+  int nhogs = argc > 1 ? atoi(argv[1]) : 4;
+  int samples = argc > 2 ? atoi(argv[2]) : 100;
+  pid_t hogs[MAX_HOGS];
+  struct termios t;
+  int master, slave;
+
+  if (nhogs < 0 || nhogs > MAX_HOGS || samples <= 0)
+    errx(EXIT_FAILURE, "usage: schedbench [mandelbrots] [samples]");
+
+  if (openpty(&master, &slave, NULL, NULL, NULL) < 0)
+    err(EXIT_FAILURE, "openpty");
+
+  /* Pass each character through as soon as it's typed. */
+  tcgetattr(slave, &t);
+  cfmakeraw(&t);
+  tcsetattr(slave, TCSANOW, &t);
+
+  pid_t echo_pid = fork();
+  if (echo_pid < 0)
+    err(EXIT_FAILURE, "fork");
+  if (echo_pid == 0) {
+    close(master);
+    echo(slave);
+  }
+  close(slave);
+
+  measure(master, samples, 0);
+
+  for (int i = 0; i < nhogs; i++) {
+    if ((hogs[i] = fork()) < 0)
+      err(EXIT_FAILURE, "fork");
+    if (hogs[i] == 0)
+      mandelbrot();
+  }
+
+  measure(master, samples, nhogs);
+
+  for (int i = 0; i < nhogs; i++)
+    kill(hogs[i], SIGKILL);
+  kill(echo_pid, SIGKILL);
+
+  while (wait(NULL) > 0)
+    continue;
+
+  return EXIT_SUCCESS;
+}
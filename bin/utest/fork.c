@@ -1,9 +1,13 @@
 #include "utest.h"
+#include "util.h"
 
 #include <sched.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
@@ -61,3 +65,91 @@ TEST_ADD(fork_sigchld_ignored) {
   assert(wait(NULL) == -1);
   return 0;
 }
+
+TEST_ADD(fork_cow) {
+  size_t pgsz = getpagesize();
+  char *map =
+    mmap(NULL, 4 * pgsz, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+  assert(map != (char *)MAP_FAILED);
+
+  strcpy(map, "parent");
+  strcpy(map + pgsz, "parent");
+
+  pid_t pid = fork();
+  assert(pid >= 0);
+
+  if (pid == 0) {
+    /* child sees parent's data, but its writes must stay private */
+    assert(strcmp(map, "parent") == 0);
+    strcpy(map, "child");
+    strcpy(map + 2 * pgsz, "child");
+    assert(strcmp(map + pgsz, "parent") == 0);
+    exit(0);
+  }
+
+  /* parent writes after fork must not be visible in the child */
+  strcpy(map + pgsz, "parent2");
+  wait_for_child_exit(pid, 0);
+  assert(strcmp(map, "parent") == 0);
+  assert(strcmp(map + pgsz, "parent2") == 0);
+  assert(map[2 * pgsz] == 0);
+  assert(munmap(map, 4 * pgsz) == 0);
+  return 0;
+}
+
+#define FORK_BENCH_PAGES 512
+#define FORK_BENCH_ROUNDS 16
+
+static long usec_since(timespec_t *start) {
+  timespec_t now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000L +
+         (now.tv_nsec - start->tv_nsec) / 1000L;
+}
+
+/* Measures fork+exec latency of a process with a large private working set
+ * and compares it against a fork that touches every page of it. With
+ * copy-on-write the former does not depend on the size of address space. */
+TEST_ADD(fork_exec_latency) {
+  size_t pgsz = getpagesize();
+  size_t size = FORK_BENCH_PAGES * pgsz;
+  char *map =
+    mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+  assert(map != (char *)MAP_FAILED);
+  memset(map, 0x55, size);
+
+  timespec_t start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < FORK_BENCH_ROUNDS; i++) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      execl("/bin/echo", "echo", "-n", NULL);
+      exit(1);
+    }
+    wait_for_child_exit(pid, 0);
+  }
+  long exec_us = usec_since(&start) / FORK_BENCH_ROUNDS;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int i = 0; i < FORK_BENCH_ROUNDS; i++) {
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+      for (size_t off = 0; off < size; off += pgsz)
+        map[off] = 0xaa;
+      exit(0);
+    }
+    wait_for_child_exit(pid, 0);
+  }
+  long touch_us = usec_since(&start) / FORK_BENCH_ROUNDS;
+
+  printf("fork+exec with %d private pages: %ld us\n", FORK_BENCH_PAGES,
+         exec_us);
+  printf("fork+write of %d private pages: %ld us\n", FORK_BENCH_PAGES,
+         touch_us);
+
+  assert(map[0] == 0x55 && map[size - 1] == 0x55);
+  assert(munmap(map, size) == 0);
+  return 0;
+}
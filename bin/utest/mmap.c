@@ -2,6 +2,7 @@
 #include "util.h"
 
 #include <errno.h>
+#include <fcntl.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdint.h>
@@ -9,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #if __SIZEOF_POINTER__ == 4
@@ -365,3 +367,160 @@ TEST_ADD(mmap_fixed_replace_many_2) {
 
   return 0;
 }
+
+#define TESTFILE "/tmp/mmap_file"
+
+static int prepare_file(size_t pgsz) {
+  int fd = open(TESTFILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+  char *buf = malloc(2 * pgsz);
+  memset(buf, 'a', pgsz);
+  memset(buf + pgsz, 'b', pgsz);
+  assert(write(fd, buf, 2 * pgsz) == (ssize_t)(2 * pgsz));
+  free(buf);
+  return fd;
+}
+
+TEST_ADD(mmap_file_private) {
+  size_t pgsz = getpagesize();
+  int fd = prepare_file(pgsz);
+
+  char *addr =
+    mmap(NULL, 2 * pgsz, PROT_READ | PROT_WRITE, MAP_FILE | MAP_PRIVATE, fd, 0);
+  assert(addr != MAP_FAILED);
+  assert(addr[0] == 'a' && addr[pgsz] == 'b');
+
+  /* Private modifications must not reach the file. */
+  addr[0] = 'x';
+  char c;
+  syscall_ok(lseek(fd, 0, SEEK_SET));
+  assert(read(fd, &c, 1) == 1);
+  assert(c == 'a');
+
+  /* Mapping at an offset within the file. */
+  char *second = mmap(NULL, pgsz, PROT_READ, MAP_FILE | MAP_PRIVATE, fd, pgsz);
+  assert(second != MAP_FAILED);
+  assert(second[0] == 'b' && second[pgsz - 1] == 'b');
+
+  /* Offset must be page aligned. */
+  syscall_fail(mmap(NULL, pgsz, PROT_READ, MAP_FILE | MAP_PRIVATE, fd, 1),
+               EINVAL);
+
+  syscall_ok(munmap(addr, 2 * pgsz));
+  syscall_ok(munmap(second, pgsz));
+  syscall_ok(close(fd));
+  syscall_ok(unlink(TESTFILE));
+  return 0;
+}
+
+TEST_ADD(mmap_file_shared) {
+  size_t pgsz = getpagesize();
+  int fd = prepare_file(pgsz);
+
+  char *addr =
+    mmap(NULL, 2 * pgsz, PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED, fd, 0);
+  assert(addr != MAP_FAILED);
+
+  pid_t pid = fork();
+  assert(pid >= 0);
+
+  if (pid == 0) {
+    /* child shares pages with the parent through the file */
+    char *map = mmap(NULL, pgsz, PROT_READ | PROT_WRITE,
+                     MAP_FILE | MAP_SHARED, fd, pgsz);
+    assert(map != MAP_FAILED);
+    strcpy(map, "Hello, World!");
+    exit(0);
+  }
+
+  wait_for_child_exit(pid, 0);
+  string_eq(addr + pgsz, "Hello, World!");
+
+  /* Changes must be visible through read(2) after msync. */
+  addr[0] = 'x';
+  syscall_ok(msync(addr, pgsz, MS_SYNC));
+  char c;
+  syscall_ok(lseek(fd, 0, SEEK_SET));
+  assert(read(fd, &c, 1) == 1);
+  assert(c == 'x');
+
+  /* Writes through file descriptor are visible in the mapping. */
+  assert(lseek(fd, 1, SEEK_SET) == 1);
+  assert(write(fd, "y", 1) == 1);
+  assert(addr[1] == 'y');
+
+  /* ... and they don't discard changes made to the rest of the page. */
+  addr[2] = 'z';
+  assert(lseek(fd, 3, SEEK_SET) == 3);
+  assert(write(fd, "w", 1) == 1);
+  assert(addr[2] == 'z' && addr[3] == 'w');
+  syscall_ok(msync(addr, pgsz, MS_SYNC));
+  syscall_ok(lseek(fd, 2, SEEK_SET));
+  assert(read(fd, &c, 1) == 1);
+  assert(c == 'z');
+
+  syscall_ok(munmap(addr, 2 * pgsz));
+  syscall_ok(close(fd));
+  syscall_ok(unlink(TESTFILE));
+  return 0;
+}
+
+TEST_ADD(mmap_file_access) {
+  size_t pgsz = getpagesize();
+  int fd = prepare_file(pgsz);
+  syscall_ok(close(fd));
+
+  fd = open(TESTFILE, O_RDONLY);
+  assert(fd >= 0);
+
+  /* Cannot write to read-only file through shared mapping. */
+  syscall_fail(
+    mmap(NULL, pgsz, PROT_READ | PROT_WRITE, MAP_FILE | MAP_SHARED, fd, 0),
+    EACCES);
+
+  /* ... but private mapping is fine. */
+  void *addr =
+    mmap(NULL, pgsz, PROT_READ | PROT_WRITE, MAP_FILE | MAP_PRIVATE, fd, 0);
+  assert(addr != MAP_FAILED);
+  syscall_ok(munmap(addr, pgsz));
+
+  syscall_fail(mmap(NULL, pgsz, PROT_READ, MAP_FILE | MAP_SHARED, -1, 0),
+               EBADF);
+
+  syscall_ok(close(fd));
+  syscall_ok(unlink(TESTFILE));
+  return 0;
+}
+
+TEST_ADD(mmap_file_eof) {
+  size_t pgsz = getpagesize();
+  int fd = open(TESTFILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  assert(fd >= 0);
+  char *buf = malloc(pgsz + 10);
+  memset(buf, 'a', pgsz + 10);
+  assert(write(fd, buf, pgsz + 10) == (ssize_t)(pgsz + 10));
+  free(buf);
+
+  char *addr = mmap(NULL, 3 * pgsz, PROT_READ, MAP_FILE | MAP_SHARED, fd, 0);
+  assert(addr != MAP_FAILED);
+
+  /* The last page of the file is zero-filled past the end of file. */
+  assert(addr[pgsz + 9] == 'a');
+  for (size_t i = pgsz + 10; i < 2 * pgsz; i++)
+    assert(addr[i] == 0);
+
+  /* Pages beyond the last one cannot be accessed. */
+  siginfo_t si;
+  EXPECT_SIGNAL(SIGBUS, &si) {
+    int data = *(volatile char *)(addr + 2 * pgsz);
+    (void)data;
+  }
+  CLEANUP_SIGNAL();
+  void *eof_page = addr + 2 * pgsz;
+  CHECK_SIGBUS(&si, eof_page, eof_page, BUS_OBJERR);
+
+  syscall_ok(munmap(addr, 3 * pgsz));
+  syscall_ok(close(fd));
+  syscall_ok(unlink(TESTFILE));
+  return 0;
+}
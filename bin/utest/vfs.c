@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <dirent.h>
 #include <unistd.h>
 
 /* Shift used fds by 3 so std{in,out,err} are not affected. */
@@ -394,3 +395,102 @@ TEST_ADD(vfs_chmod) {
 
   return 0;
 }
+
+#define NFILES 512
+
+TEST_ADD(vfs_dir_many) {
+  char path[64];
+  int fd;
+
+  syscall_ok(mkdir(TESTDIR "/many", 0700));
+
+  for (int i = 0; i < NFILES; i++) {
+    snprintf(path, sizeof(path), TESTDIR "/many/file%d", i);
+    assert((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0);
+    syscall_ok(close(fd));
+  }
+
+  /* Every name must be found exactly once. */
+  for (int i = 0; i < NFILES; i++) {
+    snprintf(path, sizeof(path), TESTDIR "/many/file%d", i);
+    syscall_fail(open(path, O_RDWR | O_CREAT | O_EXCL, 0600), EEXIST);
+  }
+  syscall_fail(access(TESTDIR "/many/file", 0), ENOENT);
+
+  /* Remove every other file and check readdir sees the rest. */
+  for (int i = 0; i < NFILES; i += 2) {
+    snprintf(path, sizeof(path), TESTDIR "/many/file%d", i);
+    syscall_ok(unlink(path));
+    syscall_fail(access(path, 0), ENOENT);
+  }
+
+  DIR *dir = opendir(TESTDIR "/many");
+  assert(dir != NULL);
+  struct dirent *de;
+  int nfiles = 0;
+  while ((de = readdir(dir)) != NULL) {
+    if (de->d_name[0] == '.')
+      continue;
+    int n = atoi(de->d_name + strlen("file"));
+    assert(n % 2 == 1 && n < NFILES);
+    nfiles++;
+  }
+  closedir(dir);
+  assert(nfiles == NFILES / 2);
+
+  for (int i = 1; i < NFILES; i += 2) {
+    snprintf(path, sizeof(path), TESTDIR "/many/file%d", i);
+    syscall_ok(unlink(path));
+  }
+  syscall_ok(rmdir(TESTDIR "/many"));
+
+  return 0;
+}
+
+TEST_ADD(vfs_getdents_resume) {
+  char path[64];
+  /* Room for exactly one entry, since names are at most 6 characters long. */
+  uint64_t buf[3];
+  int fd;
+
+  syscall_ok(mkdir(TESTDIR "/resume", 0700));
+  for (int i = 0; i < NFILES / 8; i++) {
+    snprintf(path, sizeof(path), TESTDIR "/resume/file%d", i);
+    assert((fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600)) >= 0);
+    syscall_ok(close(fd));
+  }
+
+  assert((fd = open(TESTDIR "/resume", O_RDONLY | O_DIRECTORY)) >= 0);
+
+  /* Read one entry at a time, remembering the offset of the sixth one. */
+  int nentries = 0, n;
+  off_t sixth = -1;
+  char name[32];
+  for (;;) {
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    assert(offset >= 0);
+    if ((n = getdents(fd, (char *)buf, sizeof(buf))) == 0)
+      break;
+    struct dirent *de = (struct dirent *)buf;
+    assert(n == de->d_reclen);
+    if (++nentries == 6) {
+      sixth = offset;
+      strlcpy(name, de->d_name, sizeof(name));
+    }
+  }
+  assert(nentries == NFILES / 8 + 2);
+
+  /* Going back to the saved offset must yield the same entry. */
+  assert(lseek(fd, sixth, SEEK_SET) == sixth);
+  assert(getdents(fd, (char *)buf, sizeof(buf)) > 0);
+  assert(!strcmp(((struct dirent *)buf)->d_name, name));
+  syscall_ok(close(fd));
+
+  for (int i = 0; i < NFILES / 8; i++) {
+    snprintf(path, sizeof(path), TESTDIR "/resume/file%d", i);
+    syscall_ok(unlink(path));
+  }
+  syscall_ok(rmdir(TESTDIR "/resume"));
+
+  return 0;
+}
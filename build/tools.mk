@@ -81,5 +81,6 @@ CURL	= curl -J -L
 GIT     = git
 PATCH   = patch
 GENASSYM = $(TOPDIR)/sys/script/genassym.sh
+MKINITRD = $(TOPDIR)/sys/script/mkinitrd.py
 YACC	= byacc
 GZIP	= gzip -9
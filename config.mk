@@ -43,3 +43,5 @@ KASAN ?= 0
 KGPROF ?= 0
 KCSAN ?= 0
 TRAP_USER_ACCESS ?= 0
+# Compress initial ramdisk, so that it takes less time to load.
+INITRD_COMPRESS ?= 0
@@ -1,7 +1,37 @@
 #ifndef _AARCH64_PCPU_H_
 #define _AARCH64_PCPU_H_
 
+#define MAXCPU 4
+
 #define PCPU_MD_FIELDS                                                         \
   struct {}
 
+#ifndef __ASSEMBLER__
+
+/* TPIDR_EL1 holds the address of pcpu_t of the CPU we run on. */
+#define curpcpu()                                                              \
+  ({                                                                           \
+    pcpu_t *__pc;                                                              \
+    __asm __volatile("mrs %0, tpidr_el1" : "=r"(__pc));                        \
+    __pc;                                                                      \
+  })
+
+/* Reading TPIDR_EL1 and loading `curthread` are separate instructions, so IRQs
+ * are masked in between to prevent the thread from migrating. */
+#define md_curthread()                                                         \
+  ({                                                                           \
+    thread_t *__td;                                                            \
+    uint64_t __daif;                                                           \
+    __asm __volatile("mrs %0, daif\n\t"                                        \
+                     "msr daifset, #2\n\t"                                     \
+                     "mrs %1, tpidr_el1\n\t"                                   \
+                     "ldr %1, [%1, %2]\n\t"                                    \
+                     "msr daif, %0"                                            \
+                     : "=&r"(__daif), "=&r"(__td)                              \
+                     : "i"(offsetof(pcpu_t, curthread)));                      \
+    __td;                                                                      \
+  })
+
+#endif /* !__ASSEMBLER__ */
+
 #endif /* !_AARCH64_PCPU_H_ */
@@ -0,0 +1,79 @@
+#ifndef _BCM2835_DMAREG_H_
+#define _BCM2835_DMAREG_H_
+
+/* For detailed information on the DMA controller, please refer to chapter 4
+ * of BCM2835 ARM Peripherals datasheet. */
+
+/* DMA channel registers */
+#define BCMDMA_CS 0x0000
+#define BCMDMA_CONBLK_AD 0x0004
+#define BCMDMA_TI 0x0008
+#define BCMDMA_SOURCE_AD 0x000C
+#define BCMDMA_DEST_AD 0x0010
+#define BCMDMA_TXFR_LEN 0x0014
+#define BCMDMA_STRIDE 0x0018
+#define BCMDMA_NEXTCONBK 0x001C
+#define BCMDMA_DEBUG 0x0020
+
+/* BCMDMA_CS bits */
+#define CS_RESET 0x80000000
+#define CS_ABORT 0x40000000
+#define CS_DISDEBUG 0x20000000
+#define CS_WAIT_WRITES 0x10000000 /* Wait for outstanding writes */
+#define CS_PANIC_PRIORITY(x) (((x)&0xf) << 20)
+#define CS_PRIORITY(x) (((x)&0xf) << 16)
+#define CS_ERROR 0x00000100
+#define CS_PAUSED 0x00000010
+#define CS_DREQ 0x00000008
+#define CS_INT 0x00000004 /* Write 1 to clear */
+#define CS_END 0x00000002 /* Write 1 to clear */
+#define CS_ACTIVE 0x00000001
+
+/* Control block transfer information bits */
+#define TI_NO_WIDE_BURSTS 0x04000000
+#define TI_WAITS(x) (((x)&0x1f) << 21)
+#define TI_PERMAP(x) (((x)&0x1f) << 16)
+#define TI_BURST_LENGTH(x) (((x)&0xf) << 12)
+#define TI_SRC_IGNORE 0x00000800
+#define TI_SRC_DREQ 0x00000400
+#define TI_SRC_WIDTH 0x00000200
+#define TI_SRC_INC 0x00000100
+#define TI_DEST_IGNORE 0x00000080
+#define TI_DEST_DREQ 0x00000040
+#define TI_DEST_WIDTH 0x00000020
+#define TI_DEST_INC 0x00000010
+#define TI_WAIT_RESP 0x00000008
+#define TI_TDMODE 0x00000002
+#define TI_INTEN 0x00000001
+
+/* BCMDMA_DEBUG bits (write 1 to clear) */
+#define DEBUG_READ_ERROR 0x00000004
+#define DEBUG_FIFO_ERROR 0x00000002
+#define DEBUG_READ_LAST_NOT_SET_ERROR 0x00000001
+#define DEBUG_ERRORS 0x00000007
+
+/* Peripheral DREQ signals */
+#define DREQ_EMMC 11
+
+/* Control block, which must be aligned to 32 bytes. All addresses are bus
+ * addresses. */
+typedef struct bcmdma_cb {
+  uint32_t ti;        /* Transfer information */
+  uint32_t source_ad; /* Source address */
+  uint32_t dest_ad;   /* Destination address */
+  uint32_t txfr_len;  /* Transfer length in bytes */
+  uint32_t stride;    /* 2D mode stride */
+  uint32_t nextconbk; /* Next control block address (0 if last) */
+  uint32_t reserved[2];
+} __aligned(32) bcmdma_cb_t;
+
+/* Conversions from ARM physical addresses to VideoCore bus addresses, see
+ * `ranges` and `dma-ranges` properties of the `soc` node in rpi3.dts. */
+#define BCM2835_PERIPH_PHYS_BASE 0x3f000000
+#define BCM2835_PERIPH_BUS_BASE 0x7e000000
+#define BCM2835_PERIPH_BUSADDR(pa)                                             \
+  ((uint32_t)((pa)-BCM2835_PERIPH_PHYS_BASE + BCM2835_PERIPH_BUS_BASE))
+/* SDRAM as seen by DMA engines (VideoCore uncached alias) */
+#define BCM2835_SDRAM_BUSADDR(pa) ((uint32_t)((pa) | 0xc0000000))
+
+#endif
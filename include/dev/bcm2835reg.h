@@ -136,7 +136,7 @@
 #define BCM2835_INTC_ENABLEBASE (BCM2835_INTC_BASE + 0x10)
 #define BCM2835_INTC_DISABLEBASE (BCM2835_INTC_BASE + 0x1c)
 
-#define BCM2836_NCPUS 1 /* TODO: change to 4 when SMP is supported */
+#define BCM2836_NCPUS 4
 #define BCM2836_NIRQPERCPU 32
 
 #define BCM2836_INT_LOCALBASE 0
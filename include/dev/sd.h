@@ -3,7 +3,7 @@
 
 /* Must be a power of two */
 #define DEFAULT_BLKSIZE 512
-#define SD_KERNEL_BLOCKS 4 /* Number of blocks buffered in kernel memory */
+#define SD_KERNEL_BLOCKS 128 /* Max. blocks transferred by one command */
 
 /* The custom R7 response is handled just like R1 response, but has different
  * bitfields, same goes for R6 */
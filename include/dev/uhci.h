@@ -29,7 +29,8 @@ struct uhci_td {
   volatile uint32_t td_status;
   volatile uint32_t td_token;
   volatile uint32_t td_buffer;
-  uint32_t __reserved[4]; /* 16 bytes for user usage */
+  /* The following fields are for software use only. */
+  uhci_td_t *td_vnext; /* next transfer descriptor of a transfer (or NULL) */
 } __aligned(UHCI_TD_ALIGN);
 
 #define UHCI_TD_GET_ACTLEN(s) (((s) + 1) & 0x3ff)
@@ -93,7 +94,8 @@ struct uhci_qh {
     struct {
       TAILQ_ENTRY(uhci_qh) qh_link; /* link on a main queue's list */
       usb_buf_t *qh_buf; /* usb buffer associated with the transaction */
-      void *qh_data;     /* I/O data buffer of the transaction */
+      uhci_td_t *qh_tds; /* transfer descriptors of the transaction */
+      bool qh_pending;   /* waits for an earlier transfer to the endpoint */
     };
   };
 } __aligned(UHCI_QH_ALIGN);
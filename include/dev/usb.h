@@ -66,6 +66,7 @@ typedef struct usb_dev_req {
 #define UDESC_DEVICE 0x01
 #define UDESC_CONFIG 0x02
 #define UDESC_STRING 0x03
+#define UDESC_ENDPOINT 0x05
 #define UDESC_HUB 0x29
 
 /* Feature numbers. */
@@ -240,10 +241,12 @@ typedef enum usb_direction {
   USB_DIR_OUTPUT,
 } __packed usb_direction_t;
 
-/* XXX: FTTB, we only handle low and full speed devices. */
+/* XXX: FTTB, high and super speed devices are handled by xHCI only. */
 typedef enum usb_speed {
   USB_SPD_LOW,
   USB_SPD_FULL,
+  USB_SPD_HIGH,
+  USB_SPD_SUPER,
 } __packed usb_speed_t;
 
 /* USB string kinds. */
@@ -263,6 +266,7 @@ typedef struct usb_endpt {
   usb_transfer_t transfer;     /* transfer type */
   usb_direction_t dir;         /* transfer direction */
   uint8_t interval;            /* interval for polling data transfers */
+  uint8_t toggle;              /* next data toggle (host controller use) */
 } usb_endpt_t;
 
 /* USB device software representation. */
@@ -278,19 +282,29 @@ typedef struct usb_device {
   uint8_t class_code;             /* device class code */
   uint8_t subclass_code;          /* device subclass code */
   uint8_t protocol_code;          /* protocol code */
+  uint8_t port;                   /* root hub port the device is attached to */
+  void *hcpriv;                   /* host controller's private data */
 } usb_device_t;
 
+typedef struct usb_buf usb_buf_t;
+
+/* Called when the transfer described by `buf` completes, or when an error is
+ * encountered. Runs in the host controller's interrupt thread. */
+typedef void (*usb_buf_done_t)(usb_buf_t *buf);
+
 /* USB buffer used for USB transfers. */
-typedef struct usb_buf {
+struct usb_buf {
   condvar_t cv;           /* wait for the transfer to complete */
   mtx_t lock;             /* buffer guard */
   usb_endpt_t *endpt;     /* device's endpoint we're talking with */
   void *data;             /* data buffer */
   void *priv;             /* buffer's private data (do not alter!) */
+  usb_buf_done_t done;    /* completion callback of a non-periodic transfer */
+  void *done_arg;         /* argument for the completion callback */
   uint16_t transfer_size; /* size of data to transfer in the data stage */
   uint8_t executed : 1;   /* 1 - transfer has been executed, 0 otherwise */
   usb_error_t error;      /* errors encountered during transfer */
-} usb_buf_t;
+};
 
 static inline usb_device_t *usb_device_of(device_t *dev) {
   return dev->bus == DEV_BUS_USB ? dev->instance : NULL;
@@ -315,7 +329,8 @@ bool usb_buf_periodic(usb_buf_t *buf);
 int usb_buf_wait(usb_buf_t *buf);
 
 /* When the transfer request finishes the `data` or `error` are available.
- * We need to update `buf` to reflect that change.
+ * We need to update `buf` to reflect that change and call the completion
+ * callback (if any). Input `data` may already reside in `buf::data`.
  * Only for host controller driver internal use! */
 void usb_buf_process(usb_buf_t *buf, void *data, usb_error_t error);
 
@@ -371,7 +386,9 @@ static inline void usb_control_transfer(device_t *dev, usb_buf_t *buf,
 /*
  * Issues a data stage only transfer asynchronously.
  *
- * Pass `buf` to `usb_buf_wait` to wait for the transfer to complete.
+ * Pass `buf` to `usb_buf_wait` to wait for the transfer to complete, or set
+ * `buf::done` to be notified on completion. Multiple transfers to the same
+ * endpoint may be in flight; they're executed in order of issue.
  *
  * Arguments:
  *  - `dev`: device requesting the transfer
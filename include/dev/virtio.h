@@ -0,0 +1,87 @@
+#ifndef _DEV_VIRTIO_H_
+#define _DEV_VIRTIO_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+typedef struct device device_t;
+typedef struct resource resource_t;
+typedef struct virtqueue virtqueue_t;
+
+/*
+ * Virtio device.
+ *
+ * XXX: FTTB only the legacy PCI transport is implemented, since it's the only
+ * one that the emulated boards can provide (virtio-mmio would require a board
+ * with a device tree describing the devices).
+ */
+typedef struct virtio_dev {
+  device_t *dev;     /* device owning the transport */
+  resource_t *regs;  /* transport registers */
+  uint32_t features; /* negotiated features */
+} virtio_dev_t;
+
+/* Physically contiguous piece of a buffer described by a descriptor. */
+typedef struct virtio_seg {
+  paddr_t pa;
+  uint32_t len;
+} virtio_seg_t;
+
+/* Resets the device behind `dev` and announces that the driver will drive it.
+ * Returns 0 on success. */
+int virtio_pci_attach(virtio_dev_t *vd, device_t *dev);
+
+/* Accepts features of the device that are present in `wanted`.
+ * Returns negotiated features. */
+uint32_t virtio_negotiate(virtio_dev_t *vd, uint32_t wanted);
+
+/* Reads a 32-bit field from the device specific configuration. */
+uint32_t virtio_read_config_4(virtio_dev_t *vd, unsigned off);
+
+/* Tells the device that the driver is ready (or has failed). */
+void virtio_driver_ok(virtio_dev_t *vd);
+void virtio_failed(virtio_dev_t *vd);
+
+/* Reads and acknowledges ISR status, i.e. VIRTIO_PCI_ISR_* flags.
+ * Can be called from interrupt filter. */
+uint8_t virtio_intr_status(virtio_dev_t *vd);
+
+/*
+ * Virtqueue interface.
+ *
+ * Virtqueues aren't locked, the driver is responsible for serializing all
+ * operations on a virtqueue.
+ */
+
+/* Sets up virtqueue `index` for descriptor chains of at most `maxsegs`
+ * segments. The number of chains that fit in the virtqueue at once is stored
+ * in `nchainsp`. Returns NULL if the device has no such virtqueue. */
+virtqueue_t *virtq_alloc(virtio_dev_t *vd, unsigned index, unsigned maxsegs,
+                         unsigned *nchainsp);
+
+/* Detaches virtqueue `vq` from the device and releases its memory. */
+void virtq_free(virtqueue_t *vq);
+
+/* Places a chain of `nout` device-readable segments followed by `nin`
+ * device-writable segments on virtqueue `vq`. The chain is identified by
+ * `cookie`, which is returned by `virtq_dequeue` once the device is done with
+ * it. The device isn't notified until `virtq_publish` is called. */
+void virtq_enqueue(virtqueue_t *vq, virtio_seg_t *segs, unsigned nout,
+                   unsigned nin, void *cookie);
+
+/* Makes enqueued chains visible to the device and notifies it if needed. */
+void virtq_publish(virtqueue_t *vq);
+
+/* Returns the cookie of the next chain that the device is done with, or NULL.
+ * The number of bytes written by the device is stored in `lenp`. */
+void *virtq_dequeue(virtqueue_t *vq, uint32_t *lenp);
+
+/* Asks the device to interrupt the driver once it's done with the next chain.
+ * Returns false if some chains have been used in the meantime, in which case
+ * the driver must dequeue them, since the device may not interrupt. */
+bool virtq_enable_intr(virtqueue_t *vq);
+
+/* Asks the device not to interrupt the driver. */
+void virtq_disable_intr(virtqueue_t *vq);
+
+#endif /* _DEV_VIRTIO_H_ */
@@ -0,0 +1,42 @@
+/*
+ * Based on "Virtual I/O Device (VIRTIO) Version 1.1", section 5.2
+ * (Block Device).
+ */
+#ifndef _DEV_VIRTIO_BLKREG_H_
+#define _DEV_VIRTIO_BLKREG_H_
+
+/* Feature bits */
+#define VIRTIO_BLK_F_SIZE_MAX (1U << 1) /* max. size of a single segment */
+#define VIRTIO_BLK_F_SEG_MAX (1U << 2)  /* max. number of segments */
+#define VIRTIO_BLK_F_RO (1U << 5)       /* device is read-only */
+#define VIRTIO_BLK_F_BLK_SIZE (1U << 6) /* block size of disk */
+
+/* Device configuration layout (offset from VIRTIO_PCI_CONFIG) */
+#define VIRTIO_BLK_CFG_CAPACITY 0x00 /* capacity in sectors (8 bytes) */
+#define VIRTIO_BLK_CFG_SIZE_MAX 0x08 /* valid with VIRTIO_BLK_F_SIZE_MAX */
+#define VIRTIO_BLK_CFG_SEG_MAX 0x0c  /* valid with VIRTIO_BLK_F_SEG_MAX */
+#define VIRTIO_BLK_CFG_BLK_SIZE 0x14 /* valid with VIRTIO_BLK_F_BLK_SIZE */
+
+/* Sectors are always 512 bytes long, whatever the block size of the disk. */
+#define VIRTIO_BLK_SECTOR_SIZE 512
+
+/* Request types */
+#define VIRTIO_BLK_T_IN 0  /* read */
+#define VIRTIO_BLK_T_OUT 1 /* write */
+
+/* Request status */
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+/*
+ * A request is a descriptor chain made of the header, the data buffer and
+ * a single status byte written by the device.
+ */
+typedef struct virtio_blk_req_hdr {
+  uint32_t type;   /* VIRTIO_BLK_T_* */
+  uint32_t ioprio; /* reserved */
+  uint64_t sector; /* first sector to transfer */
+} virtio_blk_req_hdr_t;
+
+#endif /* _DEV_VIRTIO_BLKREG_H_ */
@@ -0,0 +1,100 @@
+/*
+ * Based on "Virtual I/O Device (VIRTIO) Version 1.1", section 4.1.4.8
+ * (Legacy Interfaces: A Note on PCI Device Layout) and section 2.6 (Split
+ * Virtqueues).
+ */
+#ifndef _DEV_VIRTIOREG_H_
+#define _DEV_VIRTIOREG_H_
+
+/* PCI identification of transitional devices */
+#define VIRTIO_PCI_VENDORID 0x1af4
+#define VIRTIO_PCI_DEVICEID_BLK 0x1001 /* block device */
+
+/* Legacy PCI register layout (BAR 0, I/O space) */
+#define VIRTIO_PCI_HOST_FEATURES 0x00  /* RO device features */
+#define VIRTIO_PCI_GUEST_FEATURES 0x04 /* RW driver features */
+#define VIRTIO_PCI_QUEUE_PFN 0x08      /* RW queue page frame number */
+#define VIRTIO_PCI_QUEUE_NUM 0x0c      /* RO queue size (2 bytes) */
+#define VIRTIO_PCI_QUEUE_SEL 0x0e      /* RW queue select (2 bytes) */
+#define VIRTIO_PCI_QUEUE_NOTIFY 0x10   /* RW queue notify (2 bytes) */
+#define VIRTIO_PCI_STATUS 0x12         /* RW device status (1 byte) */
+#define VIRTIO_PCI_ISR 0x13            /* RO ISR status (1 byte), read clears */
+#define VIRTIO_PCI_ISR_QUEUE 0x01      /* used buffer notification */
+#define VIRTIO_PCI_ISR_CONFIG 0x02     /* configuration change */
+#define VIRTIO_PCI_CONFIG 0x14         /* device config (MSI-X disabled) */
+
+#define VIRTIO_PCI_QUEUE_ADDR_SHIFT 12 /* QUEUE_PFN is in 4KiB units */
+#define VIRTIO_PCI_VRING_ALIGN 4096    /* alignment of the used ring */
+
+/* Device status */
+#define VIRTIO_STATUS_ACK 0x01       /* guest has noticed the device */
+#define VIRTIO_STATUS_DRIVER 0x02    /* guest knows how to drive the device */
+#define VIRTIO_STATUS_DRIVER_OK 0x04 /* driver is ready */
+#define VIRTIO_STATUS_FAILED 0x80    /* driver has given up on the device */
+
+/* Device independent feature bits */
+#define VIRTIO_F_NOTIFY_ON_EMPTY (1U << 24)
+#define VIRTIO_RING_F_INDIRECT_DESC (1U << 28) /* indirect descriptors */
+#define VIRTIO_RING_F_EVENT_IDX (1U << 29)     /* used & avail event index */
+
+/*
+ * Split virtqueue.
+ *
+ * A virtqueue consists of a descriptor table, a ring of descriptor chains
+ * made available to the device (driver area) and a ring of chains the device
+ * is done with (device area). Each ring is followed by an event index, which
+ * is used by the other side only if VIRTIO_RING_F_EVENT_IDX was negotiated.
+ */
+
+typedef struct vring_desc {
+  volatile uint64_t addr;  /* guest physical address of the buffer */
+  volatile uint32_t len;   /* length of the buffer */
+  volatile uint16_t flags; /* VRING_DESC_F_* flags */
+  volatile uint16_t next;  /* next descriptor if VRING_DESC_F_NEXT is set */
+} vring_desc_t;
+
+#define VRING_DESC_F_NEXT 1     /* buffer continues in the next descriptor */
+#define VRING_DESC_F_WRITE 2    /* buffer is device write-only */
+#define VRING_DESC_F_INDIRECT 4 /* buffer contains a table of descriptors */
+
+typedef struct vring_avail {
+  volatile uint16_t flags;
+  volatile uint16_t idx;    /* where the driver puts the next entry */
+  volatile uint16_t ring[]; /* followed by `used_event` */
+} vring_avail_t;
+
+#define VRING_AVAIL_F_NO_INTERRUPT 1
+
+typedef struct vring_used_elem {
+  volatile uint32_t id;  /* head of the used descriptor chain */
+  volatile uint32_t len; /* number of bytes written into the buffer */
+} vring_used_elem_t;
+
+typedef struct vring_used {
+  volatile uint16_t flags;
+  volatile uint16_t idx;             /* where the device puts the next entry */
+  volatile vring_used_elem_t ring[]; /* followed by `avail_event` */
+} vring_used_t;
+
+#define VRING_USED_F_NO_NOTIFY 1
+
+/* Offset of the used ring within a virtqueue of `num` entries. */
+static inline size_t vring_used_offset(unsigned num) {
+  size_t size = sizeof(vring_desc_t) * num + sizeof(uint16_t) * (3 + num);
+  return roundup(size, VIRTIO_PCI_VRING_ALIGN);
+}
+
+/* Size of a virtqueue of `num` entries in legacy layout. */
+static inline size_t vring_size(unsigned num) {
+  return vring_used_offset(num) + sizeof(uint16_t) * 3 +
+         sizeof(vring_used_elem_t) * num;
+}
+
+/* Having moved its index from `old` to `new`, should one side notify the other
+ * one, which asked to be notified once the index moves past `event`? */
+static inline bool vring_need_event(uint16_t event, uint16_t new,
+                                    uint16_t old) {
+  return (uint16_t)(new - event - 1) < (uint16_t)(new - old);
+}
+
+#endif /* _DEV_VIRTIOREG_H_ */
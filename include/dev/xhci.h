@@ -0,0 +1,142 @@
+/*
+ * Based on FreeBSD `sys/dev/usb/controller/xhci.h`.
+ */
+#ifndef _DEV_XHCI_H_
+#define _DEV_XHCI_H_
+
+/* Structures alignment (bytes) */
+#define XHCI_TRB_ALIGN 16
+#define XHCI_ERST_ALIGN 64
+#define XHCI_DCBAA_ALIGN 64
+#define XHCI_CTX_ALIGN 64
+
+#define XHCI_MAX_SLOTS 255    /* max. number of device slots */
+#define XHCI_MAX_ENDPOINTS 32 /* device context index range (0 - slot) */
+
+typedef uint64_t xhci_physaddr_t;
+
+/*
+ * Transfer Request Block.
+ *
+ * TRBs are placed on rings: the command ring, transfer rings (one per
+ * endpoint) and event rings. The producer of a ring marks each TRB it has
+ * written with its cycle state, which toggles each time the ring wraps.
+ */
+typedef struct xhci_trb {
+  volatile uint64_t trb_param;
+  volatile uint32_t trb_status;
+  volatile uint32_t trb_control;
+} __aligned(XHCI_TRB_ALIGN) xhci_trb_t;
+
+/* TRB status field */
+#define XHCI_TRB_LEN(n) ((n)&0x1ffff)                     /* transfer length */
+#define XHCI_TRB_TDSZ(n) (((uint32_t)(n)&0x1f) << 17)     /* TD size */
+#define XHCI_TRB_INTR(n) (((uint32_t)(n)&0x3ff) << 22)    /* interrupter */
+#define XHCI_TRB_GET_REMAIN(s) ((s)&0xffffff)             /* residue */
+#define XHCI_TRB_GET_CC(s) (((uint32_t)(s) >> 24) & 0xff) /* completion code */
+
+/* TRB control field */
+#define XHCI_TRB_CYCLE 0x00000001    /* cycle bit */
+#define XHCI_TRB_TC 0x00000002       /* toggle cycle (link TRB) */
+#define XHCI_TRB_ENT 0x00000002      /* evaluate next TRB */
+#define XHCI_TRB_ISP 0x00000004      /* interrupt on short packet */
+#define XHCI_TRB_CH 0x00000010       /* chain bit */
+#define XHCI_TRB_IOC 0x00000020      /* interrupt on completion */
+#define XHCI_TRB_IDT 0x00000040      /* immediate data */
+#define XHCI_TRB_BSR 0x00000200      /* block set address request */
+#define XHCI_TRB_DIR_IN 0x00010000   /* data and status stage direction */
+#define XHCI_TRB_TRT_NONE 0x00000000 /* setup stage: no data stage */
+#define XHCI_TRB_TRT_OUT 0x00020000  /* setup stage: OUT data stage */
+#define XHCI_TRB_TRT_IN 0x00030000   /* setup stage: IN data stage */
+#define XHCI_TRB_TYPE(t) (((uint32_t)(t)&0x3f) << 10)
+#define XHCI_TRB_GET_TYPE(c) (((uint32_t)(c) >> 10) & 0x3f)
+#define XHCI_TRB_EPID(e) (((uint32_t)(e)&0x1f) << 16)
+#define XHCI_TRB_GET_EPID(c) (((uint32_t)(c) >> 16) & 0x1f)
+#define XHCI_TRB_SLOT(s) (((uint32_t)(s)&0xff) << 24)
+#define XHCI_TRB_GET_SLOT(c) (((uint32_t)(c) >> 24) & 0xff)
+
+/* TRB types */
+#define XHCI_TRB_NORMAL 1
+#define XHCI_TRB_SETUP 2
+#define XHCI_TRB_DATA 3
+#define XHCI_TRB_STATUS 4
+#define XHCI_TRB_LINK 6
+#define XHCI_TRB_NOOP 8
+#define XHCI_CMD_ENABLE_SLOT 9
+#define XHCI_CMD_DISABLE_SLOT 10
+#define XHCI_CMD_ADDRESS_DEVICE 11
+#define XHCI_CMD_CONFIGURE_EP 12
+#define XHCI_CMD_EVALUATE_CTX 13
+#define XHCI_CMD_RESET_EP 14
+#define XHCI_CMD_STOP_EP 15
+#define XHCI_CMD_SET_TR_DEQUEUE 16
+#define XHCI_CMD_NOOP 23
+#define XHCI_EVT_TRANSFER 32
+#define XHCI_EVT_CMD_COMPLETE 33
+#define XHCI_EVT_PORT_STS_CHANGE 34
+#define XHCI_EVT_HOST_CTRL 37
+
+/* Completion codes */
+#define XHCI_CC_SUCCESS 1
+#define XHCI_CC_DATA_BUFFER 2
+#define XHCI_CC_BABBLE 3
+#define XHCI_CC_TRANSACTION 4
+#define XHCI_CC_TRB 5
+#define XHCI_CC_STALL 6
+#define XHCI_CC_RESOURCE 7
+#define XHCI_CC_NO_SLOTS 9
+#define XHCI_CC_SHORT_PACKET 13
+#define XHCI_CC_STOPPED 26
+#define XHCI_CC_STOPPED_LEN 27
+
+/*
+ * Event Ring Segment Table entry.
+ */
+typedef struct xhci_erst_entry {
+  volatile uint64_t erst_base; /* event ring segment base address */
+  volatile uint32_t erst_size; /* number of TRBs in the segment */
+  volatile uint32_t erst_reserved;
+} __aligned(XHCI_ERST_ALIGN) xhci_erst_entry_t;
+
+/*
+ * Device contexts.
+ *
+ * A device context consists of a slot context followed by 31 endpoint
+ * contexts, identified by device context index (DCI). An input context is
+ * prefixed with an input control context, which selects the contexts to be
+ * evaluated by a command. Each context takes 32 or 64 bytes, as reported by
+ * `XHCI_HCC_CSZ`, and is accessed as an array of 32-bit words, of which we
+ * only use the first eight.
+ */
+
+/* Input control context */
+#define XHCI_INCTX_DROP 0 /* drop context flags */
+#define XHCI_INCTX_ADD 1  /* add context flags */
+
+/* Slot context */
+#define XHCI_SCTX_0_ROUTE(x) ((x)&0xfffff)
+#define XHCI_SCTX_0_SPEED(x) (((uint32_t)(x)&0xf) << 20)
+#define XHCI_SCTX_0_CTX_NUM(x) (((uint32_t)(x)&0x1f) << 27)
+#define XHCI_SCTX_1_RH_PORT(x) (((uint32_t)(x)&0xff) << 16)
+#define XHCI_SCTX_3_DEV_ADDR_GET(x) ((x)&0xff)
+
+/* Endpoint context */
+#define XHCI_EPCTX_0_IVAL(x) (((uint32_t)(x)&0xff) << 16)
+#define XHCI_EPCTX_1_CERR(x) (((uint32_t)(x)&0x3) << 1)
+#define XHCI_EPCTX_1_EPTYPE(x) (((uint32_t)(x)&0x7) << 3)
+#define XHCI_EPCTX_1_MAXB(x) (((uint32_t)(x)&0xff) << 8)
+#define XHCI_EPCTX_1_MAXP(x) (((uint32_t)(x)&0xffff) << 16)
+#define XHCI_EPCTX_2_DCS 0x00000001 /* dequeue cycle state */
+#define XHCI_EPCTX_4_AVG_TRB_LEN(x) ((x)&0xffff)
+#define XHCI_EPCTX_4_MAX_ESIT(x) (((uint32_t)(x)&0xffff) << 16)
+
+/* Endpoint types */
+#define XHCI_EPTYPE_ISOC_OUT 1
+#define XHCI_EPTYPE_BULK_OUT 2
+#define XHCI_EPTYPE_INTR_OUT 3
+#define XHCI_EPTYPE_CONTROL 4
+#define XHCI_EPTYPE_ISOC_IN 5
+#define XHCI_EPTYPE_BULK_IN 6
+#define XHCI_EPTYPE_INTR_IN 7
+
+#endif /* _DEV_XHCI_H_ */
@@ -0,0 +1,93 @@
+/*
+ * Based on FreeBSD `sys/dev/usb/controller/xhcireg.h`.
+ */
+#ifndef _DEV_XHCIREG_H_
+#define _DEV_XHCIREG_H_
+
+/* PCI config registers */
+#define PCI_USB_CLASSCODE 0x0c
+#define PCI_USB_SUBCLASSCODE 0x03
+#define PCI_INTERFACE_XHCI 0x30
+
+/* xHCI capability registers */
+#define XHCI_CAPLENGTH 0x00  /* RO capability length (1 byte) */
+#define XHCI_HCIVERSION 0x02 /* RO interface version (2 bytes) */
+#define XHCI_HCSPARAMS1 0x04 /* RO structural parameters 1 */
+#define XHCI_HCS1_DEVSLOT_MAX(x) ((x)&0xff)
+#define XHCI_HCS1_IRQ_MAX(x) (((x) >> 8) & 0x7ff)
+#define XHCI_HCS1_N_PORTS(x) (((x) >> 24) & 0xff)
+#define XHCI_HCSPARAMS2 0x08 /* RO structural parameters 2 */
+#define XHCI_HCS2_SPB_MAX(x) ((((x) >> 16) & 0x3e0) | (((x) >> 27) & 0x1f))
+#define XHCI_HCSPARAMS3 0x0c       /* RO structural parameters 3 */
+#define XHCI_HCCPARAMS1 0x10       /* RO capability parameters 1 */
+#define XHCI_HCC_AC64(x) ((x)&0x1) /* 64-bit capable */
+#define XHCI_HCC_CSZ(x) ((x)&0x4)  /* 64-byte contexts */
+#define XHCI_DBOFF 0x14            /* RO doorbell offset */
+#define XHCI_RTSOFF 0x18           /* RO runtime register space offset */
+
+/* xHCI operational registers (offset from CAPLENGTH) */
+#define XHCI_USBCMD 0x00          /* RW USB command */
+#define XHCI_CMD_RS 0x00000001    /* run/stop */
+#define XHCI_CMD_HCRST 0x00000002 /* host controller reset */
+#define XHCI_CMD_INTE 0x00000004  /* interrupter enable */
+#define XHCI_CMD_HSEE 0x00000008  /* host system error enable */
+#define XHCI_USBSTS 0x04          /* RW USB status */
+#define XHCI_STS_HCH 0x00000001   /* host controller halted */
+#define XHCI_STS_HSE 0x00000004   /* host system error (write 1 to clear) */
+#define XHCI_STS_EINT 0x00000008  /* event interrupt (write 1 to clear) */
+#define XHCI_STS_PCD 0x00000010   /* port change detect (write 1 to clear) */
+#define XHCI_STS_CNR 0x00000800   /* controller not ready */
+#define XHCI_PAGESIZE 0x08        /* RO page size */
+#define XHCI_DNCTRL 0x14          /* RW device notification control */
+#define XHCI_CRCR_LO 0x18         /* RW command ring control */
+#define XHCI_CRCR_HI 0x1c
+#define XHCI_CRCR_RCS 0x00000001 /* ring cycle state */
+#define XHCI_DCBAAP_LO 0x30      /* RW device context base address array */
+#define XHCI_DCBAAP_HI 0x34
+#define XHCI_CONFIG 0x38 /* RW configure */
+#define XHCI_CONFIG_SLOTS_MASK 0xff
+
+/* xHCI port status and control registers (offset from CAPLENGTH) */
+#define XHCI_PORTSC(n) (0x400 + (n)*0x10)        /* n = 0 .. N_PORTS - 1 */
+#define XHCI_PS_CCS 0x00000001                   /* current connect status */
+#define XHCI_PS_PED 0x00000002                   /* port enabled */
+#define XHCI_PS_OCA 0x00000008                   /* over current active */
+#define XHCI_PS_PR 0x00000010                    /* port reset */
+#define XHCI_PS_PLS_GET(x) (((x) >> 5) & 0xf)    /* port link state */
+#define XHCI_PS_PP 0x00000200                    /* port power */
+#define XHCI_PS_SPEED_GET(x) (((x) >> 10) & 0xf) /* port speed */
+#define XHCI_PS_CSC 0x00020000                   /* connect status change */
+#define XHCI_PS_PEC 0x00040000                   /* port enabled change */
+#define XHCI_PS_WRC 0x00080000                   /* warm port reset change */
+#define XHCI_PS_OCC 0x00100000                   /* over-current change */
+#define XHCI_PS_PRC 0x00200000                   /* port reset change */
+#define XHCI_PS_PLC 0x00400000                   /* port link state change */
+#define XHCI_PS_CEC 0x00800000                   /* port config error change */
+#define XHCI_PS_WPR 0x80000000                   /* warm port reset */
+#define XHCI_PS_CLEAR                                                          \
+  (XHCI_PS_PED | XHCI_PS_CSC | XHCI_PS_PEC | XHCI_PS_WRC | XHCI_PS_OCC |       \
+   XHCI_PS_PRC | XHCI_PS_PLC | XHCI_PS_CEC)
+
+/* Port speed IDs (default protocol speed ID mapping) */
+#define XHCI_SPEED_FULL 1
+#define XHCI_SPEED_LOW 2
+#define XHCI_SPEED_HIGH 3
+#define XHCI_SPEED_SUPER 4
+
+/* xHCI runtime registers (offset from RTSOFF) */
+#define XHCI_IMAN(n) (0x20 + (n)*0x20)      /* RW interrupter management */
+#define XHCI_IMAN_INTR_PEND 0x00000001      /* interrupt pending (W1C) */
+#define XHCI_IMAN_INTR_ENA 0x00000002       /* interrupter enable */
+#define XHCI_IMOD(n) (0x24 + (n)*0x20)      /* RW interrupter moderation */
+#define XHCI_IMOD_IVAL_SET(x) ((x)&0xffff)  /* interval in 250ns units */
+#define XHCI_ERSTSZ(n) (0x28 + (n)*0x20)    /* RW event ring seg. table size */
+#define XHCI_ERSTBA_LO(n) (0x30 + (n)*0x20) /* RW event ring seg. table base */
+#define XHCI_ERSTBA_HI(n) (0x34 + (n)*0x20)
+#define XHCI_ERDP_LO(n) (0x38 + (n)*0x20) /* RW event ring dequeue pointer */
+#define XHCI_ERDP_HI(n) (0x3c + (n)*0x20)
+#define XHCI_ERDP_BUSY 0x00000008 /* event handler busy (write 1 to clear) */
+
+/* xHCI doorbell registers (offset from DBOFF) */
+#define XHCI_DOORBELL(n) ((n)*4)
+
+#endif /* _DEV_XHCIREG_H_ */
@@ -1,6 +1,8 @@
 #ifndef _MIPS_PCPU_H_
 #define _MIPS_PCPU_H_
 
+#define MAXCPU 1
+
 #define PCPU_MD_FIELDS                                                         \
   struct {                                                                     \
     /*!< kernel sp restored on user->kernel transition */                      \
@@ -9,6 +11,10 @@
     register_t status, sp, cause, epc, badvaddr;                               \
   }
 
+#ifndef __ASSEMBLER__
+#define curpcpu() (&_pcpu_data[0])
+#endif /* !__ASSEMBLER__ */
+
 #ifdef _MACHDEP
 #ifdef __ASSEMBLER__
 
@@ -1,9 +1,21 @@
 #ifndef _RISCV_BOOT_H_
 #define _RISCV_BOOT_H_
 
+#include <sys/cdefs.h>
 #include <sys/types.h>
 
 #define PHYSADDR(x) ((paddr_t)((vaddr_t)(x) + (KERNEL_PHYS - KERNEL_VIRT)))
 #define VIRTADDR(x) ((vaddr_t)((paddr_t)(x) + (KERNEL_VIRT - KERNEL_PHYS)))
 
+/* Passed by physical address to secondary hart entering `_start_ap`. */
+typedef struct ap_boot_args {
+  register_t sp;    /* kernel stack of the idle thread */
+  register_t tp;    /* pcpu structure of the hart */
+  register_t satp;  /* kernel page table */
+  register_t entry; /* virtual address of `riscv_ap_boot` */
+} ap_boot_args_t;
+
+/* Entered by secondary hart after it enabled MMU. */
+__noreturn void riscv_ap_boot(void);
+
 #endif /* !_RISCV_BOOT_H_ */
@@ -1,7 +1,48 @@
 #ifndef _RISCV_PCPU_H_
 #define _RISCV_PCPU_H_
 
+#define MAXCPU 4
+
 #define PCPU_MD_FIELDS                                                         \
-  struct {}
+  struct {                                                                     \
+    /*!< hart identifier used by SBI */                                        \
+    register_t hartid;                                                         \
+    /*!< user sp saved on user->kernel transition */                           \
+    register_t usp;                                                            \
+  }
+
+#ifndef __ASSEMBLER__
+
+/* Thread pointer register holds the address of pcpu_t of the hart. */
+#define curpcpu()                                                              \
+  ({                                                                           \
+    pcpu_t *__pc;                                                              \
+    __asm __volatile("mv %0, tp" : "=r"(__pc));                                \
+    __pc;                                                                      \
+  })
+
+/* Loading `curthread` relative to the thread pointer is a single instruction,
+ * so the thread cannot migrate in the middle of it. */
+#if __riscv_xlen == 64
+#define md_curthread()                                                         \
+  ({                                                                           \
+    thread_t *__td;                                                            \
+    __asm __volatile("ld %0, %1(tp)"                                           \
+                     : "=r"(__td)                                              \
+                     : "i"(offsetof(pcpu_t, curthread)));                      \
+    __td;                                                                      \
+  })
+#else
+#define md_curthread()                                                         \
+  ({                                                                           \
+    thread_t *__td;                                                            \
+    __asm __volatile("lw %0, %1(tp)"                                           \
+                     : "=r"(__td)                                              \
+                     : "i"(offsetof(pcpu_t, curthread)));                      \
+    __td;                                                                      \
+  })
+#endif
+
+#endif /* !__ASSEMBLER__ */
 
 #endif /* !_RISCV_PCPU_H_ */
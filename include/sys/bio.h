@@ -0,0 +1,101 @@
+#ifndef _SYS_BIO_H_
+#define _SYS_BIO_H_
+
+#ifdef _KERNEL
+
+#include <sys/types.h>
+#include <sys/queue.h>
+#include <sys/condvar.h>
+#include <machine/vm_param.h>
+
+typedef struct devnode devnode_t;
+typedef struct uio uio_t;
+
+/*
+ * Block I/O layer.
+ *
+ * Block devices provide a `d_strategy` routine that transfers data described
+ * by a buffer. Device contents are accessed through a buffer cache of fixed
+ * size blocks (BIO_BSIZE bytes each), which is shared by all block devices.
+ * Blocks are identified by a (device, block number) pair and kept on an LRU
+ * queue when not in use.
+ *
+ * Adjacent blocks are transferred in clusters of up to BIO_MAXCLUSTER blocks
+ * with a single `d_strategy` call. Clusters are used to read ahead of
+ * sequential readers and to write out delayed writes.
+ *
+ * Field markings and the corresponding locks:
+ *  (bc) buffer cache lock
+ *  (b) owned by the thread that has marked the buffer busy
+ *  (!) read-only after the buffer has been allocated
+ */
+
+#define BIO_BSIZE PAGESIZE /* size of a buffer cache block */
+#define BIO_MAXCLUSTER 16  /* max. number of blocks in a single transfer */
+
+typedef int64_t daddr_t;
+
+/* Buffer flags. */
+#define B_BUSY 0x0001   /* I/O in progress or buffer owned by a thread */
+#define B_VALID 0x0002  /* buffer contains valid device data */
+#define B_READ 0x0004   /* transfer data from device to memory */
+#define B_DONE 0x0008   /* I/O is completed */
+#define B_ERROR 0x0010  /* I/O has failed, see b_error */
+#define B_DELWRI 0x0020 /* buffer is dirty and must be written out */
+
+typedef struct buf {
+  LIST_ENTRY(buf) b_hash;  /* (bc) entry on hash chain */
+  TAILQ_ENTRY(buf) b_lru;  /* (bc) entry on LRU queue (if not busy) */
+  condvar_t b_cv;          /* (!) waits for buffer to become unbusy or done */
+  uint32_t b_flags;        /* (bc) B_* flags, see above */
+  devnode_t *b_dev;        /* (b) device the block belongs to */
+  daddr_t b_blkno;         /* (b) block number in BIO_BSIZE units */
+  void *b_data;            /* (!) buffer memory (>= b_bcount bytes) */
+  size_t b_bcount;         /* (b) number of bytes to transfer */
+  size_t b_resid;          /* (b) number of bytes not transferred */
+  int b_error;             /* (b) error code of the last transfer */
+} buf_t;
+
+/* Called by device drivers when I/O requested by `d_strategy` is finished.
+ * Pass non-zero error if the transfer failed. */
+void biodone(buf_t *bp, int error);
+
+/* Wait until I/O on a busy buffer is finished. Returns b_error. */
+int biowait(buf_t *bp);
+
+/* Returns busy buffer for the given block. Its contents is valid only if
+ * B_VALID flag is set. */
+buf_t *getblk(devnode_t *dev, daddr_t blkno);
+
+/* Returns busy buffer with the contents of the given block. On error the
+ * buffer is released and *bpp is set to NULL. */
+int bread(devnode_t *dev, daddr_t blkno, buf_t **bpp);
+
+/* Writes a busy buffer synchronously and releases it. If the write fails
+ * and the buffer was dirty, it stays dirty. */
+int bwrite(buf_t *bp);
+
+/* Marks a busy buffer dirty and releases it. The block will be written out
+ * later, possibly together with adjacent dirty blocks. */
+void bdwrite(buf_t *bp);
+
+/* Writes out all delayed writes of given device, or of all devices if `dev`
+ * is NULL. Stops at the first failed write and returns its error, in which
+ * case remaining blocks stay dirty. */
+int bio_flush(devnode_t *dev);
+
+/* Releases a busy buffer and puts it onto the LRU queue. */
+void brelse(buf_t *bp);
+
+/* Drops all cached blocks of given device, e.g. when the media is gone. */
+void binvalidate(devnode_t *dev);
+
+/* Generic `d_read` and `d_write` routines for block devices, which transfer
+ * data through the buffer cache. Reads look at the sequential access hint in
+ * `uio_ioflags` to decide how much data to read ahead. */
+int bio_read(devnode_t *dev, uio_t *uio);
+int bio_write(devnode_t *dev, uio_t *uio);
+
+#endif /* !_KERNEL */
+
+#endif /* !_SYS_BIO_H_ */
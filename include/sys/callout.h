@@ -16,10 +16,11 @@ typedef struct callout {
   unsigned c_index; /* index of bucket this callout is assigned to */
 } callout_t;
 
-/* callout has been delegated to callout thread and will be executed soon */
+/* callout has expired and its function will be executed soon */
 #define CALLOUT_ACTIVE 0x0001
 #define CALLOUT_PENDING 0x0002 /* callout is waiting for timeout */
 #define CALLOUT_STOPPED 0x0004 /* disallow rescheduling */
+#define CALLOUT_DIRECT 0x0008  /* call function from clock interrupt */
 
 /*! \brief Called during kernel initialization. */
 void init_callout(void);
@@ -27,6 +28,13 @@ void init_callout(void);
 /* Set up callout @co to call @fn with argument @arg. */
 void callout_setup(callout_t *co, timeout_t fn, void *arg);
 
+/*
+ * Same as callout_setup(), but @fn will be called directly from the clock
+ * interrupt rather than by callout thread. It must be short and must not
+ * sleep or take sleep mutexes.
+ */
+void callout_setup_direct(callout_t *co, timeout_t fn, void *arg);
+
 /*
  * Add a callout to the queue, using time relative to current time.
  * After ticks @tm passed callout's function will be called.
@@ -64,11 +72,19 @@ bool callout_reschedule(callout_t *co, systime_t tm);
 bool callout_stop(callout_t *handle);
 
 /*
- * Process all callouts that happened since last time and delegate them to
- * callout thread.
+ * Process all callouts that happened since last time. Direct callouts are
+ * called right away, others are delegated to callout thread.
  */
 void callout_process(systime_t now);
 
+/*
+ * Find the earliest time at which pending callouts need to be processed.
+ * It may be earlier than any of their deadlines.
+ *
+ * \return False if there are no pending callouts.
+ */
+bool callout_next_event(systime_t *tmp);
+
 /*
  * Wait until a callout ends its execution or return immediately if the
  * callout has already been executed or stopped.
@@ -2,12 +2,14 @@
 #define _SYS_CONDVAR_H_
 
 #include <sys/types.h>
+#include <sys/time.h>
+#include <stdatomic.h>
 
 typedef struct mtx mtx_t;
 
 typedef struct condvar {
   const char *name;     /*!< name for debugging purpose */
-  volatile int waiters; /*!< # of threads sleeping in associated sleep queue */
+  atomic_int waiters;   /*!< # of threads sleeping in associated sleep queue */
 } condvar_t;
 
 /*! \brief Initialize a conditional variable.
@@ -44,6 +46,14 @@ void cv_wait(condvar_t *cv, mtx_t *m);
  */
 int cv_wait_timed(condvar_t *cv, mtx_t *m, systime_t timeout);
 
+/*! \brief Wait on a conditional variable until given point in time.
+ *
+ * \arg deadline Time since boot at which the sleep times out.
+ *
+ * \returns same values as `cv_wait_timed`
+ */
+int cv_wait_until(condvar_t *cv, mtx_t *m, bintime_t deadline);
+
 /*! \brief Wake a single thread waiting on a conditional variable.
  *
  * If there are multiple waiting threads then the one with the highest priority
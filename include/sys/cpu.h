@@ -22,4 +22,12 @@ void cpu_intr_enable(void) __no_profile;
 /*! \brief Check if local CPU interrupts are disabled. */
 bool cpu_intr_disabled(void) __no_profile;
 
+/*! \brief Waits in low power state until an interrupt is pending.
+ *
+ * Must be called with local CPU interrupts disabled, so that an interrupt
+ * that arrives in the meantime can't be missed. The interrupt is handled
+ * once interrupts are enabled again. May return immediately if the processor
+ * is not able to wait with interrupts disabled. */
+void cpu_idle(void) __no_profile;
+
 #endif /* !_SYS_CPU_H_ */
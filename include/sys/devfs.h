@@ -11,6 +11,7 @@ typedef struct devnode devnode_t;
 typedef struct file file_t;
 typedef struct uio uio_t;
 typedef struct knote knote_t;
+typedef struct buf buf_t;
 
 /*
  * Device node is a structure that exposes to user-space an entry point into
@@ -86,10 +87,21 @@ typedef int (*dev_ioctl_t)(devnode_t *dev, u_long cmd, void *data, int fflags);
 /* Kernel Event note registration. */
 typedef int (*dev_kqfilter_t)(devnode_t *dev, knote_t *kn);
 
+/*
+ * Block transfer routine of disk devices (see <sys/bio.h>).
+ *
+ * Transfers `bp::b_bcount` bytes between `bp::b_data` and the device starting
+ * at block `bp::b_blkno`. Must call `biodone` once the transfer is finished,
+ * possibly before returning. Transfers past the end of the device should be
+ * cut short and reflected in `bp::b_resid`.
+ */
+typedef void (*dev_strategy_t)(buf_t *bp);
+
 typedef enum {
   DT_OTHER = 0,    /* other non-seekable device file */
   DT_SEEKABLE = 1, /* other seekable device file (also a flag) */
-  /* TODO: add DT_CONS (!) and DT_DISK. */
+  DT_DISK = 3,     /* block device accessed through buffer cache (seekable) */
+  /* TODO: add DT_CONS (!). */
 } dev_type_t;
 
 /*
@@ -104,6 +116,7 @@ typedef struct devops {
   dev_write_t d_write; /* write bytes to a device file */
   dev_ioctl_t d_ioctl; /* read or modify device properties */
   dev_kqfilter_t d_kqfilter; /* called when knote is attached to the device */
+  dev_strategy_t d_strategy; /* perform block I/O (DT_DISK only) */
 } devops_t;
 
 typedef struct devnode {
@@ -154,6 +167,10 @@ int devfs_makedev(devfs_node_t *parent, const char *name, vnodeops_t *vops,
 /* TODO: remove it after rewriting drivers. */
 void *devfs_node_data(vnode_t *vnode);
 
+/* Writes out delayed writes of a disk if `fp` refers to one. Files that are
+ * not opened devfs devices are left alone. */
+int devfs_fsync(file_t *fp);
+
 /*
  * Remove a node from the devfs tree.
  *
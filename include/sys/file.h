@@ -54,14 +54,21 @@ typedef enum filetype {
 #define IO_NONBLOCK 8 /* read & write return EAGAIN instead of blocking */
 #define IO_MASK (IO_APPEND | IO_NONBLOCK)
 
+/* Sequential access hint passed to file systems and devices in `uio_ioflags`
+ * bits starting at IO_SEQSHIFT. */
+#define IO_SEQSHIFT 16
+#define IO_SEQMAX 0x7f
+
 typedef struct file {
   void *f_data; /* File specific data */
   fileops_t *f_ops;
   filetype_t f_type; /* File type */
   vnode_t *f_vnode;
   off_t f_offset;
-  refcnt_t f_count; /* Reference counter */
-  unsigned f_flags; /* FF_* and IO_* flags */
+  refcnt_t f_count;    /* Reference counter */
+  unsigned f_flags;    /* FF_* and IO_* flags */
+  off_t f_nextoff;     /* Offset at which the last read or write ended */
+  unsigned f_seqcount; /* Measure of sequential access, see file_seqcount */
 } file_t;
 
 file_t *file_alloc(void);
@@ -73,6 +80,15 @@ void file_hold(file_t *f);
 /*! \brief Decrements refcounter and destroys file if it has reached 0. */
 void file_drop(file_t *f);
 
+/*! \brief Updates sequential access heuristic with I/O about to be performed.
+ *
+ * \returns IO_* flags with the sequential access hint to be put into
+ * `uio_ioflags`. Must be followed by `file_seqdone` once the I/O is done. */
+unsigned file_seqcount(file_t *f, uio_t *uio);
+
+/*! \brief Records where the I/O started with `file_seqcount` has ended. */
+void file_seqdone(file_t *f, uio_t *uio);
+
 /* File operations for files that lost identity. */
 extern fileops_t badfileops;
 
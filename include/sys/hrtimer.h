@@ -0,0 +1,99 @@
+/* <sys/time.h> embeds hrtimer_t in kitimer_t, so it has to see this file
+ * after bintime_t is defined, but before this file is processed. */
+#include <sys/time.h>
+
+#ifndef _SYS_HRTIMER_H_
+#define _SYS_HRTIMER_H_
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/queue.h>
+
+/*
+ * High-resolution timers are like callouts, but they are due at `bintime_t`
+ * deadline (time since boot) rather than at a system clock tick. Each processor
+ * keeps its pending timers sorted by deadline under its own lock and programs
+ * its clock to trigger at the earliest one. Thus the timers' accuracy is
+ * limited by clock hardware rather than by frequency of system clock ticks.
+ *
+ * Expired timers are delegated to a kernel thread, unless created with
+ * `HRT_DIRECT` flag. Function of such timer is called in interrupt context, so
+ * it must not sleep or take sleep mutexes.
+ */
+
+typedef void (*hrtimer_fn_t)(void *);
+
+typedef struct hrtimer {
+  TAILQ_ENTRY(hrtimer) ht_link;
+  bintime_t ht_time;    /* absolute time of the event */
+  hrtimer_fn_t ht_func; /* function to call */
+  void *ht_arg;         /* function argument */
+  uint32_t ht_flags;
+  int ht_cpu; /* processor whose queue the timer is pending on */
+} hrtimer_t;
+
+#define HRT_DIRECT 0x0001 /* call function in interrupt context */
+/* timer has expired and its function will be called soon or is running now */
+#define HRT_ACTIVE 0x0100
+#define HRT_PENDING 0x0200 /* timer is waiting for its deadline */
+#define HRT_STOPPED 0x0400 /* disallow rescheduling */
+
+/*! \brief Called during kernel initialization. */
+void init_hrtimer(void);
+
+/* Set up timer @ht to call @fn with argument @arg. */
+void hrtimer_setup(hrtimer_t *ht, hrtimer_fn_t fn, void *arg, uint32_t flags);
+
+/*
+ * Arm a timer to call its function once time since boot reaches @deadline.
+ * The timer is kept by current processor.
+ */
+void hrtimer_start(hrtimer_t *ht, bintime_t deadline);
+
+/*
+ * Rearm a running timer, e.g. to implement periodic timers.
+ * This function is intended to be called from the timer's function.
+ * Returns false if the timer has been stopped in the meantime.
+ */
+bool hrtimer_reschedule(hrtimer_t *ht, bintime_t deadline);
+
+/*
+ * Disarm a timer if it's pending. Semantics is the same as of callout_stop(),
+ * i.e. false means that hrtimer_drain() must be called before the timer
+ * can be reused or freed.
+ */
+bool hrtimer_stop(hrtimer_t *ht);
+
+/*
+ * Wait until the timer's function ends its execution.
+ *
+ * \return True if the function call blocked.
+ */
+bool hrtimer_drain(hrtimer_t *ht);
+
+/*
+ * Called by the system clock of each processor with interrupts disabled.
+ * Runs (or delegates) current processor's timers that are due at @now.
+ */
+void hrtimer_process(bintime_t now);
+
+/*
+ * Find the deadline of the earliest timer pending on current processor.
+ *
+ * \return False if there are no pending timers.
+ */
+bool hrtimer_next_event(bintime_t *btp);
+
+/*
+ * Implemented by the system clock. Called with interrupts disabled when
+ * a timer due at @deadline became the earliest one on processor @cpu.
+ */
+void clock_hrtimer_scheduled(int cpu, bintime_t deadline);
+
+/*
+ * Implemented by the system clock. Called on IPI_HRTIMER to reprogram the
+ * clock of current processor for its earliest timer.
+ */
+void clock_hrtimer_ipi(void);
+
+#endif /* !_SYS_HRTIMER_H_ */
@@ -2,6 +2,7 @@
 #define _SYS_KMEM_H_
 
 #include <sys/kmem_flags.h>
+#include <sys/linker_set.h>
 
 typedef struct vm_page vm_page_t;
 
@@ -16,6 +17,12 @@ void *kmem_alloc(size_t size, kmem_flags_t flags) __warn_unused;
 void kmem_free(void *ptr, size_t size);
 size_t kmem_size(void *ptr);
 
+/* Registers `void func(void)` to be called when kernel is running short of
+ * physical memory. The function should return memory that its subsystem
+ * keeps cached, but does not use, by calling `kmem_free`. It must not hold
+ * locks that could have been taken by a thread calling `kmem_alloc`. */
+#define KMEM_LOWMEM_HANDLER(func) SET_ENTRY(kmem_lowmem, func)
+
 /* Allocates contiguous physical memory of `size` bytes aligned to at least
  * `PAGESIZE` boundary. First physical address of the region will be stored
  * under `pap`. Memory will be mapped read-write with `flags` passed to
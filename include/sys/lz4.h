@@ -0,0 +1,12 @@
+#ifndef _SYS_LZ4_H_
+#define _SYS_LZ4_H_
+
+#include <sys/types.h>
+
+/* Decompresses `srclen` bytes of LZ4 block format data at `src` into buffer
+ * `dst` of `*dstlenp` bytes. On success stores the number of decompressed
+ * bytes in `dstlenp` and returns 0. Returns EINVAL if data is malformed or
+ * doesn't fit into the buffer. */
+int lz4_decompress(const void *src, size_t srclen, void *dst, size_t *dstlenp);
+
+#endif /* !_SYS_LZ4_H_ */
@@ -110,6 +110,23 @@ __noreturn void kernel_init(void);
 /*! \brief Called during kernel initialization. */
 void init_clock(void);
 
+/*! \brief Starts system clock on secondary processor. */
+void init_clock_cpu(void);
+
+/*! \brief Stops periodic clock tick on current processor.
+ *
+ * Called by idle thread with interrupts disabled. The clock is set up to
+ * trigger once, when the earliest callout or high-resolution timer is due. */
+void clock_idle_enter(void);
+
+/*! \brief Restarts periodic clock tick stopped by \fn clock_idle_enter. */
+void clock_idle_exit(void);
+
+/*! \brief Notifies the clock about an event scheduled at time `tm`.
+ *
+ * Wakes up the boot processor if it's idle and would oversleep the event. */
+void clock_event_scheduled(systime_t tm);
+
 /* Initial range of virtual addresses used by kernel image. */
 extern char __kernel_start[];
 extern char __kernel_end[];
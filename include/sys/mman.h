@@ -24,6 +24,11 @@
 #define PROT_WRITE 2
 #define PROT_EXEC 4
 
+/* Flags to msync. */
+#define MS_ASYNC 0x01      /* perform asynchronous writes */
+#define MS_INVALIDATE 0x02 /* invalidate cached data */
+#define MS_SYNC 0x04       /* perform synchronous writes */
+
 /* Original advice values, equivalent to POSIX definitions. */
 #define MADV_NORMAL 0     /* No further special treatment */
 #define MADV_RANDOM 1     /* Expect random page references */
@@ -37,6 +42,7 @@ void *mmap(void *addr, size_t length, int prot, int flags, int fd,
 int munmap(void *addr, size_t len);
 int mprotect(void *addr, size_t len, int prot);
 int madvise(void *addr, size_t len, int advice);
+int msync(void *addr, size_t len, int flags);
 
 #endif /* !_KERNEL */
 
@@ -3,7 +3,9 @@
 
 #include <machine/types.h>
 #include <machine/pcpu.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 typedef struct thread thread_t;
 typedef struct pmap pmap_t;
@@ -11,21 +13,29 @@ typedef struct vm_map vm_map_t;
 
 /*! \brief Private per-cpu structure. */
 typedef struct pcpu {
-  bool no_switch;        /*!< executing code that must not switch out */
-  thread_t *curthread;   /*!< thread running on this CPU */
-  thread_t *idle_thread; /*!< idle thread executed on this CPU */
-  pmap_t *curpmap;       /*!< current page table */
-  vm_map_t *uspace;      /*!< user space virtual memory map */
+  bool no_switch;          /*!< executing code that must not switch out */
+  thread_t *curthread;     /*!< thread running on this CPU */
+  thread_t *idle_thread;   /*!< idle thread executed on this CPU */
+  pmap_t *curpmap;         /*!< current page table */
+  vm_map_t *uspace;        /*!< user space virtual memory map */
+  int cpuid;               /*!< index of this structure in `_pcpu_data` */
+  atomic_uint ipi_pending; /*!< inter-processor interrupts to be handled */
 
   /* Machine-dependent part */
   PCPU_MD_FIELDS;
 } pcpu_t;
 
-extern pcpu_t _pcpu_data[1];
+extern pcpu_t _pcpu_data[MAXCPU];
 
-/* Read pcpu.h from FreeBSD for API reference */
-#define PCPU_GET(member) (_pcpu_data->member)
-#define PCPU_PTR(member) (&_pcpu_data->member)
-#define PCPU_SET(member, value) (_pcpu_data->member = (value))
+/*! \brief Number of processors that have been started. */
+extern int ncpus;
+
+/* Read pcpu.h from FreeBSD for API reference.
+ *
+ * NOTE: If the calling thread can be preempted, it may end up on another CPU
+ * between computing the address of pcpu_t and accessing the member. */
+#define PCPU_GET(member) (curpcpu()->member)
+#define PCPU_PTR(member) (&curpcpu()->member)
+#define PCPU_SET(member, value) (curpcpu()->member = (value))
 
 #endif /* !_SYS_PCPU_H_ */
@@ -37,6 +37,15 @@ void pmap_delete(pmap_t *pmap);
 
 void pmap_enter(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
                 unsigned flags);
+
+/*
+ * Enter mappings of `n` consecutive virtual pages starting at `va` while
+ * acquiring locks only once. Page `pgs[i]` gets mapped with `prots[i]`
+ * permissions, unless it's NULL or it's already mapped with at least these
+ * permissions.
+ */
+void pmap_enter_many(pmap_t *pmap, vaddr_t va, vm_page_t **pgs,
+                     vm_prot_t *prots, size_t n, unsigned flags);
 bool pmap_extract(pmap_t *pmap, vaddr_t va, paddr_t *pap);
 void pmap_remove(pmap_t *pmap, vaddr_t start, vaddr_t end);
 
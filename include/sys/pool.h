@@ -7,6 +7,7 @@
 #include <sys/kasan.h>
 #include <sys/kmem_flags.h>
 #include <sys/mutex.h>
+#include <sys/pcpu.h>
 #include <sys/queue.h>
 
 /*! \file pool.h
@@ -15,11 +16,42 @@
  * of the slab allocator, however object caching facility is not available
  * (though the actual implementation is capable of supporting it).
  *
+ * Free items are cached in magazines (i.e. stacks of item pointers) in front
+ * of slab layer, as described in Bonwick's "Magazines and Vmem" paper. Each
+ * CPU owns two magazines, so most allocations and releases only push or pop
+ * a pointer with preemption disabled. Full and empty magazines are exchanged
+ * with the depot, which is protected by a spin lock. A CPU returns cached items
+ * to slabs by itself, after it notices that the pool was drained.
+ *
  * Pooled allocator idea is loosely based on NetBSD's pool(9).
  */
 
 typedef LIST_HEAD(, slab) slab_list_t;
 
+/* Number of items that a single magazine holds. */
+#define POOL_MAGAZINE_SIZE 15
+
+/* Maximum number of full magazines kept in the depot. */
+#define POOL_DEPOT_MAX 8
+
+typedef struct pool_magazine {
+  SLIST_ENTRY(pool_magazine) pm_link; /* depot magazine list */
+  unsigned pm_nrounds;                /* # of items in the magazine */
+  void *pm_rounds[POOL_MAGAZINE_SIZE];
+} pool_magazine_t;
+
+typedef SLIST_HEAD(, pool_magazine) pool_magazine_list_t;
+
+typedef struct pool_cache {
+  pool_magazine_t *pc_loaded;   /* items are taken from / put here first */
+  pool_magazine_t *pc_previous; /* either full or empty magazine */
+  unsigned pc_generation;       /* pp_generation when the cache was used */
+} pool_cache_t;
+
+/* Pool flags */
+#define POOL_NOCACHE 1 /* bypass magazine layer */
+#define POOL_DMA 2     /* grow with contiguous uncached memory for devices */
+
 typedef struct pool {
   TAILQ_ENTRY(pool) pp_link;
   mtx_t pp_mtx;
@@ -30,6 +62,14 @@ typedef struct pool {
   size_t pp_itemsize;        /* size of item */
   size_t pp_alignment;       /* alignment of allocated items */
   size_t pp_slabsize;        /* size of a single slab */
+  unsigned pp_flags;         /* POOL_* flags */
+  /* magazine layer */
+  pool_cache_t pp_cache[MAXCPU];      /* per-CPU caches */
+  atomic_uint pp_generation;          /* advanced when the pool is purged */
+  mtx_t pp_depot_lock;                /* spin lock guarding the depot */
+  pool_magazine_list_t pp_full_mags;  /* depot of full magazines */
+  pool_magazine_list_t pp_empty_mags; /* depot of empty magazines */
+  size_t pp_nfull_mags;               /* number of full magazines in depot */
 #if KASAN
   size_t pp_redzone; /* size of redzone after each item */
   quar_t pp_quarantine;
@@ -46,9 +86,11 @@ typedef struct slab {
   pool_t *ph_pool;          /* pool handle */
   uint16_t ph_nused;        /* # of items in use */
   uint16_t ph_ntotal;       /* total number of items */
+  bool ph_external;         /* memory was supplied by pool_add_page */
   size_t ph_size;           /* size of memory allocated for the slab */
   size_t ph_itemsize;       /* total size of item (with header and redzone) */
-  void *ph_items;           /* ptr to array of items after bitmap */
+  void *ph_items;           /* ptr to array of items after bitmaps */
+  bitstr_t *ph_cached;      /* items cached in magazines, after ph_bitmap */
   bitstr_t ph_bitmap[0];
 } slab_t;
 
@@ -61,6 +103,7 @@ typedef struct pool_init {
   size_t size;
   size_t alignment;
   size_t slabsize;
+  unsigned flags;
 } pool_init_t;
 
 /*! \brief Creates a pool of objects of given size. */
@@ -94,6 +137,13 @@ void *pool_alloc(pool_t *pool, kmem_flags_t flags) __warn_unused;
 /*! \brief Release an object that belongs to the pool. */
 void pool_free(pool_t *pool, void *ptr);
 
+/*! \brief Return free memory of the pool to kmem.
+ *
+ * Releases items cached in the depot and magazines of current CPU, and then
+ * all empty slabs. Other CPUs release their magazines when they use the pool
+ * next time. Called for all pools when kernel is running short of memory. */
+void pool_drain(pool_t *pool);
+
 /*! \brief Define a pool that will be initialized during system startup. */
 #define POOL_DEFINE(NAME, ...)                                                 \
   pool_t NAME[1];                                                              \
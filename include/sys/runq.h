@@ -4,6 +4,8 @@
 #ifdef _KERNEL
 
 #include <sys/cdefs.h>
+#include <sys/types.h>
+#include <sys/param.h>
 #include <sys/queue.h>
 
 typedef struct thread thread_t;
@@ -12,9 +14,14 @@ typedef struct thread thread_t;
 #define RQ_NQS 64 /* Number of run queues. */
 #define RQ_PPQ 4  /* Priorities per queue. */
 
+#define RQB_BPW (sizeof(u_long) * NBBY)   /* Bits per status word. */
+#define RQB_LEN howmany(RQ_NQS, RQB_BPW) /* Number of status words. */
+
 TAILQ_HEAD(rq_head, thread);
 
 typedef struct {
+  /* Bit is set iff corresponding queue is not empty. */
+  u_long rq_status[RQB_LEN];
   struct rq_head rq_queues[RQ_NQS];
 } runq_t;
 
@@ -78,7 +78,8 @@ void sched_unlend_prio(thread_t *td, prio_t prio);
  * Active priority \a td_prio is changed on condition that we are not lowering
  * priority of a thread that borrows priority via \a sched_lend_prio.
  *
- * \note Must be called with \a td_spin acquired!
+ * \note Must be called with \a td_lock acquired! If the thread is blocked on
+ * a turnstile, the lock is released for a moment (see \a turnstile_adjust).
  */
 void sched_set_prio(thread_t *td, prio_t prio);
 
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/time.h>
 
 typedef struct mtx mtx_t;
 typedef struct thread thread_t;
@@ -44,6 +45,16 @@ void sleepq_wait(void *wchan, const void *waitpt, mtx_t *mtx);
 int sleepq_wait_timed(void *wchan, const void *waitpt, mtx_t *mtx,
                       systime_t timeout);
 
+/*! \brief Performs interruptible sleep until given point in time.
+ *
+ * Same as \a sleepq_wait_timed, but the timeout is driven by a high-resolution
+ * timer, hence it's not rounded up to system clock ticks.
+ *
+ * \param deadline time since boot at which the sleep times out
+ * \returns how the thread was actually woken up */
+int sleepq_wait_until(void *wchan, const void *waitpt, mtx_t *mtx,
+                      bintime_t deadline);
+
 /*! \brief Wakes up highest priority thread waiting on \a wchan.
  *
  * \param wchan unique sleep queue identifier
@@ -0,0 +1,43 @@
+#ifndef _SYS_SMP_H_
+#define _SYS_SMP_H_
+
+#include <sys/cdefs.h>
+
+typedef struct device device_t;
+
+/* Inter-processor interrupt types (bit mask). */
+#define IPI_RESCHED 1 /* look for a thread to run in the run queue */
+#define IPI_HRTIMER 2 /* reprogram clock for the earliest hrtimer */
+
+/*! \brief Starts secondary processors during kernel initialization.
+ *
+ * Each secondary processor gets its own idle thread, which it begins
+ * execution with in \fn init_ap. */
+void init_smp(void);
+
+/*! \brief Entry point of secondary processor after it enabled MMU.
+ *
+ * Must be entered on the stack of the idle thread (see `td_uctx`), with
+ * interrupts disabled and `curpcpu()` pointing to `_pcpu_data[cpu]`. */
+__noreturn void init_ap(void);
+
+/*! \brief Starts processor `cpu`, machine-dependent.
+ *
+ * Kernel stack of the idle thread is taken from `_pcpu_data[cpu].curthread`.
+ * Returns ENODEV if there's no such processor. */
+int smp_md_start_ap(int cpu);
+
+typedef void (*smp_ipi_send_t)(device_t *dev, int cpu);
+
+/*! \brief Registers the interrupt controller that delivers IPIs. */
+void smp_ipi_claim(smp_ipi_send_t send, device_t *dev);
+
+/*! \brief Posts inter-processor interrupt `ipi` to processor `cpu`. */
+void smp_ipi_send(int cpu, unsigned ipi);
+
+/*! \brief Handles IPIs posted to current processor.
+ *
+ * Must be called by interrupt filter that received an IPI. */
+void smp_ipi_handler(void);
+
+#endif /* !_SYS_SMP_H_ */
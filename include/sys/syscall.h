@@ -92,6 +92,7 @@
 #define SYS_kqueue1 84
 #define SYS_kevent 85
 #define SYS_sigtimedwait 86
-#define SYS_MAXSYSCALL 87
+#define SYS_msync 87
+#define SYS_MAXSYSCALL 88
 
 #define SYS_MAXSYSARGS 6
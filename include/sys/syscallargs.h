@@ -443,3 +443,9 @@ typedef struct {
   SYSCALLARG(siginfo_t *) info;
   SYSCALLARG(struct timespec *) timeout;
 } sigtimedwait_args_t;
+
+typedef struct {
+  SYSCALLARG(void *) addr;
+  SYSCALLARG(size_t) len;
+  SYSCALLARG(int) flags;
+} msync_args_t;
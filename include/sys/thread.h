@@ -4,7 +4,7 @@
 #include <sys/cdefs.h>
 #include <sys/queue.h>
 #include <sys/context.h>
-#include <sys/callout.h>
+#include <sys/hrtimer.h>
 #include <sys/mutex.h>
 #include <sys/condvar.h>
 #include <sys/priority.h>
@@ -123,15 +123,18 @@ typedef struct thread {
   /* waiting channel */
   void *td_wchan;            /*!< (*) memory object on which thread awaits */
   const void *td_waitpt;     /*!< (*) PC where program waits */
-  callout_t td_slpcallout;   /*!< (*) callout used to wakeup from sleep */
+  hrtimer_t td_slptimer;     /*!< (*) timer used to wakeup from sleep */
   sleepq_t *td_sleepqueue;   /*!< ($) thread's sleepqueue */
   turnstile_t *td_blocked;   /*!< (#) turnstile on which thread is blocked */
   turnstile_t *td_turnstile; /*!< (#) thread's turnstile */
   LIST_HEAD(, turnstile) td_contested; /* (#) turnstiles of locks that we own */
   /* scheduler part */
-  prio_t td_base_prio; /*!< ($) base priority */
-  prio_t td_prio;      /*!< ($) active priority */
-  int td_slice;        /*!< ($) time slice length in system ticks */
+  prio_t td_base_prio;    /*!< ($) base priority */
+  prio_t td_prio;         /*!< ($) active priority */
+  int td_slice;           /*!< ($) time slice length in system ticks */
+  unsigned td_runhist;    /*!< ($) recent time spent running [us] */
+  unsigned td_slphist;    /*!< ($) recent time spent sleeping [us] */
+  volatile bool td_oncpu; /*!< (~) context of the thread is used by a CPU */
   /* thread statistics */
   bintime_t td_rtime;        /*!< (*) time spent running */
   bintime_t td_last_rtime;   /*!< (*) time of last switch to running state */
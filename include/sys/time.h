@@ -60,11 +60,29 @@ static inline void bt2ts(const bintime_t *bt, timespec_t *ts) {
   ts->tv_nsec = (1000000000ULL * (uint32_t)(bt->frac >> 32)) >> 32;
 }
 
+static inline uint64_t bt2ns(const bintime_t *bt) {
+  timespec_t ts;
+  bt2ts(bt, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 static inline void bt2tv(const bintime_t *bt, timeval_t *tv) {
   tv->tv_sec = bt->sec;
   tv->tv_usec = (1000000ULL * (uint32_t)(bt->frac >> 32)) >> 32;
 }
 
+static inline void ts2bt(const timespec_t *ts, bintime_t *bt) {
+  bt->sec = ts->tv_sec;
+  /* 18446744073 = int(2^64 / 1000000000) */
+  bt->frac = ts->tv_nsec * 18446744073ULL;
+}
+
+static inline void tv2bt(const timeval_t *tv, bintime_t *bt) {
+  bt->sec = tv->tv_sec;
+  /* 18446744073709 = int(2^64 / 1000000) */
+  bt->frac = tv->tv_usec * 18446744073709ULL;
+}
+
 /* Operations on timevals. */
 #define timerclear(tvp) (tvp)->tv_sec = (tvp)->tv_usec = 0L
 #define timerisset(tvp) ((tvp)->tv_sec || (tvp)->tv_usec)
@@ -128,6 +146,12 @@ static inline void bintime_sub(bintime_t *bt, bintime_t *bt2) {
   bt->sec -= bt2->sec;
 }
 
+static inline bintime_t st2bt(systime_t st) {
+  bintime_t bt = bintime_mul(HZ2BT(CLK_TCK), st % CLK_TCK);
+  bt.sec += st / CLK_TCK;
+  return bt;
+}
+
 typedef enum clockid { CLOCK_MONOTONIC = 1, CLOCK_REALTIME = 2 } clockid_t;
 
 /* Operations on timespecs. */
@@ -173,7 +197,7 @@ struct itimerval {
 
 #ifdef _KERNEL
 
-#include <sys/callout.h>
+#include <sys/hrtimer.h>
 
 typedef struct proc proc_t;
 
@@ -182,7 +206,7 @@ typedef struct {
   /* absolute time of nearest expiration, 0 means inactive */
   timeval_t kit_next;
   timeval_t kit_interval; /* time between expirations, 0 means non-periodic */
-  callout_t kit_callout;
+  hrtimer_t kit_timer;
 } kitimer_t;
 
 /* Initialize a process's interval timer structure. */
@@ -38,6 +38,7 @@ typedef void (*tm_event_cb_t)(timer_t *tm, void *arg);
 #define TMF_PERIODIC 0x0002   /*!< triggers callback on regular basis */
 #define TMF_TYPEMASK 0x0003   /*!< don't use other bits! */
 #define TMF_TIMESOURCE 0x0004 /*!< choose this timer as time source */
+#define TMF_PERCPU 0x0008     /*!< each processor has its own instance */
 
 typedef struct timer {
   TAILQ_ENTRY(timer) tm_link; /*!< entry on list of all timers */
@@ -76,6 +77,20 @@ int tm_init(timer_t *tm, tm_event_cb_t event, void *arg);
 /*! \brief Configures timer to trigger callback(s). */
 int tm_start(timer_t *tm, unsigned flags, const bintime_t start,
              const bintime_t period);
+/*! \brief Starts an instance of active per-CPU timer on current processor.
+ *
+ * Arguments must be the same as passed to \fn tm_start. Returns ENODEV if
+ * the timer is not a per-CPU timer. */
+int tm_start_cpu(timer_t *tm, unsigned flags, const bintime_t start,
+                 const bintime_t period);
+/*! \brief Changes mode of active timer on current processor.
+ *
+ * With TMF_ONESHOT the callback is triggered once at `start`, which is time
+ * measured from the start of system. With TMF_PERIODIC the timer triggers
+ * the callback every `period` from now on. Must be called with interrupts
+ * disabled. Returns ENODEV if the timer doesn't support requested mode. */
+int tm_reprogram(timer_t *tm, unsigned flags, const bintime_t start,
+                 const bintime_t period);
 /*! \brief Stops timer from triggering a callback. */
 int tm_stop(timer_t *tm);
 /*! \brief Used by interrupt filter routine to trigger a callback. */
@@ -25,10 +25,12 @@ void turnstile_destroy(turnstile_t *ts);
  * priorities. Unlending would be problematic and the borrowing threads should
  * finish soon anyway.
  *
- * \note Requires td_spin acquired. */
+ * \note Requires td_lock acquired. The lock is released for a moment, as
+ * the turnstile lock must be taken first. */
 void turnstile_adjust(thread_t *td, prio_t oldprio);
 
-/* Provide turnstile that we're going to block on. */
+/* Provide turnstile that we're going to block on. Acquires the turnstile lock,
+ * which is released either by `turnstile_give` or `turnstile_wait`. */
 turnstile_t *turnstile_take(void *wchan);
 
 /* Release turnstile in case we decided not to block on it. */
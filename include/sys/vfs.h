@@ -134,6 +134,25 @@ int vfs_maybe_descend(vnode_t **vp);
 /* Finds name of v-node in given directory. */
 int vfs_name_in_dir(vnode_t *dv, vnode_t *v, char *buf, size_t *lastp);
 
+/* Looks up component cn of directory dv in the name cache. On a hit returns
+ * true and sets *vp to the vnode with usecnt incremented, or to NULL if the
+ * name is known not to exist. Always sets *genp, which must be passed to
+ * vfs_namecache_enter after the lookup is performed by the filesystem. */
+bool vfs_namecache_lookup(vnode_t *dv, const componentname_t *cn,
+                          vnode_t **vp, unsigned *genp);
+
+/* Records the result of VOP_LOOKUP in the name cache. Pass NULL as vp to
+ * record that the name does not exist in the directory. */
+void vfs_namecache_enter(vnode_t *dv, const componentname_t *cn, vnode_t *vp,
+                         unsigned gen);
+
+/* Removes the entry for component cn of directory dv from the name cache.
+ * Must be called whenever the name is created, removed or renamed. */
+void vfs_namecache_remove(vnode_t *dv, const componentname_t *cn);
+
+/* Removes all name cache entries referring to the vnode. */
+void vfs_namecache_purge(vnode_t *v);
+
 #endif /* !_KERNEL */
 
 #endif /* !_SYS_VFS_H_ */
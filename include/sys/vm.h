@@ -3,6 +3,7 @@
 
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/tree.h>
 #include <machine/vm_param.h>
 
 #ifdef _KERNEL
@@ -16,6 +17,7 @@ typedef enum {
   PG_MANAGED = 0x02,    /* a page is on a freeq */
   PG_REFERENCED = 0x04, /* page has been accessed since last check */
   PG_MODIFIED = 0x08,   /* page has been modified since last check */
+  PG_FIXED = 0x10,      /* page is never returned to physmem (e.g. ramdisk) */
 } __packed pg_flags_t;
 
 typedef enum {
@@ -37,6 +39,7 @@ typedef enum {
 
 typedef struct vm_page vm_page_t;
 typedef TAILQ_HEAD(vm_pagelist, vm_page) vm_pagelist_t;
+typedef RB_HEAD(vm_pagetree, vm_page) vm_pagetree_t;
 
 typedef struct pv_entry pv_entry_t;
 typedef struct vm_object vm_object_t;
@@ -52,7 +55,7 @@ struct vm_page {
   union {
     TAILQ_ENTRY(vm_page) freeq;    /* (P) list of free pages for buddy system */
     TAILQ_ENTRY(vm_page) pageq;    /* used to group allocated pages */
-    TAILQ_ENTRY(vm_page) objpages; /* (O) list of pages in vm_object */
+    RB_ENTRY(vm_page) objpages;    /* (O) tree of pages in vm_object */
     slab_t *slab; /* active when page is used by pool allocator */
   };
   TAILQ_HEAD(, pv_entry) pv_list; /* (@) where this page is mapped? */
@@ -63,8 +66,10 @@ struct vm_page {
   uint32_t size;                  /* (P) size of page in PAGESIZE units */
 };
 
-int do_mmap(vaddr_t *addr_p, size_t length, int u_prot, int u_flags);
+int do_mmap(vaddr_t *addr_p, size_t length, int u_prot, int u_flags, int fd,
+            off_t pos);
 int do_munmap(vaddr_t addr, size_t length);
+int do_msync(vaddr_t addr, size_t length, int flags);
 
 #endif /* !_KERNEL */
 
@@ -55,6 +55,9 @@ vaddr_t vm_map_entry_start(vm_map_entry_t *ent);
 vaddr_t vm_map_entry_end(vm_map_entry_t *ent);
 vm_map_entry_t *vm_map_entry_next(vm_map_entry_t *ent);
 
+/*! \brief Sets offset in memory object that maps to the entry's start. */
+void vm_map_entry_set_offset(vm_map_entry_t *ent, vaddr_t offset);
+
 /*! \brief Looks up a gap of \a length size in \a map.
  *
  * The search starts at an address read from \a start_p location.
@@ -64,10 +67,19 @@ vm_map_entry_t *vm_map_entry_next(vm_map_entry_t *ent);
  */
 int vm_map_findspace(vm_map_t *map, vaddr_t /*inout*/ *start_p, size_t length);
 
-/*! \brief Allocates entry and associate anonymous memory object with it. */
-int vm_map_alloc_entry(vm_map_t *map, vaddr_t addr, size_t length,
-                       vm_prot_t prot, vm_flags_t flags,
-                       vm_map_entry_t **ent_p);
+/*! \brief Allocates entry and inserts it into \a map.
+ *
+ * If \a flags contain VM_ANON then new anonymous memory object is associated
+ * with the entry and \a obj must be NULL. Otherwise the entry maps \a obj
+ * starting at \a offset and takes over caller's reference to the object. */
+int vm_map_alloc_entry(vm_map_t *map, vm_object_t *obj, vaddr_t offset,
+                       vaddr_t addr, size_t length, vm_prot_t prot,
+                       vm_flags_t flags, vm_map_entry_t **ent_p);
+
+/*! \brief Writes back modified pages of files mapped into [start, end).
+ *
+ * \returns ENOMEM if the range is not fully mapped */
+int vm_map_sync(vm_map_t *map, vaddr_t start, vaddr_t end);
 
 /* Tries to resize an entry, by moving its end if there
    are no other mappings in the way. On success, returns 0. */
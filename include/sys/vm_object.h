@@ -6,6 +6,8 @@
 #include <sys/mutex.h>
 #include <sys/refcnt.h>
 
+typedef struct vnode vnode_t;
+
 /*! \brief Virtual memory object
  *
  * Field marking and corresponding locks:
@@ -15,19 +17,43 @@
 
 typedef struct vm_object {
   mtx_t vo_lock;
-  vm_pagelist_t vo_pages; /* (@) List of pages */
-  size_t vo_npages;       /* (@) Number of pages */
-  vm_pager_t *vo_pager;   /* Pager type and page fault function for object */
-  refcnt_t vo_refs;       /* (a) How many objects refer to this object? */
+  vm_pagetree_t vo_pages;  /* (@) Pages sorted by offset */
+  size_t vo_npages;        /* (@) Number of pages */
+  vm_pager_t *vo_pager;    /* Pager type and page fault function for object */
+  refcnt_t vo_refs;        /* (a) How many objects refer to this object? */
+  vm_object_t *vo_backing; /* (@) Object shadowed by this one (copy-on-write) */
+  vnode_t *vo_vnode;       /* Source of pages of VM_VNODE object */
 } vm_object_t;
 
+/* Use RB_FOREACH, RB_NFIND, RB_NEXT with vm_pagetree to iterate over pages of
+ * an object in order of their offsets. */
+RB_PROTOTYPE(vm_pagetree, vm_page, objpages, vm_page_cmp);
+
 vm_object_t *vm_object_alloc(vm_pgr_type_t type);
 void vm_object_hold(vm_object_t *obj);
 void vm_object_drop(vm_object_t *obj);
 void vm_object_add_page(vm_object_t *obj, vm_offset_t off, vm_page_t *pg);
+/*! \brief Insert \a pg into \a obj unless there's a page at \a off already.
+ *
+ * \returns the page that is present in the object at given offset */
+vm_page_t *vm_object_try_add_page(vm_object_t *obj, vm_offset_t off,
+                                  vm_page_t *pg);
 void vm_object_remove_pages(vm_object_t *obj, vm_offset_t off, size_t len);
 vm_page_t *vm_object_find_page(vm_object_t *obj, vm_offset_t off);
-vm_object_t *vm_object_clone(vm_object_t *obj);
+
+/*! \brief Create a copy-on-write shadow object backed by \a obj.
+ *
+ * Pages of the shadow are looked up in \a obj (and its backing objects)
+ * until they are written to, at which point they get copied to the shadow.
+ * The shadow holds a reference to \a obj. */
+vm_object_t *vm_object_shadow(vm_object_t *obj);
+
+/*! \brief Merge backing objects referenced only by \a obj into it.
+ *
+ * Keeps chains of shadow objects short when a process forks repeatedly
+ * and its children exit. */
+void vm_object_collapse(vm_object_t *obj);
+
 void vm_object_dump(vm_object_t *obj);
 
 #endif /* !_SYS_VM_OBJECT_H_ */
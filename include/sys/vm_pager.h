@@ -3,18 +3,52 @@
 
 #include <sys/vm.h>
 
+typedef struct vnode vnode_t;
+
 typedef enum {
   VM_DUMMY,
   VM_ANONYMOUS,
+  VM_SHADOW,
+  VM_VNODE,
 } vm_pgr_type_t;
 
-typedef vm_page_t *vm_pgr_fault_t(vm_object_t *obj, off_t offset);
+/* Brings in page at \a offset of \a obj and returns it through \a pgp.
+ * The page may belong to one of the objects backing \a obj. Returns EFAULT if
+ * there's no memory to back the page and EIO if it can't be read in. */
+typedef int vm_pgr_fault_t(vm_object_t *obj, off_t offset, vm_page_t **pgp);
+typedef void vm_pgr_free_t(vm_object_t *obj);
 
 typedef struct vm_pager {
   vm_pgr_type_t pgr_type;
   vm_pgr_fault_t *pgr_fault;
+  vm_pgr_free_t *pgr_free; /* called when last reference to object is gone */
 } vm_pager_t;
 
 extern vm_pager_t pagers[];
 
+/*! \brief Returns memory object caching pages of vnode \a vn.
+ *
+ * The object is created on first use and returned with its reference counter
+ * incremented. The object keeps \a vn alive as long as it exists. */
+vm_object_t *vnode_pager_object(vnode_t *vn);
+
+/*! \brief Writes back modified pages from [offset, offset + length) range.
+ *
+ * Pages get modified by processes that map the file with MAP_SHARED.
+ * File contents are never extended. Vnode must be locked. */
+int vnode_pager_flush(vnode_t *vn, off_t offset, size_t length);
+
+/*! \brief Reads in [offset, offset + length) range of pages cached for \a vn.
+ *
+ * Must be called after vnode contents have been modified not through vnode
+ * pager. Other data in the pages, that may have been modified through shared
+ * mappings, is left intact. Vnode must be locked. */
+void vnode_pager_update(vnode_t *vn, off_t offset, size_t length);
+
+/*! \brief Drops pages cached for \a vn beyond new end of file at \a size.
+ *
+ * The last page of the file has its part beyond the end of file cleared.
+ * Vnode must be locked. */
+void vnode_pager_truncate(vnode_t *vn, size_t size);
+
 #endif /* !_SYS_VM_PAGER_H_ */
@@ -26,6 +26,10 @@ void vm_pagelist_free(vm_pagelist_t *pglist);
 /* Returns vm_page associated with frame of given address. */
 vm_page_t *vm_page_find(paddr_t pa);
 
+/* Returns vm_page of a frame in a segment plugged as used (e.g. ramdisk), so
+ * it can be put into a vm_object. Such page is never freed. */
+vm_page_t *vm_page_fixed(paddr_t pa);
+
 /* Returns vm_page to physical memory manager. */
 void vm_page_free(vm_page_t *page);
 
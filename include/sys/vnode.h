@@ -19,6 +19,8 @@ typedef struct dirent dirent_t;
 typedef struct stat stat_t;
 typedef struct componentname componentname_t;
 typedef struct cred cred_t;
+typedef struct vm_object vm_object_t;
+typedef struct vm_page vm_page_t;
 
 /* Indicates that given field of vattr structure does not hold a value.
  * vnodeops should not modify attributes set to VNOVAL. */
@@ -57,6 +59,7 @@ typedef int vnode_readlink_t(vnode_t *v, uio_t *uio);
 typedef int vnode_symlink_t(vnode_t *dv, componentname_t *cn, vattr_t *va,
                             char *target, vnode_t **vp);
 typedef int vnode_link_t(vnode_t *dv, vnode_t *v, componentname_t *cn);
+typedef int vnode_getpage_t(vnode_t *v, off_t offset, vm_page_t **pgp);
 
 typedef struct vnodeops {
   vnode_lookup_t *v_lookup;
@@ -78,13 +81,14 @@ typedef struct vnodeops {
   vnode_readlink_t *v_readlink;
   vnode_symlink_t *v_symlink;
   vnode_link_t *v_link;
+  vnode_getpage_t *v_getpage;
 } vnodeops_t;
 
 /* Fill missing entries with default vnode operation. */
 void vnodeops_init(vnodeops_t *vops);
 
 typedef struct {
-  bool vl_locked;
+  thread_t *vl_owner; /* thread holding the lock or NULL */
   condvar_t vl_cv;
   mtx_t vl_interlock;
 } vnlock_t;
@@ -105,6 +109,10 @@ typedef struct vnode {
 
   refcnt_t v_usecnt;
   vnlock_t v_lock;
+  vm_object_t *v_object; /* Pages cached by vnode pager (if any) */
+
+  LIST_HEAD(, namecache) v_ncsrc; /* Name cache entries in this directory */
+  LIST_HEAD(, namecache) v_ncdst; /* Name cache entries pointing at vnode */
 } vnode_t;
 
 static inline bool is_mountpoint(vnode_t *v) {
@@ -210,6 +218,13 @@ static inline int VOP_LINK(vnode_t *dv, vnode_t *v, componentname_t *cn) {
   return VOP_CALL(link, dv, v, cn);
 }
 
+/* Returns a page that holds file contents at `offset` as they are, so that
+ * it can be mapped without copying. Filesystems that can't do that return
+ * EOPNOTSUPP and the contents get read with VOP_READ instead. */
+static inline int VOP_GETPAGE(vnode_t *v, off_t offset, vm_page_t **pgp) {
+  return VOP_CALL(getpage, v, offset, pgp);
+}
+
 #undef VOP_CALL
 
 /* Allocates and initializes a new vnode */
@@ -220,6 +235,9 @@ vnode_t *vnode_new(vnodetype_t type, vnodeops_t *ops, void *data);
 void vnode_lock(vnode_t *v);
 void vnode_unlock(vnode_t *v);
 
+/* Check whether current thread holds the vnode's lock. */
+bool vnode_owned(vnode_t *v);
+
 /* Increase and decrease the use counter.
  * Call vnode_ref if you don't want the vnode to be recycled. */
 void vnode_hold(vnode_t *v);
@@ -254,6 +272,14 @@ uint8_t vt2dt(vnodetype_t v_type);
 #define DIRENT_DOTDOT ((void *)-1)
 #define DIRENT_EOF NULL
 
+/* Directory offsets used by readdir_generic are opaque cookies rather than
+ * byte offsets. Cookies 0 and 1 denote "." and ".." respectively. Filesystems
+ * that provide seek and cookie_of operations assign cookies to remaining
+ * entries themselves. These must be at least DIRENT_COOKIE_MIN and increase
+ * along next. Otherwise the cookie is the position of an entry in the
+ * directory and resuming readdir has to walk over all preceding entries. */
+#define DIRENT_COOKIE_MIN 2
+
 typedef struct readdir_ops {
   /* take next directory entry */
   void *(*next)(vnode_t *dir, void *entry);
@@ -261,6 +287,10 @@ typedef struct readdir_ops {
   size_t (*namlen_of)(vnode_t *dir, void *entry);
   /* make dirent based on entry */
   void (*convert)(vnode_t *dir, void *entry, dirent_t *dirent);
+  /* (optional) find first entry with cookie not less than given one */
+  void *(*seek)(vnode_t *dir, off_t cookie);
+  /* (optional) cookie of given entry, must be provided along with seek */
+  off_t (*cookie_of)(vnode_t *dir, void *entry);
 } readdir_ops_t;
 
 int readdir_generic(vnode_t *v, uio_t *uio, readdir_ops_t *ops);
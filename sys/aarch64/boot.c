@@ -4,6 +4,8 @@
 #include <sys/pcpu.h>
 #include <sys/pmap.h>
 #include <sys/kasan.h>
+#include <sys/smp.h>
+#include <sys/thread.h>
 #include <aarch64/abi.h>
 #include <aarch64/armreg.h>
 #include <aarch64/vm_param.h>
@@ -49,8 +51,11 @@ __boot_data static volatile vaddr_t _ebss = (vaddr_t)__ebss;
 __boot_data static volatile vaddr_t _evec = (vaddr_t)exception_vectors;
 __boot_data static volatile vaddr_t _hvec = (vaddr_t)hypervisor_vectors;
 __boot_data static volatile vaddr_t _pcpu = (vaddr_t)_pcpu_data;
+__boot_data static volatile vaddr_t _init_ap = (vaddr_t)init_ap;
+/* Kernel page directory is shared with secondary CPUs. */
+__boot_data static volatile paddr_t _kernel_pde;
 
-__boot_text static void configure_cpu(void) {
+__boot_text static void configure_cpu(int cpu) {
   /* Enable hw management of data coherency with other cores in the cluster. */
   WRITE_SPECIALREG(S3_1_C15_c2_1, READ_SPECIALREG(S3_1_C15_C2_1) | SMPEN);
   __dsb("sy");
@@ -64,7 +69,7 @@ __boot_text static void configure_cpu(void) {
     halt();
 #endif
 
-  WRITE_SPECIALREG(tpidr_el1, _pcpu);
+  WRITE_SPECIALREG(tpidr_el1, _pcpu + cpu * sizeof(pcpu_t));
 }
 
 __boot_text static void drop_to_el1(void) {
@@ -275,7 +280,7 @@ __boot_text static void enable_mmu(pde_t *pde) {
 
 __boot_text __noreturn void aarch64_init(paddr_t dtb) {
   drop_to_el1();
-  configure_cpu();
+  configure_cpu(0);
   boot_clear(PHYSADDR(_bss), PHYSADDR(_ebss));
   boot_sbrk_init(PHYSADDR(_ebss));
 
@@ -285,6 +290,7 @@ __boot_text __noreturn void aarch64_init(paddr_t dtb) {
   vaddr_t vma_end = VIRTADDR(boot_sbrk_align(PAGESIZE));
 
   pde_t *pde = build_page_table(vma_end);
+  _kernel_pde = (paddr_t)pde;
   enable_mmu(pde);
 
   void *sbrk_end = boot_sbrk(0);
@@ -304,6 +310,23 @@ __boot_text __noreturn void aarch64_init(paddr_t dtb) {
   __unreachable();
 }
 
+/* Secondary CPU enters the kernel on the stack of its idle thread, which has
+ * been prepared by `init_smp`. */
+__boot_text __noreturn void aarch64_init_ap(int cpu) {
+  drop_to_el1();
+  configure_cpu(cpu);
+  enable_mmu((pde_t *)_kernel_pde);
+
+  pcpu_t *pc = (pcpu_t *)(_pcpu + cpu * sizeof(pcpu_t));
+  vaddr_t sp = (vaddr_t)pc->curthread->td_uctx;
+
+  __asm __volatile("mov sp, %0\n\t"
+                   "br %1"
+                   :
+                   : "r"(sp), "r"(_init_ap));
+  __unreachable();
+}
+
 extern void *board_stack(void);
 
 static __noreturn void aarch64_boot(void *dtb, paddr_t pde, paddr_t sbrk_end,
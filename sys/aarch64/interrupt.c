@@ -14,3 +14,8 @@ __no_profile bool cpu_intr_disabled(void) {
   uint32_t daif = READ_SPECIALREG(daif);
   return (daif & PSR_I) != 0;
 }
+
+__no_profile void cpu_idle(void) {
+  /* WFI wakes up the processor on pending interrupt even if it's masked. */
+  __asm __volatile("dsb sy; wfi" ::: "memory");
+}
@@ -0,0 +1,37 @@
+#define KL_LOG KL_INIT
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/errno.h>
+#include <sys/pcpu.h>
+#include <sys/pmap.h>
+#include <sys/smp.h>
+
+/*
+ * Raspberry Pi 3 firmware keeps secondary cores in a loop, where each of them
+ * waits for an event and then reads its spin table entry. Once the entry is
+ * non-zero, the core jumps to the physical address found there.
+ */
+#define SPIN_TABLE_BASE 0xd8
+
+extern char _start_ap[];
+
+/* Physical address of `_start_ap`, see comment in boot.c. */
+static volatile paddr_t ap_entry = (paddr_t)_start_ap;
+
+int smp_md_start_ap(int cpu) {
+  if (cpu >= MAXCPU)
+    return ENODEV;
+
+  volatile paddr_t *entry =
+    phys_to_dmap(SPIN_TABLE_BASE + cpu * sizeof(paddr_t));
+  *entry = ap_entry;
+
+  /* The core is still running with caches disabled. */
+  __asm __volatile("dc civac, %0\n\t"
+                   "dsb sy\n\t"
+                   "sev" ::"r"(entry)
+                   : "memory");
+
+  klog("Released CPU %d from the spin table", cpu);
+  return 0;
+}
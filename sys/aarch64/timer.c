@@ -6,6 +6,7 @@
 #include <sys/bus.h>
 #include <sys/devclass.h>
 #include <sys/fdt.h>
+#include <sys/pcpu.h>
 
 #define CNTCTL_ENABLE 1
 #define CNTCTL_DISABLE 0
@@ -13,18 +14,24 @@
 typedef struct arm_timer_state {
   resource_t *irq_res;
   timer_t timer;
-  uint64_t step;
+  uint64_t step[MAXCPU]; /* period in counter ticks, 0 in one-shot mode */
 } arm_timer_state_t;
 
-static int arm_timer_start(timer_t *tm, unsigned flags __unused,
-                           const bintime_t start __unused,
+static int arm_timer_start(timer_t *tm, unsigned flags, const bintime_t start,
                            const bintime_t period) {
   arm_timer_state_t *state = ((device_t *)tm->tm_priv)->state;
-  state->step = bintime_mul(period, tm->tm_frequency).sec;
 
   WITH_INTR_DISABLED {
-    uint64_t count = READ_SPECIALREG(cntpct_el0);
-    WRITE_SPECIALREG(cntp_cval_el0, count + state->step);
+    uint64_t *step = &state->step[PCPU_GET(cpuid)];
+    uint64_t count;
+    if (flags & TMF_ONESHOT) {
+      *step = 0;
+      count = bintime_mul(start, tm->tm_frequency).sec;
+    } else {
+      *step = bintime_mul(period, tm->tm_frequency).sec;
+      count = READ_SPECIALREG(cntpct_el0) + *step;
+    }
+    WRITE_SPECIALREG(cntp_cval_el0, count);
     WRITE_SPECIALREG(cntp_ctl_el0, CNTCTL_ENABLE);
   }
 
@@ -47,14 +54,19 @@ static bintime_t arm_timer_gettime(timer_t *tm) {
 
 static intr_filter_t arm_timer_intr(void *data /* device_t* */) {
   arm_timer_state_t *state = ((device_t *)data)->state;
+  uint64_t step = state->step[PCPU_GET(cpuid)];
 
-  tm_trigger(&state->timer);
-
-  /*
+  /* Acknowledge the event before the callback, as it may reprogram the timer.
    * https://developer.arm.com/docs/ddi0595/h/aarch64-system-registers/cntp_cval_el0
    */
-  uint64_t prev = READ_SPECIALREG(cntp_cval_el0);
-  WRITE_SPECIALREG(cntp_cval_el0, prev + state->step);
+  if (step) {
+    uint64_t prev = READ_SPECIALREG(cntp_cval_el0);
+    WRITE_SPECIALREG(cntp_cval_el0, prev + step);
+  } else {
+    WRITE_SPECIALREG(cntp_ctl_el0, CNTCTL_DISABLE);
+  }
+
+  tm_trigger(&state->timer);
 
   return IF_FILTERED;
 }
@@ -71,7 +83,7 @@ static int arm_timer_attach(device_t *dev) {
   /* Save link to timer device. */
   state->timer = (timer_t){
     .tm_name = "arm-cpu-timer",
-    .tm_flags = TMF_PERIODIC,
+    .tm_flags = TMF_PERIODIC | TMF_ONESHOT | TMF_PERCPU,
     .tm_quality = 0,
     .tm_start = arm_timer_start,
     .tm_stop = arm_timer_stop,
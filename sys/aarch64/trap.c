@@ -65,7 +65,10 @@ void user_trap_handler(mcontext_t *uctx) {
       if (abort_signo[dfsc] == SIGBUS) {
         sig_trap(SIGBUS, BUS_ADRALN, (void *)far, exc_code);
       } else if (abort_signo[dfsc] == SIGSEGV) {
-        if ((error = pmap_fault_handler(ctx, far, exc_access(exc_code, esr))))
+        error = pmap_fault_handler(ctx, far, exc_access(exc_code, esr));
+        if (error == EIO)
+          sig_trap(SIGBUS, BUS_OBJERR, (void *)far, exc_code);
+        else if (error)
           sig_trap(SIGSEGV, error == EFAULT ? SEGV_MAPERR : SEGV_ACCERR,
                    (void *)far, exc_code);
       } else {
@@ -19,19 +19,29 @@
 #include <sys/errno.h>
 #include <sys/bitops.h>
 #include <dev/bcm2835_emmcreg.h>
+#include <dev/bcm2835_dmareg.h>
 #include <sys/fdt.h>
+#include <sys/kmem.h>
+#include <sys/pmap.h>
+#include <aarch64/armreg.h>
 
 typedef struct bcmemmc_state {
   resource_t *emmc;      /* e.MMC controller registers */
   resource_t *irq;       /* e.MMC controller interrupt */
   condvar_t intr_recv;   /* Used to wake up a thread waiting for an interrupt */
-  mtx_t lock;            /* Covers `pending`, `intr_recv` and `emmc`. */
+  mtx_t lock;            /* Covers `pending`, `dma_end`, condvars, `emmc` */
   uint64_t rca;          /* Relative Card Address */
   uint64_t host_version; /* Host specification version */
   volatile uint32_t pending;   /* All interrupts received */
   emmc_error_t errors;         /* Error flags */
   emmc_error_t ignored_errors; /* Error flags that do not cause invalidation of
                                 * current state */
+  resource_t *dma;             /* DMA channel registers (NULL if unavailable) */
+  resource_t *dma_irq;         /* DMA channel interrupt */
+  condvar_t dma_done;          /* Used to wake up a thread waiting for DMA */
+  volatile bool dma_end;       /* DMA transfer has finished */
+  bcmdma_cb_t *dma_cb;         /* DMA control blocks (uncached memory) */
+  paddr_t dma_cb_pa;           /* Physical address of `dma_cb` */
 } bcmemmc_state_t;
 
 #define b_in bus_read_4
@@ -485,21 +495,182 @@ static emmc_error_t bcmemmc_send_cmd(device_t *cdev, emmc_cmd_t cmd,
   return bcmemmc_cmd_code(cdev->parent, code, arg, resp);
 }
 
+/*
+ * DMA transfers.
+ *
+ * Data port of the controller can be served by a channel of the BCM2835 DMA
+ * engine paced by the e.MMC DREQ signal. A buffer is described by a chain of
+ * control blocks, one per physically contiguous range of pages, so the data
+ * moves straight to or from the caller's memory while the thread sleeps.
+ * The engine is not coherent with CPU caches, so they're maintained by hand.
+ * Buffers that share a cache line with other data are transferred by the CPU,
+ * since invalidating such line would discard the neighbouring data.
+ */
+
+/* Number of control blocks that fit into a single page. */
+#define BCMEMMC_DMA_NCB (PAGESIZE / sizeof(bcmdma_cb_t))
+/* Shorter transfers are not worth setting up the DMA engine. */
+#define BCMEMMC_DMA_MINLEN 512
+
+static size_t bcmemmc_dcache_line(void) {
+  return CTR_DLINE_SIZE(READ_SPECIALREG(ctr_el0));
+}
+
+/* Writes back data cache lines covering given range, which must be aligned to
+ * cache line size. If `inv` is set, the lines are invalidated as well. */
+static void bcmemmc_dcache_sync(vaddr_t va, size_t len, bool inv) {
+  size_t line = bcmemmc_dcache_line();
+  vaddr_t end = va + len;
+
+  assert(is_aligned(va, line) && is_aligned(len, line));
+
+  for (; va < end; va += line) {
+    if (inv)
+      __asm __volatile("dc civac, %0" : : "r"(va) : "memory");
+    else
+      __asm __volatile("dc cvac, %0" : : "r"(va) : "memory");
+  }
+  __asm __volatile("dsb sy" : : : "memory");
+}
+
+/* Builds a chain of control blocks for a transfer between the data port and
+ * a buffer. Returns false if the buffer cannot be described. */
+static bool bcmemmc_dma_load(bcmemmc_state_t *state, vaddr_t va, size_t len,
+                             bool read) {
+  uint32_t port = BCM2835_PERIPH_BUSADDR(state->emmc->r_start + BCMEMMC_DATA);
+  uint32_t ti = TI_PERMAP(DREQ_EMMC) | TI_WAIT_RESP;
+  bcmdma_cb_t *cb = NULL;
+  unsigned n = 0;
+
+  ti |= read ? (TI_SRC_DREQ | TI_DEST_INC) : (TI_DEST_DREQ | TI_SRC_INC);
+
+  while (len > 0) {
+    size_t chunk = min(len, PAGESIZE - va % PAGESIZE);
+    paddr_t pa;
+
+    if (!pmap_kextract(va, &pa))
+      return false;
+
+    uint32_t addr = BCM2835_SDRAM_BUSADDR(pa);
+
+    if (cb && (read ? cb->dest_ad : cb->source_ad) + cb->txfr_len == addr) {
+      /* Page is physically contiguous with the previous one. */
+      cb->txfr_len += chunk;
+    } else {
+      if (n == BCMEMMC_DMA_NCB)
+        return false;
+      if (cb)
+        cb->nextconbk =
+          BCM2835_SDRAM_BUSADDR(state->dma_cb_pa + n * sizeof(bcmdma_cb_t));
+      cb = &state->dma_cb[n++];
+      cb->ti = ti;
+      cb->source_ad = read ? port : addr;
+      cb->dest_ad = read ? addr : port;
+      cb->txfr_len = chunk;
+      cb->stride = 0;
+      cb->nextconbk = 0;
+    }
+
+    va += chunk;
+    len -= chunk;
+  }
+
+  cb->ti |= TI_INTEN;
+  return true;
+}
+
+/* Runs the loaded chain of control blocks and sleeps until it's finished. */
+static emmc_error_t bcmemmc_dma_run(bcmemmc_state_t *state) {
+  resource_t *dma = state->dma;
+
+  SCOPED_MTX_LOCK(&state->lock);
+
+  state->dma_end = false;
+  b_out(dma, BCMDMA_CS, CS_INT | CS_END);
+  b_out(dma, BCMDMA_DEBUG, DEBUG_ERRORS);
+  b_out(dma, BCMDMA_CONBLK_AD, BCM2835_SDRAM_BUSADDR(state->dma_cb_pa));
+  b_out(dma, BCMDMA_CS, CS_ACTIVE | CS_WAIT_WRITES);
+
+  while (!state->dma_end) {
+    if (cv_wait_timed(&state->dma_done, &state->lock, BCMEMMC_TIMEOUT) &&
+        !state->dma_end) {
+      klog("e.MMC: DMA transfer timed out");
+      b_out(dma, BCMDMA_CS, CS_RESET);
+      return bcmemmc_set_error(state, EMMC_ERROR_TIMEOUT);
+    }
+  }
+
+  if (b_in(dma, BCMDMA_CS) & CS_ERROR) {
+    klog("e.MMC: DMA transfer failed (debug: 0x%x)", b_in(dma, BCMDMA_DEBUG));
+    b_out(dma, BCMDMA_CS, CS_RESET);
+    return bcmemmc_set_error(state, EMMC_ERROR_INTERNAL);
+  }
+
+  return 0;
+}
+
+/* Moves data between the data port and a buffer using DMA. Returns false if
+ * the transfer has to be done by the CPU instead. */
+static bool bcmemmc_dma_xfer(bcmemmc_state_t *state, void *buf, size_t len,
+                             bool read, emmc_error_t *errorp) {
+  vaddr_t va = (vaddr_t)buf;
+  size_t line = bcmemmc_dcache_line();
+
+  if (state->dma == NULL || len < BCMEMMC_DMA_MINLEN)
+    return false;
+
+  /* Cache maintenance must not touch data outside of the buffer. */
+  if (!is_aligned(va, line) || !is_aligned(len, line))
+    return false;
+
+  if (!bcmemmc_dma_load(state, va, len, read))
+    return false;
+
+  /* The engine must see current contents of the buffer and dirty lines must
+   * not be evicted over the data it writes. */
+  bcmemmc_dcache_sync(va, len, read);
+
+  *errorp = bcmemmc_dma_run(state);
+
+  /* Drop lines that could have been speculatively fetched in the meantime. */
+  if (read)
+    bcmemmc_dcache_sync(va, len, true);
+
+  return true;
+}
+
+static intr_filter_t bcmemmc_dma_intr_filter(void *data) {
+  bcmemmc_state_t *state = (bcmemmc_state_t *)data;
+  WITH_MTX_LOCK (&state->lock) {
+    if (!(b_in(state->dma, BCMDMA_CS) & CS_INT))
+      return IF_STRAY;
+    b_out(state->dma, BCMDMA_CS, CS_INT);
+    state->dma_end = true;
+    cv_signal(&state->dma_done);
+  }
+  return IF_FILTERED;
+}
+
 static emmc_error_t bcmemmc_read(device_t *cdev, void *buf, size_t len,
                                  size_t *read) {
   device_t *emmcdev = cdev->parent;
   bcmemmc_state_t *state = (bcmemmc_state_t *)emmcdev->state;
   resource_t *emmc = state->emmc;
   uint32_t *data = buf;
+  emmc_error_t error;
 
   assert(is_aligned(len, 4)); /* Assert multiple of 32 bits */
 
   if (bcmemmc_invalid_state(state))
     return bcmemmc_set_error(state, EMMC_ERROR_INVALID_STATE);
 
-  /* A very simple transfer (should be replaced with DMA in the future) */
-  for (size_t i = 0; i < len / sizeof(uint32_t); i++)
-    data[i] = b_in(emmc, BCMEMMC_DATA);
+  if (bcmemmc_dma_xfer(state, buf, len, true, &error)) {
+    if (error)
+      return error;
+  } else {
+    for (size_t i = 0; i < len / sizeof(uint32_t); i++)
+      data[i] = b_in(emmc, BCMEMMC_DATA);
+  }
 
   if (read)
     *read = len;
@@ -512,15 +683,20 @@ static emmc_error_t bcmemmc_write(device_t *cdev, const void *buf, size_t len,
   bcmemmc_state_t *state = (bcmemmc_state_t *)emmcdev->state;
   resource_t *emmc = state->emmc;
   const uint32_t *data = buf;
+  emmc_error_t error;
 
   assert(is_aligned(len, 4)); /* Assert multiple of 32 bits */
 
   if (bcmemmc_invalid_state(state))
     return bcmemmc_set_error(state, EMMC_ERROR_INVALID_STATE);
 
-  /* A very simple transfer (should be replaced with DMA in the future) */
-  for (size_t i = 0; i < len / sizeof(uint32_t); i++)
-    b_out(emmc, BCMEMMC_DATA, data[i]);
+  if (bcmemmc_dma_xfer(state, __UNCONST(buf), len, false, &error)) {
+    if (error)
+      return error;
+  } else {
+    for (size_t i = 0; i < len / sizeof(uint32_t); i++)
+      b_out(emmc, BCMEMMC_DATA, data[i]);
+  }
 
   if (wrote)
     *wrote = len;
@@ -600,6 +776,23 @@ static int bcmemmc_attach(device_t *dev) {
     (b_in(state->emmc, BCMEMMC_SLOTISR_VER) & HOST_SPEC_NUM) >>
     HOST_SPEC_NUM_SHIFT;
 
+  /* DMA channel is optional, data port is accessed by the CPU without it. */
+  if ((state->dma = device_take_memory(dev, 1))) {
+    if ((err = bus_map_resource(dev, state->dma)))
+      return err;
+
+    state->dma_cb =
+      (void *)kmem_alloc_contig(&state->dma_cb_pa, PAGESIZE, PMAP_NOCACHE);
+    cv_init(&state->dma_done, "e.MMC DMA completion wakeup");
+    b_out(state->dma, BCMDMA_CS, CS_RESET);
+
+    state->dma_irq = device_take_irq(dev, 1);
+    assert(state->dma_irq);
+    pic_setup_intr(dev, state->dma_irq, bcmemmc_dma_intr_filter, NULL, state,
+                   "e.MMC DMA interrupt");
+    klog("e.MMC: using DMA for data transfers");
+  }
+
   int error = bcmemmc_reset_internal(dev);
   if (error) {
     klog("e.MMC: initialzation failed with error flags %d.", error);
@@ -5,18 +5,21 @@
 #include <sys/devclass.h>
 #include <sys/fdt.h>
 #include <sys/libkern.h>
+#include <sys/pcpu.h>
+#include <sys/smp.h>
 #include <aarch64/armreg.h>
 #include <dev/bcm2835reg.h>
 #include <dev/simplebus.h>
 
 /*
  * located at BCM2836_ARM_LOCAL_BASE
- * 32 local interrupts -- one per CPU but now we only support 1 CPU
+ * 32 local interrupts per CPU -- sources are enabled on all CPUs at once,
+ * mailbox 0 of each CPU is used to deliver IPIs
  */
 
 typedef struct rootdev {
   resource_t mem_local; /* ARM local */
-  intr_event_t *intr_event[BCM2836_NIRQ];
+  intr_event_t *intr_event[BCM2836_INT_NLOCAL];
 } rootdev_t;
 
 #define in4(addr) bus_read_4(&rd->mem_local, (addr))
@@ -27,9 +30,10 @@ static void rootdev_enable_irq(intr_event_t *ie) {
   unsigned irq = ie->ie_irq;
   assert(irq < BCM2836_INT_NLOCAL);
 
-  /* TODO: fix needed for SMP. */
-  uint32_t irqctrl = in4(BCM2836_LOCAL_TIMER_IRQ_CONTROLN(0));
-  out4(BCM2836_LOCAL_TIMER_IRQ_CONTROLN(0), irqctrl | (1 << irq));
+  for (int cpu = 0; cpu < BCM2836_NCPUS; cpu++) {
+    uint32_t irqctrl = in4(BCM2836_LOCAL_TIMER_IRQ_CONTROLN(cpu));
+    out4(BCM2836_LOCAL_TIMER_IRQ_CONTROLN(cpu), irqctrl | (1 << irq));
+  }
 }
 
 static void rootdev_disable_irq(intr_event_t *ie) {
@@ -37,9 +41,10 @@ static void rootdev_disable_irq(intr_event_t *ie) {
   unsigned irq = ie->ie_irq;
   assert(irq < BCM2836_INT_NLOCAL);
 
-  /* TODO: fix needed for SMP. */
-  uint32_t irqctrl = in4(BCM2836_LOCAL_TIMER_IRQ_CONTROLN(0));
-  out4(BCM2836_LOCAL_TIMER_IRQ_CONTROLN(0), irqctrl & ~(1 << irq));
+  for (int cpu = 0; cpu < BCM2836_NCPUS; cpu++) {
+    uint32_t irqctrl = in4(BCM2836_LOCAL_TIMER_IRQ_CONTROLN(cpu));
+    out4(BCM2836_LOCAL_TIMER_IRQ_CONTROLN(cpu), irqctrl & ~(1 << irq));
+  }
 }
 
 static const char *rootdev_intr_name(int irq) {
@@ -66,11 +71,23 @@ static void rootdev_teardown_intr(device_t *pic, device_t *dev,
   intr_event_remove_handler(irq->r_handler);
 }
 
+static void rootdev_send_ipi(device_t *dev, int cpu) {
+  rootdev_t *rd = dev->state;
+  out4(BCM2836_LOCAL_MAILBOX0_SETN(cpu), 1);
+}
+
 static void rootdev_intr_handler(ctx_t *ctx, device_t *dev) {
   rootdev_t *rd = dev->state;
   intr_event_t **events = rd->intr_event;
-  /* TODO: fix needed for SMP. */
-  uint32_t pending = in4(BCM2836_LOCAL_INTC_IRQPENDINGN(0));
+  int cpu = PCPU_GET(cpuid);
+  uint32_t pending = in4(BCM2836_LOCAL_INTC_IRQPENDINGN(cpu));
+
+  if (pending & (1 << BCM2836_INT_MAILBOX0)) {
+    /* Acknowledge before handling, so that no IPI gets lost. */
+    out4(BCM2836_LOCAL_MAILBOX0_CLRN(cpu), ~0U);
+    smp_ipi_handler();
+    pending &= ~(1 << BCM2836_INT_MAILBOX0);
+  }
 
   while (pending) {
     unsigned irq = ffs(pending) - 1;
@@ -115,6 +132,11 @@ static int rootdev_attach(device_t *bus) {
 
   intr_root_claim(rootdev_intr_handler, bus);
 
+  /* Device interrupts are routed to CPU 0, IPIs can be received by any CPU. */
+  for (int cpu = 0; cpu < BCM2836_NCPUS; cpu++)
+    out4(BCM2836_LOCAL_MAILBOX_IRQ_CONTROLN(cpu), 1);
+  smp_ipi_claim(rootdev_send_ipi, bus);
+
   /*
    * Device enumeration.
    * TODO: this should be performed by a simplebus enumeration.
@@ -5,6 +5,8 @@
 #include <sys/interrupt.h>
 #include <sys/klog.h>
 #include <sys/libkern.h>
+#include <sys/pcpu.h>
+#include <sys/smp.h>
 #include <sys/timer.h>
 #include <riscv/cpufunc.h>
 #include <riscv/sbi.h>
@@ -13,7 +15,7 @@ typedef struct clint_state {
   timer_t mtimer;
   resource_t *mswi_irq;
   resource_t *mtimer_irq;
-  uint64_t mtimer_step;
+  uint64_t mtimer_step[MAXCPU]; /* period in ticks, 0 in one-shot mode */
 } clint_state_t;
 
 /*
@@ -25,10 +27,13 @@ static intr_filter_t mtimer_intr(void *data) {
   register_t sip = csr_read(sip);
 
   if (sip & SIP_STIP) {
-    tm_trigger(&clint->mtimer);
+    uint64_t step = clint->mtimer_step[PCPU_GET(cpuid)];
+
+    /* Setting the timer clears pending interrupt. It must be done before
+     * the callback, as it may reprogram the timer. */
+    sbi_set_timer(step ? rdtime() + step : UINT64_MAX);
 
-    uint64_t prev = rdtime();
-    sbi_set_timer(prev + clint->mtimer_step);
+    tm_trigger(&clint->mtimer);
 
     return IF_FILTERED;
   }
@@ -40,13 +45,21 @@ static int mtimer_start(timer_t *tm, unsigned flags, const bintime_t start,
                         const bintime_t period) {
   device_t *dev = tm->tm_priv;
   clint_state_t *clint = dev->state;
-  clint->mtimer_step = bintime_mul(period, tm->tm_frequency).sec;
 
-  pic_setup_intr(dev, clint->mtimer_irq, mtimer_intr, NULL, clint, "MTIMER");
+  /* The interrupt is private to each hart, so it's set up only once. */
+  if (!clint->mtimer_irq->r_handler)
+    pic_setup_intr(dev, clint->mtimer_irq, mtimer_intr, NULL, clint,
+                   "MTIMER");
 
   WITH_INTR_DISABLED {
-    uint64_t count = rdtime();
-    sbi_set_timer(count + clint->mtimer_step);
+    uint64_t *step = &clint->mtimer_step[PCPU_GET(cpuid)];
+    if (flags & TMF_ONESHOT) {
+      *step = 0;
+      sbi_set_timer(bintime_mul(start, tm->tm_frequency).sec);
+    } else {
+      *step = bintime_mul(period, tm->tm_frequency).sec;
+      sbi_set_timer(rdtime() + *step);
+    }
   }
 
   return 0;
@@ -72,8 +85,15 @@ static bintime_t mtimer_gettime(timer_t *tm) {
  * MSWI device.
  */
 
+/* Supervisor software interrupts are used solely to deliver IPIs. */
 static intr_filter_t mswi_intr(void *data) {
-  panic("Supervisor software interrupt!");
+  smp_ipi_handler();
+  return IF_FILTERED;
+}
+
+static void mswi_send_ipi(device_t *dev, int cpu) {
+  u_long mask = 1UL << _pcpu_data[cpu].hartid;
+  sbi_send_ipi(&mask);
 }
 
 /*
@@ -94,6 +114,7 @@ static int clint_attach(device_t *dev) {
   assert(clint->mtimer_irq);
 
   pic_setup_intr(dev, clint->mswi_irq, mswi_intr, NULL, NULL, "SSI");
+  smp_ipi_claim(mswi_send_ipi, dev);
 
   phandle_t cpus = FDT_finddevice("/cpus");
   if (cpus == FDT_NODEV)
@@ -106,7 +127,7 @@ static int clint_attach(device_t *dev) {
 
   clint->mtimer = (timer_t){
     .tm_name = "RISC-V CLINT",
-    .tm_flags = TMF_PERIODIC,
+    .tm_flags = TMF_PERIODIC | TMF_ONESHOT | TMF_PERCPU,
     .tm_frequency = freq,
     .tm_min_period = HZ2BT(freq),
     .tm_max_period = bintime_mul(HZ2BT(freq), (1LL << 32) - 1),
@@ -6,6 +6,7 @@
 
 #include <dev/evdev.h>
 #include <sys/devfs.h>
+#include <sys/callout.h>
 #include <sys/queue.h>
 #include <sys/mutex.h>
 #include <sys/devfs.h>
@@ -56,7 +56,6 @@ static uint32_t pci_bar_size(device_t *pcid, int bar, uint32_t *addr) {
                      cmd & ~(PCIM_CMD_MEMEN | PCIM_CMD_PORTEN));
 
   uint32_t old = pci_read_config_4(pcid, PCIR_BAR(bar));
-  /* XXX: we don't handle 64-bit memory space bars. */
 
   /* If we write 0xFFFFFFFF to a BAR register and then read
    * it back, we'll get a bar size indicator. */
@@ -160,6 +159,11 @@ void pci_bus_enumerate(device_t *pcib) {
           ioports_start = start + size;
         else
           mem_start = start + size;
+
+        /* XXX: we place 64-bit memory space bars below 4GiB, so the upper
+         * half of the address, held by the next bar, is simply cleared. */
+        if (type == RT_MEMORY && (addr & PCI_BAR_64BIT))
+          pci_write_config_4(dev, PCIR_BAR(++i), 0);
       }
       if (pcid->pin) {
         int irq = pci_route_interrupt(dev);
@@ -102,11 +102,12 @@ static void hlic_intr_handler(ctx_t *ctx, device_t *bus) {
   if (!ie)
     panic("Unknown HLIC interrupt %lx!", cause);
 
-  intr_event_run_handlers(ie);
-
-  /* Supervisor software interrupts are cleared directly through SIP. */
+  /* Supervisor software interrupts are cleared directly through SIP.
+   * It's done before running handlers, so that no IPI gets lost. */
   if (cause == HLIC_IRQ_SOFTWARE_SUPERVISOR)
-    csr_clear(sip, ~(1 << cause));
+    csr_clear(sip, 1 << cause);
+
+  intr_event_run_handlers(ie);
 }
 
 static int hlic_map_intr(device_t *pic, device_t *dev, phandle_t *intr,
@@ -16,14 +16,16 @@
 #include <sys/klog.h>
 #include <sys/vnode.h>
 #include <sys/devfs.h>
+#include <sys/bio.h>
+#include <sys/mutex.h>
 #include <dev/sd.h>
 #include <sys/fdt.h>
 
 typedef struct sd_state {
   sd_props_t props; /* SD Card's flags */
-  void *block_buf;  /* A buffer for reading data into */
   uint64_t csd[2];  /* Card-Specific Data register's content */
   uint16_t rca;     /* Relative Card Address */
+  mtx_t lock;       /* Serializes transfers issued by the buffer cache */
 } sd_state_t;
 
 static int sd_probe(device_t *dev) {
@@ -331,16 +333,12 @@ static int sd_write_blk(device_t *dev, uint32_t lba, void *buffer, uint32_t num,
   emmc_send_cmd(dev, write_blocks_cmd, addr, NULL);
   emmc_wait(dev, EMMC_I_WRITE_READY);
 
-  for (uint32_t c = 0; c < num; c++) {
-    if ((err = sd_sanity_check(dev)))
-      return err;
+  if ((err = sd_sanity_check(dev)))
+    return err;
 
-    if ((err = emmc_write(dev, buf, DEFAULT_BLKSIZE, NULL)))
-      return err;
-    buf += DEFAULT_BLKSIZE / sizeof(uint32_t);
-    if (wrote)
-      *wrote = *wrote + DEFAULT_BLKSIZE;
-  }
+  /* Pass all blocks at once, so the controller can use DMA. */
+  if ((err = emmc_write(dev, buf, num * DEFAULT_BLKSIZE, wrote)))
+    return err;
 
   emmc_wait(dev, EMMC_I_DATA_DONE);
   if (num > 1) {
@@ -352,62 +350,48 @@ static int sd_write_blk(device_t *dev, uint32_t lba, void *buffer, uint32_t num,
 }
 
 
-static inline int sd_check_uio(device_t *dev, uio_t *uio) {
-  sd_state_t *state = (sd_state_t *)dev->state;
-  if ((uint64_t)uio->uio_offset >= sd_capacity(state))
-    return EINVAL;
-  return 0;
-}
-
-static int sd_dop_uio(devnode_t *d, uio_t *uio) {
+/* Transfers a buffer cache block. Reads and writes are split into commands
+ * of at most SD_KERNEL_BLOCKS blocks that move data directly to or from
+ * the buffer. */
+static void sd_strategy(buf_t *bp) {
+  devnode_t *d = bp->b_dev;
   device_t *dev = d->data;
   sd_state_t *state = (sd_state_t *)dev->state;
-  int err;
+  uint64_t capacity = sd_capacity(state) / DEFAULT_BLKSIZE;
+  uint64_t lba = bp->b_blkno * (BIO_BSIZE / DEFAULT_BLKSIZE);
+  uint32_t blocks_left = bp->b_bcount / DEFAULT_BLKSIZE;
+  uint8_t *data = bp->b_data;
+  int err = 0;
 
-  if ((err = sd_check_uio(dev, uio)))
-    return err;
+  SCOPED_MTX_LOCK(&state->lock);
 
-  uint32_t lba = uio->uio_offset / DEFAULT_BLKSIZE;
-  uint32_t read_offset = lba * DEFAULT_BLKSIZE;
-  uint32_t copy_offset =  uio->uio_offset - read_offset;
-  uint32_t blk_cnt = (uio->uio_resid) / DEFAULT_BLKSIZE;
-  /* XXX: If there's a offset that causes the transfer to overlap with next
-   * block, we need to read that extra block as well. */
-  if (blk_cnt * DEFAULT_BLKSIZE < copy_offset + uio->uio_resid)
-    blk_cnt++;
-
-  uint32_t blocks_left = blk_cnt;
-  while (uio->uio_resid) {
-    /* We move from internal buffer, soe we need to change the offset to reflect
-    * that from our internal buffer */
-    uio->uio_offset = copy_offset;
+  if (lba >= capacity) {
+    bp->b_resid = bp->b_bcount;
+    biodone(bp, 0);
+    return;
+  }
+
+  /* The block crosses the end of the card. */
+  if (lba + blocks_left > capacity)
+    blocks_left = capacity - lba;
+  bp->b_resid = bp->b_bcount - blocks_left * DEFAULT_BLKSIZE;
+
+  while (blocks_left) {
     uint32_t num = min(blocks_left, (uint32_t)SD_KERNEL_BLOCKS);
-    uint32_t bytes_to_transfer =
-      min(uio->uio_resid, num * DEFAULT_BLKSIZE - copy_offset);
-
-    if (uio->uio_op == UIO_READ) {
-      if ((err = sd_read_blk(dev, lba, state->block_buf, num, NULL)))
-        return err;
-      if ((err = uiomove_frombuf(state->block_buf,
-          SD_KERNEL_BLOCKS * DEFAULT_BLKSIZE, uio)))
-        return err;
-    } else {
-      if (bytes_to_transfer % DEFAULT_BLKSIZE != 0) {
-        if ((err = sd_read_blk(dev, lba, state->block_buf, num, NULL)))
-          return err;
-      }
-      if ((err = uiomove_frombuf(state->block_buf,
-          SD_KERNEL_BLOCKS * DEFAULT_BLKSIZE, uio)))
-        return err;
-      if ((err = sd_write_blk(dev, lba, state->block_buf, num, NULL)))
-        return err;
-    }
-    copy_offset = 0;
+
+    if (bp->b_flags & B_READ)
+      err = sd_read_blk(dev, lba, data, num, NULL);
+    else
+      err = sd_write_blk(dev, lba, data, num, NULL);
+    if (err)
+      break;
+
+    data += num * DEFAULT_BLKSIZE;
     blocks_left -= num;
     lba += num;
   }
 
-  return 0;
+  biodone(bp, err);
 }
 
 static int sd_open(devnode_t *d, file_t *fp, int oflags) {
@@ -420,30 +404,21 @@ static int sd_open(devnode_t *d, file_t *fp, int oflags) {
 }
 
 static devops_t sd_devops = {
-  .d_type = DT_SEEKABLE,
+  .d_type = DT_DISK,
   .d_open = sd_open,
-  .d_read = sd_dop_uio,
-  .d_write = sd_dop_uio,
+  .d_strategy = sd_strategy,
 };
 
 static int sd_attach(device_t *dev) {
-  int err = 0;
   sd_state_t *state = (sd_state_t *)dev->state;
+  int err = 0;
 
-  state->block_buf = kmalloc(M_DEV, SD_KERNEL_BLOCKS * DEFAULT_BLKSIZE, 0);
+  mtx_init(&state->lock, 0);
 
   if ((err = sd_init(dev)))
-    goto sd_attach_fail;
-
-  if ((err = devfs_makedev_new(NULL, "sd_card", &sd_devops, dev, NULL)))
-    goto sd_attach_fail;
-
-  return err;
-
-sd_attach_fail:
-  kfree(M_DEV, state->block_buf);
+    return err;
 
-  return err;
+  return devfs_makedev_new(NULL, "sd_card", &sd_devops, dev, NULL);
 }
 
 static driver_t sd_block_device_driver = {
@@ -86,7 +86,7 @@ static int sb_get_region(device_t *dev, fdt_mem_reg_t *mrs, size_t *cntp) {
     pcell_t *tuple = &tuples[i * tuple_cells];
     fdt_mem_reg_t *mr = &mrs[i];
     if ((err = FDT_data_to_res(tuple, addr_cells, size_cells, &mr->addr,
-                               &mrs->size)))
+                               &mr->size)))
       goto end;
     if ((err = sb_soc_addr_to_cpu_addr(mr->addr, &mr->addr)))
       goto end;
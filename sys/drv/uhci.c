@@ -43,38 +43,29 @@ typedef struct uhci_state {
 } uhci_state_t;
 
 /*
- * For each transfer we need a contiguous memory range to compose appropriate
- * UCHI specific structures which state a USB transaction. Besides that,
- * a transfer also needs another contiguous span for I/O data to transfer.
- * To meet these requirements we supply two pools:
- * - `P_TFR`  - memory buffers for UHCI transfer constructs,
- * - `P_DATA` - memory buffers for I/O data to transfer.
+ * Each transfer is composed of a UHCI queue and a chain of UHCI transfer
+ * descriptors, one per USB packet. Each transfer descriptor is immediately
+ * followed by a buffer for I/O data of its packet, thus the size of a transfer
+ * is only limited by the number of available transfer descriptors.
+ * These constructs must reside in memory which the controller can access
+ * without a cache in the way. To meet these requirements we supply two pools,
+ * which also grow with uncached memory when they run out of items:
+ * - `P_QH` - UHCI queues,
+ * - `P_TD` - UHCI transfer descriptors along with their packet buffers.
  */
 
-#define UHCI_DATA_BUF_SIZE 512UL
+#define UHCI_MAX_PKTSIZE 64 /* max. packet size of low/full speed endpoints */
 
-/* Control transfer: SETUP + (device request + actual data) + STATUS. */
-#define UHCI_TFR_CTRL_MAX_TDS                                                  \
-  (2 + (UHCI_DATA_BUF_SIZE - sizeof(usb_dev_req_t)) / USB_MAX_IPACKET)
+#define UHCI_TD_BUF_SIZE (sizeof(uhci_td_t) + UHCI_MAX_PKTSIZE)
 
-/* DATA transfer: actual data. */
-#define UHCI_TFR_DATA_MAX_TDS (UHCI_DATA_BUF_SIZE / USB_MAX_IPACKET)
+#define UHCI_QH_POOL_SIZE PAGESIZE
 
-#define UHCI_TFR_MAX_TDS max(UHCI_TFR_CTRL_MAX_TDS, UHCI_TFR_DATA_MAX_TDS)
-#define UHCI_TFR_BUF_SIZE                                                      \
-  (sizeof(uhci_qh_t) + UHCI_TFR_MAX_TDS * sizeof(uhci_td_t))
+#define UHCI_TD_POOL_SIZE (32 * PAGESIZE)
 
-#define UHCI_MAX_NREQS 15 /* maximum number of scheduled request */
-
-#define UHCI_DATA_POOL_SIZE (UHCI_MAX_NREQS * UHCI_DATA_BUF_SIZE)
-
-#define UHCI_TFR_POOL_SIZE (UHCI_MAX_NREQS * UHCI_TFR_BUF_SIZE)
-
-#define UHCI_ALIGNMENT max(UHCI_TD_ALIGN, UHCI_QH_ALIGN)
-
-static POOL_DEFINE(P_TFR, "UHCI transfer buffers", UHCI_TFR_BUF_SIZE,
-                   UHCI_ALIGNMENT);
-static POOL_DEFINE(P_DATA, "UHCI data buffers", UHCI_DATA_BUF_SIZE);
+static POOL_DEFINE(P_QH, "UHCI queues", sizeof(uhci_qh_t), UHCI_QH_ALIGN,
+                   .flags = POOL_DMA);
+static POOL_DEFINE(P_TD, "UHCI transfer descriptors", UHCI_TD_BUF_SIZE,
+                   UHCI_TD_ALIGN, .flags = POOL_DMA);
 
 /*
  * How do we manage the UHCI frame list?
@@ -143,34 +134,37 @@ static POOL_DEFINE(P_DATA, "UHCI data buffers", UHCI_DATA_BUF_SIZE);
  *
  * How do we build a UHCI transfer?
  *
- * For each transfer we need a buffer for UHCI constructs and a buffer
- * for I/O data. The former contains a single UHCI queue followed by
- * a number of UHCI transfer descriptors. These describe a UHCI transfer.
- * Each transfer descriptor contains a pointer which points to some location
- * in the I/O data buffer.
+ * A transfer is described by a single UHCI queue. The queue's element link
+ * pointer points at a chain of transfer descriptors. Each transfer descriptor
+ * points at the packet buffer which follows it in memory. Transfer descriptors
+ * are allocated one by one, so the chain may span any number of pages.
  *
  * Conceptual drawing:
  *
- *         transfer buffer                           data I/O buffer
- *        (UHCI constructs)                 (buffer for data/bytes to transfer)
- *                              `qh_data`
- *   start ---------------           -------> start ---------------
- *         |             |          /               |             |
- *         |    queue    |---------/                |             |
- *         |             |                          |             |
- *         ---------------                          |             |
- *         |   transfer  |      `td_buffer`         |             |
- *         |  descriptor |------------------------> |             |
- *         |     #0      |                          |  row data   |
- *         ---------------                          |    stram    |
- *         |             |                          |             |
- *               ...                                      ...
- *         |             |                          |             |
- *         ---------------      `td_buffer`         |             |
- *         |   transfer  |         ---------------> |             |
- *         |  descriptor |--------/                 |             |
- *         |     #n      |                          |             |
- *     end ---------------                          ---------------
+ *      ---------------
+ *      |    queue    |
+ *      ---------------
+ *             |  `qh_e_next`
+ *             v
+ *      ---------------  `td_next`  ---------------             ---------------
+ *      |   transfer  | ----------> |   transfer  | --> ... --> |   transfer  |
+ *      |  descriptor |             |  descriptor |             |  descriptor |
+ *      |     #0      |             |     #1      |             |     #n      |
+ *      ---------------             ---------------             ---------------
+ *      |   packet    |             |   packet    |             |   packet    |
+ *      |    data     |             |    data     |             |    data     |
+ *      ---------------             ---------------             ---------------
+ *
+ *
+ * How do we keep multiple transfers to an endpoint in flight?
+ *
+ * The controller must not work on two transfers to the same endpoint at once,
+ * since packets of the latter could overtake packets of the former. Hence a
+ * transfer issued while another transfer to the same endpoint is scheduled
+ * is inserted into the main queue halted (i.e. pending). It's started as soon
+ * as the preceding transfer finishes, without waiting for the device driver.
+ * Data toggles are assigned to packets on insertion, so that they continue
+ * where the previous transfer to the endpoint has left off.
  */
 
 /*
@@ -234,26 +228,25 @@ static uhci_physaddr_t uhci_physaddr(void *vaddr) {
  * Transfer descriptor handling functions.
  */
 
+/* Return the packet buffer of a transfer descriptor. */
+static inline void *td_buf(uhci_td_t *td) {
+  return td + 1;
+}
+
 /*
  * Initialize a transfer descriptor.
  *
- * - `ioc` - UHCI_TD_IOC (Interrupt On Completion), or 0
  * - `token` - one of `UHCI_TD_{SETUP,OUT,IN}`
- * - `data`  - virtual address of an I/O buffer
  */
-static void td_init(uhci_td_t *td, usb_device_t *udev, uint32_t ioc,
-                    uint32_t token, void *data) {
+static void td_init(uhci_td_t *td, usb_device_t *udev, uint32_t token) {
   uint32_t ls = (udev->speed == USB_SPD_LOW ? UHCI_TD_LS : 0);
 
-  bzero(td, sizeof(uhci_td_t));
-  /* Consecutive transfer descriptors are always contiguous.
-   * Note: we assume that only the last transfer descriptor in a transfer
-   * will trigger IOC. */
-  td->td_next =
-    (ioc ? UHCI_PTR_T : uhci_physaddr(td + 1) | UHCI_PTR_VF | UHCI_PTR_TD);
-  td->td_status = UHCI_TD_SET_ERRCNT(3) | ioc | ls | UHCI_TD_ACTIVE;
+  /* The transfer descriptor is the last one until another one is appended. */
+  td->td_next = UHCI_PTR_T;
+  td->td_status = UHCI_TD_SET_ERRCNT(3) | ls | UHCI_TD_ACTIVE;
   td->td_token = token;
-  td->td_buffer = (data ? uhci_physaddr(data) : 0);
+  td->td_buffer = uhci_physaddr(td_buf(td));
+  td->td_vnext = NULL;
 }
 
 /* Create a SETUP transfer descriptor. */
@@ -261,9 +254,8 @@ static void td_setup(uhci_td_t *td, usb_device_t *udev, usb_endpt_t *endpt,
                      usb_dev_req_t *req) {
   uint32_t token =
     UHCI_TD_SETUP(sizeof(usb_dev_req_t), endpt->addr, udev->addr);
-  /* A SETUP packet is always the first packet of a transfer, thus
-   * no Interrupt On Competion is used. */
-  td_init(td, udev, 0, token, req);
+  memcpy(td_buf(td), req, sizeof(usb_dev_req_t));
+  td_init(td, udev, token);
 }
 
 /* Compose a DATA IN/DATA OUT token. */
@@ -278,20 +270,20 @@ static uint32_t td_data_token(uint8_t dev_addr, uint8_t endpt_addr,
 
 /* Create a DATA IN/DATA OUT transfer descriptor. */
 static void td_data(uhci_td_t *td, usb_device_t *udev, usb_endpt_t *endpt,
-                    uint32_t ioc, uint16_t pktsize, uint8_t data_toggle,
-                    void *data) {
+                    uint16_t pktsize, uint8_t data_toggle, void *data) {
   uint32_t token =
     td_data_token(udev->addr, endpt->addr, endpt->dir, pktsize, data_toggle);
-  td_init(td, udev, ioc, token, data);
+  /* Copyin data to transfer. */
+  if (endpt->dir == USB_DIR_OUTPUT)
+    memcpy(td_buf(td), data, pktsize);
+  td_init(td, udev, token);
 }
 
 /* Create a STATUS transfer descriptor. */
 static void td_status(uhci_td_t *td, usb_device_t *udev, usb_endpt_t *endpt,
-                      uint16_t transfer_size, usb_direction_t dir) {
+                      usb_direction_t dir) {
   uint32_t token = td_data_token(udev->addr, endpt->addr, dir, 0, 1);
-  /* A SETUP packet is always the last packet of a control transfer, thus
-   * an Interrupt On Competion shuld be triggered at the end. */
-  td_init(td, udev, UHCI_TD_IOC, token, NULL);
+  td_init(td, udev, token);
 }
 
 /* Discard all errors and mark a transfer descriptor as to be executed. */
@@ -303,7 +295,12 @@ static void td_reactivate(uhci_td_t *td) {
 
 /* Chect whether a transfer descriptor is the last one in a transfer. */
 static inline bool td_last(uhci_td_t *td) {
-  return td->td_next & UHCI_PTR_T;
+  return td->td_vnext == NULL;
+}
+
+/* Return the number of bytes a transfer descriptor is meant to move. */
+static inline uint16_t td_length(uhci_td_t *td) {
+  return UHCI_TD_GET_MAXLEN(td->td_token);
 }
 
 /*
@@ -316,41 +313,65 @@ static inline void qh_add_td(uhci_qh_t *qh, uhci_td_t *td) {
   qh->qh_e_next = uhci_physaddr(td) | UHCI_PTR_TD;
 }
 
-/* Return a pointer to the first transfer descriptor composing `qh`. */
-static inline uhci_td_t *qh_first_td(uhci_qh_t *qh) {
-  return (uhci_td_t *)(qh + 1);
-}
-
-/* Initialize a regular (i.e. not main) queue. */
-static void qh_init(uhci_qh_t *qh, usb_buf_t *buf) {
+/* Allocate a new regular (i.e. not main) queue. */
+static uhci_qh_t *qh_alloc(usb_buf_t *buf) {
+  uhci_qh_t *qh = pool_alloc(P_QH, M_ZERO);
   qh->qh_h_next = UHCI_PTR_T;
   qh->qh_e_next = UHCI_PTR_T;
   qh->qh_buf = buf;
-  qh_add_td(qh, qh_first_td(qh));
+  return qh;
 }
 
-/* Allocate a new queue (including transfer I/O data buffer). */
-static uhci_qh_t *qh_alloc(usb_buf_t *buf) {
-  uhci_qh_t *qh = pool_alloc(P_TFR, M_ZERO);
-  qh_init(qh, buf);
-  qh->qh_data = pool_alloc(P_DATA, M_ZERO);
-  return qh;
+/* Allocate a transfer descriptor and append it to the queue's chain after
+ * `last`, or make it the first one if `last` is NULL. */
+static uhci_td_t *qh_append_td(uhci_qh_t *qh, uhci_td_t *last) {
+  uhci_td_t *td = pool_alloc(P_TD, M_ZERO);
+
+  if (!last) {
+    qh->qh_tds = td;
+    qh_add_td(qh, td);
+  } else {
+    /* Execute the transfer descriptors depth first. */
+    last->td_next = uhci_physaddr(td) | UHCI_PTR_VF | UHCI_PTR_TD;
+    last->td_vnext = td;
+  }
+
+  return td;
 }
 
-/* Release a queue (including transfer I/O data buffer). */
+/* Release a queue (including its transfer descriptors). */
 static void qh_free(uhci_qh_t *qh) {
-  void *data = qh->qh_data;
-  assert(data);
-  pool_free(P_DATA, data);
-  pool_free(P_TFR, qh);
+  uhci_td_t *td = qh->qh_tds;
+
+  while (td) {
+    uhci_td_t *next = td->td_vnext;
+    pool_free(P_TD, td);
+    td = next;
+  }
+  pool_free(P_QH, qh);
+}
+
+/* Return a pointer to the last transfer descriptor composing `qh`. */
+static uhci_td_t *qh_last_td(uhci_qh_t *qh) {
+  uhci_td_t *td = qh->qh_tds;
+  while (!td_last(td))
+    td = td->td_vnext;
+  return td;
 }
 
 /* Return `true` if the trnasfer corresponding to `qh` has been executrd. */
 static bool qh_executed(uhci_qh_t *qh) {
-  uhci_td_t *td = qh_first_td(qh);
-  while (!td_last(td))
-    td++;
-  return !(td->td_status & UHCI_TD_ACTIVE);
+  return !(qh_last_td(qh)->td_status & UHCI_TD_ACTIVE);
+}
+
+/* Assign consecutive data toggles to packets of `qh` starting from `toggle`.
+ * Returns the data toggle of a packet which would follow the transfer. */
+static uint8_t qh_set_toggle(uhci_qh_t *qh, uint8_t toggle) {
+  for (uhci_td_t *td = qh->qh_tds; td; td = td->td_vnext, toggle ^= 1) {
+    td->td_token &= ~UHCI_TD_SET_DT(1);
+    td->td_token |= UHCI_TD_SET_DT(toggle);
+  }
+  return toggle;
 }
 
 /* Initialize a main queue. */
@@ -387,8 +408,24 @@ static inline void qh_unhalt(uhci_qh_t *qh) {
 static void qh_insert(uhci_qh_t *mq, uhci_qh_t *qh) {
   SCOPED_MTX_LOCK(&mq->qh_lock);
 
+  usb_endpt_t *endpt = qh->qh_buf->endpt;
   uhci_qh_t *last = TAILQ_LAST(&mq->qh_list, qh_list);
 
+  /* Control transfers use fixed data toggles. */
+  if (endpt->transfer != USB_TFR_CONTROL)
+    endpt->toggle = qh_set_toggle(qh, endpt->toggle);
+
+  /* If another transfer to the endpoint is scheduled,
+   * then the queue has to wait for its turn. */
+  uhci_qh_t *other;
+  TAILQ_FOREACH (other, &mq->qh_list, qh_link) {
+    if (other->qh_buf->endpt == endpt) {
+      qh->qh_pending = true;
+      qh_halt(qh);
+      break;
+    }
+  }
+
   TAILQ_INSERT_TAIL(&mq->qh_list, qh, qh_link);
 
   /* If we're inserting the first queue,
@@ -404,6 +441,16 @@ static void qh_remove(uhci_qh_t *mq, uhci_qh_t *qh) {
   assert(mtx_owned(&mq->qh_lock));
 
   uhci_qh_t *prev = TAILQ_PREV(qh, qh_list, qh_link);
+  uhci_qh_t *next = qh;
+
+  /* Start the next transfer to the same endpoint (if any). */
+  while ((next = TAILQ_NEXT(next, qh_link))) {
+    if (next->qh_buf->endpt == qh->qh_buf->endpt) {
+      next->qh_pending = false;
+      qh_unhalt(next);
+      break;
+    }
+  }
 
   TAILQ_REMOVE(&mq->qh_list, qh, qh_link);
 
@@ -419,28 +466,57 @@ static void qh_remove(uhci_qh_t *mq, uhci_qh_t *qh) {
 static uint32_t qh_error_status(uhci_qh_t *qh) {
   uint32_t error = 0;
 
-  for (uhci_td_t *td = qh_first_td(qh); !td_last(td); td++)
+  for (uhci_td_t *td = qh->qh_tds; td; td = td->td_vnext)
     if ((error = td->td_status & UHCI_TD_ERROR))
       break;
 
   return error;
 }
 
-/* Remove the specified queue from the pointed main queue and reclaim
- * UHCI buffers associated with the queue. */
-static void qh_discard(uhci_qh_t *mq, uhci_qh_t *qh) {
-  assert(mtx_owned(&mq->qh_lock));
-  qh_remove(mq, qh);
-  qh_free(qh);
-}
-
 /* Set a queue to be executed. */
 static void qh_reactivate(uhci_qh_t *qh) {
-  uhci_td_t *td = qh_first_td(qh);
-  qh_add_td(qh, td);
-  do {
+  usb_endpt_t *endpt = qh->qh_buf->endpt;
+
+  /* Data toggles continue after the last packet of the previous run. */
+  endpt->toggle = qh_set_toggle(qh, endpt->toggle);
+
+  for (uhci_td_t *td = qh->qh_tds; td; td = td->td_vnext)
     td_reactivate(td);
-  } while (!td_last(td++));
+  qh_add_td(qh, qh->qh_tds);
+}
+
+/* Gather data received by the transfer identified by queue `qh`.
+ * Returns a pointer to contiguous data, or NULL for output transfers. */
+static void *qh_input_data(uhci_qh_t *qh) {
+  usb_buf_t *buf = qh->qh_buf;
+
+  if (buf->endpt->dir != USB_DIR_INPUT)
+    return NULL;
+
+  /* Periodic transfers consist of a single packet. */
+  if (usb_buf_periodic(buf))
+    return td_buf(qh->qh_tds);
+
+  uint8_t *dst = buf->data;
+  uint8_t *end = dst + buf->transfer_size;
+  for (uhci_td_t *td = qh->qh_tds; td; td = td->td_vnext) {
+    if (UHCI_TD_GET_PID(td->td_token) != UHCI_TD_PID_IN)
+      continue;
+    /* Packets that haven't been executed carry no data. */
+    if (td->td_status & UHCI_TD_ACTIVE)
+      break;
+    uint16_t len = min(UHCI_TD_GET_ACTLEN(td->td_status), td_length(td));
+    memcpy(dst, td_buf(td), len);
+    dst += len;
+    /* A short packet ends the transfer. */
+    if (len < td_length(td))
+      break;
+  }
+
+  /* Don't hand over stale contents of the buffer if less data arrived. */
+  bzero(dst, end - dst);
+
+  return buf->data;
 }
 
 /*
@@ -479,17 +555,15 @@ static void uhci_init_frames(uhci_state_t *uhci) {
 
 /* Supply a contiguous physical memory for further buffer allocation. */
 static void uhci_init_pool(void) {
-  const size_t tfr_pool_asize = roundup2(UHCI_TFR_POOL_SIZE, PAGESIZE);
-  assert(powerof2(tfr_pool_asize));
-  void *tfr_pool =
-    (void *)kmem_alloc_contig(NULL, tfr_pool_asize, PMAP_NOCACHE);
-  pool_add_page(P_TFR, tfr_pool, tfr_pool_asize);
+  assert(powerof2(UHCI_QH_POOL_SIZE));
+  void *qh_pool =
+    (void *)kmem_alloc_contig(NULL, UHCI_QH_POOL_SIZE, PMAP_NOCACHE);
+  pool_add_page(P_QH, qh_pool, UHCI_QH_POOL_SIZE);
 
-  const size_t data_pool_asize = roundup2(UHCI_DATA_POOL_SIZE, PAGESIZE);
-  assert(powerof2(data_pool_asize));
-  void *data_pool =
-    (void *)kmem_alloc_contig(NULL, data_pool_asize, PMAP_NOCACHE);
-  pool_add_page(P_DATA, data_pool, data_pool_asize);
+  assert(powerof2(UHCI_TD_POOL_SIZE));
+  void *td_pool =
+    (void *)kmem_alloc_contig(NULL, UHCI_TD_POOL_SIZE, PMAP_NOCACHE);
+  pool_add_page(P_TD, td_pool, UHCI_TD_POOL_SIZE);
 }
 
 /*
@@ -512,10 +586,16 @@ static usb_error_t uhcie2usbe(uint32_t error) {
   return uerr;
 }
 
-/* Process the transfer identified by queue `qh`. */
-static void uhci_process(uhci_state_t *uhci, uhci_qh_t *mq, uhci_qh_t *qh) {
+/* Process the transfer identified by queue `qh`. Returns `true` if the
+ * transfer has finished, in which case the queue has been removed from `mq`
+ * and has to be passed to `uhci_complete`. */
+static bool uhci_process(uhci_state_t *uhci, uhci_qh_t *mq, uhci_qh_t *qh) {
   assert(mtx_owned(&mq->qh_lock));
 
+  /* The transfer waits for an earlier transfer to the endpoint. */
+  if (qh->qh_pending)
+    return false;
+
   qh_halt(qh);
 
   usb_buf_t *buf = qh->qh_buf;
@@ -523,30 +603,37 @@ static void uhci_process(uhci_state_t *uhci, uhci_qh_t *mq, uhci_qh_t *qh) {
   /* Obtain the queue's status. */
   uint32_t error = qh_error_status(qh);
 
-  /* If an error has occured, signal the error and discard the transfer. */
-  if (error) {
-    usb_error_t uerr = uhcie2usbe(error);
-    usb_buf_process(buf, NULL, uerr);
-    qh_discard(mq, qh);
-    return;
-  }
-
   /* If the transfer isn't done yet, we'll come back to it later. */
-  if (!qh_executed(qh)) {
+  if (!error && !qh_executed(qh)) {
     qh_unhalt(qh);
-    return;
+    return false;
   }
 
-  /* Let the USB bus layer handle the received data. */
-  usb_buf_process(buf, qh->qh_data, 0);
-
   /* If this is a periodic transfer we have to reactivate it. */
-  if (usb_buf_periodic(buf)) {
+  if (!error && usb_buf_periodic(buf)) {
+    /* Let the USB bus layer handle the received data. */
+    usb_buf_process(buf, qh_input_data(qh), 0);
     /* Adding a transfer descriptor will unhalt the queue automatically. */
     qh_reactivate(qh);
-  } else {
-    qh_discard(mq, qh);
+    return false;
   }
+
+  qh_remove(mq, qh);
+  return true;
+}
+
+/* Let the USB bus layer handle the outcome of a finished transfer
+ * and reclaim UHCI constructs associated with the transfer. */
+static void uhci_complete(uhci_qh_t *qh) {
+  usb_buf_t *buf = qh->qh_buf;
+  uint32_t error = qh_error_status(qh);
+
+  if (error)
+    usb_buf_process(buf, NULL, uhcie2usbe(error));
+  else
+    usb_buf_process(buf, qh_input_data(qh), 0);
+
+  qh_free(qh);
 }
 
 /* UHCI Interrupt Service Routine. */
@@ -572,19 +659,29 @@ static intr_filter_t uhci_isr(void *data) {
 
 static void uhci_service(void *data) {
   uhci_state_t *uhci = data;
+  uhci_qh_list_t done = TAILQ_HEAD_INITIALIZER(done);
+  uhci_qh_t *qh, *next;
 
   for (int i = 0; i < UHCI_NMAINQS; i++) {
     uhci_qh_t *mq = uhci->mainqs[i];
     /* Travers each main queue to find the delinquent. */
     WITH_MTX_LOCK (&mq->qh_lock) {
-      uhci_qh_t *qh, *next;
-      TAILQ_FOREACH_SAFE (qh, &mq->qh_list, qh_link, next)
-        uhci_process(uhci, mq, qh);
+      TAILQ_FOREACH_SAFE (qh, &mq->qh_list, qh_link, next) {
+        if (uhci_process(uhci, mq, qh))
+          TAILQ_INSERT_TAIL(&done, qh, qh_link);
+      }
       /* Unhalt only non-empty main queues. */
       if (!TAILQ_EMPTY(&mq->qh_list))
         qh_unhalt(mq);
     }
   }
+
+  /* Complete finished transfers with no main queue lock held,
+   * so that completion callbacks are free to issue new transfers. */
+  while ((qh = TAILQ_FIRST(&done))) {
+    TAILQ_REMOVE(&done, qh, qh_link);
+    uhci_complete(qh);
+  }
 }
 
 /* Schedule a queue for execution in `flr(log(interval))` ms. */
@@ -601,24 +698,24 @@ static void uhci_schedule(uhci_state_t *uhci, uhci_qh_t *qh, uint8_t interval) {
 /*
  * Setup the data stage of a transaction.
  *
- * - `td`   - address of the first transfer descriptor to fill,
- * - `toggle` - firs data toggle to grant,
- * - `data`   - pointer to the I/O data.
+ * - `td`     - transfer descriptor to append the data stage to, or NULL,
+ * - `toggle` - firs data toggle to grant.
  *
- * Returns pointer to the next available transfer descriptor.
+ * Returns pointer to the last transfer descriptor of the transaction.
  */
 static uhci_td_t *uhci_data_stage(usb_device_t *udev, usb_buf_t *buf,
-                                  uhci_td_t *td, uint16_t toggle, void *data) {
+                                  uhci_qh_t *qh, uhci_td_t *td,
+                                  uint8_t toggle) {
   usb_endpt_t *endpt = buf->endpt;
+  uint8_t *data = buf->data;
 
-  /* Copyin data to transfer. */
-  if (endpt->dir == USB_DIR_OUTPUT)
-    memcpy(data, buf->data, buf->transfer_size);
+  assert(endpt->maxpkt <= UHCI_MAX_PKTSIZE);
 
   /* Prepare DATA packets. */
   for (uint16_t nbytes = 0; nbytes != buf->transfer_size; toggle ^= 1) {
     uint16_t pktsize = min(buf->transfer_size - nbytes, endpt->maxpkt);
-    td_data(td++, udev, endpt, 0, pktsize, toggle, data);
+    td = qh_append_td(qh, td);
+    td_data(td, udev, endpt, pktsize, toggle, data);
     nbytes += pktsize;
     data += pktsize;
   }
@@ -630,45 +727,44 @@ static uhci_td_t *uhci_data_stage(usb_device_t *udev, usb_buf_t *buf,
 static void uhci_control_transfer(device_t *hcdev, device_t *dev,
                                   usb_buf_t *buf, usb_dev_req_t *req,
                                   usb_direction_t status_dir) {
-  assert(buf->transfer_size + sizeof(usb_dev_req_t) <= UHCI_DATA_BUF_SIZE);
-
   uhci_state_t *uhci = hcdev->state;
   usb_device_t *udev = usb_device_of(dev);
   usb_endpt_t *endpt = buf->endpt;
   uhci_qh_t *qh = qh_alloc(buf);
 
-  /* Copyin the USB device request at the end of the data buffer. */
-  void *req_cpy = qh->qh_data + buf->transfer_size;
-  memcpy(req_cpy, req, sizeof(usb_dev_req_t));
-
   /* Prepare a SETUP packet. */
-  uhci_td_t *td = qh_first_td(qh);
-  td_setup(td, udev, endpt, req_cpy);
+  uhci_td_t *td = qh_append_td(qh, NULL);
+  td_setup(td, udev, endpt, req);
 
   /* Preapre the data stage. */
-  td = uhci_data_stage(udev, buf, td + 1, 1, qh->qh_data);
+  td = uhci_data_stage(udev, buf, qh, td, 1);
 
-  /* Prepare a STATUS packet. */
-  td_status(td, udev, endpt, buf->transfer_size, status_dir);
+  /* Prepare a STATUS packet. A STATUS packet is always the last packet of
+   * a control transfer, thus an Interrupt On Completion should be triggered
+   * at the end. */
+  td = qh_append_td(qh, td);
+  td_status(td, udev, endpt, status_dir);
+  td->td_status |= UHCI_TD_IOC;
 
   uhci_schedule(uhci, qh, 0);
 }
 
 /* Issue a data stage only transfer. */
 static void uhci_data_transfer(device_t *hcdev, device_t *dev, usb_buf_t *buf) {
-  assert(buf->transfer_size <= UHCI_DATA_BUF_SIZE);
-
   uhci_state_t *uhci = hcdev->state;
   usb_device_t *udev = usb_device_of(dev);
   usb_endpt_t *endpt = buf->endpt;
+
+  assert(buf->transfer_size);
+  /* An interrupt endpoint moves a single packet per service interval. */
+  assert(!usb_buf_periodic(buf) || buf->transfer_size <= endpt->maxpkt);
+
   uhci_qh_t *qh = qh_alloc(buf);
 
-  /* Preapre the data stage. */
-  uhci_td_t *td = uhci_data_stage(udev, buf, qh_first_td(qh), 0, qh->qh_data);
+  /* Preapre the data stage. Data toggles are assigned by `qh_insert`. */
+  uhci_td_t *td = uhci_data_stage(udev, buf, qh, NULL, 0);
 
   /* The last transfer descriptor has to finish the transfer. */
-  td--;
-  td->td_next = UHCI_PTR_T;
   td->td_status |= UHCI_TD_IOC;
 
   uhci_schedule(uhci, qh, endpt->interval);
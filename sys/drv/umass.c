@@ -12,12 +12,14 @@
  *     https://manuals.plus/wp-content/sideloads/seagate-scsi-commands-reference-manual-optimized.pdf
  */
 #define KL_LOG KL_DEV
+#include <sys/bio.h>
 #include <sys/devclass.h>
 #include <sys/devfs.h>
 #include <sys/device.h>
 #include <sys/endian.h>
 #include <sys/klog.h>
 #include <sys/libkern.h>
+#include <sys/mutex.h>
 #include <dev/scsi.h>
 #include <dev/usb.h>
 #include <dev/umass.h>
@@ -25,8 +27,19 @@
 
 /* We assume that block size >= 512. */
 #define UMASS_MIN_BLOCK_SIZE 512
+/* Max. number of bytes moved by a single READ (10) or WRITE (10) command. */
+#define UMASS_MAX_XFER (64 * 1024)
+/* Max. number of bytes moved by a single bulk transfer of the data phase. */
+#define UMASS_MAX_TFR_SIZE (16 * 1024U)
+/* Max. number of bulk transfers of the data phase kept in flight. */
+#define UMASS_MAX_NTFRS (UMASS_MAX_XFER / UMASS_MAX_TFR_SIZE)
 
 typedef struct umass_state {
+  mtx_t lock;                           /* serializes commands */
+  mtx_t tfr_lock;                       /* guards `tfr_pending` */
+  condvar_t tfr_done;                   /* all data transfers have finished */
+  unsigned tfr_pending;                 /* number of data transfers in flight */
+  usb_buf_t *tfr_bufs[UMASS_MAX_NTFRS]; /* buffers for data transfers */
   uint32_t next_tag;                    /* next CBS tag to grant */
   uint32_t nblocks;                     /* number of available blocks */
   uint32_t block_size;                  /* size of a single block */
@@ -142,7 +155,8 @@ static inline bool csw_valid_p(umass_bbb_csw_t *csw, uint32_t expected_tag) {
 }
 
 /* Status transport is described in (1) 5.3.3. */
-static int csw_receive(device_t *dev, uint32_t expected_tag, usb_buf_t *buf) {
+static int csw_receive(device_t *dev, uint32_t expected_tag, usb_buf_t *buf,
+                       uint32_t *residuep) {
   umass_bbb_csw_t csw;
   int error = 0;
 
@@ -169,6 +183,9 @@ static int csw_receive(device_t *dev, uint32_t expected_tag, usb_buf_t *buf) {
     goto bad;
   }
 
+  if (residuep)
+    *residuep = csw.dCSWDataResidue;
+
   return (csw.bCSWStatus == CSWSTATUS_GOOD) ? 0 : EIO;
 
 bad:
@@ -176,13 +193,64 @@ bad:
   return error;
 }
 
+/*
+ * Data phase handling functions.
+ */
+
+/* Called by the host controller when a data phase transfer finishes. */
+static void umass_tfr_done(usb_buf_t *buf) {
+  umass_state_t *umass = buf->done_arg;
+
+  SCOPED_MTX_LOCK(&umass->tfr_lock);
+  if (--umass->tfr_pending == 0)
+    cv_signal(&umass->tfr_done);
+}
+
+/* Data transport is described in (1) 5.3.2. The data is split into bulk
+ * transfers, up to `UMASS_MAX_NTFRS` of which are issued at once, so that
+ * the host controller can move on to the next one without waiting for us. */
+static int umass_data_phase(device_t *dev, usb_direction_t dir, void *data,
+                            uint32_t size) {
+  umass_state_t *umass = dev->state;
+  int error = 0;
+
+  while (size && !error) {
+    unsigned ntfrs = min(howmany(size, UMASS_MAX_TFR_SIZE), UMASS_MAX_NTFRS);
+
+    WITH_MTX_LOCK (&umass->tfr_lock)
+      umass->tfr_pending = ntfrs;
+
+    for (unsigned i = 0; i < ntfrs; i++) {
+      uint16_t tfrsize = min(size, UMASS_MAX_TFR_SIZE);
+      usb_data_transfer(dev, umass->tfr_bufs[i], data, tfrsize, USB_TFR_BULK,
+                        dir);
+      data += tfrsize;
+      size -= tfrsize;
+    }
+
+    WITH_MTX_LOCK (&umass->tfr_lock) {
+      while (umass->tfr_pending)
+        cv_wait(&umass->tfr_done, &umass->tfr_lock);
+    }
+
+    for (unsigned i = 0; i < ntfrs; i++)
+      if (umass->tfr_bufs[i]->error)
+        error = EIO;
+  }
+
+  return error;
+}
+
 /*
  * Bulk-Only transfer functions.
  */
 
-/* Command/Data/Status protocol transfers are described in (1) 5.  */
+/* Command/Data/Status protocol transfers are described in (1) 5.
+ * If `residuep` is not NULL, it's set to the number of bytes which were not
+ * transferred, as reported by the device. */
 static int umass_transfer(device_t *dev, void *cmd, uint8_t cmdsize,
-                          usb_direction_t dir, void *data, uint32_t size) {
+                          usb_direction_t dir, void *data, uint32_t size,
+                          uint32_t *residuep) {
 
   umass_state_t *umass = dev->state;
   usb_buf_t *buf = usb_buf_alloc();
@@ -203,26 +271,15 @@ static int umass_transfer(device_t *dev, void *cmd, uint8_t cmdsize,
    * Data transfer phase.
    */
 
-  /* Transfer data using block size units. */
-  for (uint32_t nbytes = 0; nbytes != size;) {
-    uint32_t tfrsize = min(size, umass->block_size);
-
-    usb_data_transfer(dev, buf, data, tfrsize, USB_TFR_BULK, dir);
-    if ((error = usb_buf_wait(buf))) {
-      /* If we encounter an error in the data phase,
-       * we still need to receive a CSW. */
-      break;
-    }
-
-    nbytes += tfrsize;
-    data += tfrsize;
-  }
+  /* If we encounter an error in the data phase,
+   * we still need to receive a CSW. */
+  error = umass_data_phase(dev, dir, data, size);
 
   /*
    * Command Status Block phase.
    */
 
-  csw_error = csw_receive(dev, tag, buf);
+  csw_error = csw_receive(dev, tag, buf, residuep);
 
 end:
   usb_buf_free(buf);
@@ -243,7 +300,7 @@ static int umass_inquiry(device_t *dev) {
   int error = 0;
 
   if ((error = umass_transfer(dev, &inq, sizeof(scsi_inquiry_t), USB_DIR_INPUT,
-                              &inq_data, SHORT_INQUIRY_LENGTH)))
+                              &inq_data, SHORT_INQUIRY_LENGTH, NULL)))
     return error;
 
   /* We only handle direct access block devices (i.e. command set SBC-3). */
@@ -273,7 +330,7 @@ static int umass_request_sense(device_t *dev) {
   /* XXX: in the future, some recovery logic may be needed.
    * FTTB, simply performing the command is sufficient. */
   return umass_transfer(dev, &sen, sizeof(scsi_request_sense_t), USB_DIR_INPUT,
-                        &sen_data, sizeof(scsi_sense_data_t));
+                        &sen_data, sizeof(scsi_sense_data_t), NULL);
 }
 
 /*
@@ -295,7 +352,7 @@ static int umass_read_capacity(device_t *dev) {
   for (i = 0; i < READ_CAPACITY_MAX_ITR; i++) {
     /* Try to issue the read capacity command. */
     if (!umass_transfer(dev, &cap, sizeof(scsi_read_capacity_t), USB_DIR_INPUT,
-                        &cap_data, sizeof(scsi_read_capacity_data_t)))
+                        &cap_data, sizeof(scsi_read_capacity_data_t), NULL))
       break;
 
     /* We've failed. Let's perform the request sense command. */
@@ -325,65 +382,64 @@ static int umass_read_capacity(device_t *dev) {
  * Device node interface.
  */
 
-static inline usb_direction_t uioop_to_usbdir(uio_op_t op) {
-  switch (op) {
-    case UIO_READ:
-      return USB_DIR_INPUT;
-    case UIO_WRITE:
-      return USB_DIR_OUTPUT;
-    default:
-      panic("Invalid UIO operation!");
-  }
-}
-
-static int umass_op(devnode_t *node, uio_t *uio) {
-  device_t *dev = node->data;
+/* Transfers a run of buffer cache blocks, each spanning one or more logical
+ * blocks. Data moves directly to or from the buffer, in commands of at most
+ * UMASS_MAX_XFER bytes. */
+static void umass_strategy(buf_t *bp) {
+  device_t *dev = bp->b_dev->data;
   umass_state_t *umass = dev->state;
-  usb_direction_t dir = uioop_to_usbdir(uio->uio_op);
+  usb_direction_t dir =
+    (bp->b_flags & B_READ) ? USB_DIR_INPUT : USB_DIR_OUTPUT;
   uint32_t block_size = umass->block_size;
+  uint64_t start = bp->b_blkno * (BIO_BSIZE / block_size);
+  uint32_t nblocks = bp->b_bcount / block_size;
+  uint32_t maxblocks = UMASS_MAX_XFER / block_size;
+  uint8_t *data = bp->b_data;
   int error = 0;
 
-  if (!is_aligned(uio->uio_offset, block_size))
-    return EINVAL;
-  if (!is_aligned(uio->uio_resid, block_size))
-    return EINVAL;
+  SCOPED_MTX_LOCK(&umass->lock);
 
-  uint32_t start = uio->uio_offset / block_size;
-  uint32_t nblocks = uio->uio_resid / block_size;
-  uint32_t size = nblocks * block_size;
+  if (start >= umass->nblocks) {
+    bp->b_resid = bp->b_bcount;
+    biodone(bp, 0);
+    return;
+  }
 
-  /* NOTE: we assume that number of blocks to read is <= `UINT16_MAX`. */
-  if (nblocks > UINT16_MAX)
-    return EINVAL;
+  /* The transfer crosses the end of the drive. */
+  if (start + nblocks > umass->nblocks)
+    nblocks = umass->nblocks - start;
+  bp->b_resid = bp->b_bcount - nblocks * block_size;
+
+  while (nblocks > 0) {
+    uint32_t n = min(nblocks, maxblocks);
+    uint32_t residue;
+
+    scsi_rw_10_t rw10 = (scsi_rw_10_t){
+      .opcode = (dir == USB_DIR_INPUT) ? READ_10 : WRITE_10,
+      .addr = htobe32(start),
+      .length = htobe16(n),
+    };
+    if ((error = umass_transfer(dev, &rw10, sizeof(scsi_rw_10_t), dir, data,
+                                n * block_size, &residue)))
+      break;
 
-  void *buf = kmalloc(M_DEV, size, M_WAITOK);
+    /* A block device must not transfer less than it has been asked for. */
+    if (residue) {
+      error = EIO;
+      break;
+    }
 
-  if (dir == USB_DIR_OUTPUT) {
-    if ((error = uiomove(buf, uio->uio_resid, uio)))
-      goto end;
+    start += n;
+    data += n * block_size;
+    nblocks -= n;
   }
 
-  scsi_rw_10_t rw10 = (scsi_rw_10_t){
-    .opcode = (dir == USB_DIR_INPUT) ? READ_10 : WRITE_10,
-    .addr = htobe32(start),
-    .length = htobe16(nblocks),
-  };
-  error = umass_transfer(dev, &rw10, sizeof(scsi_rw_10_t), dir, buf, size);
-  if (error)
-    goto end;
-
-  if (dir == USB_DIR_INPUT)
-    error = uiomove_frombuf(buf, size, uio);
-
-end:
-  kfree(M_DEV, buf);
-  return error;
+  biodone(bp, error);
 }
 
 static devops_t umass_devops = {
-  .d_type = DT_SEEKABLE, /* TODO: should be `DT_DISK`. */
-  .d_read = umass_op,
-  .d_write = umass_op,
+  .d_type = DT_DISK,
+  .d_strategy = umass_strategy,
 };
 
 /*
@@ -420,10 +476,22 @@ static int umass_attach(device_t *dev) {
   /* Set the initial block size. */
   umass_state_t *umass = dev->state;
   umass->block_size = UMASS_MIN_BLOCK_SIZE;
+  mtx_init(&umass->lock, 0);
+  mtx_init(&umass->tfr_lock, 0);
+  cv_init(&umass->tfr_done, "umass data phase");
+
+  for (unsigned i = 0; i < UMASS_MAX_NTFRS; i++) {
+    usb_buf_t *buf = usb_buf_alloc();
+    buf->done = umass_tfr_done;
+    buf->done_arg = umass;
+    umass->tfr_bufs[i] = buf;
+  }
 
   /* Identify the connected device. */
-  if ((error = umass_inquiry(dev)))
-    return ENXIO;
+  if ((error = umass_inquiry(dev))) {
+    error = ENXIO;
+    goto fail;
+  }
 
   /*
    * After receiving a successful inquiry transfer,
@@ -431,15 +499,31 @@ static int umass_attach(device_t *dev) {
    */
 
   /* Obtain the number and length of the logical blocks. */
-  if ((error = umass_read_capacity(dev)))
-    return ENXIO;
+  if ((error = umass_read_capacity(dev))) {
+    error = ENXIO;
+    goto fail;
+  }
+
+  /* Buffer cache blocks must consist of whole logical blocks. */
+  if (umass->block_size > BIO_BSIZE || BIO_BSIZE % umass->block_size) {
+    error = ENXIO;
+    goto fail;
+  }
 
   umass_print(dev);
 
   /* Prepare /dev/umass interface. */
-  devfs_makedev_new(NULL, "umass", &umass_devops, dev, NULL);
+  devnode_t *node;
+  if ((error = devfs_makedev_new(NULL, "umass", &umass_devops, dev, &node)))
+    goto fail;
+  node->size = (size_t)umass->nblocks * umass->block_size;
 
   return 0;
+
+fail:
+  for (unsigned i = 0; i < UMASS_MAX_NTFRS; i++)
+    usb_buf_free(umass->tfr_bufs[i]);
+  return error;
 }
 
 static driver_t umass_driver = {
@@ -57,6 +57,8 @@ static const char *dir_info[] = {
 static const char *speed_info[] = {
   [USB_SPD_LOW] = "low",
   [USB_SPD_FULL] = "full",
+  [USB_SPD_HIGH] = "high",
+  [USB_SPD_SUPER] = "super",
 };
 
 /*
@@ -132,26 +134,30 @@ int usb_buf_wait(usb_buf_t *buf) {
 }
 
 void usb_buf_process(usb_buf_t *buf, void *data, usb_error_t error) {
-  SCOPED_MTX_LOCK(&buf->lock);
-
-  if (error) {
-    buf->error |= error;
-    goto end;
-  }
+  WITH_MTX_LOCK (&buf->lock) {
+    if (error) {
+      buf->error |= error;
+      cv_signal(&buf->cv);
+      break;
+    }
 
-  void *dst = buf->data;
-  usb_endpt_t *endpt = buf->endpt;
-  if (endpt->dir == USB_DIR_INPUT) {
-    /* In case of periodic transfers, copy the data
-     * to the internal buffer first. */
-    if (usb_buf_periodic(buf))
-      dst = buf->priv;
-    memcpy(dst, data, buf->transfer_size);
+    void *dst = buf->data;
+    usb_endpt_t *endpt = buf->endpt;
+    if (endpt->dir == USB_DIR_INPUT) {
+      /* In case of periodic transfers, copy the data
+       * to the internal buffer first. */
+      if (usb_buf_periodic(buf))
+        dst = buf->priv;
+      if (dst != data)
+        memcpy(dst, data, buf->transfer_size);
+    }
+    buf->executed = 1;
+    cv_signal(&buf->cv);
   }
-  buf->executed = 1;
 
-end:
-  cv_signal(&buf->cv);
+  /* The callback may issue another transfer using `buf`. */
+  if (buf->done)
+    buf->done(buf);
 }
 
 /*
@@ -282,23 +288,15 @@ static int usb_send_req(device_t *dev, void *data, usb_direction_t dir,
   return error;
 }
 
-/* Obtain device descriptor corresponding to device `dev`. */
-static int usb_get_dev_dsc(device_t *dev, usb_dev_dsc_t *devdsc) {
+/* Obtain the first `len` bytes of device descriptor
+ * corresponding to device `dev`. */
+static int usb_get_dev_dsc(device_t *dev, usb_dev_dsc_t *devdsc, uint16_t len) {
   usb_dev_req_t req = (usb_dev_req_t){
     .bmRequestType = UT_READ_DEVICE,
     .bRequest = UR_GET_DESCRIPTOR,
     .wValue = UV_MAKE(UDESC_DEVICE, 0),
-    .wLength = sizeof(uint8_t),
+    .wLength = len,
   };
-
-  /* The actual size of the descriptor is contained in the first byte,
-   * hence we'll read it first. */
-  int error = usb_send_req(dev, devdsc, USB_DIR_INPUT, &req, NULL);
-  if (error)
-    return error;
-
-  /* Get the whole descriptor. */
-  req.wLength = devdsc->bLength;
   return usb_send_req(dev, devdsc, USB_DIR_INPUT, &req, NULL);
 }
 
@@ -374,8 +372,8 @@ static int usb_get_config(device_t *dev, usb_cfg_dsc_t *cfgdsc) {
   if (error)
     return error;
 
-  /* Read the whole configuration. */
-  req.wLength = cfgdsc->wTotalLength;
+  /* Read the whole configuration, or as much of it as fits. */
+  req.wLength = min(cfgdsc->wTotalLength, (uint16_t)USB_MAX_CONFIG_SIZE);
   return usb_send_req(dev, cfgdsc, USB_DIR_INPUT, &req, NULL);
 }
 
@@ -403,7 +401,12 @@ int usb_unhalt_endpt(device_t *dev, usb_transfer_t transfer,
     .wValue = UF_ENDPOINT_HALT,
     .wIndex = endpt->addr,
   };
-  return usb_send_req(dev, NULL, USB_DIR_OUTPUT, &req, NULL);
+  int error = usb_send_req(dev, NULL, USB_DIR_OUTPUT, &req, NULL);
+
+  /* Clearing the halt feature resets the endpoint's data toggle. */
+  if (!error)
+    endpt->toggle = 0;
+  return error;
 }
 
 /* Retreive deivice's string language descriptor. */
@@ -707,10 +710,32 @@ static void usb_print_dev(device_t *dev) {
 static int usb_identify(device_t *dev) {
   usb_device_t *udev = usb_device_of(dev);
   usb_dev_dsc_t *devdsc = kmalloc(M_DEV, sizeof(usb_dev_dsc_t), M_ZERO);
-  int error = usb_get_dev_dsc(dev, devdsc);
+
+  /* The initial part of the descriptor fits in a single packet
+   * and tells us the max packet size of endpoint zero. */
+  int error = usb_get_dev_dsc(dev, devdsc, USB_MAX_IPACKET);
   if (error)
     goto end;
 
+  /* Update endpoint zero's max packet size. Super speed devices
+   * report it as an exponent of 2. */
+  uint16_t maxpkt = devdsc->bMaxPacketSize;
+  if (udev->speed == USB_SPD_SUPER)
+    maxpkt = 1 << maxpkt;
+  usb_endpt_t *endpt = usb_dev_ctrl_endpt(udev, USB_DIR_INPUT);
+  endpt->maxpkt = maxpkt;
+  endpt = usb_dev_ctrl_endpt(udev, USB_DIR_OUTPUT);
+  endpt->maxpkt = maxpkt;
+
+  /* Assign a unique address to the device. */
+  if ((error = usb_set_addr(dev)))
+    goto end;
+
+  /* Get the whole descriptor. */
+  uint16_t len = min(devdsc->bLength, sizeof(usb_dev_dsc_t));
+  if ((error = usb_get_dev_dsc(dev, devdsc, len)))
+    goto end;
+
   /* If `bDeviceClass` field is 0, the class, subclass, and protocol codes
    * should be retreived form an interface descriptor. */
   if (devdsc->bDeviceClass) {
@@ -719,19 +744,9 @@ static int usb_identify(device_t *dev) {
     udev->protocol_code = devdsc->bDeviceProtocol;
   }
 
-  /* Update endpoint zero's max packet size. */
-  usb_endpt_t *endpt = usb_dev_ctrl_endpt(udev, USB_DIR_INPUT);
-  endpt->maxpkt = devdsc->bMaxPacketSize;
-  endpt = usb_dev_ctrl_endpt(udev, USB_DIR_OUTPUT);
-  endpt->maxpkt = devdsc->bMaxPacketSize;
-
   udev->vendor_id = devdsc->idVendor;
   udev->product_id = devdsc->idProduct;
 
-  /* Assign a unique address to the device. */
-  if ((error = usb_set_addr(dev)))
-    goto end;
-
   /* Check whether the device supports English before reading any
    * string descriptors. */
   if ((error = usb_english_support(dev)))
@@ -761,11 +776,29 @@ static usb_endpt_dsc_t *usb_if_endpt_dsc(usb_if_dsc_t *ifdsc) {
 }
 
 /* Process each endpoint implemented by interface `ifdsc`
- * within device `udev`. */
-static void usb_if_process_endpts(usb_if_dsc_t *ifdsc, usb_device_t *udev) {
-  usb_endpt_dsc_t *endptdsc = usb_if_endpt_dsc(ifdsc);
+ * within device `udev`. Configuration descriptors end at `cfgend`.
+ * Returns EINVAL if the descriptors are malformed. */
+static int usb_if_process_endpts(usb_if_dsc_t *ifdsc, void *cfgend,
+                                 usb_device_t *udev) {
+  void *dsc = usb_if_endpt_dsc(ifdsc);
+  uint8_t i = 0;
+
+  while (i < ifdsc->bNumEndpoints) {
+    usb_endpt_dsc_t *endptdsc = dsc;
+
+    /* Each descriptor begins with its length and type. */
+    if (dsc + 2 > cfgend || endptdsc->bLength < 2 ||
+        dsc + endptdsc->bLength > cfgend)
+      return EINVAL;
+    dsc += endptdsc->bLength;
+
+    /* Skip other descriptors, e.g. super speed endpoint companions. */
+    if (endptdsc->bDescriptorType != UDESC_ENDPOINT)
+      continue;
+    if (endptdsc->bLength < sizeof(usb_endpt_dsc_t))
+      return EINVAL;
+    i++;
 
-  for (uint8_t i = 0; i < ifdsc->bNumEndpoints; i++, endptdsc++) {
     /* Obtain endpoint's address. */
     uint8_t addr = UE_GET_ADDR(endptdsc->bEndpointAddress);
 
@@ -783,6 +816,8 @@ static void usb_if_process_endpts(usb_if_dsc_t *ifdsc, usb_device_t *udev) {
                                          transfer, dir, endptdsc->bInterval);
     TAILQ_INSERT_TAIL(&udev->endpts, endpt, link);
   }
+
+  return 0;
 }
 
 /* Move device `dev` form addressed to configured state. Layout of device
@@ -815,7 +850,10 @@ static int usb_configure(device_t *dev) {
     return error;
 
   /* Process each supplied endpoint. */
-  usb_if_process_endpts(ifdsc, udev);
+  void *cfgend = (void *)cfgdsc + min(cfgdsc->wTotalLength,
+                                      (uint16_t)USB_MAX_CONFIG_SIZE);
+  if ((error = usb_if_process_endpts(ifdsc, cfgend, udev)))
+    return error;
 
   /* Move the device to the configured state. */
   error = usb_set_config(dev, cfgdsc->bConfigurationValue);
@@ -859,6 +897,7 @@ static int usb_enumerate_root_port(device_t *hcdev, uint8_t port) {
   usb_speed_t speed = usbhc_device_speed(hcdev, port);
   device_t *dev = usb_add_child(busdev, usb->next_addr, speed);
   usb_device_t *udev = usb_device_of(dev);
+  udev->port = port;
 
   if ((error = usb_identify(dev))) {
     klog("failed to identify the device at port %u", port);
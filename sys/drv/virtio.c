@@ -0,0 +1,301 @@
+/*
+ * Virtio legacy PCI transport and split virtqueues.
+ *
+ * For explanation of terms used throughout the code please see:
+ *
+ * - Virtual I/O Device (VIRTIO) Version 1.1, April 2019:
+ *     https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html
+ *
+ * Virtqueue memory is allocated uncached and the device accesses it
+ * concurrently with the driver, so the order of stores and loads is enforced
+ * with memory fences where the specification requires it.
+ *
+ * If VIRTIO_RING_F_INDIRECT_DESC was negotiated, each chain takes a single
+ * descriptor of the virtqueue, which points to a table of descriptors
+ * preallocated for that descriptor. Otherwise chains are built directly
+ * in the descriptor table.
+ *
+ * If VIRTIO_RING_F_EVENT_IDX was negotiated, both sides use event indices
+ * instead of flags to tell the other one when it wishes to be notified, which
+ * lets a batch of chains be published or consumed with a single notification.
+ */
+#define KL_LOG KL_DEV
+#include <sys/mimiker.h>
+#include <sys/bus.h>
+#include <sys/device.h>
+#include <sys/errno.h>
+#include <sys/klog.h>
+#include <sys/kmem.h>
+#include <sys/libkern.h>
+#include <sys/malloc.h>
+#include <sys/pmap.h>
+#include <dev/virtio.h>
+#include <dev/virtioreg.h>
+
+struct virtqueue {
+  virtio_dev_t *vd;     /* device owning the virtqueue */
+  unsigned index;       /* virtqueue number */
+  uint16_t size;        /* number of descriptors */
+  vring_desc_t *desc;   /* descriptor table */
+  vring_avail_t *avail; /* driver area */
+  vring_used_t *used;   /* device area */
+  void **cookie;        /* cookies of chains indexed by head descriptor */
+  uint16_t free_head;   /* first descriptor on the free list */
+  uint16_t nfree;       /* number of descriptors on the free list */
+  uint16_t avail_idx;   /* `avail->idx` after the next `virtq_publish` */
+  uint16_t last_avail;  /* `avail->idx` seen by the device */
+  uint16_t last_used;   /* next entry of `used->ring` to consume */
+  unsigned maxsegs;     /* max. length of a chain */
+  vring_desc_t *ind;    /* indirect descriptor tables (or NULL) */
+  paddr_t ind_pa;       /* physical address of `ind` */
+};
+
+#define vd_read_1(vd, o) bus_read_1((vd)->regs, (o))
+#define vd_read_2(vd, o) bus_read_2((vd)->regs, (o))
+#define vd_read_4(vd, o) bus_read_4((vd)->regs, (o))
+#define vd_write_1(vd, o, v) bus_write_1((vd)->regs, (o), (v))
+#define vd_write_2(vd, o, v) bus_write_2((vd)->regs, (o), (v))
+#define vd_write_4(vd, o, v) bus_write_4((vd)->regs, (o), (v))
+
+/* Event indices are placed right after the rings. */
+#define VQ_USED_EVENT(vq) ((vq)->avail->ring[(vq)->size])
+#define VQ_AVAIL_EVENT(vq)                                                     \
+  (*(volatile uint16_t *)&(vq)->used->ring[(vq)->size])
+
+static inline bool vd_has(virtio_dev_t *vd, uint32_t feature) {
+  return vd->features & feature;
+}
+
+/*
+ * Transport.
+ */
+
+static void virtio_set_status(virtio_dev_t *vd, uint8_t status) {
+  vd_write_1(vd, VIRTIO_PCI_STATUS, vd_read_1(vd, VIRTIO_PCI_STATUS) | status);
+}
+
+int virtio_pci_attach(virtio_dev_t *vd, device_t *dev) {
+  int err;
+
+  vd->dev = dev;
+  vd->regs = device_take_ioports(dev, 0);
+  if (!vd->regs)
+    return ENXIO;
+
+  if ((err = bus_map_resource(dev, vd->regs)))
+    return err;
+
+  /* Writing zero resets the device. */
+  vd_write_1(vd, VIRTIO_PCI_STATUS, 0);
+  virtio_set_status(vd, VIRTIO_STATUS_ACK);
+  virtio_set_status(vd, VIRTIO_STATUS_DRIVER);
+  return 0;
+}
+
+uint32_t virtio_negotiate(virtio_dev_t *vd, uint32_t wanted) {
+  vd->features = vd_read_4(vd, VIRTIO_PCI_HOST_FEATURES) & wanted;
+  vd_write_4(vd, VIRTIO_PCI_GUEST_FEATURES, vd->features);
+  return vd->features;
+}
+
+uint32_t virtio_read_config_4(virtio_dev_t *vd, unsigned off) {
+  return vd_read_4(vd, VIRTIO_PCI_CONFIG + off);
+}
+
+void virtio_driver_ok(virtio_dev_t *vd) {
+  virtio_set_status(vd, VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_failed(virtio_dev_t *vd) {
+  virtio_set_status(vd, VIRTIO_STATUS_FAILED);
+}
+
+uint8_t virtio_intr_status(virtio_dev_t *vd) {
+  return vd_read_1(vd, VIRTIO_PCI_ISR);
+}
+
+/*
+ * Virtqueues.
+ */
+
+virtqueue_t *virtq_alloc(virtio_dev_t *vd, unsigned index, unsigned maxsegs,
+                         unsigned *nchainsp) {
+  vd_write_2(vd, VIRTIO_PCI_QUEUE_SEL, index);
+  uint16_t size = vd_read_2(vd, VIRTIO_PCI_QUEUE_NUM);
+  if (size == 0 || vd_read_4(vd, VIRTIO_PCI_QUEUE_PFN))
+    return NULL;
+
+  /* Without indirect descriptors the longest chain must fit in the table. */
+  bool indirect = vd_has(vd, VIRTIO_RING_F_INDIRECT_DESC);
+  if (!indirect && size < maxsegs)
+    return NULL;
+
+  virtqueue_t *vq = kmalloc(M_DEV, sizeof(virtqueue_t), M_ZERO);
+  vq->vd = vd;
+  vq->index = index;
+  vq->size = size;
+  vq->maxsegs = maxsegs;
+  vq->cookie = kmalloc(M_DEV, sizeof(void *) * size, M_ZERO);
+
+  /* The device requires the rings to be physically contiguous. */
+  paddr_t pa;
+  size_t len = roundup(vring_size(size), PAGESIZE);
+  void *va = (void *)kmem_alloc_contig(&pa, len, PMAP_NOCACHE);
+  bzero(va, len);
+  vq->desc = va;
+  vq->avail = va + sizeof(vring_desc_t) * size;
+  vq->used = va + vring_used_offset(size);
+
+  if (indirect) {
+    len = roundup(sizeof(vring_desc_t) * maxsegs * size, PAGESIZE);
+    vq->ind = (void *)kmem_alloc_contig(&vq->ind_pa, len, PMAP_NOCACHE);
+    bzero(vq->ind, len);
+  }
+
+  /* Put all descriptors on the free list. */
+  for (unsigned i = 0; i < size; i++)
+    vq->desc[i].next = i + 1;
+  vq->nfree = size;
+
+  vd_write_4(vd, VIRTIO_PCI_QUEUE_PFN, pa >> VIRTIO_PCI_QUEUE_ADDR_SHIFT);
+
+  *nchainsp = indirect ? size : size / maxsegs;
+  klog("virtqueue %u: %u descriptors%s%s", index, size,
+       indirect ? ", indirect descriptors" : "",
+       vd_has(vd, VIRTIO_RING_F_EVENT_IDX) ? ", event index" : "");
+  return vq;
+}
+
+void virtq_free(virtqueue_t *vq) {
+  virtio_dev_t *vd = vq->vd;
+
+  /* The device must not access the rings once they're gone. */
+  vd_write_2(vd, VIRTIO_PCI_QUEUE_SEL, vq->index);
+  vd_write_4(vd, VIRTIO_PCI_QUEUE_PFN, 0);
+
+  if (vq->ind)
+    kmem_free(vq->ind,
+              roundup(sizeof(vring_desc_t) * vq->maxsegs * vq->size, PAGESIZE));
+  kmem_free(vq->desc, roundup(vring_size(vq->size), PAGESIZE));
+  kfree(M_DEV, vq->cookie);
+  kfree(M_DEV, vq);
+}
+
+/* Makes descriptor `d` point to segment `seg`. */
+static void virtq_fill(vring_desc_t *d, virtio_seg_t *seg, bool write) {
+  d->addr = seg->pa;
+  d->len = seg->len;
+  d->flags = write ? VRING_DESC_F_WRITE : 0;
+}
+
+void virtq_enqueue(virtqueue_t *vq, virtio_seg_t *segs, unsigned nout,
+                   unsigned nin, void *cookie) {
+  unsigned n = nout + nin;
+  uint16_t head = vq->free_head;
+
+  assert(n > 0 && n <= vq->maxsegs);
+
+  if (vq->ind) {
+    /* A single descriptor points to the table reserved for it. */
+    assert(vq->nfree > 0);
+    vring_desc_t *table = &vq->ind[head * vq->maxsegs];
+    for (unsigned i = 0; i < n; i++) {
+      virtq_fill(&table[i], &segs[i], i >= nout);
+      if (i + 1 < n) {
+        table[i].flags |= VRING_DESC_F_NEXT;
+        table[i].next = i + 1;
+      }
+    }
+
+    vring_desc_t *d = &vq->desc[head];
+    vq->free_head = d->next;
+    vq->nfree--;
+    d->addr = vq->ind_pa + (paddr_t)head * vq->maxsegs * sizeof(vring_desc_t);
+    d->len = n * sizeof(vring_desc_t);
+    d->flags = VRING_DESC_F_INDIRECT;
+  } else {
+    /* Free descriptors are already linked, so take first `n` of them. */
+    assert(vq->nfree >= n);
+    for (unsigned i = 0; i < n; i++) {
+      vring_desc_t *d = &vq->desc[vq->free_head];
+      virtq_fill(d, &segs[i], i >= nout);
+      if (i + 1 < n)
+        d->flags |= VRING_DESC_F_NEXT;
+      vq->free_head = d->next;
+    }
+    vq->nfree -= n;
+  }
+
+  vq->cookie[head] = cookie;
+  vq->avail->ring[vq->avail_idx++ % vq->size] = head;
+}
+
+void virtq_publish(virtqueue_t *vq) {
+  uint16_t old = vq->last_avail;
+  uint16_t new = vq->avail_idx;
+
+  if (old == new)
+    return;
+
+  /* Descriptors must be visible before the index that exposes them. */
+  atomic_thread_fence(memory_order_seq_cst);
+  vq->avail->idx = new;
+  vq->last_avail = new;
+
+  /* The index must be visible before we check if the device wants a kick. */
+  atomic_thread_fence(memory_order_seq_cst);
+
+  bool kick;
+  if (vd_has(vq->vd, VIRTIO_RING_F_EVENT_IDX))
+    kick = vring_need_event(VQ_AVAIL_EVENT(vq), new, old);
+  else
+    kick = !(vq->used->flags & VRING_USED_F_NO_NOTIFY);
+
+  if (kick)
+    vd_write_2(vq->vd, VIRTIO_PCI_QUEUE_NOTIFY, vq->index);
+}
+
+void *virtq_dequeue(virtqueue_t *vq, uint32_t *lenp) {
+  if (vq->last_used == vq->used->idx)
+    return NULL;
+
+  /* Read the used entry only after its index. */
+  atomic_thread_fence(memory_order_seq_cst);
+  volatile vring_used_elem_t *elem = &vq->used->ring[vq->last_used % vq->size];
+  uint16_t head = elem->id;
+  if (lenp)
+    *lenp = elem->len;
+  vq->last_used++;
+
+  /* Return the chain to the free list. */
+  uint16_t tail = head;
+  vq->nfree++;
+  while (vq->desc[tail].flags & VRING_DESC_F_NEXT) {
+    tail = vq->desc[tail].next;
+    vq->nfree++;
+  }
+  vq->desc[tail].next = vq->free_head;
+  vq->free_head = head;
+
+  void *cookie = vq->cookie[head];
+  vq->cookie[head] = NULL;
+  return cookie;
+}
+
+bool virtq_enable_intr(virtqueue_t *vq) {
+  if (vd_has(vq->vd, VIRTIO_RING_F_EVENT_IDX))
+    VQ_USED_EVENT(vq) = vq->last_used;
+  else
+    vq->avail->flags &= ~VRING_AVAIL_F_NO_INTERRUPT;
+
+  /* Catch chains used before the device could have noticed the change. */
+  atomic_thread_fence(memory_order_seq_cst);
+  return vq->used->idx == vq->last_used;
+}
+
+void virtq_disable_intr(virtqueue_t *vq) {
+  /* With event index the device interrupts only once after `used_event` has
+   * been passed, so it's enough not to move it forward. */
+  if (!vd_has(vq->vd, VIRTIO_RING_F_EVENT_IDX))
+    vq->avail->flags |= VRING_AVAIL_F_NO_INTERRUPT;
+}
@@ -0,0 +1,290 @@
+/*
+ * Virtio block device driver.
+ *
+ * For explanation of terms used throughout the code please see:
+ *
+ * - Virtual I/O Device (VIRTIO) Version 1.1, April 2019:
+ *     https://docs.oasis-open.org/virtio/virtio/v1.1/virtio-v1.1.html
+ *
+ * Requests are queued by `vtblk_strategy` and completed from the interrupt
+ * thread, so many of them may be in flight at once. Data moves directly to
+ * or from buffer cache pages, which virtio devices can always access.
+ */
+#define KL_LOG KL_DEV
+#include <sys/mimiker.h>
+#include <sys/bio.h>
+#include <sys/condvar.h>
+#include <sys/devclass.h>
+#include <sys/devfs.h>
+#include <sys/device.h>
+#include <sys/errno.h>
+#include <sys/interrupt.h>
+#include <sys/klog.h>
+#include <sys/kmem.h>
+#include <sys/libkern.h>
+#include <sys/mutex.h>
+#include <sys/pmap.h>
+#include <sys/vnode.h>
+#include <dev/pci.h>
+#include <dev/virtio.h>
+#include <dev/virtioreg.h>
+#include <dev/virtio_blkreg.h>
+
+/* Max. number of data segments: a cluster of buffer cache blocks is made of
+ * whole pages, but the buffer may start in the middle of a page. */
+#define VTBLK_MAX_DATA_SEGS (BIO_MAXCLUSTER * BIO_BSIZE / PAGESIZE + 1)
+/* Each request also has a header and a status segment. */
+#define VTBLK_MAX_SEGS (VTBLK_MAX_DATA_SEGS + 2)
+/* Max. number of requests in flight. */
+#define VTBLK_MAX_REQS 64
+
+#define VTBLK_FEATURES                                                         \
+  (VIRTIO_BLK_F_SIZE_MAX | VIRTIO_BLK_F_SEG_MAX |                              \
+   VIRTIO_RING_F_INDIRECT_DESC | VIRTIO_RING_F_EVENT_IDX)
+
+typedef struct vtblk_req {
+  virtio_blk_req_hdr_t hdr;    /* read by the device */
+  uint8_t status;              /* written by the device */
+  buf_t *bp;                   /* buffer being transferred */
+  SLIST_ENTRY(vtblk_req) link; /* entry on free list */
+} vtblk_req_t;
+
+typedef struct vtblk_state {
+  virtio_dev_t vd;                   /* transport */
+  virtqueue_t *vq;                   /* request queue */
+  resource_t *irq;                   /* interrupt line */
+  mtx_t lock;                        /* guards the fields below */
+  condvar_t req_cv;                  /* a request has been freed */
+  SLIST_HEAD(, vtblk_req) free_reqs; /* requests not in flight */
+  vtblk_req_t *reqs;                 /* requests (uncached memory) */
+  paddr_t reqs_pa;                   /* physical address of `reqs` */
+  uint32_t seg_size;                 /* max. size of a segment */
+  uint64_t nsectors;                 /* number of sectors of the disk */
+} vtblk_state_t;
+
+/* Obtain the physical address of `ptr` pointing into the request array. */
+static paddr_t vtblk_req_pa(vtblk_state_t *vtblk, void *ptr) {
+  return vtblk->reqs_pa + (ptr - (void *)vtblk->reqs);
+}
+
+/* Describes `len` bytes of kernel memory at `data` with segments of
+ * physically contiguous memory. Returns the number of segments. */
+static unsigned vtblk_map(vtblk_state_t *vtblk, void *data, size_t len,
+                          virtio_seg_t *segs) {
+  vaddr_t va = (vaddr_t)data;
+  unsigned n = 0;
+
+  while (len > 0) {
+    size_t chunk = min(len, PAGESIZE - (va & (PAGESIZE - 1)));
+    paddr_t pa;
+
+    if (!pmap_kextract(va, &pa))
+      panic("buffer at %p is not mapped", (void *)va);
+
+    if (n > 0 && segs[n - 1].pa + segs[n - 1].len == pa &&
+        segs[n - 1].len + chunk <= vtblk->seg_size)
+      segs[n - 1].len += chunk;
+    else
+      segs[n++] = (virtio_seg_t){.pa = pa, .len = chunk};
+
+    va += chunk;
+    len -= chunk;
+  }
+
+  assert(n <= VTBLK_MAX_DATA_SEGS);
+  return n;
+}
+
+/*
+ * Device node interface.
+ */
+
+/* Queues a request transferring a run of buffer cache blocks. The buffer
+ * is released by the interrupt thread once the device is done with it. */
+static void vtblk_strategy(buf_t *bp) {
+  device_t *dev = bp->b_dev->data;
+  vtblk_state_t *vtblk = dev->state;
+  uint64_t sector = bp->b_blkno * (BIO_BSIZE / VIRTIO_BLK_SECTOR_SIZE);
+  size_t len = bp->b_bcount;
+  bool read = bp->b_flags & B_READ;
+  virtio_seg_t segs[VTBLK_MAX_SEGS];
+  vtblk_req_t *req;
+
+  assert(len <= BIO_MAXCLUSTER * BIO_BSIZE);
+
+  if (sector >= vtblk->nsectors) {
+    bp->b_resid = bp->b_bcount;
+    biodone(bp, 0);
+    return;
+  }
+
+  /* The transfer crosses the end of the disk. */
+  if (sector + len / VIRTIO_BLK_SECTOR_SIZE > vtblk->nsectors)
+    len = (vtblk->nsectors - sector) * VIRTIO_BLK_SECTOR_SIZE;
+  bp->b_resid = bp->b_bcount - len;
+
+  unsigned ndata = vtblk_map(vtblk, bp->b_data, len, &segs[1]);
+
+  SCOPED_MTX_LOCK(&vtblk->lock);
+
+  while (!(req = SLIST_FIRST(&vtblk->free_reqs)))
+    cv_wait(&vtblk->req_cv, &vtblk->lock);
+  SLIST_REMOVE_HEAD(&vtblk->free_reqs, link);
+
+  req->hdr.type = read ? VIRTIO_BLK_T_IN : VIRTIO_BLK_T_OUT;
+  req->hdr.ioprio = 0;
+  req->hdr.sector = sector;
+  req->status = VIRTIO_BLK_S_IOERR;
+  req->bp = bp;
+
+  segs[0] = (virtio_seg_t){.pa = vtblk_req_pa(vtblk, &req->hdr),
+                           .len = sizeof(req->hdr)};
+  segs[ndata + 1] = (virtio_seg_t){.pa = vtblk_req_pa(vtblk, &req->status),
+                                   .len = sizeof(req->status)};
+
+  /* The device reads the header and writes the status. */
+  if (read)
+    virtq_enqueue(vtblk->vq, segs, 1, ndata + 1, req);
+  else
+    virtq_enqueue(vtblk->vq, segs, ndata + 1, 1, req);
+  virtq_publish(vtblk->vq);
+}
+
+static devops_t vtblk_devops = {
+  .d_type = DT_DISK,
+  .d_strategy = vtblk_strategy,
+};
+
+/*
+ * Interrupt handling.
+ */
+
+static intr_filter_t vtblk_isr(void *data) {
+  vtblk_state_t *vtblk = data;
+
+  /* Reading the status acknowledges the interrupt. */
+  uint8_t isr = virtio_intr_status(&vtblk->vd);
+  if (!isr)
+    return IF_STRAY;
+
+  /* Configuration changes (e.g. disk resize) are ignored. */
+  return (isr & VIRTIO_PCI_ISR_QUEUE) ? IF_DELEGATE : IF_FILTERED;
+}
+
+static void vtblk_service(void *data) {
+  vtblk_state_t *vtblk = data;
+  vtblk_req_t *req;
+
+  SCOPED_MTX_LOCK(&vtblk->lock);
+
+  virtq_disable_intr(vtblk->vq);
+
+  /* Complete all finished requests, including the ones that finish before
+   * the device notices that we want to be interrupted again. */
+  do {
+    while ((req = virtq_dequeue(vtblk->vq, NULL))) {
+      int error = (req->status == VIRTIO_BLK_S_OK) ? 0 : EIO;
+      biodone(req->bp, error);
+      req->bp = NULL;
+      SLIST_INSERT_HEAD(&vtblk->free_reqs, req, link);
+      cv_signal(&vtblk->req_cv);
+    }
+  } while (!virtq_enable_intr(vtblk->vq));
+}
+
+/*
+ * Driver interface implementation.
+ */
+
+static int vtblk_probe(device_t *dev) {
+  pci_device_t *pcid = pci_device_of(dev);
+
+  if (!pcid)
+    return 0;
+
+  return pci_device_match(pcid, VIRTIO_PCI_VENDORID, VIRTIO_PCI_DEVICEID_BLK);
+}
+
+static int vtblk_attach(device_t *dev) {
+  vtblk_state_t *vtblk = dev->state;
+  virtio_dev_t *vd = &vtblk->vd;
+  unsigned nreqs;
+  size_t size;
+  int err;
+
+  if ((err = virtio_pci_attach(vd, dev)))
+    return err;
+
+  uint32_t features = virtio_negotiate(vd, VTBLK_FEATURES);
+
+  /* Our requests must not exceed the limits of the device. */
+  vtblk->seg_size = UINT32_MAX;
+  if (features & VIRTIO_BLK_F_SIZE_MAX)
+    vtblk->seg_size = virtio_read_config_4(vd, VIRTIO_BLK_CFG_SIZE_MAX);
+  if (vtblk->seg_size < PAGESIZE ||
+      ((features & VIRTIO_BLK_F_SEG_MAX) &&
+       virtio_read_config_4(vd, VIRTIO_BLK_CFG_SEG_MAX) <
+         VTBLK_MAX_DATA_SEGS)) {
+    err = ENXIO;
+    goto fail;
+  }
+
+  vtblk->nsectors =
+    virtio_read_config_4(vd, VIRTIO_BLK_CFG_CAPACITY) |
+    (uint64_t)virtio_read_config_4(vd, VIRTIO_BLK_CFG_CAPACITY + 4) << 32;
+
+  if (!(vtblk->vq = virtq_alloc(vd, 0, VTBLK_MAX_SEGS, &nreqs))) {
+    err = ENXIO;
+    goto fail;
+  }
+  nreqs = min(nreqs, (unsigned)VTBLK_MAX_REQS);
+
+  mtx_init(&vtblk->lock, MTX_SLEEP);
+  cv_init(&vtblk->req_cv, "virtio-blk free request");
+
+  /* Headers and status bytes are accessed by the device. */
+  size = roundup(nreqs * sizeof(vtblk_req_t), PAGESIZE);
+  vtblk->reqs = (void *)kmem_alloc_contig(&vtblk->reqs_pa, size, PMAP_NOCACHE);
+  bzero(vtblk->reqs, size);
+  SLIST_INIT(&vtblk->free_reqs);
+  for (unsigned i = 0; i < nreqs; i++)
+    SLIST_INSERT_HEAD(&vtblk->free_reqs, &vtblk->reqs[i], link);
+
+  pci_enable_busmaster(dev);
+
+  vtblk->irq = device_take_irq(dev, 0);
+  assert(vtblk->irq);
+  pic_setup_intr(dev, vtblk->irq, vtblk_isr, vtblk_service, vtblk,
+                 "virtio-blk");
+
+  virtio_driver_ok(vd);
+
+  klog("virtio-blk: %llu sectors, %u requests in flight", vtblk->nsectors,
+       nreqs);
+
+  /* Prepare /dev/vtbd interface. */
+  devnode_t *node;
+  if ((err = devfs_makedev_new(NULL, "vtbd", &vtblk_devops, dev, &node)))
+    goto fail_intr;
+  node->size = vtblk->nsectors * VIRTIO_BLK_SECTOR_SIZE;
+
+  return 0;
+
+fail_intr:
+  pic_teardown_intr(dev, vtblk->irq);
+  virtq_free(vtblk->vq);
+  kmem_free(vtblk->reqs, size);
+fail:
+  virtio_failed(vd);
+  return err;
+}
+
+static driver_t vtblk_driver = {
+  .desc = "Virtio block device driver",
+  .size = sizeof(vtblk_state_t),
+  .pass = SECOND_PASS,
+  .probe = vtblk_probe,
+  .attach = vtblk_attach,
+};
+
+DEVCLASS_ENTRY(pci, vtblk_driver);
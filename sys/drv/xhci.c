@@ -0,0 +1,1115 @@
+/*
+ * xHCI host controller PCI driver.
+ *
+ * For explanation of terms used throughout the code
+ * please see the following documents:
+ *
+ * - eXtensible Host Controller Interface for Universal Serial Bus (xHCI),
+ *   Revision 1.2, May 2019:
+ *     https://www.intel.com/content/dam/www/public/us/en/documents/
+ *     technical-specifications/extensible-host-controler-interface-usb-xhci.pdf
+ *
+ * - Universal Serial Bus Specification Revision 2.0, April 27, 2000:
+ *     http://sdpha2.ucsd.edu/Lab_Equip_Manuals/usb_20.pdf
+ *
+ * Each inner function if given a description. For description
+ * of the rest of contained functions please see `include/dev/usbhc.h`.
+ *
+ * XXX: devices attached through external hubs aren't supported, since they
+ * would require us to fill in route strings and TT information.
+ */
+#define KL_LOG KL_DEV
+#include <sys/errno.h>
+#include <sys/bus.h>
+#include <sys/condvar.h>
+#include <sys/devclass.h>
+#include <sys/libkern.h>
+#include <sys/klog.h>
+#include <sys/kmem.h>
+#include <sys/malloc.h>
+#include <sys/mutex.h>
+#include <sys/pmap.h>
+#include <sys/pool.h>
+#include <sys/time.h>
+#include <dev/pci.h>
+#include <dev/usb.h>
+#include <dev/usbhc.h>
+#include <dev/xhci.h>
+#include <dev/xhcireg.h>
+
+#define XHCI_RING_SIZE PAGESIZE /* each ring takes a single page */
+#define XHCI_RING_NTRBS (XHCI_RING_SIZE / sizeof(xhci_trb_t))
+
+#define XHCI_DCI_EP0 1 /* device context index of endpoint zero */
+
+#define XHCI_TIMEOUT 1000 /* ms */
+
+/* Interrupter moderation interval in 250 ns units. The controller waits at
+ * least 40 us between interrupts, coalescing events that arrive in the
+ * meantime, which keeps the interrupt rate bounded under bulk traffic. */
+#define XHCI_IMOD_IVAL 160
+
+typedef struct xhci_xfer xhci_xfer_t;
+typedef TAILQ_HEAD(xfer_list, xhci_xfer) xhci_xfer_list_t;
+
+/* Software state of a transfer in flight. */
+struct xhci_xfer {
+  TAILQ_ENTRY(xhci_xfer) xf_link; /* entry on a list of finished transfers */
+  usb_buf_t *xf_buf;              /* USB buffer associated with the transfer */
+  usb_error_t xf_error;           /* errors encountered during the transfer */
+};
+
+/* Software state of a TRB placed on a transfer ring. */
+typedef struct xhci_trb_soft {
+  xhci_xfer_t *xfer; /* transfer finished by the TRB (the last TRB only) */
+  void *chunk;       /* data buffer of the TRB (or NULL) */
+} xhci_trb_soft_t;
+
+typedef struct xhci_ring {
+  xhci_trb_t *trbs;      /* TRBs, the last one links back to the first one */
+  xhci_physaddr_t paddr; /* physical address of `trbs` */
+  xhci_trb_soft_t *soft; /* software state of TRBs (transfer rings only) */
+  uint16_t enqueue;      /* index of the TRB to be written next */
+  uint16_t dequeue;      /* index of the oldest TRB in use */
+  uint16_t nfree;        /* number of TRBs available for new transfers */
+  uint8_t cycle;         /* producer (or consumer) cycle state */
+  bool halted;           /* endpoint has halted due to an error */
+  bool resetting;        /* endpoint is being recovered from a halt */
+} xhci_ring_t;
+
+/* Host controller specific state of a USB device. */
+typedef struct xhci_dev {
+  usb_device_t *udev;                     /* USB device */
+  uint8_t slot;                           /* device slot ID */
+  void *inctx;                            /* input context */
+  xhci_physaddr_t inctx_paddr;            /* physical address of `inctx` */
+  void *outctx;                           /* output device context */
+  xhci_ring_t *rings[XHCI_MAX_ENDPOINTS]; /* transfer rings indexed by DCI */
+} xhci_dev_t;
+
+typedef struct xhci_state {
+  mtx_t lock;                           /* guards rings and command state */
+  condvar_t ring_cv;                    /* waits for free TRBs on a ring */
+  condvar_t cmd_cv;                     /* waits for a command to complete */
+  mtx_t cmd_lock;                       /* serializes commands */
+  resource_t *regs;                     /* host controller registers */
+  resource_t *irq;                      /* host controller interrupt */
+  uint32_t op_off;                      /* operational registers offset */
+  uint32_t rt_off;                      /* runtime registers offset */
+  uint32_t db_off;                      /* doorbell registers offset */
+  size_t ctxsize;                       /* size of a context (32 or 64) */
+  uint8_t nslots;                       /* number of enabled device slots */
+  uint8_t nports;                       /* number of root hub ports */
+  xhci_physaddr_t *dcbaa;               /* device context base address array */
+  xhci_ring_t cmd_ring;                 /* command ring */
+  xhci_ring_t evt_ring;                 /* event ring of interrupter 0 */
+  xhci_dev_t *devs[XHCI_MAX_SLOTS + 1]; /* devices indexed by slot ID */
+  bool cmd_done;                        /* the last command has completed */
+  uint8_t cmd_cc;                       /* completion code of the command */
+  uint8_t cmd_slot;                     /* slot ID reported by the command */
+} xhci_state_t;
+
+/*
+ * Rings and device contexts take a page of uncached memory each. Data is
+ * moved through bounce buffers (chunks) allocated from `P_CHUNK` pool, which
+ * we supply with memory that the controller can access without a cache in
+ * the way. The pool also grows with such memory when it runs out of chunks.
+ * A chunk never crosses a 64 KiB boundary, so each TRB of a transfer
+ * describes a single chunk.
+ */
+
+#define XHCI_CHUNK_SIZE 2048
+
+#define XHCI_CHUNK_POOL_SIZE (32 * PAGESIZE)
+
+static POOL_DEFINE(P_CHUNK, "xHCI data chunks", XHCI_CHUNK_SIZE,
+                   XHCI_CHUNK_SIZE, .flags = POOL_DMA);
+static POOL_DEFINE(P_XFER, "xHCI transfers", sizeof(xhci_xfer_t));
+
+/*
+ * How do we schedule an xHCI transfer?
+ *
+ * Each endpoint of a device has a transfer ring. A transfer is described by
+ * a transfer descriptor (TD), i.e. a chain of TRBs placed on the ring.
+ * Bulk and interrupt transfers consist of Normal TRBs, one per data chunk.
+ * Control transfers consist of a Setup TRB, an optional Data TRB and a Status
+ * TRB. The last TRB of a transfer asks for an interrupt on completion.
+ *
+ *          dequeue                              enqueue
+ *             |                                    |
+ *             v                                    v
+ *      ------------------------------------------------------------------
+ *      |  TD #0  |  TD #0  |  TD #1  |  TD #2  |  free   | ... |  link  |
+ *      | (Setup) | (Status)| (Normal)| (Normal)|         |     |        |
+ *      ------------------------------------------------------------------
+ *
+ * The first TRB of a transfer is written with an inverted cycle bit, which
+ * is flipped once the whole transfer is in place. Then we ring the doorbell
+ * of the endpoint. Many transfers to an endpoint may be in flight, and the
+ * controller executes them in order without waiting for the device driver.
+ *
+ * The controller reports completion of transfers and commands on the event
+ * ring. Interrupts are moderated, so a single interrupt usually lets the
+ * service routine handle a batch of events. A transfer is finished when its
+ * last TRB (or a TRB that has encountered a short packet or an error) is
+ * reported. An error halts the endpoint, so we finish the remaining transfers
+ * of the endpoint with an error as well, and recover the endpoint before the
+ * next transfer is scheduled.
+ *
+ * Commands are issued synchronously, one at a time. We let the controller
+ * assign addresses to devices, so a SET_ADDRESS request is replaced with an
+ * Address Device command. A SET_CONFIG request is preceded with a Configure
+ * Endpoint command, which sets up transfer rings of the device's endpoints.
+ */
+
+/*
+ * The following definitions assume an implicit `xhci` argument.
+ */
+
+/*
+ * Read/write a double word from/to the specified register space.
+ */
+#define cap_in32(addr) bus_read_4(xhci->regs, (addr))
+#define op_in32(addr) bus_read_4(xhci->regs, xhci->op_off + (addr))
+#define op_out32(addr, val)                                                    \
+  bus_write_4(xhci->regs, xhci->op_off + (addr), (val))
+#define rt_in32(addr) bus_read_4(xhci->regs, xhci->rt_off + (addr))
+#define rt_out32(addr, val)                                                    \
+  bus_write_4(xhci->regs, xhci->rt_off + (addr), (val))
+#define db_out32(addr, val)                                                    \
+  bus_write_4(xhci->regs, xhci->db_off + (addr), (val))
+
+/*
+ * Helper functions.
+ */
+
+/* Obtain the physical address corresponding to `vaddr`. */
+static xhci_physaddr_t xhci_physaddr(void *vaddr) {
+  paddr_t paddr = 0;
+  pmap_kextract((vaddr_t)vaddr, &paddr);
+  return (xhci_physaddr_t)paddr;
+}
+
+/* Allocate a zeroed page of uncached memory. */
+static void *xhci_alloc_page(xhci_physaddr_t *pap) {
+  paddr_t pa;
+  void *va = (void *)kmem_alloc_contig(&pa, PAGESIZE, PMAP_NOCACHE);
+  bzero(va, PAGESIZE);
+  if (pap)
+    *pap = pa;
+  return va;
+}
+
+/* Return the device context index of an endpoint. */
+static unsigned xhci_dci(usb_endpt_t *endpt) {
+  /* Endpoint zero is bidirectional. */
+  if (endpt->transfer == USB_TFR_CONTROL)
+    return XHCI_DCI_EP0;
+  return endpt->addr * 2 + (endpt->dir == USB_DIR_INPUT);
+}
+
+/* Convert a completion code into USB bus error flags. */
+static usb_error_t xhci_cc2usbe(uint8_t cc) {
+  if (cc == XHCI_CC_SUCCESS || cc == XHCI_CC_SHORT_PACKET)
+    return 0;
+  if (cc == XHCI_CC_STALL)
+    return USB_ERR_STALLED;
+  return USB_ERR_OTHER;
+}
+
+/* Check whether an error reported with completion code `cc`
+ * moves the endpoint to the halted state. */
+static bool xhci_cc_halts(uint8_t cc) {
+  return cc == XHCI_CC_STALL || cc == XHCI_CC_BABBLE ||
+         cc == XHCI_CC_TRANSACTION;
+}
+
+/*
+ * Ring handling functions.
+ */
+
+/* Initialize a producer ring. */
+static void ring_init(xhci_ring_t *ring) {
+  ring->trbs = xhci_alloc_page(&ring->paddr);
+  ring->cycle = 1;
+  ring->nfree = XHCI_RING_NTRBS - 1;
+
+  /* The last TRB takes the controller back to the beginning of the ring. */
+  xhci_trb_t *link = &ring->trbs[XHCI_RING_NTRBS - 1];
+  link->trb_param = ring->paddr;
+  link->trb_control = XHCI_TRB_TYPE(XHCI_TRB_LINK) | XHCI_TRB_TC;
+}
+
+/* Allocate a transfer ring. */
+static xhci_ring_t *ring_alloc(void) {
+  xhci_ring_t *ring = kmalloc(M_DEV, sizeof(xhci_ring_t), M_ZERO);
+  ring_init(ring);
+  ring->soft =
+    kmalloc(M_DEV, XHCI_RING_NTRBS * sizeof(xhci_trb_soft_t), M_ZERO);
+  return ring;
+}
+
+/* Return the next index after `i` skipping the link TRB. */
+static inline unsigned ring_next(unsigned i) {
+  return (i + 1 == XHCI_RING_NTRBS - 1) ? 0 : i + 1;
+}
+
+/* Return the pointer to the enqueue position along with its cycle state,
+ * as expected by endpoint contexts and the Set TR Dequeue Pointer command. */
+static xhci_physaddr_t ring_enqueue_ptr(xhci_ring_t *ring) {
+  return (ring->paddr + ring->enqueue * sizeof(xhci_trb_t)) | ring->cycle;
+}
+
+/* Check whether the TRB at index `i` belongs to a transfer in flight. */
+static bool ring_busy(xhci_ring_t *ring, unsigned i) {
+  if (i >= XHCI_RING_NTRBS - 1 || ring->nfree == XHCI_RING_NTRBS - 1)
+    return false;
+  if (ring->dequeue < ring->enqueue)
+    return ring->dequeue <= i && i < ring->enqueue;
+  return ring->dequeue <= i || i < ring->enqueue;
+}
+
+/*
+ * Write a TRB at the enqueue position and advance the position.
+ *
+ * - `hold` - write the TRB with an inverted cycle bit, so that the controller
+ *            doesn't consume it until `ring_start` is called.
+ *
+ * Returns the index of the TRB.
+ */
+static unsigned ring_put(xhci_ring_t *ring, uint64_t param, uint32_t status,
+                         uint32_t control, bool hold) {
+  unsigned i = ring->enqueue;
+  xhci_trb_t *trb = &ring->trbs[i];
+
+  trb->trb_param = param;
+  trb->trb_status = status;
+  trb->trb_control = control | (hold ? !ring->cycle : ring->cycle);
+
+  if (++ring->enqueue == XHCI_RING_NTRBS - 1) {
+    /* Pass the chain bit on to the link TRB, so a transfer may wrap. */
+    xhci_trb_t *link = &ring->trbs[ring->enqueue];
+    link->trb_control = XHCI_TRB_TYPE(XHCI_TRB_LINK) | XHCI_TRB_TC |
+                        (control & XHCI_TRB_CH) | ring->cycle;
+    ring->enqueue = 0;
+    ring->cycle ^= 1;
+  }
+
+  return i;
+}
+
+/* Hand the transfer starting with TRB `first` over to the controller. */
+static inline void ring_start(xhci_ring_t *ring, unsigned first) {
+  ring->trbs[first].trb_control ^= XHCI_TRB_CYCLE;
+}
+
+/* Return the oldest transfer placed on a transfer ring. */
+static xhci_xfer_t *ring_oldest(xhci_ring_t *ring) {
+  unsigned i = ring->dequeue;
+  while (!ring->soft[i].xfer)
+    i = ring_next(i);
+  return ring->soft[i].xfer;
+}
+
+/* Release TRBs of the oldest transfer placed on a transfer ring. Data received
+ * by the transfer is gathered in `dst`, unless it's NULL. */
+static xhci_xfer_t *ring_retire(xhci_ring_t *ring, uint8_t *dst) {
+  xhci_xfer_t *xfer = NULL;
+
+  while (!xfer) {
+    xhci_trb_soft_t *soft = &ring->soft[ring->dequeue];
+
+    if (soft->chunk) {
+      if (dst) {
+        size_t len = XHCI_TRB_LEN(ring->trbs[ring->dequeue].trb_status);
+        memcpy(dst, soft->chunk, len);
+        dst += len;
+      }
+      pool_free(P_CHUNK, soft->chunk);
+    }
+
+    xfer = soft->xfer;
+    *soft = (xhci_trb_soft_t){};
+    ring->dequeue = ring_next(ring->dequeue);
+    ring->nfree++;
+  }
+
+  return xfer;
+}
+
+/*
+ * Context handling functions.
+ */
+
+/* Return the context number `i` of the input context of `xdev`:
+ * 0 is the input control context, 1 is the slot context and 1 + DCI
+ * are endpoint contexts. */
+static volatile uint32_t *xhci_inctx(xhci_state_t *xhci, xhci_dev_t *xdev,
+                                     unsigned i) {
+  return xdev->inctx + i * xhci->ctxsize;
+}
+
+/* Fill in the slot context of a device with `nctx` valid endpoint contexts. */
+static void xhci_slot_ctx(xhci_state_t *xhci, xhci_dev_t *xdev, unsigned nctx) {
+  static const uint8_t xhci_speed[] = {
+    [USB_SPD_LOW] = XHCI_SPEED_LOW,
+    [USB_SPD_FULL] = XHCI_SPEED_FULL,
+    [USB_SPD_HIGH] = XHCI_SPEED_HIGH,
+    [USB_SPD_SUPER] = XHCI_SPEED_SUPER,
+  };
+  usb_device_t *udev = xdev->udev;
+  volatile uint32_t *ctx = xhci_inctx(xhci, xdev, 1);
+
+  ctx[0] = XHCI_SCTX_0_SPEED(xhci_speed[udev->speed]) |
+           XHCI_SCTX_0_CTX_NUM(nctx);
+  /* Root hub ports are numbered from 1 here. */
+  ctx[1] = XHCI_SCTX_1_RH_PORT(udev->port + 1);
+}
+
+/* Return the endpoint type of an endpoint context. */
+static uint8_t xhci_endpt_type(usb_endpt_t *endpt) {
+  if (endpt->transfer == USB_TFR_CONTROL)
+    return XHCI_EPTYPE_CONTROL;
+  /* The remaining types follow the order of USB transfer types. */
+  uint8_t type = endpt->transfer - USB_TFR_CONTROL;
+  return endpt->dir == USB_DIR_INPUT ? type + XHCI_EPTYPE_CONTROL : type;
+}
+
+/* Return the service interval of a periodic endpoint
+ * as an exponent of 2 in 125 us units. */
+static uint8_t xhci_endpt_ival(usb_device_t *udev, usb_endpt_t *endpt) {
+  if (endpt->transfer != USB_TFR_INTERRUPT || !endpt->interval)
+    return 0;
+  /* Low and full speed devices express the interval in frames (1 ms). */
+  if (udev->speed == USB_SPD_LOW || udev->speed == USB_SPD_FULL)
+    return min(log2(endpt->interval * 8), 10UL);
+  return min(endpt->interval - 1, 15);
+}
+
+/* Fill in the endpoint context of `endpt` with max. packet size `maxpkt`. */
+static void xhci_endpt_ctx(xhci_state_t *xhci, xhci_dev_t *xdev,
+                           usb_endpt_t *endpt, uint16_t maxpkt) {
+  unsigned dci = xhci_dci(endpt);
+  xhci_ring_t *ring = xdev->rings[dci];
+  volatile uint32_t *ctx = xhci_inctx(xhci, xdev, 1 + dci);
+  xhci_physaddr_t deq = ring_enqueue_ptr(ring);
+
+  maxpkt &= 0x7ff;
+
+  ctx[0] = XHCI_EPCTX_0_IVAL(xhci_endpt_ival(xdev->udev, endpt));
+  ctx[1] = XHCI_EPCTX_1_CERR(3) | XHCI_EPCTX_1_EPTYPE(xhci_endpt_type(endpt)) |
+           XHCI_EPCTX_1_MAXP(maxpkt);
+  ctx[2] = (uint32_t)deq;
+  ctx[3] = deq >> 32;
+
+  if (endpt->transfer == USB_TFR_CONTROL)
+    ctx[4] = XHCI_EPCTX_4_AVG_TRB_LEN(8);
+  else if (endpt->transfer == USB_TFR_INTERRUPT)
+    ctx[4] = XHCI_EPCTX_4_AVG_TRB_LEN(maxpkt) | XHCI_EPCTX_4_MAX_ESIT(maxpkt);
+  else
+    ctx[4] = XHCI_EPCTX_4_AVG_TRB_LEN(XHCI_CHUNK_SIZE);
+}
+
+/*
+ * Command handling functions.
+ */
+
+/* Issue a command and wait for its completion. The slot ID reported by
+ * the command is stored under `slotp` (if not NULL). */
+static int xhci_command(xhci_state_t *xhci, uint64_t param, uint32_t control,
+                        uint8_t *slotp) {
+  SCOPED_MTX_LOCK(&xhci->cmd_lock);
+
+  WITH_MTX_LOCK (&xhci->lock) {
+    xhci->cmd_done = false;
+    ring_put(&xhci->cmd_ring, param, 0, control, false);
+    /* Doorbell 0 belongs to the command ring. */
+    db_out32(XHCI_DOORBELL(0), 0);
+
+    while (!xhci->cmd_done)
+      cv_wait(&xhci->cmd_cv, &xhci->lock);
+  }
+
+  if (slotp)
+    *slotp = xhci->cmd_slot;
+
+  if (xhci->cmd_cc != XHCI_CC_SUCCESS) {
+    klog("command %u failed with completion code %u",
+         XHCI_TRB_GET_TYPE(control), xhci->cmd_cc);
+    return EIO;
+  }
+
+  return 0;
+}
+
+/* Move a device to the default (if `bsr` is set) or addressed state. */
+static int xhci_address_device(xhci_state_t *xhci, xhci_dev_t *xdev,
+                               usb_endpt_t *endpt, uint16_t maxpkt, bool bsr) {
+  volatile uint32_t *ctl = xhci_inctx(xhci, xdev, 0);
+
+  bzero(xdev->inctx, PAGESIZE);
+  ctl[XHCI_INCTX_ADD] = (1 << 0) | (1 << XHCI_DCI_EP0);
+  xhci_slot_ctx(xhci, xdev, XHCI_DCI_EP0);
+  xhci_endpt_ctx(xhci, xdev, endpt, maxpkt);
+
+  uint32_t control = XHCI_TRB_TYPE(XHCI_CMD_ADDRESS_DEVICE) |
+                     XHCI_TRB_SLOT(xdev->slot) | (bsr ? XHCI_TRB_BSR : 0);
+  return xhci_command(xhci, xdev->inctx_paddr, control, NULL);
+}
+
+/* Enable a device slot for `udev` and move the device to the default state,
+ * in which endpoint zero may be used. */
+static int xhci_dev_alloc(xhci_state_t *xhci, usb_device_t *udev,
+                          usb_endpt_t *endpt) {
+  /* Max. packet sizes of endpoint zero until we learn the actual one. */
+  static const uint16_t xhci_ep0_maxpkt[] = {
+    [USB_SPD_LOW] = 8,
+    [USB_SPD_FULL] = 8,
+    [USB_SPD_HIGH] = 64,
+    [USB_SPD_SUPER] = 512,
+  };
+  uint8_t slot;
+  int error;
+
+  uint32_t control = XHCI_TRB_TYPE(XHCI_CMD_ENABLE_SLOT);
+  if ((error = xhci_command(xhci, 0, control, &slot)))
+    return error;
+
+  xhci_dev_t *xdev = kmalloc(M_DEV, sizeof(xhci_dev_t), M_ZERO);
+  xdev->udev = udev;
+  xdev->slot = slot;
+  xdev->inctx = xhci_alloc_page(&xdev->inctx_paddr);
+  xdev->rings[XHCI_DCI_EP0] = ring_alloc();
+
+  xhci_physaddr_t outctx_paddr;
+  xdev->outctx = xhci_alloc_page(&outctx_paddr);
+  xhci->dcbaa[slot] = outctx_paddr;
+
+  WITH_MTX_LOCK (&xhci->lock)
+    xhci->devs[slot] = xdev;
+  udev->hcpriv = xdev;
+
+  return xhci_address_device(xhci, xdev, endpt, xhci_ep0_maxpkt[udev->speed],
+                             true);
+}
+
+/* Set up transfer rings for all endpoints of a device. */
+static int xhci_configure_endpts(xhci_state_t *xhci, xhci_dev_t *xdev) {
+  usb_device_t *udev = xdev->udev;
+  volatile uint32_t *ctl = xhci_inctx(xhci, xdev, 0);
+  unsigned last = XHCI_DCI_EP0;
+  uint32_t add = 1 << 0;
+
+  bzero(xdev->inctx, PAGESIZE);
+
+  usb_endpt_t *endpt;
+  TAILQ_FOREACH (endpt, &udev->endpts, link) {
+    if (endpt->transfer == USB_TFR_CONTROL)
+      continue;
+
+    unsigned dci = xhci_dci(endpt);
+    if (!xdev->rings[dci])
+      xdev->rings[dci] = ring_alloc();
+    xhci_endpt_ctx(xhci, xdev, endpt, endpt->maxpkt);
+
+    add |= 1 << dci;
+    last = max(last, dci);
+  }
+
+  ctl[XHCI_INCTX_ADD] = add;
+  xhci_slot_ctx(xhci, xdev, last);
+
+  uint32_t control =
+    XHCI_TRB_TYPE(XHCI_CMD_CONFIGURE_EP) | XHCI_TRB_SLOT(xdev->slot);
+  return xhci_command(xhci, xdev->inctx_paddr, control, NULL);
+}
+
+/* Bring a halted endpoint back to the running state. Transfers that were
+ * scheduled when the endpoint halted have already been finished, so the
+ * controller continues at the enqueue position of the ring. */
+static int xhci_reset_endpt(xhci_state_t *xhci, xhci_dev_t *xdev,
+                            unsigned dci) {
+  xhci_ring_t *ring = xdev->rings[dci];
+  uint32_t ep = XHCI_TRB_SLOT(xdev->slot) | XHCI_TRB_EPID(dci);
+  int error;
+
+  if ((error = xhci_command(xhci, 0, XHCI_TRB_TYPE(XHCI_CMD_RESET_EP) | ep,
+                            NULL)))
+    return error;
+
+  return xhci_command(xhci, ring_enqueue_ptr(ring),
+                      XHCI_TRB_TYPE(XHCI_CMD_SET_TR_DEQUEUE) | ep, NULL);
+}
+
+/*
+ * xHCI transfer handling functions.
+ */
+
+/* Wait until `ntrbs` TRBs are available on the transfer ring of endpoint `dci`
+ * and recover the endpoint if it has halted. */
+static int xhci_ring_reserve(xhci_state_t *xhci, xhci_dev_t *xdev,
+                             unsigned dci, unsigned ntrbs) {
+  assert(mtx_owned(&xhci->lock));
+
+  xhci_ring_t *ring = xdev->rings[dci];
+  assert(ring);
+
+  while (ring->halted || ring->nfree < ntrbs) {
+    if (ring->halted && !ring->resetting) {
+      ring->resetting = true;
+      mtx_unlock(&xhci->lock);
+      int error = xhci_reset_endpt(xhci, xdev, dci);
+      mtx_lock(&xhci->lock);
+      ring->resetting = false;
+      if (error)
+        return error;
+      ring->halted = false;
+      cv_broadcast(&xhci->ring_cv);
+      continue;
+    }
+    cv_wait(&xhci->ring_cv, &xhci->lock);
+  }
+
+  ring->nfree -= ntrbs;
+  return 0;
+}
+
+/* Allocate a chunk for `len` bytes of data to transfer. */
+static void *xhci_chunk_alloc(usb_buf_t *buf, void *data, uint16_t len) {
+  void *chunk = pool_alloc(P_CHUNK, M_WAITOK);
+  if (buf->endpt->dir == USB_DIR_OUTPUT)
+    memcpy(chunk, data, len);
+  return chunk;
+}
+
+/* Return the value of the TD size field, i.e. the number of packets which
+ * remain to be transferred after a TRB. */
+static inline uint32_t xhci_td_size(uint16_t remain, uint16_t maxpkt) {
+  uint32_t npkts = howmany(remain, maxpkt);
+  return min(npkts, 31U);
+}
+
+/* Place Normal TRBs of a data transfer on `ring`. */
+static void xhci_queue_data(xhci_ring_t *ring, xhci_xfer_t *xfer,
+                            void *chunk) {
+  usb_buf_t *buf = xfer->xf_buf;
+  usb_endpt_t *endpt = buf->endpt;
+  uint16_t size = buf->transfer_size;
+  uint8_t *data = buf->data;
+  unsigned first = ring->enqueue;
+  bool hold = true;
+
+  for (uint16_t nbytes = 0; nbytes != size; hold = false) {
+    uint16_t len = min(size - nbytes, XHCI_CHUNK_SIZE);
+    if (!chunk)
+      chunk = xhci_chunk_alloc(buf, data + nbytes, len);
+    nbytes += len;
+
+    uint32_t tdsize = xhci_td_size(size - nbytes, endpt->maxpkt);
+    uint32_t status = XHCI_TRB_LEN(len) | XHCI_TRB_TDSZ(tdsize);
+    uint32_t control = XHCI_TRB_TYPE(XHCI_TRB_NORMAL);
+    /* A short packet ends the transfer, hence we'd like to hear of it. */
+    if (endpt->dir == USB_DIR_INPUT)
+      control |= XHCI_TRB_ISP;
+    control |= (nbytes == size) ? XHCI_TRB_IOC : XHCI_TRB_CH;
+
+    unsigned i = ring_put(ring, xhci_physaddr(chunk), status, control, hold);
+    ring->soft[i].chunk = chunk;
+    if (nbytes == size)
+      ring->soft[i].xfer = xfer;
+    chunk = NULL;
+  }
+
+  ring_start(ring, first);
+}
+
+/* Allocate software state of a transfer described by `buf`. */
+static xhci_xfer_t *xhci_xfer_alloc(usb_buf_t *buf) {
+  xhci_xfer_t *xfer = pool_alloc(P_XFER, M_ZERO);
+  xfer->xf_buf = buf;
+  return xfer;
+}
+
+/* Issue a control transfer. */
+static void xhci_control_transfer(device_t *hcdev, device_t *dev,
+                                  usb_buf_t *buf, usb_dev_req_t *req,
+                                  usb_direction_t status_dir) {
+  xhci_state_t *xhci = hcdev->state;
+  usb_device_t *udev = usb_device_of(dev);
+  usb_endpt_t *endpt = buf->endpt;
+  uint16_t size = buf->transfer_size;
+  int error = 0;
+
+  assert(size <= XHCI_CHUNK_SIZE);
+
+  /* The first request to a device makes us allocate a device slot. */
+  if (!udev->hcpriv && (error = xhci_dev_alloc(xhci, udev, endpt)))
+    goto bad;
+
+  xhci_dev_t *xdev = udev->hcpriv;
+
+  if (req->bmRequestType == UT_WRITE_DEVICE &&
+      req->bRequest == UR_SET_ADDRESS) {
+    /* The controller picks the address, and uses the max. packet size
+     * of endpoint zero which has been learned by now. */
+    if ((error = xhci_address_device(xhci, xdev, endpt, endpt->maxpkt, false)))
+      goto bad;
+    usb_buf_process(buf, NULL, 0);
+    return;
+  }
+
+  if (req->bmRequestType == UT_WRITE_DEVICE &&
+      req->bRequest == UR_SET_CONFIG) {
+    if ((error = xhci_configure_endpts(xhci, xdev)))
+      goto bad;
+  }
+
+  xhci_xfer_t *xfer = xhci_xfer_alloc(buf);
+  xhci_ring_t *ring = xdev->rings[XHCI_DCI_EP0];
+
+  WITH_MTX_LOCK (&xhci->lock) {
+    if ((error = xhci_ring_reserve(xhci, xdev, XHCI_DCI_EP0, size ? 3 : 2)))
+      break;
+
+    /* Prepare a Setup TRB. The request is passed as immediate data. */
+    uint64_t setup;
+    memcpy(&setup, req, sizeof(usb_dev_req_t));
+    uint32_t trt = XHCI_TRB_TRT_NONE;
+    if (size)
+      trt = (endpt->dir == USB_DIR_INPUT) ? XHCI_TRB_TRT_IN : XHCI_TRB_TRT_OUT;
+    unsigned first =
+      ring_put(ring, setup, XHCI_TRB_LEN(sizeof(usb_dev_req_t)),
+               XHCI_TRB_TYPE(XHCI_TRB_SETUP) | XHCI_TRB_IDT | trt, true);
+
+    /* Prepare the data stage. */
+    if (size) {
+      void *chunk = xhci_chunk_alloc(buf, buf->data, size);
+      uint32_t dir = (endpt->dir == USB_DIR_INPUT) ? XHCI_TRB_DIR_IN : 0;
+      unsigned i = ring_put(ring, xhci_physaddr(chunk), XHCI_TRB_LEN(size),
+                            XHCI_TRB_TYPE(XHCI_TRB_DATA) | dir, false);
+      ring->soft[i].chunk = chunk;
+    }
+
+    /* Prepare a Status TRB, which finishes the transfer. */
+    uint32_t dir = (status_dir == USB_DIR_INPUT) ? XHCI_TRB_DIR_IN : 0;
+    unsigned i = ring_put(ring, 0, 0,
+                          XHCI_TRB_TYPE(XHCI_TRB_STATUS) | XHCI_TRB_IOC | dir,
+                          false);
+    ring->soft[i].xfer = xfer;
+
+    ring_start(ring, first);
+    db_out32(XHCI_DOORBELL(xdev->slot), XHCI_DCI_EP0);
+  }
+
+  if (!error)
+    return;
+
+  pool_free(P_XFER, xfer);
+bad:
+  usb_buf_process(buf, NULL, USB_ERR_OTHER);
+}
+
+/* Issue a data stage only transfer. */
+static void xhci_data_transfer(device_t *hcdev, device_t *dev, usb_buf_t *buf) {
+  xhci_state_t *xhci = hcdev->state;
+  usb_device_t *udev = usb_device_of(dev);
+  xhci_dev_t *xdev = udev->hcpriv;
+  usb_endpt_t *endpt = buf->endpt;
+  unsigned dci = xhci_dci(endpt);
+  int error = 0;
+
+  assert(buf->transfer_size);
+  /* An interrupt endpoint moves a single packet per service interval. */
+  assert(!usb_buf_periodic(buf) || buf->transfer_size <= endpt->maxpkt);
+
+  xhci_xfer_t *xfer = xhci_xfer_alloc(buf);
+  unsigned ntrbs = howmany(buf->transfer_size, XHCI_CHUNK_SIZE);
+
+  WITH_MTX_LOCK (&xhci->lock) {
+    if ((error = xhci_ring_reserve(xhci, xdev, dci, ntrbs)))
+      break;
+    xhci_queue_data(xdev->rings[dci], xfer, NULL);
+    db_out32(XHCI_DOORBELL(xdev->slot), dci);
+  }
+
+  if (!error)
+    return;
+
+  pool_free(P_XFER, xfer);
+  usb_buf_process(buf, NULL, USB_ERR_OTHER);
+}
+
+/* Handle a Transfer Event. Finished transfers are appended to `done`. */
+static void xhci_transfer_event(xhci_state_t *xhci, xhci_trb_t *evt,
+                                xhci_xfer_list_t *done) {
+  uint8_t slot = XHCI_TRB_GET_SLOT(evt->trb_control);
+  uint8_t dci = XHCI_TRB_GET_EPID(evt->trb_control);
+  uint8_t cc = XHCI_TRB_GET_CC(evt->trb_status);
+  xhci_dev_t *xdev = xhci->devs[slot];
+  xhci_ring_t *ring;
+
+  if (!xdev || !(ring = xdev->rings[dci]))
+    return;
+
+  /* Skip events reported for TRBs which have already been released. */
+  unsigned i = (evt->trb_param - ring->paddr) / sizeof(xhci_trb_t);
+  if (!ring_busy(ring, i))
+    return;
+
+  xhci_xfer_t *xfer = ring_oldest(ring);
+  usb_buf_t *buf = xfer->xf_buf;
+  usb_error_t error = xhci_cc2usbe(cc);
+
+  if (!error && usb_buf_periodic(buf)) {
+    /* Let the USB bus layer handle the received packet,
+     * and reschedule the transfer with the same chunk. */
+    xhci_trb_soft_t *soft = &ring->soft[ring->dequeue];
+    void *chunk = soft->chunk;
+    soft->chunk = NULL;
+    ring_retire(ring, NULL);
+    usb_buf_process(buf, chunk, 0);
+    xhci_queue_data(ring, xfer, chunk);
+    ring->nfree--;
+    db_out32(XHCI_DOORBELL(slot), dci);
+    return;
+  }
+
+  /* Gather data received by an input transfer. */
+  uint8_t *dst = NULL;
+  if (!error && buf->endpt->dir == USB_DIR_INPUT)
+    dst = buf->data;
+
+  ring_retire(ring, dst);
+  xfer->xf_error = error;
+  TAILQ_INSERT_TAIL(done, xfer, xf_link);
+
+  if (error && xhci_cc_halts(cc)) {
+    /* Remaining transfers to the endpoint are finished with an error. */
+    while (ring->nfree != XHCI_RING_NTRBS - 1) {
+      xfer = ring_retire(ring, NULL);
+      xfer->xf_error = USB_ERR_OTHER;
+      TAILQ_INSERT_TAIL(done, xfer, xf_link);
+    }
+    ring->halted = true;
+  }
+
+  cv_broadcast(&xhci->ring_cv);
+}
+
+/* Handle a Command Completion Event. */
+static void xhci_command_event(xhci_state_t *xhci, xhci_trb_t *evt) {
+  xhci->cmd_cc = XHCI_TRB_GET_CC(evt->trb_status);
+  xhci->cmd_slot = XHCI_TRB_GET_SLOT(evt->trb_control);
+  xhci->cmd_done = true;
+  cv_signal(&xhci->cmd_cv);
+}
+
+/* xHCI Interrupt Service Routine. */
+static intr_filter_t xhci_isr(void *data) {
+  xhci_state_t *xhci = data;
+
+  if (!(op_in32(XHCI_USBSTS) & XHCI_STS_EINT))
+    return IF_STRAY;
+
+  /* Acknowledge the interrupt. */
+  op_out32(XHCI_USBSTS, XHCI_STS_EINT);
+  rt_out32(XHCI_IMAN(0), XHCI_IMAN_INTR_PEND | XHCI_IMAN_INTR_ENA);
+
+  return IF_DELEGATE;
+}
+
+static void xhci_service(void *data) {
+  xhci_state_t *xhci = data;
+  xhci_xfer_list_t done = TAILQ_HEAD_INITIALIZER(done);
+  xhci_ring_t *ring = &xhci->evt_ring;
+  xhci_xfer_t *xfer;
+
+  WITH_MTX_LOCK (&xhci->lock) {
+    /* Consume all events which the controller has posted so far. */
+    for (;;) {
+      xhci_trb_t *evt = &ring->trbs[ring->dequeue];
+      if ((evt->trb_control & XHCI_TRB_CYCLE) != ring->cycle)
+        break;
+
+      uint8_t type = XHCI_TRB_GET_TYPE(evt->trb_control);
+      if (type == XHCI_EVT_TRANSFER)
+        xhci_transfer_event(xhci, evt, &done);
+      else if (type == XHCI_EVT_CMD_COMPLETE)
+        xhci_command_event(xhci, evt);
+
+      /* The event ring has no link TRB. */
+      if (++ring->dequeue == XHCI_RING_NTRBS) {
+        ring->dequeue = 0;
+        ring->cycle ^= 1;
+      }
+    }
+
+    /* Let the controller reuse consumed events and clear the busy flag. */
+    xhci_physaddr_t erdp = ring->paddr + ring->dequeue * sizeof(xhci_trb_t);
+    rt_out32(XHCI_ERDP_LO(0), (uint32_t)erdp | XHCI_ERDP_BUSY);
+    rt_out32(XHCI_ERDP_HI(0), erdp >> 32);
+  }
+
+  /* Complete finished transfers with no lock held,
+   * so that completion callbacks are free to issue new transfers. */
+  while ((xfer = TAILQ_FIRST(&done))) {
+    TAILQ_REMOVE(&done, xfer, xf_link);
+    usb_buf_t *buf = xfer->xf_buf;
+    if (xfer->xf_error)
+      usb_buf_process(buf, NULL, xfer->xf_error);
+    else
+      usb_buf_process(buf, buf->data, 0);
+    pool_free(P_XFER, xfer);
+  }
+}
+
+/*
+ * Software context initialization functions.
+ */
+
+/* Wait until bits `mask` of operational register `reg` are equal to `val`. */
+static bool xhci_wait(xhci_state_t *xhci, uint32_t reg, uint32_t mask,
+                      uint32_t val) {
+  for (int i = 0; i < XHCI_TIMEOUT; i++) {
+    if ((op_in32(reg) & mask) == val)
+      return true;
+    mdelay(1);
+  }
+  return false;
+}
+
+/* Stop and reset the controller. */
+static int xhci_reset(xhci_state_t *xhci) {
+  if (!xhci_wait(xhci, XHCI_USBSTS, XHCI_STS_CNR, 0))
+    return ENXIO;
+
+  op_out32(XHCI_USBCMD, 0);
+  if (!xhci_wait(xhci, XHCI_USBSTS, XHCI_STS_HCH, XHCI_STS_HCH))
+    return ENXIO;
+
+  op_out32(XHCI_USBCMD, XHCI_CMD_HCRST);
+  if (!xhci_wait(xhci, XHCI_USBCMD, XHCI_CMD_HCRST, 0))
+    return ENXIO;
+  if (!xhci_wait(xhci, XHCI_USBSTS, XHCI_STS_CNR, 0))
+    return ENXIO;
+
+  return 0;
+}
+
+/* Initialize the device context base address array
+ * along with scratchpad buffers requested by the controller. */
+static void xhci_init_dcbaa(xhci_state_t *xhci) {
+  xhci_physaddr_t pa;
+
+  assert((xhci->nslots + 1) * sizeof(xhci_physaddr_t) <= PAGESIZE);
+  xhci->dcbaa = xhci_alloc_page(&pa);
+
+  unsigned nbufs = XHCI_HCS2_SPB_MAX(cap_in32(XHCI_HCSPARAMS2));
+  if (nbufs) {
+    assert(nbufs * sizeof(xhci_physaddr_t) <= PAGESIZE);
+    xhci_physaddr_t *bufs = xhci_alloc_page(&xhci->dcbaa[0]);
+    for (unsigned i = 0; i < nbufs; i++)
+      (void)xhci_alloc_page(&bufs[i]);
+  }
+
+  op_out32(XHCI_CONFIG, xhci->nslots);
+  op_out32(XHCI_DCBAAP_LO, (uint32_t)pa);
+  op_out32(XHCI_DCBAAP_HI, pa >> 32);
+}
+
+/* Initialize the command ring. */
+static void xhci_init_cmd_ring(xhci_state_t *xhci) {
+  ring_init(&xhci->cmd_ring);
+
+  xhci_physaddr_t crcr = ring_enqueue_ptr(&xhci->cmd_ring);
+  op_out32(XHCI_CRCR_LO, (uint32_t)crcr);
+  op_out32(XHCI_CRCR_HI, crcr >> 32);
+}
+
+/* Initialize the event ring of the primary interrupter. */
+static void xhci_init_evt_ring(xhci_state_t *xhci) {
+  xhci_ring_t *ring = &xhci->evt_ring;
+  xhci_physaddr_t erst_pa;
+
+  ring->trbs = xhci_alloc_page(&ring->paddr);
+  ring->cycle = 1;
+
+  /* The event ring consists of a single segment. */
+  xhci_erst_entry_t *erst = xhci_alloc_page(&erst_pa);
+  erst->erst_base = ring->paddr;
+  erst->erst_size = XHCI_RING_NTRBS;
+
+  rt_out32(XHCI_ERSTSZ(0), 1);
+  rt_out32(XHCI_ERDP_LO(0), (uint32_t)ring->paddr);
+  rt_out32(XHCI_ERDP_HI(0), ring->paddr >> 32);
+  /* Writing the segment table base address enables the event ring. */
+  rt_out32(XHCI_ERSTBA_LO(0), (uint32_t)erst_pa);
+  rt_out32(XHCI_ERSTBA_HI(0), erst_pa >> 32);
+}
+
+/* Supply a contiguous physical memory for further chunk allocation. */
+static void xhci_init_pool(void) {
+  assert(powerof2(XHCI_CHUNK_POOL_SIZE));
+  void *chunk_pool =
+    (void *)kmem_alloc_contig(NULL, XHCI_CHUNK_POOL_SIZE, PMAP_NOCACHE);
+  pool_add_page(P_CHUNK, chunk_pool, XHCI_CHUNK_POOL_SIZE);
+}
+
+/*
+ * xHCI host controller manage functions.
+ */
+
+/* Return the number of available root hub ports. */
+static uint8_t xhci_number_of_ports(device_t *dev) {
+  xhci_state_t *xhci = dev->state;
+  return xhci->nports;
+}
+
+/* Check whether a device is attached to the specified root hub port. */
+static bool xhci_device_present(device_t *dev, uint8_t port) {
+  xhci_state_t *xhci = dev->state;
+  return op_in32(XHCI_PORTSC(port)) & XHCI_PS_CCS;
+}
+
+/* Obtain speed of the device attached to the specified port. */
+static usb_speed_t xhci_device_speed(device_t *dev, uint8_t port) {
+  xhci_state_t *xhci = dev->state;
+  uint8_t speed = XHCI_PS_SPEED_GET(op_in32(XHCI_PORTSC(port)));
+
+  if (speed == XHCI_SPEED_LOW)
+    return USB_SPD_LOW;
+  if (speed == XHCI_SPEED_FULL)
+    return USB_SPD_FULL;
+  if (speed == XHCI_SPEED_HIGH)
+    return USB_SPD_HIGH;
+  return USB_SPD_SUPER;
+}
+
+/* Reset the specified root hub port. */
+static void xhci_reset_port(device_t *dev, uint8_t port) {
+  xhci_state_t *xhci = dev->state;
+  /* Avoid disabling the port and clearing change indicators by accident. */
+  uint32_t portsc = op_in32(XHCI_PORTSC(port)) & ~XHCI_PS_CLEAR;
+
+  op_out32(XHCI_PORTSC(port), portsc | XHCI_PS_PR);
+  for (int i = 0; i < USB_PORT_ROOT_RESET_DELAY_SPEC; i++) {
+    if (op_in32(XHCI_PORTSC(port)) & XHCI_PS_PRC)
+      break;
+    mdelay(1);
+  }
+
+  /* Clear status change indicators. */
+  portsc = op_in32(XHCI_PORTSC(port)) & ~XHCI_PS_CLEAR;
+  op_out32(XHCI_PORTSC(port), portsc | XHCI_PS_PRC | XHCI_PS_CSC |
+                                XHCI_PS_PEC | XHCI_PS_WRC);
+  mdelay(USB_PORT_RESET_RECOVERY_SPEC);
+}
+
+/*
+ * Driver interface functions.
+ */
+
+static int xhci_probe(device_t *dev) {
+  pci_device_t *pcid = pci_device_of(dev);
+
+  if (!pcid)
+    return 0;
+
+  /* Is it a USB compatible controller? */
+  if (pcid->class_code != PCI_USB_CLASSCODE ||
+      pcid->subclass_code != PCI_USB_SUBCLASSCODE)
+    return 0;
+
+  /* Is it an xHCI controller? */
+  if (pcid->progif != PCI_INTERFACE_XHCI)
+    return 0;
+
+  return 1;
+}
+
+static int xhci_attach(device_t *dev) {
+  xhci_state_t *xhci = dev->state;
+  int err = 0;
+
+  /* Gather memory mapped registers resource. */
+  xhci->regs = device_take_memory(dev, 0);
+  assert(xhci->regs);
+
+  if ((err = bus_map_resource(dev, xhci->regs)))
+    return err;
+
+  /* Locate register spaces and read controller's parameters. */
+  xhci->op_off = cap_in32(XHCI_CAPLENGTH) & 0xff;
+  xhci->rt_off = cap_in32(XHCI_RTSOFF) & ~0x1f;
+  xhci->db_off = cap_in32(XHCI_DBOFF) & ~0x3;
+
+  uint32_t hcs1 = cap_in32(XHCI_HCSPARAMS1);
+  xhci->nslots = min(XHCI_HCS1_DEVSLOT_MAX(hcs1), (uint32_t)XHCI_MAX_SLOTS);
+  xhci->nports = XHCI_HCS1_N_PORTS(hcs1);
+  xhci->ctxsize = XHCI_HCC_CSZ(cap_in32(XHCI_HCCPARAMS1)) ? 64 : 32;
+  klog("detected %u ports and %u device slots", xhci->nports, xhci->nslots);
+
+  if ((err = xhci_reset(xhci)))
+    return err;
+
+  /* Initialize the software context. */
+  mtx_init(&xhci->lock, MTX_SLEEP);
+  mtx_init(&xhci->cmd_lock, MTX_SLEEP);
+  cv_init(&xhci->ring_cv, "xHCI ring has free TRBs");
+  cv_init(&xhci->cmd_cv, "xHCI command completed");
+  xhci_init_dcbaa(xhci);
+  xhci_init_cmd_ring(xhci);
+  xhci_init_evt_ring(xhci);
+  xhci_init_pool();
+
+  /* Enable bus master mode. */
+  pci_enable_busmaster(dev);
+
+  /* Setup host controller's interrupt. */
+  xhci->irq = device_take_irq(dev, 0);
+  assert(xhci->irq);
+  pic_setup_intr(dev, xhci->irq, xhci_isr, xhci_service, xhci, "xHCI");
+
+  /* Turn on moderated interrupts of the primary interrupter. */
+  rt_out32(XHCI_IMOD(0), XHCI_IMOD_IVAL_SET(XHCI_IMOD_IVAL));
+  rt_out32(XHCI_IMAN(0), XHCI_IMAN_INTR_PEND | XHCI_IMAN_INTR_ENA);
+
+  /* Start the controller. */
+  op_out32(XHCI_USBCMD, XHCI_CMD_RS | XHCI_CMD_INTE);
+  if (!xhci_wait(xhci, XHCI_USBSTS, XHCI_STS_HCH, 0)) {
+    pic_teardown_intr(dev, xhci->irq);
+    return ENXIO;
+  }
+
+  /* Initialize the underlying USB bus. */
+  usb_init(dev);
+
+  /* Detect and configure attached devices. */
+  int error = usb_enumerate(dev);
+  if (error)
+    pic_teardown_intr(dev, xhci->irq);
+  return error;
+}
+
+static usbhc_methods_t xhci_usbhc_if = {
+  .number_of_ports = xhci_number_of_ports,
+  .device_present = xhci_device_present,
+  .device_speed = xhci_device_speed,
+  .reset_port = xhci_reset_port,
+  .control_transfer = xhci_control_transfer,
+  .data_transfer = xhci_data_transfer,
+};
+
+static driver_t xhci = {
+  .desc = "xHCI driver",
+  .size = sizeof(xhci_state_t),
+  .pass = SECOND_PASS,
+  .probe = xhci_probe,
+  .attach = xhci_attach,
+  .interfaces =
+    {
+      [DIF_USBHC] = &xhci_usbhc_if,
+    },
+};
+
+DEVCLASS_ENTRY(pci, xhci);
@@ -75,6 +75,7 @@ inline pmap_t *pmap_kernel(void) {
 }
 
 inline pmap_t *pmap_user(void) {
+  SCOPED_NO_PREEMPTION();
   return PCPU_GET(curpmap);
 }
 
@@ -249,9 +250,10 @@ bool pmap_kextract(vaddr_t va, paddr_t *pap) {
  * Pageable user memory interface.
  */
 
-void pmap_enter(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
-                unsigned flags) {
-  assert(pmap != pmap_kernel());
+static void pmap_enter_nolock(pmap_t *pmap, vaddr_t va, vm_page_t *pg,
+                              vm_prot_t prot, unsigned flags) {
+  assert(mtx_owned(&pv_list_lock));
+  assert(mtx_owned(&pmap->mtx));
 
   paddr_t pa = pg->paddr;
 
@@ -261,15 +263,61 @@ void pmap_enter(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
   klog("Enter virtual mapping %p for frame %p", va, pa);
 
   pte_t pte = pte_make(pa, prot, flags);
+  pte_t *ptep = pmap_ensure_pte(pmap, va);
+  /* Replacing a mapping of another page (e.g. copy-on-write)? */
+  if (pte_valid_p(ptep) && pte_frame(*ptep) != pa)
+    pv_remove(pmap, va, vm_page_find(pte_frame(*ptep)));
+  /* Keep referenced & modified bits of a page that is mapped elsewhere,
+   * e.g. page of a file shared by many processes that is not yet
+   * written back. */
+  if (TAILQ_EMPTY(&pg->pv_list))
+    pg->flags &= ~(PG_MODIFIED | PG_REFERENCED);
+  pv_entry_t *pv = pv_find(pmap, va, pg);
+  if (!pv)
+    pv_add(pmap, va, pg);
+  pmap_write_pte(pmap, ptep, pte, va);
+}
+
+void pmap_enter(pmap_t *pmap, vaddr_t va, vm_page_t *pg, vm_prot_t prot,
+                unsigned flags) {
+  assert(pmap != pmap_kernel());
 
   WITH_MTX_LOCK (&pv_list_lock) {
     WITH_MTX_LOCK (&pmap->mtx) {
-      pv_entry_t *pv = pv_find(pmap, va, pg);
-      if (!pv)
-        pv_add(pmap, va, pg);
-      pg->flags &= ~(PG_MODIFIED | PG_REFERENCED);
-      pte_t *ptep = pmap_ensure_pte(pmap, va);
-      pmap_write_pte(pmap, ptep, pte, va);
+      pmap_enter_nolock(pmap, va, pg, prot, flags);
+    }
+  }
+}
+
+/* Does `ptep` map page at `pa` with at least `prot` permissions? */
+static bool pmap_mapped_p(pte_t *ptep, paddr_t pa, vm_prot_t prot) {
+  if (!pte_valid_p(ptep) || pte_frame(*ptep) != pa)
+    return false;
+  if ((prot & VM_PROT_READ) && !pte_access(*ptep, VM_PROT_READ))
+    return false;
+  if ((prot & VM_PROT_WRITE) && !pte_access(*ptep, VM_PROT_WRITE))
+    return false;
+  if ((prot & VM_PROT_EXEC) && !pte_access(*ptep, VM_PROT_EXEC))
+    return false;
+  return true;
+}
+
+void pmap_enter_many(pmap_t *pmap, vaddr_t va, vm_page_t **pgs,
+                     vm_prot_t *prots, size_t n, unsigned flags) {
+  assert(pmap != pmap_kernel());
+  assert(pmap_contains_p(pmap, va, va + n * PAGESIZE));
+
+  WITH_MTX_LOCK (&pv_list_lock) {
+    WITH_MTX_LOCK (&pmap->mtx) {
+      for (size_t i = 0; i < n; i++, va += PAGESIZE) {
+        if (pgs[i] == NULL)
+          continue;
+        /* Leave mappings intact so as not to lose emulated bits. */
+        pte_t *ptep = pmap_lookup_pte(pmap, va);
+        if (pmap_mapped_p(ptep, pgs[i]->paddr, prots[i]))
+          continue;
+        pmap_enter_nolock(pmap, va, pgs[i], prots[i], flags);
+      }
     }
   }
 }
@@ -457,7 +505,8 @@ int pmap_fault_handler(ctx_t *ctx, vaddr_t vaddr, vm_prot_t access) {
   if (!(error = pmap_emulate_bits(pmap, vaddr, access)))
     return 0;
 
-  if (error == EACCES)
+  /* Write access to a read-only mapping may be a copy-on-write fault. */
+  if (error == EACCES && !(access & VM_PROT_WRITE))
     goto fault;
 
   vm_map_t *vmap = vm_map_user();
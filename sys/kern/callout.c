@@ -10,9 +10,27 @@
 #include <sys/interrupt.h>
 #include <sys/time.h>
 
-/* Note: If the difference in time between ticks is greater than the number of
-   buckets, some callouts may be called out-of-order! */
-#define CALLOUT_BUCKETS 64
+/*
+ * Pending callouts are kept in a hierarchical timing wheel. Each of its
+ * CALLOUT_LEVELS levels is an array of CALLOUT_WHEEL_SIZE buckets. A bucket of
+ * level `k` covers CALLOUT_WHEEL_SIZE^k ticks, so the whole wheel spans
+ * CALLOUT_WHEEL_SIZE^CALLOUT_LEVELS ticks (~4.6 hours).
+ *
+ * A callout is put at the lowest level whose span covers its deadline. Once
+ * all buckets of a level have been processed, the next bucket of the level
+ * above is cascaded, i.e. its callouts are redistributed to lower levels.
+ * Thus a callout is moved at most CALLOUT_LEVELS times, no matter how far its
+ * deadline is. Callouts due after the wheel's span are put into its last
+ * bucket and cascaded again, until they get close enough.
+ */
+#define CALLOUT_LEVELS 4
+#define CALLOUT_WHEEL_BITS 6
+#define CALLOUT_WHEEL_SIZE (1 << CALLOUT_WHEEL_BITS)
+#define CALLOUT_WHEEL_MASK (CALLOUT_WHEEL_SIZE - 1)
+#define CALLOUT_BUCKETS (CALLOUT_LEVELS * CALLOUT_WHEEL_SIZE)
+
+/* Number of bits of time that select a bucket at given level. */
+#define CALLOUT_SHIFT(lvl) ((lvl)*CALLOUT_WHEEL_BITS)
 
 #define callout_is_active(c) ((c)->c_flags & CALLOUT_ACTIVE)
 #define callout_set_active(c) ((c)->c_flags |= CALLOUT_ACTIVE)
@@ -26,16 +44,15 @@
 #define callout_set_stopped(c) ((c)->c_flags |= CALLOUT_STOPPED)
 #define callout_clear_stopped(c) ((c)->c_flags &= ~CALLOUT_STOPPED)
 
-/*
-  Every event is inside one of CALLOUT_BUCKETS buckets.
-  The buckets is a cyclic list, but we implement it as an array,
-  allowing us to access random elements in constant time.
-*/
+#define callout_is_direct(c) ((c)->c_flags & CALLOUT_DIRECT)
 
 typedef TAILQ_HEAD(callout_list, callout) callout_list_t;
 
 static struct {
+  /* Bucket `i` of level `k` is `heads[k * CALLOUT_WHEEL_SIZE + i]`. */
   callout_list_t heads[CALLOUT_BUCKETS];
+  /* Bit `i` of `nonempty[k]` is set iff bucket `i` of level `k` isn't empty. */
+  uint64_t nonempty[CALLOUT_LEVELS];
   /* Stores the value of the argument callout_process was previously
      called with. All callouts up to this timestamp have already been
      processed. */
@@ -47,34 +64,54 @@ static inline callout_list_t *ci_list(int i) {
   return &ci.heads[i];
 }
 
+/* Returns index of the bucket of level `lvl` that covers tick `tm`. */
+static inline unsigned ci_bucket(int lvl, systime_t tm) {
+  return lvl * CALLOUT_WHEEL_SIZE +
+         ((tm >> CALLOUT_SHIFT(lvl)) & CALLOUT_WHEEL_MASK);
+}
+
+static inline void ci_set_nonempty(unsigned i) {
+  ci.nonempty[i / CALLOUT_WHEEL_SIZE] |= 1ULL << (i & CALLOUT_WHEEL_MASK);
+}
+
+static inline void ci_update_nonempty(unsigned i) {
+  if (TAILQ_EMPTY(ci_list(i)))
+    ci.nonempty[i / CALLOUT_WHEEL_SIZE] &= ~(1ULL << (i & CALLOUT_WHEEL_MASK));
+}
+
 static callout_list_t delegated;
 
+/* Calls function of an expired callout and wakes up its drainers. */
+static void callout_run(callout_t *elem) {
+  assert(callout_is_active(elem));
+  assert(!callout_is_pending(elem));
+
+  /* Execute callout's function. */
+  elem->c_func(elem->c_arg);
+
+  WITH_MTX_LOCK (&ci.lock) {
+    callout_clear_active(elem);
+    /* Only notify waiters if the callout isn't already pending
+     * due to a reschedule. */
+    if (!callout_is_pending(elem))
+      sleepq_broadcast(elem);
+  }
+}
+
 static void callout_thread(void *arg) {
   while (true) {
     callout_t *elem;
 
-    WITH_INTR_DISABLED {
+    WITH_MTX_LOCK (&ci.lock) {
       while (TAILQ_EMPTY(&delegated)) {
-        sleepq_wait(&delegated, NULL, NULL);
+        sleepq_wait(&delegated, NULL, &ci.lock);
       }
 
       elem = TAILQ_FIRST(&delegated);
       TAILQ_REMOVE(&delegated, elem, c_link);
     }
 
-    assert(callout_is_active(elem));
-    assert(!callout_is_pending(elem));
-
-    /* Execute callout's function. */
-    elem->c_func(elem->c_arg);
-
-    WITH_MTX_LOCK (&ci.lock) {
-      callout_clear_active(elem);
-      /* Only notify waiters if the callout isn't already pending
-       * due to a reschedule. */
-      if (!callout_is_pending(elem))
-        sleepq_broadcast(elem);
-    }
+    callout_run(elem);
   }
 }
 
@@ -99,19 +136,55 @@ void callout_setup(callout_t *co, timeout_t fn, void *arg) {
   co->c_arg = arg;
 }
 
+void callout_setup_direct(callout_t *co, timeout_t fn, void *arg) {
+  callout_setup(co, fn, arg);
+  co->c_flags = CALLOUT_DIRECT;
+}
+
+/* Returns index of the bucket for a callout due at `tm`. If `allow_current` is
+ * set, the bucket of tick `ci.last` is yet to be expired, so callouts due at
+ * that tick are put there rather than delayed. */
+static unsigned callout_index(systime_t tm, bool allow_current) {
+  systime_t first = allow_current ? ci.last : ci.last + 1;
+
+  /* Overdue callouts are processed on next tick. */
+  if ((int32_t)(tm - first) < 0)
+    tm = first;
+
+  systime_t delta = tm - ci.last;
+  int lvl = 0;
+
+  while (lvl < CALLOUT_LEVELS - 1 &&
+         delta >= (systime_t)CALLOUT_WHEEL_SIZE << CALLOUT_SHIFT(lvl))
+    lvl++;
+
+  /* Clamp the deadline to the span of the wheel. */
+  systime_t span = (systime_t)CALLOUT_WHEEL_SIZE << CALLOUT_SHIFT(lvl);
+  if (delta >= span)
+    tm = ci.last + span - 1;
+
+  return ci_bucket(lvl, tm);
+}
+
+static void callout_insert(callout_t *co, bool allow_current) {
+  co->c_index = callout_index(co->c_time, allow_current);
+  TAILQ_INSERT_TAIL(ci_list(co->c_index), co, c_link);
+  ci_set_nonempty(co->c_index);
+}
+
 static void _callout_schedule(callout_t *co, systime_t tm) {
   assert(mtx_owned(&ci.lock));
   assert(!callout_is_pending(co));
 
   callout_set_pending(co);
 
-  int idx = tm % CALLOUT_BUCKETS;
-
   co->c_time = tm;
-  co->c_index = idx;
 
   klog("Add callout {%p} with wakeup at %ld.", co, tm);
-  TAILQ_INSERT_TAIL(ci_list(idx), co, c_link);
+  callout_insert(co, false);
+
+  /* The clock may be stopped on an idle processor. */
+  clock_event_scheduled(tm);
 }
 
 void callout_schedule_abs(callout_t *co, systime_t tm) {
@@ -149,6 +222,7 @@ bool callout_stop(callout_t *handle) {
   if (callout_is_pending(handle)) {
     callout_clear_pending(handle);
     TAILQ_REMOVE(ci_list(handle->c_index), handle, c_link);
+    ci_update_nonempty(handle->c_index);
     /* A callout may be observed to be both active and pending if it rescheduled
      * itself but hasn't finished executing yet.
      * If that's the case, we must make the caller wait for its completion in
@@ -158,59 +232,135 @@ bool callout_stop(callout_t *handle) {
   return !callout_is_active(handle);
 }
 
+/* Redistributes callouts from upper level buckets that begin at tick `t`.
+ * Callouts due at `t` go to its bucket of level 0, which is expired next. */
+static void callout_cascade(systime_t t) {
+  for (int lvl = 1; lvl < CALLOUT_LEVELS; lvl++) {
+    if (t & ((1 << CALLOUT_SHIFT(lvl)) - 1))
+      break;
+
+    unsigned i = ci_bucket(lvl, t);
+    callout_list_t moved;
+    callout_t *elem;
+
+    TAILQ_INIT(&moved);
+    TAILQ_CONCAT(&moved, ci_list(i), c_link);
+    ci_update_nonempty(i);
+
+    while ((elem = TAILQ_FIRST(&moved))) {
+      TAILQ_REMOVE(&moved, elem, c_link);
+      callout_insert(elem, true);
+    }
+  }
+}
+
+/* Detaches callouts due at tick `t` and puts them on `direct` list or
+ * delegates them to callout thread. */
+static void callout_expire(systime_t t, callout_list_t *direct) {
+  unsigned i = ci_bucket(0, t);
+  callout_list_t *head = ci_list(i);
+  callout_t *elem;
+
+  while ((elem = TAILQ_FIRST(head))) {
+    assert((int32_t)(elem->c_time - t) <= 0);
+    TAILQ_REMOVE(head, elem, c_link);
+    callout_set_active(elem);
+    callout_clear_pending(elem);
+    if (callout_is_direct(elem))
+      TAILQ_INSERT_TAIL(direct, elem, c_link);
+    else
+      TAILQ_INSERT_TAIL(&delegated, elem, c_link);
+  }
+
+  ci_update_nonempty(i);
+}
+
 /*
- * Process all timeouted callouts from queues between last position and
- * current position and delegate them to callout thread.
+ * Process all timeouted callouts between last time and current time. Direct
+ * callouts are called right away, others are delegated to callout thread.
  */
 void callout_process(systime_t time) {
-  unsigned int last_bucket;
-  unsigned int current_bucket = ci.last % CALLOUT_BUCKETS;
-
-  if (time - ci.last > CALLOUT_BUCKETS) {
-    /* Process all buckets */
-    last_bucket = (ci.last - 1) % CALLOUT_BUCKETS;
-  } else {
-    /* Process only buckets in time range ci.last to time */
-    last_bucket = time % CALLOUT_BUCKETS;
-  }
+  callout_list_t direct;
+  callout_t *elem;
 
   /* We are in kernel's bottom half. */
   assert(intr_disabled());
 
-  while (true) {
-    callout_list_t *head = ci_list(current_bucket);
-    callout_t *elem, *next;
-
-    /* Detach triggered callouts from ci_list queue. */
-    TAILQ_FOREACH_SAFE (elem, head, c_link, next) {
-      if (elem->c_time <= time) {
-        callout_set_active(elem);
-        callout_clear_pending(elem);
-        TAILQ_REMOVE(head, elem, c_link);
-        /* Attach elem to callout thread's queue. */
-        TAILQ_INSERT_TAIL(&delegated, elem, c_link);
-      }
+  TAILQ_INIT(&direct);
+
+  WITH_MTX_LOCK (&ci.lock) {
+    /* Advance the wheel tick by tick. It's cheap for empty buckets, and only
+     * a few ticks are missed, e.g. while the boot processor is idle. */
+    while ((int32_t)(time - ci.last) > 0) {
+      ci.last++;
+      callout_cascade(ci.last);
+      callout_expire(ci.last, &direct);
     }
 
-    if (current_bucket == last_bucket)
-      break;
+    /* Wake callout thread. */
+    if (!TAILQ_EMPTY(&delegated)) {
+      sleepq_signal(&delegated);
+    }
+  }
 
-    current_bucket = (current_bucket + 1) % CALLOUT_BUCKETS;
+  /* Direct callouts may reschedule themselves, so the lock is released. */
+  while ((elem = TAILQ_FIRST(&direct))) {
+    TAILQ_REMOVE(&direct, elem, c_link);
+    callout_run(elem);
   }
+}
+
+/* Returns the first tick after `ci.last`, at which bucket `i` is processed. */
+static systime_t callout_bucket_time(int i) {
+  int lvl = i / CALLOUT_WHEEL_SIZE;
+  systime_t now = ci.last >> CALLOUT_SHIFT(lvl);
+  systime_t t = (now & ~CALLOUT_WHEEL_MASK) | (i & CALLOUT_WHEEL_MASK);
+  if (t <= now)
+    t += CALLOUT_WHEEL_SIZE;
+  return t << CALLOUT_SHIFT(lvl);
+}
 
-  ci.last = time;
+/* Returns index of the first non-empty bucket of level `lvl` processed after
+ * `ci.last`. The level must not be empty. */
+static unsigned callout_next_bucket(int lvl) {
+  uint64_t word = ci.nonempty[lvl];
+  assert(word != 0);
 
-  /* Wake callout thread. */
-  if (!TAILQ_EMPTY(&delegated)) {
-    sleepq_signal(&delegated);
+  /* Rotate the bitmap, so that the bucket after the current one comes first,
+   * while the current one comes last. */
+  unsigned first = ((ci.last >> CALLOUT_SHIFT(lvl)) + 1) & CALLOUT_WHEEL_MASK;
+  if (first)
+    word = (word >> first) | (word << (CALLOUT_WHEEL_SIZE - first));
+
+  unsigned i = (first + __builtin_ctzll(word)) & CALLOUT_WHEEL_MASK;
+  return lvl * CALLOUT_WHEEL_SIZE + i;
+}
+
+bool callout_next_event(systime_t *tmp) {
+  SCOPED_MTX_LOCK(&ci.lock);
+
+  bool found = false;
+
+  /* Callouts at upper levels need to be cascaded first, so the result may be
+   * earlier than any deadline. Waking up then is harmless. */
+  for (int lvl = 0; lvl < CALLOUT_LEVELS; lvl++) {
+    if (!ci.nonempty[lvl])
+      continue;
+    systime_t t = callout_bucket_time(callout_next_bucket(lvl));
+    if (!found || (int32_t)(t - *tmp) < 0) {
+      *tmp = t;
+      found = true;
+    }
   }
+
+  return found;
 }
 
 bool callout_drain(callout_t *handle) {
-  SCOPED_INTR_DISABLED();
+  SCOPED_MTX_LOCK(&ci.lock);
   if (!callout_is_pending(handle) && !callout_is_active(handle))
     return false;
   while (callout_is_pending(handle) || callout_is_active(handle))
-    sleepq_wait(handle, NULL, NULL);
+    sleepq_wait(handle, NULL, &ci.lock);
   return true;
 }
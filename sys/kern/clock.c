@@ -1,30 +1,127 @@
 #define KL_LOG KL_TIME
 #include <sys/callout.h>
+#include <sys/hrtimer.h>
+#include <sys/interrupt.h>
 #include <sys/sched.h>
 #include <sys/mimiker.h>
 #include <sys/klog.h>
 #include <sys/timer.h>
 #include <sys/kgprof.h>
+#include <sys/pcpu.h>
+#include <sys/smp.h>
+
+/* Longest time [ticks] an idle processor sleeps without a clock event. */
+#define IDLE_MAX_TICKS CLK_TCK
 
-static systime_t now = 0;
 static timer_t *clock = NULL;
 
+/* If the timer supports one-shot mode, it's reprogrammed for each clock event,
+ * i.e. the next tick or the earliest high-resolution timer. Otherwise the timer
+ * ticks periodically and high-resolution timers get tick accuracy. */
+static bool clock_oneshot;
+
+/* Time of the next clock tick on each processor. */
+static bintime_t next_tick[MAXCPU];
+
+/* Time of the event the clock of each processor is programmed for. */
+static bintime_t next_event[MAXCPU];
+
+/* Processors that stopped their periodic clock tick. */
+static bool clock_stopped[MAXCPU];
+
+/* Time of clock event programmed by the idle boot processor, 0 if it ticks. */
+static atomic_uint idle_deadline;
+
+/* System time updated on each tick of the boot processor. */
+static volatile systime_t systime = 0;
+
+static systime_t clock_update(void) {
+  bintime_t bin = binuptime();
+  systime = bt2st(&bin);
+  return systime;
+}
+
 systime_t getsystime(void) {
-  return now;
+  /* The time source is only read if the clock of the boot processor is
+   * stopped. */
+  if (atomic_load(&idle_deadline) == 0)
+    return systime;
+  bintime_t bin = binuptime();
+  return bt2st(&bin);
 }
 
 static void stat_clock(void) {
   kgprof_tick();
 }
 
-static void clock_cb(timer_t *tm, void *arg) {
-  bintime_t bin = binuptime();
-  now = bt2st(&bin);
-  stat_clock();
-  callout_process(now);
+static void clock_tick(void) {
+  /* Callouts are maintained by the boot processor. */
+  if (PCPU_GET(cpuid) == 0) {
+    stat_clock();
+    callout_process(clock_update());
+  }
   sched_clock();
 }
 
+static void clock_program(int cpu, bintime_t deadline) {
+  next_event[cpu] = deadline;
+  if (tm_reprogram(clock, TMF_ONESHOT, deadline, (bintime_t){}))
+    panic("Failed to program system clock on CPU %d!", cpu);
+}
+
+/* Programs the clock for the next tick or the earliest high-resolution timer,
+ * whichever comes first. */
+static void clock_next_event(int cpu) {
+  bintime_t deadline = next_tick[cpu];
+  bintime_t next;
+
+  if (hrtimer_next_event(&next) && bintime_cmp(&next, &deadline, <))
+    deadline = next;
+
+  clock_program(cpu, deadline);
+}
+
+/* Starts ticking on current processor one period from now. */
+static void clock_start_ticking(int cpu) {
+  bintime_t period = HZ2BT(CLK_TCK);
+
+  next_tick[cpu] = binuptime();
+  bintime_add(&next_tick[cpu], &period);
+  clock_next_event(cpu);
+}
+
+static void clock_cb(timer_t *tm, void *arg) {
+  int cpu = PCPU_GET(cpuid);
+  bintime_t now = binuptime();
+
+  if (!clock_oneshot) {
+    clock_tick();
+    hrtimer_process(now);
+    return;
+  }
+
+  if (bintime_cmp(&now, &next_tick[cpu], >=)) {
+    bintime_t period = HZ2BT(CLK_TCK);
+    clock_tick();
+    /* Ticks missed due to interrupt latency are not made up for. */
+    do {
+      bintime_add(&next_tick[cpu], &period);
+    } while (bintime_cmp(&now, &next_tick[cpu], >=));
+  }
+
+  hrtimer_process(now);
+  clock_next_event(cpu);
+}
+
+static void clock_init_oneshot(void) {
+  if (!clock_oneshot)
+    return;
+
+  WITH_INTR_DISABLED {
+    clock_start_ticking(PCPU_GET(cpuid));
+  }
+}
+
 void init_clock(void) {
   clock = tm_reserve(NULL, TMF_PERIODIC);
   if (clock == NULL)
@@ -33,5 +130,92 @@ void init_clock(void) {
   if (tm_start(clock, TMF_PERIODIC | TMF_TIMESOURCE, (bintime_t){},
                HZ2BT(CLK_TCK)))
     panic("Failed to start system clock!");
-  klog("System clock uses \'%s\' hardware timer.", clock->tm_name);
+  clock_oneshot = clock->tm_flags & TMF_ONESHOT;
+  clock_init_oneshot();
+  klog("System clock uses \'%s\' hardware timer in %s mode.", clock->tm_name,
+       clock_oneshot ? "one-shot" : "periodic");
+}
+
+void init_clock_cpu(void) {
+  if (tm_start_cpu(clock, TMF_PERIODIC, (bintime_t){}, HZ2BT(CLK_TCK)))
+    panic("Failed to start system clock on CPU %d!", PCPU_GET(cpuid));
+  clock_init_oneshot();
+}
+
+void clock_idle_enter(void) {
+  assert(intr_disabled());
+
+  if (!clock_oneshot)
+    return;
+
+  int cpu = PCPU_GET(cpuid);
+  systime_t now = getsystime();
+  systime_t deadline = now + IDLE_MAX_TICKS;
+
+  /* Only the boot processor needs to wake up for callouts. From now on any
+   * callout due before `idle_deadline` will interrupt its sleep, so none can
+   * be missed while we look for the earliest one. */
+  if (cpu == 0) {
+    systime_t next;
+    atomic_store(&idle_deadline, deadline);
+    if (callout_next_event(&next) && next < deadline)
+      deadline = max(next, now + 1);
+    atomic_store(&idle_deadline, deadline);
+  }
+
+  /* Skip ticks until the deadline. High-resolution timers of this processor
+   * still get their clock events. */
+  clock_stopped[cpu] = true;
+  next_tick[cpu] = st2bt(deadline);
+  clock_next_event(cpu);
+}
+
+void clock_idle_exit(void) {
+  assert(intr_disabled());
+
+  int cpu = PCPU_GET(cpuid);
+
+  if (!clock_stopped[cpu])
+    return;
+
+  clock_stopped[cpu] = false;
+  clock_start_ticking(cpu);
+
+  /* Catch up with callouts that became due while the clock was stopped. */
+  if (cpu == 0) {
+    systime_t tm = clock_update();
+    atomic_store(&idle_deadline, 0);
+    callout_process(tm);
+  }
+}
+
+void clock_event_scheduled(systime_t tm) {
+  systime_t deadline = atomic_load(&idle_deadline);
+
+  /* Any interrupt makes the idle processor reprogram its clock. */
+  if (deadline && tm < deadline && PCPU_GET(cpuid) != 0)
+    smp_ipi_send(0, IPI_RESCHED);
+}
+
+void clock_hrtimer_scheduled(int cpu, bintime_t deadline) {
+  assert(intr_disabled());
+
+  if (!clock_oneshot)
+    return;
+
+  /* A timer may be rearmed on behalf of another processor, which has to
+   * program its own clock. */
+  if (cpu != PCPU_GET(cpuid))
+    smp_ipi_send(cpu, IPI_HRTIMER);
+  else if (bintime_cmp(&deadline, &next_event[cpu], <))
+    clock_program(cpu, deadline);
+}
+
+void clock_hrtimer_ipi(void) {
+  int cpu = PCPU_GET(cpuid);
+  bintime_t deadline;
+
+  if (clock_oneshot && hrtimer_next_event(&deadline) &&
+      bintime_cmp(&deadline, &next_event[cpu], <))
+    clock_program(cpu, deadline);
 }
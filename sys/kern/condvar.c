@@ -9,40 +9,35 @@ void cv_init(condvar_t *cv, const char *name) {
 }
 
 void cv_wait(condvar_t *cv, mtx_t *m) {
-  WITH_INTR_DISABLED {
-    cv->waiters++;
-    mtx_unlock(m);
-    /* If we got interrupted here and an interrupt filter called
-     * cv_signal, we would have a lost wakeup, so we need interrupts
-     * to be disabled. Same goes for cv_wait_timed. */
-    sleepq_wait(cv, __caller(0), NULL);
-  }
-  _mtx_lock(m, __caller(0));
+  /* The sleep queue chain gets locked before `m` is released, so we can't
+   * miss a wakeup, even if `cv_signal` is called on another processor. */
+  atomic_fetch_add(&cv->waiters, 1);
+  sleepq_wait(cv, __caller(0), m);
 }
 
 int cv_wait_timed(condvar_t *cv, mtx_t *m, systime_t timeout) {
-  int status;
-  WITH_INTR_DISABLED {
-    cv->waiters++;
-    mtx_unlock(m);
-    status = sleepq_wait_timed(cv, __caller(0), NULL, timeout);
-  }
-  _mtx_lock(m, __caller(0));
-  return status;
+  atomic_fetch_add(&cv->waiters, 1);
+  return sleepq_wait_timed(cv, __caller(0), m, timeout);
+}
+
+int cv_wait_until(condvar_t *cv, mtx_t *m, bintime_t deadline) {
+  atomic_fetch_add(&cv->waiters, 1);
+  return sleepq_wait_until(cv, __caller(0), m, deadline);
 }
 
 void cv_signal(condvar_t *cv) {
   SCOPED_NO_PREEMPTION();
-  if (cv->waiters > 0) {
-    cv->waiters--;
-    sleepq_signal(cv);
+  int waiters = atomic_load(&cv->waiters);
+  while (waiters > 0) {
+    if (atomic_compare_exchange_weak(&cv->waiters, &waiters, waiters - 1)) {
+      sleepq_signal(cv);
+      break;
+    }
   }
 }
 
 void cv_broadcast(condvar_t *cv) {
   SCOPED_NO_PREEMPTION();
-  if (cv->waiters > 0) {
-    cv->waiters = 0;
+  if (atomic_exchange(&cv->waiters, 0) > 0)
     sleepq_broadcast(cv);
-  }
 }
@@ -11,6 +11,7 @@
 #include <sys/vfs.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/bio.h>
 
 static KMALLOC_DEFINE(M_DEVFS, "devfs");
 
@@ -121,6 +122,7 @@ static int devfs_add_entry(devfs_node_t *parent, const char *name, int mode,
   devfs_node_t *dn = devfs_node_create(name, mode);
   dn->dn_parent = parent;
   TAILQ_INSERT_TAIL(&parent->dn_children, dn, dn_link);
+  vfs_namecache_remove(parent->dn_vnode, &COMPONENTNAME(name));
   if (mode & S_IFDIR)
     parent->dn_nlinks++;
   *dnp = dn;
@@ -142,13 +144,17 @@ static int devfs_fop_read(file_t *fp, uio_t *uio) {
   devnode_t *dev = fp->f_data;
   int err;
 
-  if (dev->ops->d_type & DT_SEEKABLE)
+  if (dev->ops->d_type & DT_SEEKABLE) {
     uio->uio_offset = fp->f_offset;
+    uio->uio_ioflags |= file_seqcount(fp, uio);
+  }
 
   err = dev->ops->d_read(dev, uio);
 
-  if (dev->ops->d_type & DT_SEEKABLE)
+  if (dev->ops->d_type & DT_SEEKABLE) {
     fp->f_offset = uio->uio_offset;
+    file_seqdone(fp, uio);
+  }
 
   return err;
 }
@@ -157,24 +163,31 @@ static int devfs_fop_write(file_t *fp, uio_t *uio) {
   devnode_t *dev = fp->f_data;
   int err;
 
-  if (dev->ops->d_type & DT_SEEKABLE)
+  if (dev->ops->d_type & DT_SEEKABLE) {
     uio->uio_offset = fp->f_offset;
+    uio->uio_ioflags |= file_seqcount(fp, uio);
+  }
 
   err = dev->ops->d_write(dev, uio);
 
-  if (dev->ops->d_type & DT_SEEKABLE)
+  if (dev->ops->d_type & DT_SEEKABLE) {
     fp->f_offset = uio->uio_offset;
+    file_seqdone(fp, uio);
+  }
 
   return err;
 }
 
 static int devfs_fop_close(file_t *fp) {
-  int error;
+  int error = 0, err;
   devnode_t *dev = fp->f_data;
   refcnt_release(&dev->refcnt);
-  error = dev->ops->d_close(dev, fp);
+  /* Push out delayed writes, so the data is on the disk after close. */
+  if (dev->ops->d_type == DT_DISK)
+    error = bio_flush(dev);
+  err = dev->ops->d_close(dev, fp);
   vnode_drop(fp->f_vnode);
-  return error;
+  return error ? error : err;
 }
 
 static int devfs_fop_seek(file_t *fp, off_t offset, int whence,
@@ -465,6 +478,15 @@ int devfs_makedev_new(devfs_node_t *parent, const char *name, devops_t *devops,
     if ((error = _devfs_makedev(parent, name, data, &dn)))
       return error;
 
+    /* Disks are read and written through the buffer cache by default. */
+    if (devops->d_type == DT_DISK) {
+      assert(devops->d_strategy != NULL);
+      if (devops->d_read == NULL)
+        devops->d_read = bio_read;
+      if (devops->d_write == NULL)
+        devops->d_write = bio_write;
+    }
+
     if (devops->d_open == NULL)
       devops->d_open = dev_noopen;
     if (devops->d_close == NULL)
@@ -527,6 +549,17 @@ void *devfs_node_data(vnode_t *v) {
   return devfs_node_of(v)->dn_device.data;
 }
 
+int devfs_fsync(file_t *fp) {
+  /* Only opened device files refer to a devnode. */
+  if (fp->f_ops != &devfs_fileops)
+    return 0;
+
+  devnode_t *dev = fp->f_data;
+  if (dev->ops->d_type != DT_DISK)
+    return 0;
+  return bio_flush(dev);
+}
+
 int devfs_makedir(devfs_node_t *parent, const char *name,
                   devfs_node_t **dir_p) {
   SCOPED_MTX_LOCK(&devfs.lock);
@@ -553,6 +586,7 @@ int devfs_unlink(devfs_node_t *dn) {
     return ENOTEMPTY;
 
   TAILQ_REMOVE(&parent->dn_children, dn, dn_link);
+  vfs_namecache_remove(parent->dn_vnode, &COMPONENTNAME(dn->dn_name));
   if (dn->dn_device.mode & S_IFDIR)
     parent->dn_nlinks--;
   vnode_drop(dn->dn_vnode);
@@ -245,40 +245,45 @@ static int kqueue_register(kqueue_t *kq, kevent_t *kev, void *obj) {
  */
 static int kqueue_scan(kqueue_t *kq, kevent_t *eventlist, size_t nevents,
                        timespec_t *tsp, int *retval) {
-  int error, event, timeout;
+  int error, event;
   size_t count = 0;
-  systime_t sleepts;
+  bool block = true;
+  bintime_t deadline;
   knote_tailq_t knqueue;
   knote_t *kn;
 
   TAILQ_INIT(&knqueue);
 
   if (tsp) {
-    timeout = ts2hz(tsp);
-    sleepts = getsystime() + timeout;
-    if (timeout <= 0)
-      timeout = -1; /* don't block */
-  } else {
-    timeout = 0; /* no timeout, wait forever */
+    if (tsp->tv_sec < 0 || !timespecisset(tsp)) {
+      block = false;
+    } else {
+      bintime_t now = binuptime();
+      ts2bt(tsp, &deadline);
+      bintime_add(&deadline, &now);
+    }
   }
 
   mtx_lock(&kq->kq_lock);
 
   /* Block until there are no events or we time out. */
   while (kq->kq_count == 0) {
-    if (timeout < 0) {
+    if (!block) {
       error = 0;
       goto done;
     }
 
-    error = cv_wait_timed(&kq->kq_cv, &kq->kq_lock, timeout);
+    if (tsp)
+      error = cv_wait_until(&kq->kq_cv, &kq->kq_lock, deadline);
+    else
+      error = cv_wait_intr(&kq->kq_cv, &kq->kq_lock);
     if (error == EINTR) {
       mtx_unlock(&kq->kq_lock);
       return EINTR;
     }
 
-    if (tsp)
-      timeout = sleepts - getsystime();
+    if (error == ETIMEDOUT)
+      block = false;
   }
 
   /* To ensure the correctness of the iteration over pending events,
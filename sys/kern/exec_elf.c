@@ -3,8 +3,11 @@
 #define _EXEC_IMPL
 #include <sys/exec.h>
 #include <sys/libkern.h>
+#include <sys/pmap.h>
 #include <sys/vm_map.h>
 #include <sys/vm_object.h>
+#include <sys/vm_pager.h>
+#include <sys/vm_physmem.h>
 #include <sys/malloc.h>
 #include <sys/errno.h>
 #include <sys/vnode.h>
@@ -83,42 +86,93 @@ int exec_elf_inspect(vnode_t *vn, Elf_Ehdr *eh) {
   return 0;
 }
 
-static int load_elf_segment(proc_t *p, vnode_t *vn, Elf_Phdr *ph) {
+static vm_prot_t elf_segment_prot(Elf_Phdr *ph) {
+  vm_prot_t prot = VM_PROT_NONE;
+  if (ph->p_flags & PF_R)
+    prot |= VM_PROT_READ;
+  if (ph->p_flags & PF_W)
+    prot |= VM_PROT_WRITE;
+  if (ph->p_flags & PF_X)
+    prot |= VM_PROT_EXEC;
+  return prot;
+}
+
+/* Takes over the reference to `obj`. Segments of a well-formed ELF file do not
+ * overlap, and must fit into user space. */
+static int map_elf_entry(proc_t *p, vm_object_t *obj, vaddr_t start,
+                         vaddr_t end, off_t offset, vm_prot_t prot) {
+  vm_map_entry_t *ent;
+  if (vm_map_alloc_entry(p->p_uspace, obj, offset, start, end - start, prot,
+                         VM_FIXED | VM_EXCL | VM_PRIVATE, &ent)) {
+    klog("Exec failed: ELF segment at %p cannot be mapped.", (void *)start);
+    return ENOEXEC;
+  }
+  return 0;
+}
+
+/* Segment's file contents are paged in on demand from the vnode. Pages are
+ * mapped copy-on-write through a shadow object, and the part of the segment
+ * that doesn't come from the file (i.e. .bss) is backed by anonymous memory. */
+static int map_elf_segment(proc_t *p, vnode_t *vn, Elf_Phdr *ph) {
+  vaddr_t start = ph->p_vaddr;
+  vaddr_t end = roundup(ph->p_vaddr + ph->p_memsz, PAGESIZE);
+  vaddr_t file_end = roundup(ph->p_vaddr + ph->p_filesz, PAGESIZE);
+  vm_prot_t prot = elf_segment_prot(ph);
   int error;
 
-  /* Avoid creating empty vm_map entries for segments that occupy no space in
-   * memory, as they might overlap with subsequent segments. */
-  if (ph->p_memsz == 0)
-    return 0;
+  if (ph->p_filesz > 0) {
+    vm_object_t *vobj = vnode_pager_object(vn);
+    vm_object_t *obj = vm_object_shadow(vobj);
+    vm_object_drop(vobj);
+
+    /* The page where file contents end and .bss begins must have its tail
+     * cleared, so it cannot be shared with the vnode. */
+    size_t tail = ph->p_filesz & (PAGESIZE - 1);
+    if (ph->p_memsz > ph->p_filesz && tail > 0) {
+      off_t offset = ph->p_offset + ph->p_filesz - tail;
+      vm_page_t *pg = vm_page_alloc(1);
+      pmap_zero_page(pg);
+      uio_t uio =
+        UIO_SINGLE_KERNEL(UIO_READ, offset, phys_to_dmap(pg->paddr), tail);
+      if ((error = VOP_READ(vn, &uio))) {
+        klog("Exec failed: Reading ELF segment failed.");
+        vm_page_free(pg);
+        vm_object_drop(obj);
+        return error;
+      }
+      vm_object_add_page(obj, offset, pg);
+    }
 
-  klog("PT_LOAD: VAddr %08x Offset %08x FileSz %08x MemSz %08x Flags %d",
-       (void *)ph->p_vaddr, (unsigned)ph->p_offset, (unsigned)ph->p_filesz,
-       (unsigned)ph->p_memsz, (unsigned)ph->p_flags);
+    if ((error = map_elf_entry(p, obj, start, file_end, ph->p_offset, prot)))
+      return error;
+    start = file_end;
+  }
 
-  if (!page_aligned_p(ph->p_vaddr)) {
-    klog("Exec failed: Segment virtual address is not page aligned!");
-    return ENOEXEC;
+  if (start < end) {
+    vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+    if ((error = map_elf_entry(p, obj, start, end, 0, prot)))
+      return error;
   }
 
+  return 0;
+}
+
+/* Fallback for segments which file offset is not congruent with virtual
+ * address modulo page size, hence cannot be mapped from the vnode. */
+static int copy_elf_segment(proc_t *p, vnode_t *vn, Elf_Phdr *ph) {
+  int error;
+
   vaddr_t start = ph->p_vaddr;
   vaddr_t end = roundup(ph->p_vaddr + ph->p_memsz, PAGESIZE);
 
   /* Temporarily permissive protection. */
   vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
-  vm_map_entry_t *ent = vm_map_entry_alloc(
-    obj, start, end, VM_PROT_READ | VM_PROT_WRITE | VM_PROT_EXEC,
-    VM_ENT_PRIVATE);
-  error = vm_map_insert(p->p_uspace, ent, VM_FIXED);
-  /* TODO: What if segments overlap? */
-  assert(error == 0);
+  if ((error = map_elf_entry(p, obj, start, end, 0,
+                             VM_PROT_READ | VM_PROT_WRITE | VM_PROT_EXEC)))
+    return error;
 
   /* Read data from file into the map entry */
   if (ph->p_filesz > 0) {
-    /* TODO: This is a lot of copying! Ideally we would look up the
-     * vm_object associated with the elf vnode, create a shadow vm_object
-     * on top of it using correct size/offset, and we would use it to page
-     * the file contents on demand. But we don't have a vnode_pager yet.
-     */
     uio_t uio =
       UIO_SINGLE_USER(UIO_READ, ph->p_offset, (char *)start, ph->p_filesz);
     if ((error = VOP_READ(vn, &uio))) {
@@ -129,18 +183,30 @@ static int load_elf_segment(proc_t *p, vnode_t *vn, Elf_Phdr *ph) {
   }
 
   /* Apply correct permissions */
-  vm_prot_t prot = VM_PROT_NONE;
-  if (ph->p_flags & PF_R)
-    prot |= VM_PROT_READ;
-  if (ph->p_flags & PF_W)
-    prot |= VM_PROT_WRITE;
-  if (ph->p_flags & PF_X)
-    prot |= VM_PROT_EXEC;
-
-  vm_map_protect(p->p_uspace, start, end, prot);
+  vm_map_protect(p->p_uspace, start, end, elf_segment_prot(ph));
   return 0;
 }
 
+static int load_elf_segment(proc_t *p, vnode_t *vn, Elf_Phdr *ph) {
+  /* Avoid creating empty vm_map entries for segments that occupy no space in
+   * memory, as they might overlap with subsequent segments. */
+  if (ph->p_memsz == 0)
+    return 0;
+
+  klog("PT_LOAD: VAddr %08x Offset %08x FileSz %08x MemSz %08x Flags %d",
+       (void *)ph->p_vaddr, (unsigned)ph->p_offset, (unsigned)ph->p_filesz,
+       (unsigned)ph->p_memsz, (unsigned)ph->p_flags);
+
+  if (!page_aligned_p(ph->p_vaddr)) {
+    klog("Exec failed: Segment virtual address is not page aligned!");
+    return ENOEXEC;
+  }
+
+  if (page_aligned_p(ph->p_offset))
+    return map_elf_segment(p, vn, ph);
+  return copy_elf_segment(p, vn, ph);
+}
+
 int exec_elf_load(proc_t *p, vnode_t *vn, Elf_Ehdr *eh) {
   /* We know that ELF header was verified in inspect function. */
   int error;
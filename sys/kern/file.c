@@ -1,4 +1,5 @@
 #include <sys/file.h>
+#include <sys/uio.h>
 #include <sys/pool.h>
 #include <sys/libkern.h>
 #include <sys/errno.h>
@@ -36,6 +37,28 @@ void file_drop(file_t *f) {
     file_destroy(f);
 }
 
+/* Amount of data that increases sequential access count by one. */
+#define SEQ_UNIT 16384
+
+unsigned file_seqcount(file_t *f, uio_t *uio) {
+  /* Access that begins where the previous one ended is sequential. Rewinding
+   * the file to the beginning does not break a sequence either. */
+  if (uio->uio_offset == f->f_nextoff ||
+      (uio->uio_offset == 0 && f->f_seqcount > 0)) {
+    f->f_seqcount += howmany(uio->uio_resid, SEQ_UNIT);
+    if (f->f_seqcount > IO_SEQMAX)
+      f->f_seqcount = IO_SEQMAX;
+    return f->f_seqcount << IO_SEQSHIFT;
+  }
+
+  f->f_seqcount = 0;
+  return 0;
+}
+
+void file_seqdone(file_t *f, uio_t *uio) {
+  f->f_nextoff = uio->uio_offset;
+}
+
 int nowrite(file_t *f, uio_t *uio) {
   return EBADF;
 }
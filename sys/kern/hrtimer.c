@@ -0,0 +1,231 @@
+#define KL_LOG KL_TIME
+#include <sys/klog.h>
+#include <sys/libkern.h>
+#include <sys/mimiker.h>
+#include <sys/hrtimer.h>
+#include <sys/mutex.h>
+#include <sys/pcpu.h>
+#include <sys/sleepq.h>
+#include <sys/thread.h>
+#include <sys/sched.h>
+#include <sys/interrupt.h>
+
+#define hrtimer_is_active(ht) ((ht)->ht_flags & HRT_ACTIVE)
+#define hrtimer_set_active(ht) ((ht)->ht_flags |= HRT_ACTIVE)
+#define hrtimer_clear_active(ht) ((ht)->ht_flags &= ~HRT_ACTIVE)
+
+#define hrtimer_is_pending(ht) ((ht)->ht_flags & HRT_PENDING)
+#define hrtimer_set_pending(ht) ((ht)->ht_flags |= HRT_PENDING)
+#define hrtimer_clear_pending(ht) ((ht)->ht_flags &= ~HRT_PENDING)
+
+#define hrtimer_is_stopped(ht) ((ht)->ht_flags & HRT_STOPPED)
+#define hrtimer_set_stopped(ht) ((ht)->ht_flags |= HRT_STOPPED)
+#define hrtimer_clear_stopped(ht) ((ht)->ht_flags &= ~HRT_STOPPED)
+
+typedef TAILQ_HEAD(hrtimer_list, hrtimer) hrtimer_list_t;
+
+/* Timers pending on a processor. The lock also protects state of the timers
+ * that were armed on the processor, i.e. `ht_cpu` points at it, until they
+ * are armed again. */
+typedef struct hrtimer_cpu {
+  mtx_t lock;
+  hrtimer_list_t pending; /* sorted by deadline */
+} hrtimer_cpu_t;
+
+static struct {
+  hrtimer_cpu_t cpu[MAXCPU];
+  /* Expired timers waiting for hrtimer thread. If both are needed, lock of
+   * a processor must be acquired before `delegated_lock`. */
+  hrtimer_list_t delegated;
+  mtx_t delegated_lock;
+} hi;
+
+/* Locks the processor that `ht` was armed on. A timer is only moved to another
+ * processor when it's armed again, so the loop rarely takes another turn. */
+static hrtimer_cpu_t *hrtimer_lock(hrtimer_t *ht) {
+  while (true) {
+    hrtimer_cpu_t *hc = &hi.cpu[ht->ht_cpu];
+    mtx_lock(&hc->lock);
+    if (hc == &hi.cpu[ht->ht_cpu])
+      return hc;
+    mtx_unlock(&hc->lock);
+  }
+}
+
+/* Calls function of an expired timer and wakes up its drainers. */
+static void hrtimer_run(hrtimer_t *ht) {
+  assert(hrtimer_is_active(ht));
+  assert(!hrtimer_is_pending(ht));
+
+  ht->ht_func(ht->ht_arg);
+
+  hrtimer_cpu_t *hc = hrtimer_lock(ht);
+  hrtimer_clear_active(ht);
+  /* Only notify waiters if the timer isn't already pending
+   * due to a reschedule. */
+  if (!hrtimer_is_pending(ht))
+    sleepq_broadcast(ht);
+  mtx_unlock(&hc->lock);
+}
+
+static void hrtimer_thread(void *arg) {
+  while (true) {
+    hrtimer_t *ht;
+
+    WITH_MTX_LOCK (&hi.delegated_lock) {
+      while (TAILQ_EMPTY(&hi.delegated))
+        sleepq_wait(&hi.delegated, NULL, &hi.delegated_lock);
+
+      ht = TAILQ_FIRST(&hi.delegated);
+      TAILQ_REMOVE(&hi.delegated, ht, ht_link);
+    }
+
+    hrtimer_run(ht);
+  }
+}
+
+void init_hrtimer(void) {
+  bzero(&hi, sizeof(hi));
+
+  for (int i = 0; i < MAXCPU; i++) {
+    mtx_init(&hi.cpu[i].lock, MTX_SPIN);
+    TAILQ_INIT(&hi.cpu[i].pending);
+  }
+
+  mtx_init(&hi.delegated_lock, MTX_SPIN);
+  TAILQ_INIT(&hi.delegated);
+
+  thread_t *td =
+    thread_create("hrtimer", hrtimer_thread, NULL, prio_kthread(0));
+  sched_add(td);
+}
+
+void hrtimer_setup(hrtimer_t *ht, hrtimer_fn_t fn, void *arg, uint32_t flags) {
+  bzero(ht, sizeof(hrtimer_t));
+  ht->ht_func = fn;
+  ht->ht_arg = arg;
+  ht->ht_flags = flags & HRT_DIRECT;
+}
+
+static void _hrtimer_start(hrtimer_t *ht, bintime_t deadline) {
+  hrtimer_list_t *pending = &hi.cpu[ht->ht_cpu].pending;
+  hrtimer_t *next;
+
+  assert(mtx_owned(&hi.cpu[ht->ht_cpu].lock));
+  assert(!hrtimer_is_pending(ht));
+
+  hrtimer_set_pending(ht);
+  ht->ht_time = deadline;
+
+  /* Sorted insertion takes time linear in the number of timers pending on
+   * the processor, which is expected to be small. Timers with equal deadlines
+   * expire in order they were armed. */
+  TAILQ_FOREACH (next, pending, ht_link) {
+    if (bintime_cmp(&deadline, &next->ht_time, <))
+      break;
+  }
+
+  if (next)
+    TAILQ_INSERT_BEFORE(next, ht, ht_link);
+  else
+    TAILQ_INSERT_TAIL(pending, ht, ht_link);
+
+  /* The clock is programmed for the earliest timer only. */
+  if (TAILQ_FIRST(pending) == ht)
+    clock_hrtimer_scheduled(ht->ht_cpu, deadline);
+}
+
+void hrtimer_start(hrtimer_t *ht, bintime_t deadline) {
+  SCOPED_NO_PREEMPTION();
+  int cpu = PCPU_GET(cpuid);
+  SCOPED_MTX_LOCK(&hi.cpu[cpu].lock);
+  assert(!hrtimer_is_active(ht));
+
+  /* The timer is idle, so it can be moved to current processor. */
+  ht->ht_cpu = cpu;
+  hrtimer_clear_stopped(ht);
+  _hrtimer_start(ht, deadline);
+}
+
+bool hrtimer_reschedule(hrtimer_t *ht, bintime_t deadline) {
+  /* Drainers of an active timer wait under the lock of its processor, so it
+   * must stay there, even if its function runs on another one. */
+  hrtimer_cpu_t *hc = hrtimer_lock(ht);
+  assert(hrtimer_is_active(ht));
+  bool stopped = hrtimer_is_stopped(ht);
+  if (!stopped)
+    _hrtimer_start(ht, deadline);
+  mtx_unlock(&hc->lock);
+  return !stopped;
+}
+
+bool hrtimer_stop(hrtimer_t *ht) {
+  hrtimer_cpu_t *hc = hrtimer_lock(ht);
+
+  hrtimer_set_stopped(ht);
+
+  if (hrtimer_is_pending(ht)) {
+    hrtimer_clear_pending(ht);
+    TAILQ_REMOVE(&hc->pending, ht, ht_link);
+    /* If the timer rescheduled itself while running, the caller still needs
+     * to wait for its completion in hrtimer_drain(). */
+  }
+
+  bool stopped = !hrtimer_is_active(ht);
+  mtx_unlock(&hc->lock);
+  return stopped;
+}
+
+bool hrtimer_drain(hrtimer_t *ht) {
+  hrtimer_cpu_t *hc = hrtimer_lock(ht);
+  bool blocked = hrtimer_is_pending(ht) || hrtimer_is_active(ht);
+  while (hrtimer_is_pending(ht) || hrtimer_is_active(ht))
+    sleepq_wait(ht, NULL, &hc->lock);
+  mtx_unlock(&hc->lock);
+  return blocked;
+}
+
+void hrtimer_process(bintime_t now) {
+  /* We are in kernel's bottom half. */
+  assert(intr_disabled());
+
+  hrtimer_cpu_t *hc = &hi.cpu[PCPU_GET(cpuid)];
+  hrtimer_t *ht;
+
+  SCOPED_MTX_LOCK(&hc->lock);
+
+  while ((ht = TAILQ_FIRST(&hc->pending))) {
+    if (bintime_cmp(&ht->ht_time, &now, >))
+      break;
+
+    TAILQ_REMOVE(&hc->pending, ht, ht_link);
+    hrtimer_clear_pending(ht);
+    hrtimer_set_active(ht);
+
+    if (ht->ht_flags & HRT_DIRECT) {
+      /* The function may want to rearm or stop the timer. */
+      mtx_unlock(&hc->lock);
+      hrtimer_run(ht);
+      mtx_lock(&hc->lock);
+    } else {
+      WITH_MTX_LOCK (&hi.delegated_lock) {
+        TAILQ_INSERT_TAIL(&hi.delegated, ht, ht_link);
+        /* Wake hrtimer thread. */
+        sleepq_signal(&hi.delegated);
+      }
+    }
+  }
+}
+
+bool hrtimer_next_event(bintime_t *btp) {
+  hrtimer_cpu_t *hc = &hi.cpu[PCPU_GET(cpuid)];
+
+  SCOPED_MTX_LOCK(&hc->lock);
+
+  hrtimer_t *ht = TAILQ_FIRST(&hc->pending);
+  if (ht == NULL)
+    return false;
+
+  *btp = ht->ht_time;
+  return true;
+}
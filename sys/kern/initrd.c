@@ -13,6 +13,11 @@
 #include <sys/dirent.h>
 #include <sys/kenv.h>
 #include <sys/pmap.h>
+#include <sys/hash.h>
+#include <sys/lz4.h>
+#include <sys/mutex.h>
+#include <sys/time.h>
+#include <sys/vm_physmem.h>
 
 typedef uint32_t cpio_dev_t;
 typedef uint32_t cpio_ino_t;
@@ -20,6 +25,7 @@ typedef uint16_t cpio_mode_t;
 
 typedef struct cpio_node cpio_node_t;
 typedef TAILQ_HEAD(, cpio_node) cpio_list_t;
+typedef LIST_HEAD(, cpio_node) cpio_hashhead_t;
 
 /* ramdisk related data that will be stored in v_data field of vnode */
 struct cpio_node {
@@ -27,6 +33,8 @@ struct cpio_node {
   cpio_list_t c_children;        /* head of list of direct descendants */
   cpio_node_t *c_parent;         /* pointer to parent or NULL for root node */
   TAILQ_ENTRY(cpio_node) c_siblings; /* nodes that have the same parent */
+  LIST_ENTRY(cpio_node) c_hash;      /* entry on path index chain */
+  uint32_t c_pathhash;               /* hash of `c_path` */
 
   cpio_dev_t c_dev;
   cpio_ino_t c_ino;
@@ -40,15 +48,43 @@ struct cpio_node {
 
   const char *c_path; /* contains exact path to file as archived by cpio */
   const char *c_name; /* contains name of file */
-  void *c_data;
+  size_t c_offset;    /* offset of file contents within the archive */
   /* Associated vnode. */
   vnode_t *c_vnode;
 };
 
+/*
+ * Compressed image made by `mkinitrd.py --compress`. The archive is split into
+ * blocks of a page, each compressed with LZ4 on its own, so that a block is
+ * decompressed only when it's accessed for the first time. A block that
+ * wouldn't get smaller is stored as it is. The header is followed by offsets
+ * of blocks within the image, the last one marks the end of the image.
+ * All fields are little-endian.
+ */
+#define INITRD_ZMAGIC "MIMIRDZ"
+
+typedef struct initrd_zhdr {
+  char z_magic[8];     /* INITRD_ZMAGIC */
+  uint32_t z_blksize;  /* size of uncompressed block */
+  uint32_t z_nblocks;  /* number of blocks */
+  uint64_t z_size;     /* size of uncompressed archive */
+  uint32_t z_offset[]; /* offsets of blocks (z_nblocks + 1 entries) */
+} initrd_zhdr_t;
+
 static KMALLOC_DEFINE(M_INITRD, "initrd");
 
+static void *rd_image;         /* ramdisk image in direct map */
+static size_t rd_size;         /* size of the archive */
+static initrd_zhdr_t *rd_zhdr; /* header of compressed image (or NULL) */
+static vm_page_t **rd_blocks;  /* decompressed blocks (if compressed) */
+static MTX_DEFINE(rd_lock, 0); /* protects `rd_blocks` */
+
 static cpio_list_t initrd_head = TAILQ_HEAD_INITIALIZER(initrd_head);
 static cpio_node_t *root_node;
+static size_t initrd_nnodes;
+/* Path index, which has at least as many chains as there are nodes. */
+static cpio_hashhead_t *initrd_hashtbl;
+static uint32_t initrd_hashmask;
 static vnodeops_t initrd_vops;
 
 static const unsigned ft2vt[16] = {[C_CHR] = V_DEV,
@@ -69,18 +105,78 @@ static void cpio_node_dump(cpio_node_t *cn) {
        cn->c_mode, cn->c_nlink, cn->c_uid, cn->c_gid, cn->c_size, cn->c_mtime);
 }
 
-static void read_bytes(void **tape, void *ptr, size_t bytes) {
-  memcpy(ptr, *tape, bytes);
+/* Returns page of the compressed archive with block `blk`, which gets
+ * decompressed on first access. */
+static vm_page_t *initrd_zblock(size_t blk) {
+  assert(blk < rd_zhdr->z_nblocks);
+
+  SCOPED_MTX_LOCK(&rd_lock);
+
+  vm_page_t *pg = rd_blocks[blk];
+  if (pg)
+    return pg;
+
+  pg = vm_page_alloc(1);
+  void *dst = phys_to_dmap(pg->paddr);
+  void *src = rd_image + rd_zhdr->z_offset[blk];
+  size_t srclen = rd_zhdr->z_offset[blk + 1] - rd_zhdr->z_offset[blk];
+  size_t len = min(rd_size - blk * PAGESIZE, (size_t)PAGESIZE);
+  size_t dstlen = len;
+
+  if (srclen >= len)
+    memcpy(dst, src, len);
+  else if (lz4_decompress(src, srclen, dst, &dstlen) || dstlen != len)
+    panic("initrd: block %lu is corrupted", blk);
+
+  /* Page belongs to the ramdisk, even if it gets mapped by vnode pager. */
+  pg->flags |= PG_FIXED;
+  rd_blocks[blk] = pg;
+  return pg;
+}
+
+/* Returns address of `blk`-th page of the archive. */
+static void *initrd_block(size_t blk) {
+  if (!rd_zhdr)
+    return rd_image + blk * PAGESIZE;
+  return phys_to_dmap(initrd_zblock(blk)->paddr);
+}
+
+static void initrd_copy(size_t offset, void *ptr, size_t bytes) {
+  while (bytes > 0) {
+    size_t skip = offset % PAGESIZE;
+    size_t len = min(bytes, PAGESIZE - skip);
+    memcpy(ptr, initrd_block(offset / PAGESIZE) + skip, len);
+    offset += len;
+    ptr += len;
+    bytes -= len;
+  }
+}
+
+static int initrd_uiomove(cpio_node_t *cn, size_t size, uio_t *uio) {
+  int error = 0;
+
+  while (!error && uio->uio_resid > 0 && (size_t)uio->uio_offset < size) {
+    size_t offset = cn->c_offset + uio->uio_offset;
+    size_t skip = offset % PAGESIZE;
+    size_t len = min(size - uio->uio_offset, PAGESIZE - skip);
+    error = uiomove(initrd_block(offset / PAGESIZE) + skip, len, uio);
+  }
+
+  return error;
+}
+
+static void read_bytes(size_t *tape, void *ptr, size_t bytes) {
+  initrd_copy(*tape, ptr, bytes);
   *tape += bytes;
 }
 
-static void skip_bytes(void **tape, size_t bytes) {
+static void skip_bytes(size_t *tape, size_t bytes) {
   *tape = align(*tape + bytes, 4);
 }
 
 #define MKDEV(major, minor) (((major & 0xff) << 8) | (minor & 0xff))
 
-static bool read_cpio_header(void **tape, cpio_node_t *cpio) {
+static bool read_cpio_header(size_t *tape, cpio_node_t *cpio) {
   cpio_new_hdr_t hdr;
 
   read_bytes(tape, &hdr, sizeof(hdr));
@@ -115,9 +211,12 @@ static bool read_cpio_header(void **tape, cpio_node_t *cpio) {
   cpio->c_size = c_filesize;
   cpio->c_mtime = c_mtime;
 
-  cpio->c_path = *tape;
+  char *path = kmalloc(M_INITRD, c_namesize, 0);
+  initrd_copy(*tape, path, c_namesize);
+  path[c_namesize - 1] = '\0';
+  cpio->c_path = path;
   skip_bytes(tape, c_namesize);
-  cpio->c_data = *tape;
+  cpio->c_offset = *tape;
   skip_bytes(tape, c_filesize);
 
   return true;
@@ -130,12 +229,13 @@ static const char *basename(const char *path) {
 }
 
 static void read_cpio_archive(void) {
-  void *tape = phys_to_dmap(ramdisk_get_start());
+  size_t tape = 0;
 
-  while (true) {
+  while (tape < rd_size) {
     cpio_node_t *node = cpio_node_alloc();
     if (!read_cpio_header(&tape, node) ||
         strcmp(node->c_path, CPIO_TRAILER) == 0) {
+      kfree(M_INITRD, (char *)node->c_path);
       kfree(M_INITRD, node);
       break;
     }
@@ -150,41 +250,71 @@ static void read_cpio_archive(void) {
     node->c_name = basename(node->c_path);
 
     TAILQ_INSERT_HEAD(&initrd_head, node, c_list);
+    initrd_nnodes++;
   }
 }
 
-/* Check if `p1` is a path to file/directory which can be contained directly
- * inside `p2` directory. */
-static bool is_direct_descendant(const char *p1, const char *p2) {
-  int i;
+static cpio_hashhead_t *initrd_bucket(uint32_t hash) {
+  return &initrd_hashtbl[hash & initrd_hashmask];
+}
 
-  for (i = 0; p1[i] && p1[i] == p2[i]; i++)
-    continue;
+/* Hash of path of `name` within directory `dir`. As `hash32_buf` can be
+ * computed piecewise, it's equal to the hash of the whole path. */
+static uint32_t initrd_child_hash(cpio_node_t *dir, const char *name,
+                                  size_t namelen) {
+  uint32_t hash = dir->c_pathhash;
+  if (dir != root_node)
+    hash = hash32_buf("/", 1, hash);
+  return hash32_buf(name, namelen, hash);
+}
 
-  if (p2[i])
-    return false;
+/* Find node with path equal to first `len` characters of `path`. */
+static cpio_node_t *initrd_find_path(const char *path, size_t len) {
+  uint32_t hash = hash32_buf(path, len, HASH32_BUF_INIT);
+  cpio_node_t *it;
 
-  /* Check whether `p1` is valid filename (does not contain '/') */
-  if (p1[i] == '/')
-    i++; /* skip trailing '/' */
-  else if (i > 0)
-    return false;
+  LIST_FOREACH (it, initrd_bucket(hash), c_hash) {
+    if (it->c_pathhash == hash && strncmp(it->c_path, path, len) == 0 &&
+        it->c_path[len] == '\0')
+      return it;
+  }
 
-  return (strchr(p1 + i, '/') == NULL);
+  return NULL;
 }
 
 static void initrd_build_tree(void) {
-  cpio_node_t *parent, *child;
+  cpio_node_t *it;
+
+  size_t nbuckets = 1;
+  while (nbuckets < initrd_nnodes)
+    nbuckets <<= 1;
+  initrd_hashtbl =
+    kmalloc(M_INITRD, sizeof(cpio_hashhead_t) * nbuckets, M_ZERO);
+  initrd_hashmask = nbuckets - 1;
 
-  TAILQ_FOREACH (parent, &initrd_head, c_list) {
-    if (CMTOFT(parent->c_mode) != C_DIR)
+  TAILQ_FOREACH (it, &initrd_head, c_list) {
+    size_t len = strlen(it->c_path);
+    it->c_pathhash = hash32_buf(it->c_path, len, HASH32_BUF_INIT);
+    LIST_INSERT_HEAD(initrd_bucket(it->c_pathhash), it, c_hash);
+  }
+
+  /* All nodes are in the index, so parents can be found regardless of order
+   * of entries in the archive. */
+  TAILQ_FOREACH (it, &initrd_head, c_list) {
+    if (it == root_node)
+      continue;
+
+    size_t dirlen = it->c_name - it->c_path;
+    cpio_node_t *parent =
+      dirlen ? initrd_find_path(it->c_path, dirlen - 1) : root_node;
+
+    if (!parent || CMTOFT(parent->c_mode) != C_DIR) {
+      klog("initrd entry '%s' has no parent directory", it->c_path);
       continue;
-    TAILQ_FOREACH (child, &initrd_head, c_list) {
-      if (parent == child)
-        continue;
-      if (is_direct_descendant(child->c_path, parent->c_path))
-        TAILQ_INSERT_TAIL(&parent->c_children, child, c_siblings);
     }
+
+    it->c_parent = parent;
+    TAILQ_INSERT_TAIL(&parent->c_children, it, c_siblings);
   }
 }
 
@@ -192,7 +322,6 @@ static ino_t initrd_enum_inodes(cpio_node_t *parent, ino_t ino) {
   cpio_node_t *it;
   parent->c_ino = ino++;
   TAILQ_FOREACH (it, &parent->c_children, c_siblings) {
-    it->c_parent = parent;
     if (CMTOFT(it->c_mode) == C_DIR) {
       parent->c_nlink++;
       ino = initrd_enum_inodes(it, ino);
@@ -221,16 +350,8 @@ static int initrd_vnode_lookup(vnode_t *vdir, componentname_t *cn,
   cpio_node_t *it;
   cpio_node_t *cn_dir = (cpio_node_t *)vdir->v_data;
 
-  TAILQ_FOREACH (it, &cn_dir->c_children, c_siblings) {
-    if (componentname_equal(cn, it->c_name)) {
-      *res = vnode_of_cpio_node(it);
-      return 0;
-    }
-  }
-
-  if (componentname_equal(cn, "..") && cn_dir->c_parent) {
-    it = cn_dir->c_parent;
-    *res = vnode_of_cpio_node(it);
+  if (componentname_equal(cn, "..")) {
+    *res = vnode_of_cpio_node(cn_dir->c_parent);
     return 0;
   } else if (componentname_equal(cn, ".")) {
     vnode_hold(vdir);
@@ -238,12 +359,52 @@ static int initrd_vnode_lookup(vnode_t *vdir, componentname_t *cn,
     return 0;
   }
 
+  uint32_t hash = initrd_child_hash(cn_dir, cn->cn_nameptr, cn->cn_namelen);
+
+  LIST_FOREACH (it, initrd_bucket(hash), c_hash) {
+    if (it->c_pathhash == hash && it->c_parent == cn_dir &&
+        componentname_equal(cn, it->c_name)) {
+      *res = vnode_of_cpio_node(it);
+      return 0;
+    }
+  }
+
   return ENOENT;
 }
 
 static int initrd_vnode_read(vnode_t *v, uio_t *uio) {
   cpio_node_t *cn = (cpio_node_t *)v->v_data;
-  return uiomove_frombuf(cn->c_data, cn->c_size, uio);
+  return initrd_uiomove(cn, cn->c_size, uio);
+}
+
+/* Contents of files that span whole pages are page aligned within archives
+ * made by mkinitrd.py, so such pages are mapped straight from the ramdisk
+ * (or from the decompressed block). The last partial page is copied, as the
+ * rest of it holds other entries. */
+static int initrd_vnode_getpage(vnode_t *v, off_t offset, vm_page_t **pgp) {
+  cpio_node_t *cn = (cpio_node_t *)v->v_data;
+  size_t pos = cn->c_offset + offset;
+
+  if (offset < 0 || offset + PAGESIZE > cn->c_size || !page_aligned_p(pos))
+    return EOPNOTSUPP;
+
+  if (rd_zhdr) {
+    *pgp = initrd_zblock(pos / PAGESIZE);
+    return 0;
+  }
+
+  paddr_t pa = ramdisk_get_start() + pos;
+  if (!page_aligned_p(pa) || !(*pgp = vm_page_fixed(pa)))
+    return EOPNOTSUPP;
+
+  return 0;
+}
+
+/* Ramdisk contents may be mapped by processes, so they must never change. */
+static int initrd_vnode_access(vnode_t *v, accmode_t mode, cred_t *cred) {
+  if (mode & VWRITE)
+    return EROFS;
+  return vnode_access_generic(v, mode, cred);
 }
 
 static int initrd_vnode_getattr(vnode_t *v, vattr_t *va) {
@@ -263,8 +424,7 @@ static int initrd_vnode_getattr(vnode_t *v, vattr_t *va) {
 
 static int initrd_vnode_readlink(vnode_t *v, uio_t *uio) {
   cpio_node_t *cn = (cpio_node_t *)v->v_data;
-  return uiomove_frombuf(cn->c_data, min((size_t)cn->c_size, uio->uio_resid),
-                         uio);
+  return initrd_uiomove(cn, cn->c_size, uio);
 }
 
 static inline cpio_node_t *vn2cn(vnode_t *v) {
@@ -343,16 +503,42 @@ static vnodeops_t initrd_vops = {.v_lookup = initrd_vnode_lookup,
                                  .v_read = initrd_vnode_read,
                                  .v_seek = vnode_seek_generic,
                                  .v_getattr = initrd_vnode_getattr,
-                                 .v_access = vnode_access_generic,
-                                 .v_readlink = initrd_vnode_readlink};
+                                 .v_access = initrd_vnode_access,
+                                 .v_readlink = initrd_vnode_readlink,
+                                 .v_getpage = initrd_vnode_getpage};
 
 static int initrd_init(vfsconf_t *vfc) {
   vnodeops_init(&initrd_vops);
 
-  klog("parsing cpio archive of %u bytes", ramdisk_get_size());
+  bintime_t start = binuptime();
+
+  rd_image = phys_to_dmap(ramdisk_get_start());
+  rd_size = ramdisk_get_size();
+
+  if (rd_size >= sizeof(initrd_zhdr_t) &&
+      memcmp(rd_image, INITRD_ZMAGIC, sizeof(INITRD_ZMAGIC)) == 0) {
+    rd_zhdr = rd_image;
+    if (rd_zhdr->z_blksize != PAGESIZE)
+      panic("initrd: blocks of %u bytes are not supported",
+            rd_zhdr->z_blksize);
+    rd_size = rd_zhdr->z_size;
+    rd_blocks =
+      kmalloc(M_INITRD, sizeof(vm_page_t *) * rd_zhdr->z_nblocks, M_ZERO);
+  }
+
+  klog("parsing cpio archive of %lu bytes", rd_size);
   read_cpio_archive();
   initrd_build_tree();
   initrd_enum_inodes(root_node, 2);
+
+  bintime_t elapsed = binuptime();
+  bintime_sub(&elapsed, &start);
+  timespec_t ts;
+  bt2ts(&elapsed, &ts);
+
+  klog("initrd: %lu entries, image of %lu bytes%s, parsed in %ld us",
+       initrd_nnodes, ramdisk_get_size(), rd_zhdr ? " (compressed)" : "",
+       ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
   return 0;
 }
 
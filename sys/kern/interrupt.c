@@ -208,8 +208,10 @@ void intr_event_run_handlers(intr_event_t *ie) {
   }
 
   if (ie_status & IF_DELEGATE) {
-    ie_disable(ie);
-    sleepq_signal(ie);
+    WITH_MTX_LOCK (&ie->ie_lock) {
+      ie_disable(ie);
+      sleepq_signal(ie);
+    }
   }
 
   if (ie_status == IF_STRAY)
@@ -269,13 +271,13 @@ static void intr_thread(void *arg) {
     }
 
     /* If there are still handlers assigned to the interrupt event, enable
-     * interrupts and wait for a wakeup. We do it with interrupts disabled
+     * interrupts and wait for a wakeup. We do it with `ie_lock` held
      * to prevent the wakeup from being lost. */
-    WITH_INTR_DISABLED {
+    WITH_MTX_LOCK (&ie->ie_lock) {
       if (!TAILQ_EMPTY(&ie->ie_handlers))
         ie_enable(ie);
 
-      sleepq_wait(ie, NULL, NULL);
+      sleepq_wait(ie, NULL, &ie->ie_lock);
     }
   }
 }
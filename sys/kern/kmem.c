@@ -24,8 +24,10 @@ void init_kmem(void) {
   max_kva = pmap_growkernel(0);
 }
 
+/* Asks subsystems to give back memory they keep cached. */
 static void kick_swapper(void) {
-  panic("Cannot allocate more kernel memory: swapper not implemented!");
+  klog("Running short of physical memory, calling low memory handlers.");
+  INVOKE_CTORS(kmem_lowmem);
 }
 
 vaddr_t kva_alloc(size_t size, kmem_flags_t flags) {
@@ -84,8 +86,11 @@ void kva_map(vaddr_t ptr, size_t size, kmem_flags_t flags) {
 
   vm_pagelist_t pglist;
   int error = vm_pagelist_alloc(npages, &pglist);
-  if (error)
+  if (error) {
     kick_swapper();
+    if ((error = vm_pagelist_alloc(npages, &pglist)))
+      panic("Cannot allocate more kernel memory: swapper not implemented!");
+  }
 
   vaddr_t va = ptr;
   vm_page_t *pg, *pg_next;
@@ -0,0 +1,74 @@
+/*
+ * Decompressor of LZ4 block format, see:
+ * https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ *
+ * A block is a sequence of (literals, match) pairs, each starting with
+ * a token that holds lengths of both. Match is a copy of bytes decompressed
+ * before, located at most 64KiB back. The last sequence has literals only.
+ */
+#include <sys/mimiker.h>
+#include <sys/errno.h>
+#include <sys/libkern.h>
+#include <sys/lz4.h>
+
+#define LZ4_MINMATCH 4
+
+/* Lengths that don't fit into 4 bits of the token continue in following
+ * bytes, till one of them is less than 255. */
+static bool lz4_length(const uint8_t **ipp, const uint8_t *iend, size_t *lenp) {
+  unsigned byte;
+
+  do {
+    if (*ipp == iend)
+      return false;
+    byte = *(*ipp)++;
+    *lenp += byte;
+  } while (byte == 255);
+
+  return true;
+}
+
+int lz4_decompress(const void *src, size_t srclen, void *dst, size_t *dstlenp) {
+  const uint8_t *ip = src;
+  const uint8_t *iend = ip + srclen;
+  uint8_t *op = dst;
+  uint8_t *oend = op + *dstlenp;
+
+  while (ip < iend) {
+    unsigned token = *ip++;
+
+    size_t len = token >> 4;
+    if (len == 15 && !lz4_length(&ip, iend, &len))
+      return EINVAL;
+    if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+      return EINVAL;
+    memcpy(op, ip, len);
+    ip += len;
+    op += len;
+
+    if (ip == iend)
+      break;
+
+    if (iend - ip < 2)
+      return EINVAL;
+    size_t dist = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (dist == 0 || dist > (size_t)(op - (uint8_t *)dst))
+      return EINVAL;
+
+    len = token & 15;
+    if (len == 15 && !lz4_length(&ip, iend, &len))
+      return EINVAL;
+    len += LZ4_MINMATCH;
+    if (len > (size_t)(oend - op))
+      return EINVAL;
+
+    /* Match may overlap bytes it produces, so it's copied byte by byte. */
+    const uint8_t *match = op - dist;
+    while (len--)
+      *op++ = *match++;
+  }
+
+  *dstlenp = op - (uint8_t *)dst;
+  return 0;
+}
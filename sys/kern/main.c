@@ -1,5 +1,6 @@
 #define KL_LOG KL_INIT
 #include <sys/klog.h>
+#include <sys/callout.h>
 #include <sys/libkern.h>
 #include <sys/kmem.h>
 #include <sys/vmem.h>
@@ -29,6 +30,7 @@
 #include <sys/lockdep.h>
 #include <sys/kcsan.h>
 #include <sys/kgprof.h>
+#include <sys/smp.h>
 
 /* This function mounts some initial filesystems. Normally this would be done by
    userspace init program. */
@@ -100,6 +102,7 @@ __noreturn void kernel_init(void) {
 
   /* With scheduler ready we can create necessary threads. */
   init_callout();
+  init_hrtimer();
   preempt_enable();
 
   /* [FIRST_PASS] Initialize first timer and console devices. */
@@ -116,6 +119,9 @@ __noreturn void kernel_init(void) {
    * so it's high time to start system clock. */
   init_clock();
 
+  /* Secondary processors need running system clock and interrupts. */
+  init_smp();
+
   init_kgprof();
 
   klog("Kernel initialized!");
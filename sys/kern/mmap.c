@@ -6,8 +6,12 @@
 #include <sys/errno.h>
 #include <sys/vm_map.h>
 #include <sys/vm_object.h>
+#include <sys/vm_pager.h>
 #include <sys/mutex.h>
 #include <sys/proc.h>
+#include <sys/file.h>
+#include <sys/filedesc.h>
+#include <sys/vnode.h>
 
 /* Ensure kernel vm_prot_t & vm_flags_t map directly to user-space constants. */
 static_assert(VM_PROT_NONE == PROT_NONE, "VM_PROT_NONE != PROT_NONE");
@@ -23,10 +27,55 @@ static_assert(VM_FIXED == MAP_FIXED, "VM_FIXED != MAP_FIXED");
 static_assert(VM_STACK == MAP_STACK, "VM_STACK != MAP_STACK");
 static_assert(VM_EXCL == MAP_EXCL, "VM_EXCL != MAP_EXCL");
 
-int do_mmap(vaddr_t *addr_p, size_t length, int u_prot, int u_flags) {
+/* Get memory object that provides pages for mapping of file `fd`. */
+static int mmap_file_object(proc_t *p, int fd, vm_prot_t prot,
+                            vm_flags_t flags, vm_object_t **obj_p) {
+  file_t *f;
+  int error;
+
+  if ((error = fdtab_get_file(p->p_fdtable, fd, 0, &f)))
+    return error;
+
+  vnode_t *vn = f->f_vnode;
+
+  if (f->f_type != FT_VNODE || vn->v_type != V_REG) {
+    error = ENODEV;
+    goto end;
+  }
+
+  /* Access to mapped memory must not exceed permissions of the file. */
+  if (!(f->f_flags & FF_READ)) {
+    error = EACCES;
+    goto end;
+  }
+
+  if ((flags & VM_SHARED) && (prot & VM_PROT_WRITE) &&
+      !(f->f_flags & FF_WRITE)) {
+    error = EACCES;
+    goto end;
+  }
+
+  /* Shared mappings use pages of the file directly, while private mappings
+   * copy them on write. */
+  vm_object_t *obj = vnode_pager_object(vn);
+  if (flags & VM_PRIVATE) {
+    *obj_p = vm_object_shadow(obj);
+    vm_object_drop(obj);
+  } else {
+    *obj_p = obj;
+  }
+
+end:
+  file_drop(f);
+  return error;
+}
+
+int do_mmap(vaddr_t *addr_p, size_t length, int u_prot, int u_flags, int fd,
+            off_t pos) {
   thread_t *td = thread_self();
-  assert(td->td_proc != NULL);
-  vm_map_t *vmap = td->td_proc->p_uspace;
+  proc_t *p = td->td_proc;
+  assert(p != NULL);
+  vm_map_t *vmap = p->p_uspace;
   assert(vmap != NULL);
 
   vm_prot_t prot = u_prot;
@@ -43,8 +92,20 @@ int do_mmap(vaddr_t *addr_p, size_t length, int u_prot, int u_flags) {
     return EINVAL;
 
   int error;
+  vm_object_t *obj = NULL;
+
+  if (!(flags & VM_ANON)) {
+    if (pos < 0 || !page_aligned_p(pos))
+      return EINVAL;
+    if ((error = mmap_file_object(p, fd, prot, flags, &obj)))
+      return error;
+  } else {
+    pos = 0;
+  }
+
   vm_map_entry_t *ent;
-  if ((error = vm_map_alloc_entry(vmap, addr, length, prot, flags, &ent)))
+  if ((error =
+         vm_map_alloc_entry(vmap, obj, pos, addr, length, prot, flags, &ent)))
     return error;
 
   vaddr_t start = vm_map_entry_start(ent);
@@ -71,3 +132,21 @@ int do_munmap(vaddr_t start, size_t length) {
 
   return vm_map_destroy_range(uspace, start, end);
 }
+
+int do_msync(vaddr_t start, size_t length, int flags) {
+  vm_map_t *uspace = proc_self()->p_uspace;
+
+  if (!page_aligned_p(start))
+    return EINVAL;
+
+  if ((flags & MS_SYNC) && (flags & MS_ASYNC))
+    return EINVAL;
+
+  if (flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE))
+    return EINVAL;
+
+  /* Pages are written back synchronously for both MS_SYNC and MS_ASYNC.
+   * Mapped pages always reflect file contents, so MS_INVALIDATE is a no-op. */
+  length = roundup(length, PAGESIZE);
+  return vm_map_sync(uspace, start, start + length);
+}
@@ -52,18 +52,15 @@ void _mtx_lock(mtx_t *m, const void *waitpt) {
       continue;
 
     WITH_NO_PREEMPTION {
-      /* TODO(cahir) turnstile_take / turnstile_give doesn't make much sense
-       * until tc_lock is thrown into the equation. */
       turnstile_t *ts = turnstile_take(m);
 
-      /* Between atomic cas and turnstile_take there's a small window when
-       * preemption can take place. This can result in mutex being released. */
-      if (m->m_owner) {
-        /* we're the first thread to block, so lock is now being contested */
-        if (ts == td->td_turnstile)
-          m->m_owner |= MTX_CONTESTED;
-
-        turnstile_wait(ts, mtx_owner(m), waitpt);
+      /* The mutex may have been released since the last try. Otherwise mark
+       * it as contested, so the owner won't release it on the fast path. */
+      expected = m->m_owner;
+      if ((expected & ~MTX_FLAGMASK) &&
+          atomic_compare_exchange_strong(&m->m_owner, &expected,
+                                         expected | MTX_CONTESTED)) {
+        turnstile_wait(ts, (thread_t *)(expected & ~MTX_FLAGMASK), waitpt);
       } else {
         turnstile_give(ts);
       }
@@ -96,7 +93,7 @@ void mtx_unlock(mtx_t *m) {
    * sequentially and only act on empty mutex on which operations are
    * cheaper. */
   WITH_NO_PREEMPTION {
-    uintptr_t owner = atomic_exchange(&m->m_owner, 0);
+    uintptr_t owner = atomic_exchange(&m->m_owner, value);
     if (owner & MTX_CONTESTED)
       turnstile_broadcast(m);
   }
@@ -1,6 +1,8 @@
 #include <sys/pcpu.h>
 #include <sys/thread.h>
 
-pcpu_t _pcpu_data[1] = {{
+pcpu_t _pcpu_data[MAXCPU] = {{
   .curthread = &thread0,
 }};
+
+int ncpus = 1;
@@ -1,4 +1,5 @@
 #define KL_LOG KL_KMEM
+#include <sys/errno.h>
 #include <sys/libkern.h>
 #include <sys/mimiker.h>
 #include <sys/klog.h>
@@ -7,8 +8,10 @@
 #include <sys/malloc.h>
 #include <sys/pool.h>
 #include <sys/kmem.h>
+#include <sys/pmap.h>
 #include <sys/vm.h>
 #include <machine/vm_param.h>
+#include <stdatomic.h>
 
 #define PI_ALIGNMENT sizeof(uint64_t)
 
@@ -23,12 +26,23 @@
 static TAILQ_HEAD(, pool) pool_list = TAILQ_HEAD_INITIALIZER(pool_list);
 static MTX_DEFINE(pool_list_lock, 0);
 static KMALLOC_DEFINE(M_POOL, "pool allocators");
+static POOL_DEFINE(P_MAGAZINE, "pool magazines", sizeof(pool_magazine_t),
+                   .flags = POOL_NOCACHE);
 
 static void *slab_item_at(slab_t *slab, unsigned i) {
   return slab->ph_items + i * slab->ph_itemsize;
 }
 
-static void add_slab(pool_t *pool, slab_t *slab, size_t slabsize) {
+static slab_t *slab_of_item(void *ptr, unsigned *indexp) {
+  vm_page_t *pg = kva_find_page((vaddr_t)ptr);
+  assert(pg != NULL);
+  slab_t *slab = pg->slab;
+  *indexp = ((intptr_t)ptr - (intptr_t)slab->ph_items) / slab->ph_itemsize;
+  return slab;
+}
+
+static void add_slab(pool_t *pool, slab_t *slab, size_t slabsize,
+                     bool external) {
   assert(mtx_owned(&pool->pp_mtx));
   assert(is_aligned(slab, PAGESIZE));
   assert(slabsize >= pool->pp_slabsize);
@@ -38,6 +52,7 @@ static void add_slab(pool_t *pool, slab_t *slab, size_t slabsize) {
 
   slab->ph_pool = pool;
   slab->ph_size = slabsize;
+  slab->ph_external = external;
   slab->ph_itemsize = pool->pp_itemsize;
 #if KASAN
   slab->ph_itemsize += pool->pp_redzone;
@@ -47,25 +62,27 @@ static void add_slab(pool_t *pool, slab_t *slab, size_t slabsize) {
    * Now we need to calculate maximum possible number of items of given `size`
    * in slab that occupies one page, taking into account space taken by:
    *  - items: ntotal * itemsize,
-   *  - slab + bitmap: sizeof(slab_t) + bitstr_size(ntotal)
+   *  - slab + bitmaps: sizeof(slab_t) + 2 * bitstr_size(ntotal)
    * With:
    *  - usable = slabsize - sizeof(slab_t)
    * ... inequation looks as follow:
-   * (1) ntotal * itemsize + (ntotal + 7) / 8 <= usable
-   * (2) ntotal * 8 * itemsize + ntotal + 7 <= usable * 8
-   * (3) ntotal * (8 * itemsize + 1) <= usable * 8 - 7
-   * (4) ntotal <= (usable * 8 - 7) / (8 * itemsize + 1)
+   * (1) ntotal * itemsize + 2 * ((ntotal + 7) / 8) <= usable
+   * (2) ntotal * 8 * itemsize + 2 * ntotal + 14 <= usable * 8
+   * (3) ntotal * (8 * itemsize + 2) <= usable * 8 - 14
+   * (4) ntotal <= (usable * 8 - 14) / (8 * itemsize + 2)
    */
   size_t usable = slabsize - sizeof(slab_t);
-  slab->ph_ntotal = (usable * 8 - 7) / (8 * slab->ph_itemsize + 1);
+  slab->ph_ntotal = (usable * 8 - 14) / (8 * slab->ph_itemsize + 2);
   slab->ph_nused = 0;
 
   assert(slab->ph_ntotal > 0);
 
-  size_t header = sizeof(slab_t) + bitstr_size(slab->ph_ntotal);
+  size_t bitmap_size = bitstr_size(slab->ph_ntotal);
+  size_t header = sizeof(slab_t) + 2 * bitmap_size;
   slab->ph_items = (void *)slab + align(header, pool->pp_alignment);
+  slab->ph_cached = slab->ph_bitmap + bitmap_size;
 
-  bzero(slab->ph_bitmap, bitstr_size(slab->ph_ntotal));
+  bzero(slab->ph_bitmap, 2 * bitmap_size);
 
   LIST_INSERT_HEAD(&pool->pp_empty_slabs, slab, ph_link);
 
@@ -79,45 +96,307 @@ static void add_slab(pool_t *pool, slab_t *slab, size_t slabsize) {
   }
 }
 
-void *pool_alloc(pool_t *pool, kmem_flags_t flags) {
-  void *ptr;
+static void *pool_slab_alloc(pool_t *pool, kmem_flags_t flags) {
+  SCOPED_MTX_LOCK(&pool->pp_mtx);
 
-  debug("pool_alloc: pool=%p", pool);
+  slab_t *slab;
 
-  WITH_MTX_LOCK (&pool->pp_mtx) {
-    slab_t *slab;
-
-    if (!(slab = LIST_FIRST(&pool->pp_part_slabs))) {
-      if (!(slab = LIST_FIRST(&pool->pp_empty_slabs))) {
-        size_t slabsize = pool->pp_slabsize;
-        slab = kmem_alloc(slabsize, flags);
-        assert(slab != NULL);
-        add_slab(pool, slab, slabsize);
-      }
+  while (!(slab = LIST_FIRST(&pool->pp_part_slabs))) {
+    if ((slab = LIST_FIRST(&pool->pp_empty_slabs))) {
       /* We're going to allocate from empty slab
        * -> move it to the list of non-empty slabs. */
       assert(slab->ph_nused == 0);
       LIST_REMOVE(slab, ph_link);
       LIST_INSERT_HEAD(&pool->pp_part_slabs, slab, ph_link);
+      break;
     }
 
-    assert(slab->ph_nused < slab->ph_ntotal);
-    int i = 0;
-    bit_ffc(slab->ph_bitmap, slab->ph_ntotal, &i);
-    bit_set(slab->ph_bitmap, i);
-    ptr = slab_item_at(slab, i);
-    debug("slab_alloc: allocated item %p at slab %p, index %d", ptr, slab, i);
+    /* Do not hold the lock while allocating memory, as kmem may ask pools to
+     * release their memory when it's running short of it. */
+    size_t slabsize = pool->pp_slabsize;
+    bool dma = pool->pp_flags & POOL_DMA;
+    mtx_unlock(&pool->pp_mtx);
+    if (dma)
+      slab = (void *)kmem_alloc_contig(NULL, slabsize, PMAP_NOCACHE);
+    else
+      slab = kmem_alloc(slabsize, flags);
+    mtx_lock(&pool->pp_mtx);
+    assert(slab != NULL);
+    /* Uncached memory is kept just like memory supplied by `pool_add_page`,
+     * since `kmem_free` does not know how to release it. */
+    add_slab(pool, slab, slabsize, dma);
+  }
+
+  assert(slab->ph_nused < slab->ph_ntotal);
+  int i = 0;
+  bit_ffc(slab->ph_bitmap, slab->ph_ntotal, &i);
+  bit_set(slab->ph_bitmap, i);
+  void *ptr = slab_item_at(slab, i);
+  debug("slab_alloc: allocated item %p at slab %p, index %d", ptr, slab, i);
+
+  if (++slab->ph_nused == slab->ph_ntotal) {
+    /* We've allocated last item from non-empty slab
+     * -> move it to the list of full slabs. */
+    LIST_REMOVE(slab, ph_link);
+    LIST_INSERT_HEAD(&pool->pp_full_slabs, slab, ph_link);
+  }
+
+  pool->pp_nused++;
+  pool->pp_nmaxused = max(pool->pp_nmaxused, pool->pp_nused);
+
+  return ptr;
+}
+
+static void destroy_slab(pool_t *pool, slab_t *slab) {
+  klog("destroy_slab: pool = %p, slab = %p", pool, slab);
 
-    if (++slab->ph_nused == slab->ph_ntotal) {
-      /* We've allocated last item from non-empty slab
-       * -> move it to the list of full slabs. */
+  for (size_t i = 0; i < slab->ph_size; i += PAGESIZE) {
+    vm_page_t *pg = kva_find_page((vaddr_t)slab + i);
+    assert(pg != NULL);
+    assert(pg->slab == slab);
+    pg->slab = NULL;
+  }
+
+  kmem_free(slab, slab->ph_size);
+}
+
+/* Returns empty slabs to kmem. Slabs supplied with `pool_add_page` are never
+ * returned. */
+static void pool_reclaim(pool_t *pool) {
+  slab_list_t slabs = LIST_HEAD_INITIALIZER(slabs);
+  slab_t *slab, *next;
+
+  WITH_MTX_LOCK (&pool->pp_mtx) {
+    LIST_FOREACH_SAFE (slab, &pool->pp_empty_slabs, ph_link, next) {
+      if (slab->ph_external)
+        continue;
       LIST_REMOVE(slab, ph_link);
-      LIST_INSERT_HEAD(&pool->pp_full_slabs, slab, ph_link);
+      LIST_INSERT_HEAD(&slabs, slab, ph_link);
+      pool->pp_ntotal -= slab->ph_ntotal;
+      pool->pp_npages -= slab->ph_size;
+    }
+  }
+
+  /* Release memory without holding the lock, just as it's allocated. */
+  LIST_FOREACH_SAFE (slab, &slabs, ph_link, next)
+    destroy_slab(pool, slab);
+}
+
+/*
+ * Magazine layer.
+ */
+
+static bool pool_cached_p(pool_t *pool) {
+#if KASAN
+  /* Items cached in magazines would bypass the quarantine. */
+  return false;
+#else /* !KASAN */
+  return !(pool->pp_flags & POOL_NOCACHE);
+#endif
+}
+
+/* Sets or clears the mark of an item cached in a magazine and returns its
+ * previous value. Items of a single slab are cached without holding pp_mtx,
+ * hence the marks are updated atomically. */
+static bool item_mark_cached(void *ptr, bool cached) {
+  unsigned i;
+  slab_t *slab = slab_of_item(ptr, &i);
+  _Atomic(bitstr_t) *byte = (void *)&slab->ph_cached[_bit_byte(i)];
+  bitstr_t mask = _bit_mask(i);
+
+  if (cached)
+    return atomic_fetch_or(byte, mask) & mask;
+  return atomic_fetch_and(byte, ~mask) & mask;
+}
+
+static void *magazine_pop(pool_magazine_t *mag) {
+  assert(mag->pm_nrounds > 0);
+  return mag->pm_rounds[--mag->pm_nrounds];
+}
+
+static void magazine_push(pool_magazine_t *mag, void *ptr) {
+  assert(mag->pm_nrounds < POOL_MAGAZINE_SIZE);
+  mag->pm_rounds[mag->pm_nrounds++] = ptr;
+}
+
+/* Moves magazines of the cache to `mags`. */
+static void pool_cache_take(pool_cache_t *pc, pool_magazine_list_t *mags) {
+  if (pc->pc_loaded)
+    SLIST_INSERT_HEAD(mags, pc->pc_loaded, pm_link);
+  if (pc->pc_previous)
+    SLIST_INSERT_HEAD(mags, pc->pc_previous, pm_link);
+  pc->pc_loaded = pc->pc_previous = NULL;
+}
+
+/* Returns the cache of current CPU, which is accessed with preemption disabled
+ * only. If the pool was purged since the CPU used the cache last time, its
+ * magazines are moved to `stale`, so the caller can release them. */
+static pool_cache_t *pool_cache_self(pool_t *pool,
+                                     pool_magazine_list_t *stale) {
+  assert(preempt_disabled());
+
+  pool_cache_t *pc = &pool->pp_cache[PCPU_GET(cpuid)];
+  unsigned generation = atomic_load(&pool->pp_generation);
+
+  if (__predict_false(pc->pc_generation != generation)) {
+    pc->pc_generation = generation;
+    pool_cache_take(pc, stale);
+  }
+
+  return pc;
+}
+
+/* Takes an item from the cache. Returns NULL if both magazines are empty and
+ * there's no full magazine in the depot. */
+static void *pool_cache_alloc(pool_t *pool, pool_magazine_list_t *stale) {
+  SCOPED_NO_PREEMPTION();
+
+  pool_cache_t *pc = pool_cache_self(pool, stale);
+  pool_magazine_t *mag;
+
+  if ((mag = pc->pc_loaded) && mag->pm_nrounds > 0)
+    return magazine_pop(mag);
+
+  if ((mag = pc->pc_previous) && mag->pm_nrounds > 0) {
+    pc->pc_previous = pc->pc_loaded;
+    pc->pc_loaded = mag;
+    return magazine_pop(mag);
+  }
+
+  /* Exchange empty magazine for a full one from the depot. */
+  WITH_MTX_LOCK (&pool->pp_depot_lock) {
+    if (!(mag = SLIST_FIRST(&pool->pp_full_mags)))
+      return NULL;
+    SLIST_REMOVE_HEAD(&pool->pp_full_mags, pm_link);
+    pool->pp_nfull_mags--;
+    if (pc->pc_previous)
+      SLIST_INSERT_HEAD(&pool->pp_empty_mags, pc->pc_previous, pm_link);
+  }
+
+  pc->pc_previous = pc->pc_loaded;
+  pc->pc_loaded = mag;
+  return magazine_pop(mag);
+}
+
+/* Puts an item into the cache. Returns ENOMEM if the depot has no empty
+ * magazines and ENOSPC if it cannot take any more full magazines. */
+static int pool_cache_free(pool_t *pool, void *ptr,
+                           pool_magazine_list_t *stale) {
+  SCOPED_NO_PREEMPTION();
+
+  pool_cache_t *pc = pool_cache_self(pool, stale);
+  pool_magazine_t *mag;
+
+  if ((mag = pc->pc_loaded) && mag->pm_nrounds < POOL_MAGAZINE_SIZE) {
+    magazine_push(mag, ptr);
+    return 0;
+  }
+
+  if ((mag = pc->pc_previous) && mag->pm_nrounds < POOL_MAGAZINE_SIZE) {
+    pc->pc_previous = pc->pc_loaded;
+    pc->pc_loaded = mag;
+    magazine_push(mag, ptr);
+    return 0;
+  }
+
+  /* Exchange full magazine for an empty one from the depot. */
+  WITH_MTX_LOCK (&pool->pp_depot_lock) {
+    if (pc->pc_previous && pool->pp_nfull_mags >= POOL_DEPOT_MAX)
+      return ENOSPC;
+    if (!(mag = SLIST_FIRST(&pool->pp_empty_mags)))
+      return ENOMEM;
+    SLIST_REMOVE_HEAD(&pool->pp_empty_mags, pm_link);
+    if (pc->pc_previous) {
+      SLIST_INSERT_HEAD(&pool->pp_full_mags, pc->pc_previous, pm_link);
+      pool->pp_nfull_mags++;
+    }
+  }
+
+  pc->pc_previous = pc->pc_loaded;
+  pc->pc_loaded = mag;
+  magazine_push(mag, ptr);
+  return 0;
+}
+
+/* Supplies the depot with an empty magazine unless it has one already. This is
+ * done when allocating items, since releasing an item must not allocate. */
+static void pool_depot_add_magazine(pool_t *pool, kmem_flags_t flags) {
+  WITH_MTX_LOCK (&pool->pp_depot_lock) {
+    if (!SLIST_EMPTY(&pool->pp_empty_mags))
+      return;
+  }
+
+  pool_magazine_t *mag = pool_alloc(P_MAGAZINE, flags | M_ZERO);
+
+  WITH_MTX_LOCK (&pool->pp_depot_lock) {
+    SLIST_INSERT_HEAD(&pool->pp_empty_mags, mag, pm_link);
+  }
+}
+
+static void _pool_free(pool_t *pool, void *ptr);
+
+/* Returns items cached in `mags` to slabs and frees the magazines. */
+static void pool_magazines_release(pool_t *pool, pool_magazine_list_t *mags) {
+  pool_magazine_t *mag;
+
+  while ((mag = SLIST_FIRST(mags))) {
+    SLIST_REMOVE_HEAD(mags, pm_link);
+    WITH_MTX_LOCK (&pool->pp_mtx) {
+      while (mag->pm_nrounds > 0) {
+        void *ptr = magazine_pop(mag);
+        item_mark_cached(ptr, false);
+        _pool_free(pool, ptr);
+      }
+    }
+    pool_free(P_MAGAZINE, mag);
+  }
+}
+
+/* Returns items cached in the depot and in the cache of current CPU to slabs.
+ *
+ * Other CPUs access their caches without locking, so they cannot be emptied
+ * here. Instead the pool's generation is advanced and each CPU releases its
+ * magazines when it uses the pool next time. */
+static void pool_cache_purge(pool_t *pool) {
+  pool_magazine_list_t mags = SLIST_HEAD_INITIALIZER(mags);
+  pool_magazine_t *mag;
+
+  atomic_fetch_add(&pool->pp_generation, 1);
+
+  WITH_NO_PREEMPTION {
+    pool_cache_self(pool, &mags);
+  }
+
+  WITH_MTX_LOCK (&pool->pp_depot_lock) {
+    while ((mag = SLIST_FIRST(&pool->pp_full_mags))) {
+      SLIST_REMOVE_HEAD(&pool->pp_full_mags, pm_link);
+      SLIST_INSERT_HEAD(&mags, mag, pm_link);
+    }
+    while ((mag = SLIST_FIRST(&pool->pp_empty_mags))) {
+      SLIST_REMOVE_HEAD(&pool->pp_empty_mags, pm_link);
+      SLIST_INSERT_HEAD(&mags, mag, pm_link);
     }
+    pool->pp_nfull_mags = 0;
+  }
+
+  pool_magazines_release(pool, &mags);
+}
+
+void *pool_alloc(pool_t *pool, kmem_flags_t flags) {
+  void *ptr = NULL;
 
-    pool->pp_nused++;
-    pool->pp_nmaxused = max(pool->pp_nmaxused, pool->pp_nused);
+  debug("pool_alloc: pool=%p", pool);
+
+  if (pool_cached_p(pool)) {
+    pool_magazine_list_t stale = SLIST_HEAD_INITIALIZER(stale);
+    if ((ptr = pool_cache_alloc(pool, &stale)))
+      item_mark_cached(ptr, false);
+    else if (!(flags & M_NOWAIT))
+      pool_depot_add_magazine(pool, flags);
+    pool_magazines_release(pool, &stale);
   }
+  if (ptr == NULL)
+    ptr = pool_slab_alloc(pool, flags);
 
   /* Create redzone after the item. */
   kasan_mark(ptr, pool->pp_itemsize, pool->pp_itemsize + pool->pp_redzone,
@@ -128,19 +407,13 @@ void *pool_alloc(pool_t *pool, kmem_flags_t flags) {
   return ptr;
 }
 
-/* TODO: destroy empty slabs when their number reaches a certain threshold
- * (maybe leave one). */
 static void _pool_free(pool_t *pool, void *ptr) {
   assert(mtx_owned(&pool->pp_mtx));
 
   debug("pool_free: pool = %p, ptr = %p", pool, ptr);
 
-  vm_page_t *pg = kva_find_page((vaddr_t)ptr);
-  assert(pg != NULL);
-  slab_t *slab = pg->slab;
-
-  unsigned index =
-    ((intptr_t)ptr - (intptr_t)slab->ph_items) / slab->ph_itemsize;
+  unsigned index;
+  slab_t *slab = slab_of_item(ptr, &index);
   bitstr_t *bitmap = slab->ph_bitmap;
 
   if (!bit_test(bitmap, index))
@@ -163,6 +436,22 @@ static void _pool_free(pool_t *pool, void *ptr) {
 }
 
 void pool_free(pool_t *pool, void *ptr) {
+  if (pool_cached_p(pool)) {
+    /* Cached items are marked as used in their slabs, so double free of such
+     * item is detected with the mark of cached items. */
+    if (item_mark_cached(ptr, true))
+      panic("Double free detected in '%s' pool at %p!", pool->pp_desc, ptr);
+
+    pool_magazine_list_t stale = SLIST_HEAD_INITIALIZER(stale);
+    int error = pool_cache_free(pool, ptr, &stale);
+    pool_magazines_release(pool, &stale);
+
+    /* If there's no room in magazines, return the item to its slab. */
+    if (error == 0)
+      return;
+    item_mark_cached(ptr, false);
+  }
+
   SCOPED_MTX_LOCK(&pool->pp_mtx);
 
   kasan_mark_invalid(ptr, pool->pp_itemsize + pool->pp_redzone,
@@ -178,28 +467,21 @@ static void pool_ctor(pool_t *pool) {
   LIST_INIT(&pool->pp_empty_slabs);
   LIST_INIT(&pool->pp_full_slabs);
   LIST_INIT(&pool->pp_part_slabs);
+  SLIST_INIT(&pool->pp_full_mags);
+  SLIST_INIT(&pool->pp_empty_mags);
   mtx_init(&pool->pp_mtx, 0);
+  mtx_init(&pool->pp_depot_lock, MTX_SPIN);
 }
 
 static void destroy_slabs(pool_t *pool, slab_list_t *slabs) {
   slab_t *slab, *next;
 
   LIST_FOREACH_SAFE (slab, slabs, ph_link, next) {
-    klog("destroy_slab: pool = %p, slab = %p", pool, slab);
-
     pool->pp_ntotal -= slab->ph_ntotal;
     pool->pp_npages -= slab->ph_size;
 
     LIST_REMOVE(slab, ph_link);
-
-    for (size_t i = 0; i < slab->ph_size; i += PAGESIZE) {
-      vm_page_t *pg = kva_find_page((vaddr_t)slab + i);
-      assert(pg != NULL);
-      assert(pg->slab == slab);
-      pg->slab = NULL;
-    }
-
-    kmem_free(slab, slab->ph_size);
+    destroy_slab(pool, slab);
   }
 }
 
@@ -225,6 +507,7 @@ void _pool_init(pool_t *pool, pool_init_t *args) {
   pool->pp_desc = desc;
   pool->pp_alignment = alignment;
   pool->pp_slabsize = slabsize;
+  pool->pp_flags = args->flags;
 #if KASAN
   /* the alignment is within the redzone */
   pool->pp_itemsize = size;
@@ -240,13 +523,35 @@ void _pool_init(pool_t *pool, pool_init_t *args) {
     TAILQ_INSERT_TAIL(&pool_list, pool, pp_link);
 }
 
+void pool_drain(pool_t *pool) {
+  pool_cache_purge(pool);
+  WITH_MTX_LOCK (&pool->pp_mtx)
+    kasan_quar_releaseall(&pool->pp_quarantine);
+  pool_reclaim(pool);
+}
+
+static void pool_lowmem(void) {
+  SCOPED_MTX_LOCK(&pool_list_lock);
+
+  pool_t *pool;
+  TAILQ_FOREACH (pool, &pool_list, pp_link) {
+    size_t npages = pool->pp_npages;
+    pool_drain(pool);
+    if (npages > pool->pp_npages)
+      klog("drained %ld bytes from '%s' pool", npages - pool->pp_npages,
+           pool->pp_desc);
+  }
+}
+
+KMEM_LOWMEM_HANDLER(pool_lowmem);
+
 void init_pool(void) {
   INVOKE_CTORS(pool_ctor_table);
 }
 
 void pool_add_page(pool_t *pool, void *page, size_t size) {
   SCOPED_MTX_LOCK(&pool->pp_mtx);
-  add_slab(pool, page, size);
+  add_slab(pool, page, size, true);
 }
 
 pool_t *_pool_create(pool_init_t *args) {
@@ -258,6 +563,14 @@ pool_t *_pool_create(pool_init_t *args) {
 void pool_destroy(pool_t *pool) {
   WITH_MTX_LOCK (&pool_list_lock)
     TAILQ_REMOVE(&pool_list, pool, pp_link);
+
+  /* The pool is not used anymore, so caches of all CPUs can be emptied. */
+  pool_magazine_list_t mags = SLIST_HEAD_INITIALIZER(mags);
+  for (int i = 0; i < MAXCPU; i++)
+    pool_cache_take(&pool->pp_cache[i], &mags);
+  pool_magazines_release(pool, &mags);
+  pool_cache_purge(pool);
+
   WITH_MTX_LOCK (&pool->pp_mtx)
     /* Lock needed as the quarantine may call _pool_free! */
     kasan_quar_releaseall(&pool->pp_quarantine);
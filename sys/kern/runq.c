@@ -10,18 +10,23 @@ void runq_init(runq_t *rq) {
     TAILQ_INIT(&rq->rq_queues[i]);
 }
 
+#define RQB_WORD(i) ((i) / RQB_BPW)
+#define RQB_BIT(i) (1UL << ((i) % RQB_BPW))
+
 void runq_add(runq_t *rq, thread_t *td) {
   unsigned prio = td->td_prio / RQ_PPQ;
   TAILQ_INSERT_TAIL(&rq->rq_queues[prio], td, td_runq);
+  rq->rq_status[RQB_WORD(prio)] |= RQB_BIT(prio);
 }
 
 thread_t *runq_choose(runq_t *rq) {
-  for (int i = 0; i < RQ_NQS; i++) {
-    struct rq_head *head = &rq->rq_queues[i];
-    thread_t *td = TAILQ_FIRST(head);
-
-    if (td)
-      return td;
+  /* The lowest set bit denotes the highest priority non-empty queue. */
+  for (unsigned i = 0; i < RQB_LEN; i++) {
+    u_long word = rq->rq_status[i];
+    if (word) {
+      unsigned prio = i * RQB_BPW + ffs(word) - 1;
+      return TAILQ_FIRST(&rq->rq_queues[prio]);
+    }
   }
 
   return NULL;
@@ -30,4 +35,6 @@ thread_t *runq_choose(runq_t *rq) {
 void runq_remove(runq_t *rq, thread_t *td) {
   unsigned prio = td->td_prio / RQ_PPQ;
   TAILQ_REMOVE(&rq->rq_queues[prio], td, td_runq);
+  if (TAILQ_EMPTY(&rq->rq_queues[prio]))
+    rq->rq_status[RQB_WORD(prio)] &= ~RQB_BIT(prio);
 }
@@ -2,6 +2,8 @@
 #include <sys/klog.h>
 #include <sys/mimiker.h>
 #include <sys/libkern.h>
+#include <sys/cpu.h>
+#include <sys/kenv.h>
 #include <sys/sched.h>
 #include <sys/runq.h>
 #include <sys/interrupt.h>
@@ -9,17 +11,185 @@
 #include <sys/thread.h>
 #include <sys/mutex.h>
 #include <sys/pcpu.h>
+#include <sys/smp.h>
 #include <sys/turnstile.h>
 
 static MTX_DEFINE(sched_lock, MTX_SPIN);
+/* Run queue is shared by all processors. If both are needed, `td_lock` of
+ * a thread must be acquired before `runq_lock`. */
+static MTX_DEFINE(runq_lock, MTX_SPIN);
 static runq_t runq;
 static bool sched_active = false;
 
 #define SLICE 10
 
+/* Scheduling class decides on priority and time slice of threads that belong
+ * to user processes. Kernel threads always run with their base priority. */
+typedef struct sched_class {
+  const char *name;
+  /* Accounts recent `run` time spent running and `slp` time spent sleeping
+   * [us] by a thread. */
+  void (*account)(thread_t *td, unsigned run, unsigned slp);
+  /* Returns priority a thread should run with. */
+  prio_t (*prio)(thread_t *td);
+  /* Returns length of time slice [ticks] of a thread. */
+  int (*slice)(thread_t *td);
+} sched_class_t;
+
+static void rr_account(thread_t *td, unsigned run, unsigned slp) {
+}
+
+static prio_t rr_prio(thread_t *td) {
+  return td->td_base_prio;
+}
+
+static int rr_slice(thread_t *td) {
+  return SLICE;
+}
+
+/* Round-robin among threads of the same priority with fixed time slices. */
+static sched_class_t sched_rr = {
+  .name = "rr",
+  .account = rr_account,
+  .prio = rr_prio,
+  .slice = rr_slice,
+};
+
+/*
+ * The fair class is modelled after interactivity scoring of FreeBSD's ULE.
+ * Score of a thread is computed from the ratio of time it recently spent
+ * sleeping and running. It ranges from 0 for threads that only sleep to
+ * 2 * FAIR_SCORE_HALF for ones that only run. Thread's priority is moved above
+ * or below its base priority by up to FAIR_PRIO_RANGE according to its score.
+ *
+ * Interactive threads, which mostly wait for user input, preempt CPU-bound
+ * ones as soon as they wake up. CPU-bound threads end up with the same score,
+ * so they get equal shares of processor time, while threads that sleep now
+ * and then get ahead of them.
+ */
+#define FAIR_SCORE_HALF 50
+#define FAIR_INTERACT_THRESH 30 /* threads below are interactive */
+#define FAIR_HIST_MAX 5000000U  /* length [us] of recent history */
+#define FAIR_PRIO_RANGE 32
+
+static void fair_account(thread_t *td, unsigned run, unsigned slp) {
+  unsigned *runp = &td->td_runhist;
+  unsigned *slpp = &td->td_slphist;
+
+  *runp += min(run, 2 * FAIR_HIST_MAX);
+  *slpp += min(slp, 2 * FAIR_HIST_MAX);
+
+  unsigned sum = *runp + *slpp;
+
+  if (sum < FAIR_HIST_MAX)
+    return;
+
+  /* After a long sleep or run only the kind of activity matters. */
+  if (sum > 2 * FAIR_HIST_MAX) {
+    if (*runp > *slpp) {
+      *runp = FAIR_HIST_MAX;
+      *slpp = 1;
+    } else {
+      *slpp = FAIR_HIST_MAX;
+      *runp = 1;
+    }
+    return;
+  }
+
+  /* Otherwise forget older history gradually. */
+  if (sum > FAIR_HIST_MAX / 5 * 6) {
+    *runp /= 2;
+    *slpp /= 2;
+  } else {
+    *runp = *runp / 5 * 4;
+    *slpp = *slpp / 5 * 4;
+  }
+}
+
+static unsigned fair_score(thread_t *td) {
+  unsigned run = td->td_runhist;
+  unsigned slp = td->td_slphist;
+
+  if (run > slp)
+    return 2 * FAIR_SCORE_HALF - slp * FAIR_SCORE_HALF / run;
+  if (slp > run)
+    return run * FAIR_SCORE_HALF / slp;
+  return run ? FAIR_SCORE_HALF : 0;
+}
+
+static prio_t fair_prio(thread_t *td) {
+  int score = fair_score(td);
+  int prio = td->td_base_prio +
+             (score - FAIR_SCORE_HALF) * FAIR_PRIO_RANGE / FAIR_SCORE_HALF;
+  return max(min(prio, (int)prio_uthread(PRIO_MIN)),
+             (int)prio_uthread(PRIO_MAX));
+}
+
+static int fair_slice(thread_t *td) {
+  /* Interactive threads are expected to block soon. */
+  if (fair_score(td) < FAIR_INTERACT_THRESH)
+    return SLICE / 2;
+  return SLICE;
+}
+
+static sched_class_t sched_fair = {
+  .name = "fair",
+  .account = fair_account,
+  .prio = fair_prio,
+  .slice = fair_slice,
+};
+
+static sched_class_t *sched_classes[] = {&sched_rr, &sched_fair};
+
+static sched_class_t *sched_class = &sched_rr;
+
+static unsigned bt2us(const bintime_t *bt) {
+  timeval_t tv;
+  bt2tv(bt, &tv);
+  if (tv.tv_sec >= UINT_MAX / 1000000)
+    return UINT_MAX;
+  return tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/* Accounts time a thread spent running or sleeping. If the thread is ready,
+ * but not yet on the run queue, its priority gets recomputed. Priority of
+ * a sleeping or blocked thread must not change, as it determines its position
+ * on a sleep queue or a turnstile. */
+static void sched_update(thread_t *td, const bintime_t *run,
+                         const bintime_t *slp) {
+  assert(mtx_owned(td->td_lock));
+
+  if (td->td_proc == NULL)
+    return;
+
+  sched_class->account(td, run ? bt2us(run) : 0, slp ? bt2us(slp) : 0);
+
+  /* Lent priority is restored once the thread releases the lock. */
+  if (td_is_ready(td) && !td_is_borrowing(td))
+    td->td_prio = sched_class->prio(td);
+}
+
+static int sched_slice(thread_t *td) {
+  return td->td_proc ? sched_class->slice(td) : SLICE;
+}
+
 void init_sched(void) {
   thread0.td_lock = &sched_lock;
   runq_init(&runq);
+
+  const char *name = kenv_get("sched");
+  if (name == NULL)
+    return;
+
+  for (size_t i = 0; i < __arraycount(sched_classes); i++) {
+    if (!strcmp(name, sched_classes[i]->name)) {
+      sched_class = sched_classes[i];
+      klog("Using '%s' scheduling class", name);
+      return;
+    }
+  }
+
+  klog("Unknown scheduling class '%s'!", name);
 }
 
 void sched_add(thread_t *td) {
@@ -29,6 +199,19 @@ void sched_add(thread_t *td) {
     sched_wakeup(td);
 }
 
+/* Asks one of idle processors (if any) to look into the run queue. */
+static void sched_kick_idle(void) {
+  int self = PCPU_GET(cpuid);
+
+  for (int cpu = 0; cpu < ncpus; cpu++) {
+    pcpu_t *pc = &_pcpu_data[cpu];
+    if (cpu != self && pc->curthread == pc->idle_thread) {
+      smp_ipi_send(cpu, IPI_RESCHED);
+      return;
+    }
+  }
+}
+
 void sched_wakeup(thread_t *td) {
   assert(mtx_owned(td->td_lock));
   assert(td != thread_self());
@@ -39,15 +222,24 @@ void sched_wakeup(thread_t *td) {
   bintime_sub(&now, &td->td_last_slptime);
   bintime_add(&td->td_slptime, &now);
 
+  /* A new thread hasn't been sleeping. */
+  bool slept = td->td_state != TDS_INACTIVE;
   td->td_state = TDS_READY;
-  td->td_slice = SLICE;
+  sched_update(td, NULL, slept ? &now : NULL);
+  td->td_slice = sched_slice(td);
 
-  runq_add(&runq, td);
+  WITH_MTX_LOCK (&runq_lock)
+    runq_add(&runq, td);
 
-  /* Check if we need to reschedule threads. */
+  /* Check if we need to reschedule threads. Flags of the current thread are
+   * protected by its own lock. */
   thread_t *oldtd = thread_self();
-  if (prio_gt(td->td_prio, oldtd->td_prio))
-    oldtd->td_flags |= TDF_NEEDSWITCH;
+  if (prio_gt(td->td_prio, oldtd->td_prio)) {
+    WITH_MTX_LOCK (oldtd->td_lock)
+      oldtd->td_flags |= TDF_NEEDSWITCH;
+  } else {
+    sched_kick_idle();
+  }
 }
 
 /*! \brief Set thread's active priority \a td_prio to \a prio.
@@ -60,14 +252,17 @@ static void sched_set_active_prio(thread_t *td, prio_t prio) {
   if (prio_eq(td->td_prio, prio))
     return;
 
-  if (td_is_ready(td)) {
-    /* Thread is on a run queue. */
-    runq_remove(&runq, td);
-    td->td_prio = prio;
-    runq_add(&runq, td);
-  } else {
-    td->td_prio = prio;
+  WITH_MTX_LOCK (&runq_lock) {
+    if (td_is_ready(td)) {
+      /* Thread is on a run queue. */
+      runq_remove(&runq, td);
+      td->td_prio = prio;
+      runq_add(&runq, td);
+      return;
+    }
   }
+
+  td->td_prio = prio;
 }
 
 void sched_set_prio(thread_t *td, prio_t prio) {
@@ -106,18 +301,34 @@ void sched_unlend_prio(thread_t *td, prio_t prio) {
     sched_lend_prio(td, prio);
 }
 
-/*! \brief Chooses next thread to run.
+/*! \brief Chooses next thread to run instead of \a td.
+ *
+ * If \a td is ready, it's put back on the run queue only after another thread
+ * has been chosen. Thus a processor never picks up a thread, that is being
+ * switched out by another processor waiting for the thread it has chosen.
  *
  * \note Returned thread is marked as running!
  */
-static thread_t *sched_choose(void) {
-  thread_t *td = runq_choose(&runq);
-  if (td == NULL)
-    return PCPU_GET(idle_thread);
-  runq_remove(&runq, td);
-  td->td_state = TDS_RUNNING;
-  td->td_last_rtime = binuptime();
-  return td;
+static thread_t *sched_choose(thread_t *td) {
+  SCOPED_MTX_LOCK(&runq_lock);
+
+  thread_t *newtd = runq_choose(&runq);
+
+  /* Idle threads need not to be inserted into the run queue. */
+  if (td_is_ready(td) && td != PCPU_GET(idle_thread)) {
+    if (newtd == NULL || prio_gt(td->td_prio, newtd->td_prio))
+      newtd = td;
+    else
+      runq_add(&runq, td);
+  }
+
+  if (newtd == NULL)
+    newtd = PCPU_GET(idle_thread);
+  else if (newtd != td)
+    runq_remove(&runq, newtd);
+  newtd->td_state = TDS_RUNNING;
+  newtd->td_last_rtime = binuptime();
+  return newtd;
 }
 
 void sched_switch(void) {
@@ -129,25 +340,29 @@ void sched_switch(void) {
   assert(mtx_owned(td->td_lock));
   assert(!td_is_running(td));
 
+  bool sliceend = td->td_flags & TDF_SLICEEND;
   td->td_flags &= ~(TDF_SLICEEND | TDF_NEEDSWITCH);
 
   /* Update running time, */
   bintime_t now = binuptime();
-  bintime_sub(&now, &td->td_last_rtime);
-  bintime_add(&td->td_rtime, &now);
+  bintime_t run = now;
+  bintime_sub(&run, &td->td_last_rtime);
+  bintime_add(&td->td_rtime, &run);
 
-  if (td_is_ready(td)) {
-    /* Idle threads need not to be inserted into the run queue. */
-    if (td != PCPU_GET(idle_thread))
-      runq_add(&runq, td);
-  } else if (td_is_sleeping(td)) {
-    /* Record when the thread fell asleep. */
+  if (!td_is_ready(td)) {
+    /* Record when the thread fell asleep (or got blocked or stopped). */
     td->td_last_slptime = now;
-  } else if (td_is_dead(td) || td_is_stopped(td)) {
-    /* Don't add dead or stopped threads to run queue. */
   }
 
-  thread_t *newtd = sched_choose();
+  sched_update(td, &run, NULL);
+
+  /* A preempted thread keeps the rest of its time slice. */
+  if (sliceend)
+    td->td_slice = sched_slice(td);
+
+  /* Ready threads are put back on the run queue, but dead or stopped ones
+   * are not. */
+  thread_t *newtd = sched_choose(td);
 
   if (td == newtd)
     goto noswitch;
@@ -158,6 +373,13 @@ void sched_switch(void) {
   if (PCPU_GET(no_switch))
     panic("Switching context while interrupts are disabled is forbidden!");
 
+  /* The thread may have been put back on the run queue by another processor
+   * that hasn't left its stack yet, see `ctx_switch`. */
+  while (newtd->td_oncpu)
+    continue;
+  atomic_thread_fence(memory_order_acquire);
+  newtd->td_oncpu = true;
+
   WITH_INTR_DISABLED {
     mtx_unlock(td->td_lock);
     ctx_switch(td, newtd);
@@ -182,6 +404,12 @@ void sched_clock(void) {
   }
 }
 
+/* Checks if there's a thread waiting for a processor. */
+static bool sched_runnable(void) {
+  SCOPED_MTX_LOCK(&runq_lock);
+  return runq_choose(&runq) != NULL;
+}
+
 __noreturn void sched_run(void) {
   thread_t *td = thread_self();
 
@@ -193,11 +421,25 @@ __noreturn void sched_run(void) {
   td->td_name = "idle-thread";
   td->td_slice = 0;
 
-  sched_active = true;
+  /* Scheduling begins once the boot processor becomes idle. */
+  if (PCPU_GET(cpuid) == 0)
+    sched_active = true;
+
+  /* Secondary processors get here with interrupts disabled, see `init_ap`. */
+  if (td->td_idnest > 0)
+    intr_enable();
 
   while (true) {
-    WITH_MTX_LOCK (td->td_lock)
-      td->td_flags |= TDF_NEEDSWITCH;
+    /* With interrupts disabled neither an interrupt nor an IPI can be missed
+     * between looking into the run queue and halting the processor. */
+    intr_disable();
+    if (!sched_runnable()) {
+      clock_idle_enter();
+      cpu_idle();
+      clock_idle_exit();
+    }
+    intr_enable();
+    thread_yield();
   }
 }
 
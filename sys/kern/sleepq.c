@@ -10,7 +10,8 @@
 #include <sys/thread.h>
 #include <sys/interrupt.h>
 #include <sys/errno.h>
-#include <sys/callout.h>
+#include <sys/hrtimer.h>
+#include <sys/time.h>
 
 #define SC_TABLESIZE 256 /* Must be power of 2. */
 #define SC_MASK (SC_TABLESIZE - 1)
@@ -144,12 +145,15 @@ static void sq_enter(thread_t *td, sleepq_chain_t *sc, void *wchan,
 
   TAILQ_INSERT_TAIL(&sq->sq_blocked, td, td_sleepq);
   sq->sq_nblocked++;
-  sc_release(sc);
 
+  /* `td_wchan` must be set before the chain is released, so that
+   * `_sleepq_abort` can tell whether the thread really sleeps on `wchan`. */
   td->td_wchan = wchan;
   td->td_waitpt = waitpt;
   td->td_sleepqueue = NULL;
   td->td_state = TDS_SLEEPING;
+  sc_release(sc);
+
   sched_switch();
 }
 
@@ -251,10 +255,16 @@ bool sleepq_broadcast(void *wchan) {
 }
 
 static bool _sleepq_abort(thread_t *td, int wakeup) {
-  sleepq_chain_t *sc = sc_acquire(td->td_wchan);
-  sleepq_t *sq = sq_lookup(sc, td->td_wchan);
+  /* The thread may be woken up on another processor in the meantime,
+   * hence the waiting channel must be checked again with chain locked. */
+  void *wchan = td->td_wchan;
+  if (wchan == NULL)
+    return false;
 
-  if (sq == NULL) {
+  sleepq_chain_t *sc = sc_acquire(wchan);
+  sleepq_t *sq = sq_lookup(sc, wchan);
+
+  if (sq == NULL || td->td_wchan != wchan) {
     sc_release(sc);
     return false;
   }
@@ -295,36 +305,42 @@ void sleepq_wait(void *wchan, const void *waitpt, mtx_t *mtx) {
 }
 
 static void sq_timeout(thread_t *td) {
+  /* Fails if the thread has been woken up in the meantime. */
   _sleepq_abort(td, ETIMEDOUT);
 }
 
-int sleepq_wait_timed(void *wchan, const void *waitpt, mtx_t *mtx,
-                      systime_t timeout) {
+/* Performs interruptible sleep until `deadline`, or indefinitely if it's
+ * null. */
+static int sq_wait_timed(void *wchan, const void *waitpt, mtx_t *mtx,
+                         const bintime_t *deadline) {
   thread_t *td = thread_self();
   int error = 0;
 
-  if (waitpt == NULL)
-    waitpt = __caller(0);
+  /* Timer lock must not be acquired with sleep queue chain locked. The timer
+   * is kept by current processor, so with interrupts disabled it cannot fire
+   * before we enter the sleep queue. */
+  if (deadline) {
+    hrtimer_setup(&td->td_slptimer, (hrtimer_fn_t)sq_timeout, td, HRT_DIRECT);
+    intr_disable();
+    hrtimer_start(&td->td_slptimer, *deadline);
+  }
 
   sleepq_chain_t *sc = sc_acquire(wchan);
+  if (deadline)
+    intr_enable();
   if (mtx)
     mtx_unlock(mtx);
   mtx_lock(td->td_lock);
 
   /* If there are pending signals, interrupt the sleep immediately. */
-  if ((td->td_flags & TDF_NEEDSIGCHK) && (timeout == 0)) {
+  if ((td->td_flags & TDF_NEEDSIGCHK) && (deadline == NULL)) {
     mtx_unlock(td->td_lock);
     sc_release(sc);
     error = EINTR;
     goto end;
   }
 
-  if (timeout > 0) {
-    callout_setup(&td->td_slpcallout, (timeout_t)sq_timeout, td);
-    callout_schedule(&td->td_slpcallout, timeout);
-  }
-
-  td->td_flags |= (timeout > 0) ? TDF_SLPTIMED : TDF_SLPINTR;
+  td->td_flags |= deadline ? TDF_SLPTIMED : TDF_SLPINTR;
   sq_enter(td, sc, wchan, waitpt);
 
   /* After wakeup, only one of the following flags may be set:
@@ -339,11 +355,35 @@ int sleepq_wait_timed(void *wchan, const void *waitpt, mtx_t *mtx,
     td->td_flags &= ~(TDF_SLPINTR | TDF_SLPTIMED);
   }
 
-  if (timeout > 0)
-    callout_stop(&td->td_slpcallout);
+  /* The timer may be running on behalf of us right now. Wait for it,
+   * as `td_slptimer` will be set up again on next timed sleep. */
+  if (deadline && !hrtimer_stop(&td->td_slptimer))
+    hrtimer_drain(&td->td_slptimer);
 
 end:
   if (mtx)
     mtx_lock(mtx);
   return error;
 }
+
+int sleepq_wait_timed(void *wchan, const void *waitpt, mtx_t *mtx,
+                      systime_t timeout) {
+  if (waitpt == NULL)
+    waitpt = __caller(0);
+
+  if (timeout == 0)
+    return sq_wait_timed(wchan, waitpt, mtx, NULL);
+
+  bintime_t deadline = binuptime();
+  bintime_t delta = st2bt(timeout);
+  bintime_add(&deadline, &delta);
+  return sq_wait_timed(wchan, waitpt, mtx, &deadline);
+}
+
+int sleepq_wait_until(void *wchan, const void *waitpt, mtx_t *mtx,
+                      bintime_t deadline) {
+  if (waitpt == NULL)
+    waitpt = __caller(0);
+
+  return sq_wait_timed(wchan, waitpt, mtx, &deadline);
+}
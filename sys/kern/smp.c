@@ -0,0 +1,111 @@
+#define KL_LOG KL_INIT
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/errno.h>
+#include <sys/hrtimer.h>
+#include <sys/interrupt.h>
+#include <sys/pcpu.h>
+#include <sys/sched.h>
+#include <sys/smp.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+
+/* How long [ms] do we wait for a secondary processor to report it's alive. */
+#define AP_START_TIMEOUT 1000
+
+static smp_ipi_send_t ipi_send;
+static device_t *ipi_dev;
+static atomic_int ap_started;
+
+void smp_ipi_claim(smp_ipi_send_t send, device_t *dev) {
+  assert(send != NULL);
+
+  ipi_send = send;
+  ipi_dev = dev;
+}
+
+void smp_ipi_send(int cpu, unsigned ipi) {
+  assert(cpu < ncpus);
+
+  if (ipi_send == NULL)
+    return;
+
+  atomic_fetch_or(&_pcpu_data[cpu].ipi_pending, ipi);
+  ipi_send(ipi_dev, cpu);
+}
+
+void smp_ipi_handler(void) {
+  unsigned ipi = atomic_exchange(PCPU_PTR(ipi_pending), 0);
+
+  if (ipi & IPI_RESCHED) {
+    /* The thread will switch out on return from interrupt. */
+    thread_t *td = thread_self();
+    WITH_MTX_LOCK (td->td_lock)
+      td->td_flags |= TDF_NEEDSWITCH;
+  }
+
+  if (ipi & IPI_HRTIMER)
+    clock_hrtimer_ipi();
+}
+
+__noreturn void init_ap(void) {
+  int cpu = PCPU_GET(cpuid);
+
+  klog("CPU %d started", cpu);
+
+  init_clock_cpu();
+
+  atomic_store(&ap_started, cpu);
+
+  sched_run();
+}
+
+#if MAXCPU > 1
+static bool start_ap(int cpu) {
+  /* Secondary processor starts on the stack of its idle thread, hence
+   * the thread doesn't need an entry point. */
+  thread_t *td = thread_create("idle-thread", NULL, NULL, PRIO_MIN);
+  td->td_state = TDS_RUNNING;
+  td->td_oncpu = true;
+  /* Interrupts remain disabled until the processor becomes idle. */
+  td->td_idnest = 1;
+
+  pcpu_t *pc = &_pcpu_data[cpu];
+  pc->cpuid = cpu;
+  pc->curthread = td;
+
+  int error = smp_md_start_ap(cpu);
+  if (error) {
+    if (error != ENODEV)
+      klog("Failed to start CPU %d (error %d)!", cpu, error);
+    pc->curthread = NULL;
+    td->td_state = TDS_DEAD;
+    td->td_oncpu = false;
+    thread_delete(td);
+    return false;
+  }
+
+  systime_t deadline = getsystime() + AP_START_TIMEOUT;
+  while (atomic_load(&ap_started) != cpu) {
+    /* The processor may still wake up, so its idle thread must stay. */
+    if (getsystime() > deadline) {
+      klog("CPU %d did not respond!", cpu);
+      return false;
+    }
+  }
+
+  return true;
+}
+#endif
+
+void init_smp(void) {
+#if MAXCPU > 1
+  for (int cpu = 1; cpu < MAXCPU; cpu++) {
+    if (!start_ap(cpu))
+      break;
+    ncpus++;
+  }
+#endif
+
+  klog("%d CPU(s) online", ncpus);
+}
@@ -25,6 +25,11 @@
 #include <sys/statvfs.h>
 #include <sys/pty.h>
 #include <sys/event.h>
+#include <sys/filedesc.h>
+#include <sys/vnode.h>
+#include <sys/vm_pager.h>
+#include <sys/devfs.h>
+#include <sys/bio.h>
 
 #include "sysent.h"
 
@@ -169,11 +174,14 @@ static int sys_mmap(proc_t *p, mmap_args_t *args, register_t *res) {
   size_t length = SCARG(args, len);
   vm_prot_t prot = SCARG(args, prot);
   int flags = SCARG(args, flags);
+  int fd = SCARG(args, fd);
+  off_t pos = SCARG(args, pos);
 
-  klog("mmap(%p, %u, %d, %d)", (void *)va, length, prot, flags);
+  klog("mmap(%p, %u, %d, %d, %d, %ld)", (void *)va, length, prot, flags, fd,
+       pos);
 
   int error;
-  if ((error = do_mmap(&va, length, prot, flags)))
+  if ((error = do_mmap(&va, length, prot, flags, fd, pos)))
     return error;
 
   *res = va;
@@ -1268,13 +1276,33 @@ static int sys_setitimer(proc_t *p, setitimer_args_t *args, register_t *res) {
 }
 
 static int sys_sync(proc_t *p, void *args, register_t *res) {
-  /* TODO(mohrcore): implement buffering */
+  /* sync(2) cannot fail, so errors are only reported by fsync(2). */
+  (void)bio_flush(NULL);
   return 0;
 }
 
 static int sys_fsync(proc_t *p, fsync_args_t *args, register_t *res) {
-  /* TODO(mohrcore): implement buffering */
-  return 0;
+  int fd = SCARG(args, fd);
+  file_t *f;
+  int error;
+
+  klog("fsync(%d)", fd);
+
+  if ((error = fdtab_get_file(p->p_fdtable, fd, 0, &f)))
+    return error;
+
+  if (f->f_type == FT_VNODE) {
+    vnode_t *vn = f->f_vnode;
+    vnode_lock(vn);
+    error = vnode_pager_flush(vn, 0, SIZE_MAX);
+    vnode_unlock(vn);
+    /* Other file systems (e.g. tmpfs, initrd) keep no buffered blocks. */
+    if (!error && vn->v_type == V_DEV)
+      error = devfs_fsync(f);
+  }
+
+  file_drop(f);
+  return error;
 }
 
 static int sys_kqueue1(proc_t *p, kqueue1_args_t *args, register_t *res) {
@@ -1332,3 +1360,13 @@ static int sys_sigtimedwait(proc_t *p, sigtimedwait_args_t *args,
                             register_t *res) {
   return ENOTSUP;
 }
+
+static int sys_msync(proc_t *p, msync_args_t *args, register_t *res) {
+  vaddr_t addr = (vaddr_t)SCARG(args, addr);
+  size_t len = SCARG(args, len);
+  int flags = SCARG(args, flags);
+
+  klog("msync(%p, %u, %d)", (void *)addr, len, flags);
+
+  return do_msync(addr, len, flags);
+}
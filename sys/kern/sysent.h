@@ -92,6 +92,7 @@ static int sys_fsync(proc_t *, fsync_args_t *, register_t *);
 static int sys_kqueue1(proc_t *, kqueue1_args_t *, register_t *);
 static int sys_kevent(proc_t *, kevent_args_t *, register_t *);
 static int sys_sigtimedwait(proc_t *, sigtimedwait_args_t *, register_t *);
+static int sys_msync(proc_t *, msync_args_t *, register_t *);
 
 struct sysent sysent[] = {
   [SYS_syscall] = { .name = "syscall", .nargs = 1, .call = (syscall_t *)sys_syscall },
@@ -181,5 +182,6 @@ struct sysent sysent[] = {
   [SYS_kqueue1] = { .name = "kqueue1", .nargs = 1, .call = (syscall_t *)sys_kqueue1 },
   [SYS_kevent] = { .name = "kevent", .nargs = 6, .call = (syscall_t *)sys_kevent },
   [SYS_sigtimedwait] = { .name = "sigtimedwait", .nargs = 3, .call = (syscall_t *)sys_sigtimedwait },
+  [SYS_msync] = { .name = "msync", .nargs = 3, .call = (syscall_t *)sys_msync },
 };
 
@@ -24,9 +24,8 @@ static thread_list_t zombie_threads = TAILQ_HEAD_INITIALIZER(zombie_threads);
 
 /* FTTB such a primitive method of creating new TIDs will do. */
 static tid_t make_tid(void) {
-  static volatile tid_t tid = 1;
-  SCOPED_NO_PREEMPTION();
-  return tid++;
+  static atomic_int tid = 1;
+  return atomic_fetch_add(&tid, 1);
 }
 
 static alignas(PAGESIZE) uint8_t _stack0[KSTACK_SIZE];
@@ -39,6 +38,7 @@ thread_t thread0 = {
   .td_base_prio = 255,
   .td_proc = &proc0,
   .td_state = TDS_RUNNING,
+  .td_oncpu = true,
   .td_idnest = 1,
   .td_pdnest = 1,
   .td_kstack = KSTACK_INIT(_stack0, KSTACK_SIZE),
@@ -89,7 +89,7 @@ thread_t *thread_create(const char *name, void (*fn)(void *), void *arg,
 
   cv_init(&td->td_waitcv, "thread waiters");
   LIST_INIT(&td->td_contested);
-  bzero(&td->td_slpcallout, sizeof(callout_t));
+  bzero(&td->td_slptimer, sizeof(hrtimer_t));
 
   td->td_name = kstrndup(M_STR, name, TD_NAME_MAX);
   kstack_init(&td->td_kstack, kmem_alloc(KSTACK_SIZE, M_ZERO), KSTACK_SIZE);
@@ -120,9 +120,15 @@ void thread_delete(thread_t *td) {
   WITH_MTX_LOCK (&threads_lock)
     TAILQ_REMOVE(&all_threads, td, td_all);
 
+  /* The thread may have just switched out on another CPU and still be
+   * running on its kernel stack. */
+  while (td->td_oncpu)
+    continue;
+  atomic_thread_fence(memory_order_acquire);
+
   kmem_free(td->td_kstack.stk_base, KSTACK_SIZE);
 
-  callout_drain(&td->td_slpcallout);
+  hrtimer_drain(&td->td_slptimer);
   sleepq_destroy(td->td_sleepqueue);
   turnstile_destroy(td->td_turnstile);
   sigpend_destroy(&td->td_sigpend);
@@ -136,7 +142,11 @@ void thread_delete(thread_t *td) {
  * recursion.
  */
 __no_profile __no_kcsan_sanitize thread_t *thread_self(void) {
+#ifdef md_curthread
+  return md_curthread();
+#else
   return PCPU_GET(curthread);
+#endif
 }
 
 /* For now this is only a stub
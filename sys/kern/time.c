@@ -4,6 +4,7 @@
 #include <sys/sleepq.h>
 #include <sys/time.h>
 #include <sys/callout.h>
+#include <sys/hrtimer.h>
 #include <sys/proc.h>
 #include <sys/klog.h>
 #include <limits.h>
@@ -53,72 +54,63 @@ static bool timeval_invalid(const timeval_t *tv) {
   return tv->tv_usec < 0 || tv->tv_usec >= 1000000 || tv->tv_sec < 0;
 }
 
-static int ts2timo(clockid_t clock_id, int flags, timespec_t *ts,
-                   systime_t *timo, timespec_t *start) {
-  int error;
-  *timo = 0;
+/* Converts time `ts` measured by clock `clk` to time since boot. */
+static int ts2deadline(clockid_t clk, int flags, const timespec_t *ts,
+                       bintime_t *deadline) {
+  bintime_t now;
 
   if (timespec_invalid(ts) || (flags & ~TIMER_ABSTIME))
     return EINVAL;
 
-  if ((error = do_clock_gettime(clock_id, start)))
-    return error;
-
-  if (flags & TIMER_ABSTIME)
-    timespecsub(ts, start, ts);
+  if (clk != CLOCK_MONOTONIC && clk != CLOCK_REALTIME)
+    return EINVAL;
 
-  if ((ts->tv_sec == 0 && ts->tv_nsec == 0) || ts->tv_sec < 0)
-    return ETIMEDOUT;
+  ts2bt(ts, deadline);
 
-  *timo = ts2hz(ts);
+  if (flags & TIMER_ABSTIME) {
+    if (clk == CLOCK_MONOTONIC)
+      return 0;
+    /* Realtime clock is offset from time since boot by time of boot. */
+    now = bintime();
+    bintime_sub(deadline, &now);
+  }
 
+  now = binuptime();
+  bintime_add(deadline, &now);
   return 0;
 }
 
 int do_clock_nanosleep(clockid_t clk, int flags, timespec_t *rqtp,
                        timespec_t *rmtp) {
-  /* rmt - remaining time, rqt - requested time, p - pointer */
-  timespec_t rmt_start, rmt_end, rmt;
-  systime_t timo;
-  int error, error2;
-
-  if ((error = ts2timo(clk, flags, rqtp, &timo, &rmt_start))) {
-    if (error == ETIMEDOUT)
-      goto timedout;
+  bintime_t deadline, now;
+  int error;
+
+  if ((error = ts2deadline(clk, flags, rqtp, &deadline)))
     return error;
-  }
 
+  /* Nobody else sleeps on `deadline`, so we can only be interrupted
+   * or time out. */
   do {
-    error = sleepq_wait_timed((void *)(&rmt_start), __caller(0), NULL, timo);
-    if (error == ETIMEDOUT)
-      goto timedout;
+    error = sleepq_wait_until((void *)&deadline, __caller(0), NULL, deadline);
+  } while (error == 0);
 
-    if ((error2 = do_clock_gettime(clk, &rmt_end)))
-      return error2;
+  if (error == ETIMEDOUT) {
+    if (rmtp)
+      rmtp->tv_sec = rmtp->tv_nsec = 0;
+    return 0;
+  }
 
-    if (flags == TIMER_ABSTIME) {
-      timespecsub(rqtp, &rmt_end, &rmt);
+  if (rmtp) {
+    now = binuptime();
+    if (bintime_cmp(&deadline, &now, >)) {
+      bintime_sub(&deadline, &now);
+      bt2ts(&deadline, rmtp);
     } else {
-      timespecsub(&rmt_end, &rmt_start, &rmt);
-      timespecsub(rqtp, &rmt, &rmt);
+      timespecclear(rmtp);
     }
-    if (rmt.tv_sec < 0)
-      timespecclear(&rmt);
-
-    if (rmtp)
-      *rmtp = rmt;
-    if (error)
-      return error;
-
-    timo = ts2hz(&rmt);
-  } while (timo > 0);
-
-  return 0;
+  }
 
-timedout:
-  if (rmtp)
-    rmtp->tv_sec = rmtp->tv_nsec = 0;
-  return 0;
+  return error;
 }
 
 time_t tm2sec(tm_t *t) {
@@ -200,11 +192,11 @@ bool kitimer_stop(proc_t *p) {
 
   kitimer_t *it = &p->p_itimer;
 
-  if (callout_stop(&it->kit_callout))
+  if (hrtimer_stop(&it->kit_timer))
     return true;
 
   mtx_unlock(&p->p_lock);
-  callout_drain(&it->kit_callout);
+  hrtimer_drain(&it->kit_timer);
   mtx_lock(&p->p_lock);
   return false;
 }
@@ -235,13 +227,15 @@ static void kitimer_timeout(void *arg) {
     timeradd(&next, &it->kit_interval, &next);
   it->kit_next = next;
 
-  /* Undo the `+ 1` done by ts2hz(). */
-  systime_t st = tv2hz(&next) - 1;
-  callout_reschedule(&it->kit_callout, st);
+  bintime_t deadline;
+  tv2bt(&next, &deadline);
+  hrtimer_reschedule(&it->kit_timer, deadline);
 }
 
 void kitimer_init(proc_t *p) {
-  callout_setup(&p->p_itimer.kit_callout, kitimer_timeout, p);
+  /* The timer's function takes `p_lock`, so it can't run in interrupt
+   * context. */
+  hrtimer_setup(&p->p_itimer.kit_timer, kitimer_timeout, p, 0);
 }
 
 /* The timer must have been stopped prior to calling this function. */
@@ -257,9 +251,9 @@ static void kitimer_setup(proc_t *p, const struct itimerval *itval) {
     timeradd(value, &abs, &abs);
     it->kit_next = abs;
     it->kit_interval = itval->it_interval;
-    /* Undo the `+ 1` done by ts2hz(). */
-    systime_t st = tv2hz(&it->kit_next) - 1;
-    callout_schedule_abs(&it->kit_callout, st);
+    bintime_t deadline;
+    tv2bt(&it->kit_next, &deadline);
+    hrtimer_start(&it->kit_timer, deadline);
   } else {
     timerclear(&it->kit_next);
     timerclear(&it->kit_interval);
@@ -302,7 +296,7 @@ static void mdelay_timeout(__unused void *arg) {
 
 void mdelay(systime_t ms) {
   callout_t callout;
-  callout_setup(&callout, mdelay_timeout, NULL);
+  callout_setup_direct(&callout, mdelay_timeout, NULL);
   callout_schedule(&callout, ms);
   callout_drain(&callout);
 }
@@ -49,7 +49,7 @@ int tm_register(timer_t *tm) {
 
   WITH_MTX_LOCK (&timers_mtx) {
     TAILQ_INSERT_TAIL(&timers, tm, tm_link);
-    tm->tm_flags &= TMF_TYPEMASK;
+    tm->tm_flags &= TMF_TYPEMASK | TMF_PERCPU;
     tm->tm_flags |= TMF_REGISTERED;
   }
 
@@ -65,7 +65,7 @@ int tm_deregister(timer_t *tm) {
 
   WITH_MTX_LOCK (&timers_mtx) {
     TAILQ_REMOVE(&timers, tm, tm_link);
-    tm->tm_flags &= TMF_TYPEMASK;
+    tm->tm_flags &= TMF_TYPEMASK | TMF_PERCPU;
   }
 
   klog("Unregistered '%s' timer.", tm->tm_name);
@@ -148,6 +148,27 @@ int tm_start(timer_t *tm, unsigned flags, const bintime_t start,
   return retval;
 }
 
+int tm_start_cpu(timer_t *tm, unsigned flags, const bintime_t start,
+                 const bintime_t period) {
+  assert(is_active(tm));
+
+  if (!(tm->tm_flags & TMF_PERCPU))
+    return ENODEV;
+
+  return tm->tm_start(tm, flags, start, period);
+}
+
+int tm_reprogram(timer_t *tm, unsigned flags, const bintime_t start,
+                 const bintime_t period) {
+  assert(is_active(tm));
+  assert(intr_disabled());
+
+  if (((tm->tm_flags & flags) & TMF_TYPEMASK) == 0)
+    return ENODEV;
+
+  return tm->tm_start(tm, flags, start, period);
+}
+
 int tm_stop(timer_t *tm) {
   assert(is_initialized(tm));
 
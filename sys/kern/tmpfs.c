@@ -12,6 +12,8 @@
 #include <sys/pmap.h>
 #include <sys/malloc.h>
 #include <sys/cred.h>
+#include <sys/hash.h>
+#include <sys/tree.h>
 #include <bitstring.h>
 
 /*
@@ -40,9 +42,17 @@
  *
  * When a direntry is freed, then it is returned back to the pool of free
  * direntries. For simplicity, we never return back whole data blocks.
+ *
+ * Used direntries are also kept in a red-black tree ordered by hash of their
+ * names, so that lookups don't need to scan the whole directory.
+ *
+ * Readdir visits direntries in order of their position in directory data
+ * blocks. Position of a direntry never changes, hence it is used as the
+ * directory offset (cookie), which lets readdir resume without a scan.
  */
 
 #define TMPFS_NAME_MAX 64
+#define TMPFS_DIRENTS_PER_BLK (BLOCK_SIZE / sizeof(tmpfs_dirent_t))
 
 #define BLOCK_SIZE PAGESIZE
 #define BLOCK_MASK (BLOCK_SIZE - 1)
@@ -74,12 +84,16 @@ typedef struct _blk *blkptr_t;
 
 typedef struct tmpfs_dirent {
   TAILQ_ENTRY(tmpfs_dirent) tfd_entries; /* node on dirent list */
+  RB_ENTRY(tmpfs_dirent) tfd_tree;       /* node in tree of used dirents */
   struct tmpfs_node *tfd_node;           /* pointer to the file's node */
+  uint32_t tfd_hash;                     /* hash of the name */
+  uint32_t tfd_slot;                     /* index among directory's dirents */
   size_t tfd_namelen;            /* number of bytes occupied in array below */
   char tfd_name[TMPFS_NAME_MAX]; /* name of file */
 } tmpfs_dirent_t;
 
 typedef TAILQ_HEAD(, tmpfs_dirent) tmpfs_dirent_list_t;
+typedef RB_HEAD(tmpfs_dirent_tree, tmpfs_dirent) tmpfs_dirent_tree_t;
 
 typedef struct tmpfs_node {
   vnode_t *tfn_vnode;   /* corresponding v-node */
@@ -108,6 +122,7 @@ typedef struct tmpfs_node {
       struct tmpfs_node *parent;    /* Parent directory. */
       tmpfs_dirent_list_t dirents;  /* List of directory entries. */
       tmpfs_dirent_list_t fdirents; /* List of free directory entries. */
+      tmpfs_dirent_tree_t dtree;    /* Directory entries sorted by hash. */
     } tfn_dir;
     struct {
       char *link;
@@ -313,15 +328,55 @@ static int tmpfs_chtimes(tmpfs_node_t *v, timespec_t *atime, timespec_t *mtime,
                          cred_t *cred, va_flags_t vaflags);
 static void tmpfs_update_time(tmpfs_node_t *v, tmpfs_time_type_t type);
 
+/* tmpfs directory entry tree */
+
+static inline uint32_t tmpfs_name_hash(const char *name, size_t namelen) {
+  return hash32_buf(name, namelen, HASH32_BUF_INIT);
+}
+
+static int tmpfs_dirent_cmp(tmpfs_dirent_t *a, tmpfs_dirent_t *b) {
+  if (a->tfd_hash != b->tfd_hash)
+    return a->tfd_hash < b->tfd_hash ? -1 : 1;
+  if (a->tfd_namelen != b->tfd_namelen)
+    return a->tfd_namelen < b->tfd_namelen ? -1 : 1;
+  return memcmp(a->tfd_name, b->tfd_name, a->tfd_namelen);
+}
+
+RB_GENERATE_STATIC(tmpfs_dirent_tree, tmpfs_dirent, tfd_tree, tmpfs_dirent_cmp);
+
 /* tmpfs readdir operations */
 
+/* Find the first used direntry stored at slot position or further. */
+static tmpfs_dirent_t *tmpfs_dir_first_used(tmpfs_node_t *tfn, size_t slot) {
+  size_t blkno = slot / TMPFS_DIRENTS_PER_BLK;
+  size_t i = slot % TMPFS_DIRENTS_PER_BLK;
+
+  for (; blkno < NBLOCKS(tfn->tfn_size); blkno++, i = 0) {
+    tmpfs_dirent_t *de = (tmpfs_dirent_t *)*tmpfs_get_blk(tfn, blkno);
+    for (; i < TMPFS_DIRENTS_PER_BLK; i++)
+      if (de[i].tfd_node != NULL)
+        return &de[i];
+  }
+
+  return NULL;
+}
+
 static void *tmpfs_dirent_next(vnode_t *v, void *it) {
   assert(it != NULL);
   if (it == DIRENT_DOT)
     return DIRENT_DOTDOT;
   if (it == DIRENT_DOTDOT)
-    return TAILQ_FIRST(&TMPFS_NODE_OF(v)->tfn_dir.dirents);
-  return TAILQ_NEXT((tmpfs_dirent_t *)it, tfd_entries);
+    return tmpfs_dir_first_used(TMPFS_NODE_OF(v), 0);
+  return tmpfs_dir_first_used(TMPFS_NODE_OF(v),
+                              ((tmpfs_dirent_t *)it)->tfd_slot + 1);
+}
+
+static void *tmpfs_dirent_seek(vnode_t *v, off_t cookie) {
+  return tmpfs_dir_first_used(TMPFS_NODE_OF(v), cookie - DIRENT_COOKIE_MIN);
+}
+
+static off_t tmpfs_dirent_cookie(vnode_t *v, void *it) {
+  return ((tmpfs_dirent_t *)it)->tfd_slot + DIRENT_COOKIE_MIN;
 }
 
 static size_t tmpfs_dirent_namlen(vnode_t *v, void *it) {
@@ -356,6 +411,8 @@ static readdir_ops_t tmpfs_readdir_ops = {
   .next = tmpfs_dirent_next,
   .namlen_of = tmpfs_dirent_namlen,
   .convert = tmpfs_to_dirent,
+  .seek = tmpfs_dirent_seek,
+  .cookie_of = tmpfs_dirent_cookie,
 };
 
 /* tmpfs vnode operations */
@@ -676,6 +733,7 @@ static tmpfs_node_t *tmpfs_new_node(tmpfs_mount_t *tfm, vattr_t *va,
     case V_DIR:
       TAILQ_INIT(&node->tfn_dir.dirents);
       TAILQ_INIT(&node->tfn_dir.fdirents);
+      RB_INIT(&node->tfn_dir.dtree);
       /* Extra link count for the '.' entry. */
       node->tfn_links++;
       break;
@@ -732,6 +790,7 @@ static void tmpfs_dir_attach(tmpfs_node_t *dnode, tmpfs_dirent_t *de,
   node->tfn_links++;
   de->tfd_node = node;
   TAILQ_INSERT_TAIL(&dnode->tfn_dir.dirents, de, tfd_entries);
+  RB_INSERT(tmpfs_dirent_tree, &dnode->tfn_dir.dtree, de);
 
   /* If directory set parent and increase the link count of parent. */
   if (node->tfn_type == V_DIR) {
@@ -764,11 +823,13 @@ static int tmpfs_dir_extend(tmpfs_node_t *tfn) {
   if ((error = tmpfs_resize(tfm, tfn, tfn->tfn_size + BLOCK_SIZE)))
     return error;
 
-  blkptr_t blk = *tmpfs_get_blk(tfn, BLKNO(tfn->tfn_size) - 1);
+  size_t blkno = BLKNO(tfn->tfn_size) - 1;
+  blkptr_t blk = *tmpfs_get_blk(tfn, blkno);
 
-  size_t ndirent = BLOCK_SIZE / sizeof(tmpfs_dirent_t);
-  for (size_t i = 0; i < ndirent; i++) {
+  for (size_t i = 0; i < TMPFS_DIRENTS_PER_BLK; i++) {
     tmpfs_dirent_t *de = (tmpfs_dirent_t *)blk + i;
+    de->tfd_node = NULL;
+    de->tfd_slot = blkno * TMPFS_DIRENTS_PER_BLK + i;
     TAILQ_INSERT_TAIL(&tfn->tfn_dir.fdirents, de, tfd_entries);
   }
 
@@ -792,9 +853,12 @@ static int tmpfs_alloc_dirent(tmpfs_node_t *tfn, const char *name,
 
   tmpfs_dirent_t *dirent = TAILQ_FIRST(&tfn->tfn_dir.fdirents);
   TAILQ_REMOVE(&tfn->tfn_dir.fdirents, dirent, tfd_entries);
+  uint32_t slot = dirent->tfd_slot;
   bzero(dirent, sizeof(tmpfs_dirent_t));
 
   dirent->tfd_node = NULL;
+  dirent->tfd_slot = slot;
+  dirent->tfd_hash = tmpfs_name_hash(name, namelen);
   dirent->tfd_namelen = namelen;
   memcpy(dirent->tfd_name, name, namelen);
   dirent->tfd_name[namelen] = 0;
@@ -805,12 +869,14 @@ static int tmpfs_alloc_dirent(tmpfs_node_t *tfn, const char *name,
 
 static tmpfs_dirent_t *tmpfs_dir_lookup(tmpfs_node_t *tfn,
                                         const componentname_t *cn) {
-  tmpfs_dirent_t *de;
-  TAILQ_FOREACH (de, &tfn->tfn_dir.dirents, tfd_entries) {
-    if (componentname_equal(cn, de->tfd_name))
-      return de;
-  }
-  return NULL;
+  if (cn->cn_namelen + 1 > TMPFS_NAME_MAX)
+    return NULL;
+
+  tmpfs_dirent_t find = {.tfd_hash =
+                           tmpfs_name_hash(cn->cn_nameptr, cn->cn_namelen),
+                         .tfd_namelen = cn->cn_namelen};
+  memcpy(find.tfd_name, cn->cn_nameptr, cn->cn_namelen);
+  return RB_FIND(tmpfs_dirent_tree, &tfn->tfn_dir.dtree, &find);
 }
 
 /*
@@ -829,6 +895,7 @@ static void tmpfs_dir_detach(tmpfs_node_t *dv, tmpfs_dirent_t *de) {
   }
   de->tfd_node = NULL;
   TAILQ_REMOVE(&dv->tfn_dir.dirents, de, tfd_entries);
+  RB_REMOVE(tmpfs_dirent_tree, &dv->tfn_dir.dtree, de);
   TAILQ_INSERT_TAIL(&dv->tfn_dir.fdirents, de, tfd_entries);
 
   tmpfs_update_time(dv, TMPFS_UPDATE_MTIME | TMPFS_UPDATE_CTIME);
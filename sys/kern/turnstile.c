@@ -58,6 +58,10 @@ typedef struct turnstile_chain {
 
 static turnstile_chain_t turnstile_chains[TC_TABLESIZE];
 
+/* Protects all turnstiles, turnstile chains and `td_contested` lists.
+ * Must be acquired before any `td_lock`. */
+static MTX_DEFINE(turnstile_lock, MTX_SPIN);
+
 static void turnstile_ctor(turnstile_t *ts) {
   LIST_INIT(&ts->ts_free);
   TAILQ_INIT(&ts->ts_blocked);
@@ -175,18 +179,30 @@ static void propagate_priority(thread_t *td) {
 
 void turnstile_adjust(thread_t *td, prio_t oldprio) {
   assert(mtx_owned(td->td_lock));
-  assert(td_is_blocked(td));
 
-  turnstile_t *ts = td->td_blocked;
-  assert(ts != NULL);
-  assert(ts->ts_state == USED_BLOCKED);
+  /* `turnstile_lock` must be acquired before `td_lock`. In the meantime td
+   * may get woken up or its priority may change again. */
+  mtx_unlock(td->td_lock);
+  mtx_lock(&turnstile_lock);
+  mtx_lock(td->td_lock);
+
+  if (td_is_blocked(td)) {
+    turnstile_t *ts = td->td_blocked;
+    assert(ts != NULL);
+    assert(ts->ts_state == USED_BLOCKED);
 
-  adjust_thread(ts, td, oldprio);
+    /* `oldprio` may be stale by now, so find td's place from scratch. */
+    TAILQ_REMOVE(&ts->ts_blocked, td, td_blockedq);
+    TAILQ_INSERT_HEAD(&ts->ts_blocked, td, td_blockedq);
+    adjust_thread_forward(ts, td);
 
-  /* If td got higher priority and it is at the head of ts_blocked,
-   * propagate its priority. */
-  if (td == TAILQ_FIRST(&ts->ts_blocked) && prio_gt(td->td_prio, oldprio))
-    propagate_priority(td);
+    /* If td got higher priority and it is at the head of ts_blocked,
+     * propagate its priority. */
+    if (td == TAILQ_FIRST(&ts->ts_blocked) && prio_gt(td->td_prio, oldprio))
+      propagate_priority(td);
+  }
+
+  mtx_unlock(&turnstile_lock);
 }
 
 static void switch_away(turnstile_t *ts, const void *waitpt) {
@@ -200,6 +216,8 @@ static void switch_away(turnstile_t *ts, const void *waitpt) {
   td->td_waitpt = waitpt;
   td->td_state = TDS_BLOCKED;
   propagate_priority(td);
+  /* Whoever wakes us up must wait for `td_lock` until we switch away. */
+  mtx_unlock(&turnstile_lock);
   sched_switch();
 }
 
@@ -294,6 +312,8 @@ static __used turnstile_t *turnstile_lookup(void *wchan) {
 turnstile_t *turnstile_take(void *wchan) {
   assert(preempt_disabled());
 
+  mtx_lock(&turnstile_lock);
+
   turnstile_t *ts = turnstile_lookup(wchan);
 
   if (ts != NULL)
@@ -312,10 +332,13 @@ void turnstile_give(turnstile_t *ts) {
   thread_t *td = thread_self();
   if (ts == td->td_turnstile)
     ts->ts_wchan = NULL;
+
+  mtx_unlock(&turnstile_lock);
 }
 
 void turnstile_wait(turnstile_t *ts, thread_t *owner, const void *waitpt) {
   assert(preempt_disabled());
+  assert(mtx_owned(&turnstile_lock));
   assert(ts != NULL);
 
   thread_t *td = thread_self();
@@ -362,6 +385,8 @@ void turnstile_wait(turnstile_t *ts, thread_t *owner, const void *waitpt) {
 void turnstile_broadcast(void *wchan) {
   assert(preempt_disabled());
 
+  SCOPED_MTX_LOCK(&turnstile_lock);
+
   turnstile_t *ts = turnstile_lookup(wchan);
 
   assert(ts != NULL);
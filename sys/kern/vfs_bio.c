@@ -0,0 +1,591 @@
+#define KL_LOG KL_VFS
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/bio.h>
+#include <sys/devfs.h>
+#include <sys/errno.h>
+#include <sys/file.h>
+#include <sys/hash.h>
+#include <sys/kmem.h>
+#include <sys/libkern.h>
+#include <sys/mutex.h>
+#include <sys/pool.h>
+#include <sys/uio.h>
+
+/*
+ * Buffers are allocated on demand until there are NBUF of them. From then on
+ * the least recently used buffer that is not busy gets recycled. If all of
+ * them are busy, a thread waits until one of them is released. Buffers that
+ * no longer hold a block (e.g. because of an I/O error or invalidation) are
+ * returned to P_BUF instead of being kept around. That's safe since nobody
+ * sleeps on a condition variable of a buffer that is not busy.
+ *
+ * Writes are delayed (B_DELWRI) until one of the following happens:
+ *  - a dirty buffer is about to be recycled,
+ *  - the last block of an aligned run of BIO_MAXCLUSTER blocks is written,
+ *  - there are too many dirty buffers,
+ *  - the device is flushed, e.g. when it gets closed.
+ * A dirty buffer is always written out together with all adjacent dirty blocks
+ * that are not busy, so a sequential writer ends up issuing transfers of
+ * BIO_MAXCLUSTER blocks. If a write fails the blocks stay dirty and b_error
+ * is set, so the data is not lost and the write is retried later.
+ *
+ * Transfers of more than one block are staged in a single preallocated
+ * cluster buffer, which is used by one thread at a time.
+ */
+
+#define NBUF 64
+#define NDIRTY_MAX (NBUF / 2)
+#define BUF_HASHSIZE 64
+
+typedef LIST_HEAD(, buf) bufhashhead_t;
+typedef TAILQ_HEAD(, buf) buflru_t;
+
+static POOL_DEFINE(P_BUF, "buf", sizeof(buf_t));
+
+static MTX_DEFINE(bcache_lock, 0);
+static bufhashhead_t buf_hashtbl[BUF_HASHSIZE];            /* (bc) */
+static buflru_t buf_lru = TAILQ_HEAD_INITIALIZER(buf_lru); /* (bc) */
+static unsigned buf_count;                                 /* (bc) */
+static unsigned buf_ndirty;                                /* (bc) */
+/* Signaled whenever a buffer is released or freed. */
+static condvar_t buf_freed = {.name = "buf_freed"};
+static buf_t bio_cluster; /* (bc) */
+static condvar_t bio_cluster_cv = {.name = "bio_cluster"};
+
+static bufhashhead_t *buf_bucket(devnode_t *dev, daddr_t blkno) {
+  uint32_t hash = hash32_buf(&dev, sizeof(devnode_t *), HASH32_BUF_INIT);
+  hash = hash32_buf(&blkno, sizeof(daddr_t), hash);
+  return &buf_hashtbl[hash % BUF_HASHSIZE];
+}
+
+static buf_t *buf_incore(bufhashhead_t *bucket, devnode_t *dev,
+                         daddr_t blkno) {
+  assert(mtx_owned(&bcache_lock));
+
+  buf_t *bp;
+  LIST_FOREACH (bp, bucket, b_hash) {
+    if (bp->b_dev == dev && bp->b_blkno == blkno)
+      return bp;
+  }
+  return NULL;
+}
+
+static buf_t *buf_alloc(void) {
+  buf_t *bp = pool_alloc(P_BUF, M_ZERO);
+  bp->b_data = kmem_alloc(BIO_BSIZE, M_ZERO);
+  cv_init(&bp->b_cv, "buf");
+  return bp;
+}
+
+/* Returns a buffer that is not busy and holds no block to P_BUF. */
+static void buf_free(buf_t *bp) {
+  assert(mtx_owned(&bcache_lock));
+  assert(bp->b_dev == NULL && bp->b_flags == 0);
+
+  kmem_free(bp->b_data, BIO_BSIZE);
+  pool_free(P_BUF, bp);
+  buf_count--;
+  cv_signal(&buf_freed);
+}
+
+/* Returns a buffer that is not associated with any block. Returns NULL if all
+ * buffers are busy or the least recently used one has to be written out
+ * first. */
+static buf_t *buf_getnew(void) {
+  assert(mtx_owned(&bcache_lock));
+
+  buf_t *bp;
+
+  if (buf_count < NBUF) {
+    buf_count++;
+    return buf_alloc();
+  }
+
+  bp = TAILQ_FIRST(&buf_lru);
+  if (bp == NULL || (bp->b_flags & B_DELWRI))
+    return NULL;
+
+  TAILQ_REMOVE(&buf_lru, bp, b_lru);
+  if (bp->b_dev)
+    LIST_REMOVE(bp, b_hash);
+  return bp;
+}
+
+/* Associates a buffer returned by `buf_getnew` with a block. */
+static void buf_assign(buf_t *bp, bufhashhead_t *bucket, devnode_t *dev,
+                       daddr_t blkno) {
+  assert(mtx_owned(&bcache_lock));
+
+  bp->b_flags = B_BUSY;
+  bp->b_dev = dev;
+  bp->b_blkno = blkno;
+  bp->b_error = 0;
+  LIST_INSERT_HEAD(bucket, bp, b_hash);
+}
+
+/* Marks a buffer that is not busy as owned by the current thread. */
+static void buf_acquire(buf_t *bp) {
+  assert(mtx_owned(&bcache_lock));
+  assert(!(bp->b_flags & B_BUSY));
+
+  TAILQ_REMOVE(&buf_lru, bp, b_lru);
+  bp->b_flags |= B_BUSY;
+}
+
+/* Returns dirty buffer of the given block if it is not busy. */
+static buf_t *buf_delwri(devnode_t *dev, daddr_t blkno) {
+  buf_t *bp = buf_incore(buf_bucket(dev, blkno), dev, blkno);
+  if (bp == NULL || (bp->b_flags & B_BUSY) || !(bp->b_flags & B_DELWRI))
+    return NULL;
+  return bp;
+}
+
+static void buf_clean(buf_t *bp) {
+  assert(mtx_owned(&bcache_lock));
+
+  if (bp->b_flags & B_DELWRI) {
+    bp->b_flags &= ~B_DELWRI;
+    buf_ndirty--;
+  }
+}
+
+static int bio_write_cluster(buf_t *bp);
+
+buf_t *getblk(devnode_t *dev, daddr_t blkno) {
+  bufhashhead_t *bucket = buf_bucket(dev, blkno);
+  buf_t *bp;
+
+  mtx_lock(&bcache_lock);
+
+  for (;;) {
+    if ((bp = buf_incore(bucket, dev, blkno))) {
+      if (!(bp->b_flags & B_BUSY)) {
+        buf_acquire(bp);
+        break;
+      }
+      /* Buffer could have been recycled while we slept, so look it up
+       * again. */
+      cv_wait(&bp->b_cv, &bcache_lock);
+      continue;
+    }
+
+    if ((bp = buf_getnew())) {
+      buf_assign(bp, bucket, dev, blkno);
+      break;
+    }
+
+    /* All buffers are busy, so wait until one of them is released. */
+    if (TAILQ_EMPTY(&buf_lru)) {
+      cv_wait(&buf_freed, &bcache_lock);
+      continue;
+    }
+
+    /* Least recently used buffer is dirty, so write it out and retry. */
+    bp = TAILQ_FIRST(&buf_lru);
+    buf_acquire(bp);
+    mtx_unlock(&bcache_lock);
+    bio_write_cluster(bp);
+    mtx_lock(&bcache_lock);
+  }
+
+  mtx_unlock(&bcache_lock);
+  return bp;
+}
+
+void brelse(buf_t *bp) {
+  SCOPED_MTX_LOCK(&bcache_lock);
+
+  assert(bp->b_flags & B_BUSY);
+
+  /* Wake up threads waiting for the block before the buffer can go away. */
+  cv_broadcast(&bp->b_cv);
+
+  if ((bp->b_flags & B_ERROR) || !(bp->b_flags & B_VALID)) {
+    /* Contents of the buffer are useless, so give it back. */
+    assert(!(bp->b_flags & B_DELWRI));
+    LIST_REMOVE(bp, b_hash);
+    bp->b_dev = NULL;
+    bp->b_flags = 0;
+    buf_free(bp);
+  } else {
+    bp->b_flags &= ~(B_BUSY | B_READ | B_DONE);
+    TAILQ_INSERT_TAIL(&buf_lru, bp, b_lru);
+    cv_signal(&buf_freed);
+  }
+}
+
+void biodone(buf_t *bp, int error) {
+  SCOPED_MTX_LOCK(&bcache_lock);
+
+  assert(bp->b_flags & B_BUSY);
+
+  if (error) {
+    bp->b_flags |= B_ERROR;
+    bp->b_error = error;
+  }
+  bp->b_flags |= B_DONE;
+  cv_broadcast(&bp->b_cv);
+}
+
+int biowait(buf_t *bp) {
+  SCOPED_MTX_LOCK(&bcache_lock);
+
+  while (!(bp->b_flags & B_DONE))
+    cv_wait(&bp->b_cv, &bcache_lock);
+
+  return (bp->b_flags & B_ERROR) ? bp->b_error : 0;
+}
+
+/* Passes a busy buffer to device driver and waits for the transfer to end. */
+static int bio_strategy(buf_t *bp, uint32_t op, size_t size) {
+  WITH_MTX_LOCK (&bcache_lock)
+    bp->b_flags = (bp->b_flags & ~(B_READ | B_DONE | B_ERROR)) | op;
+
+  bp->b_bcount = size;
+  bp->b_resid = 0;
+  bp->b_error = 0;
+  bp->b_dev->ops->d_strategy(bp);
+
+  return biowait(bp);
+}
+
+/* Waits until the cluster buffer is free and marks it busy. */
+static buf_t *bio_cluster_acquire(devnode_t *dev, daddr_t blkno) {
+  SCOPED_MTX_LOCK(&bcache_lock);
+
+  buf_t *cbp = &bio_cluster;
+
+  while (cbp->b_flags & B_BUSY)
+    cv_wait(&bio_cluster_cv, &bcache_lock);
+
+  if (cbp->b_data == NULL) {
+    cbp->b_data = kmem_alloc(BIO_MAXCLUSTER * BIO_BSIZE, 0);
+    cv_init(&cbp->b_cv, "bio_cluster");
+  }
+
+  cbp->b_flags = B_BUSY;
+  cbp->b_dev = dev;
+  cbp->b_blkno = blkno;
+  return cbp;
+}
+
+static void bio_cluster_release(buf_t *cbp) {
+  SCOPED_MTX_LOCK(&bcache_lock);
+
+  cbp->b_flags = 0;
+  cbp->b_dev = NULL;
+  cv_signal(&bio_cluster_cv);
+}
+
+/* Transfers busy buffers holding consecutive blocks with a single
+ * `d_strategy` call. Data is staged in the cluster buffer if there's more
+ * than one block. Blocks that cross the end of device are padded with
+ * zeros. Stores the result in b_error of all buffers. After a read sets or
+ * clears their B_VALID flag depending on the result. */
+static int bio_transfer(buf_t **cl, int n, uint32_t op) {
+  buf_t *cbp = cl[0];
+  size_t size = n * BIO_BSIZE;
+
+  if (n > 1) {
+    cbp = bio_cluster_acquire(cl[0]->b_dev, cl[0]->b_blkno);
+    if (!(op & B_READ)) {
+      for (int i = 0; i < n; i++)
+        memcpy(cbp->b_data + i * BIO_BSIZE, cl[i]->b_data, BIO_BSIZE);
+    }
+  }
+
+  int error = bio_strategy(cbp, op, size);
+
+  if (!error && (op & B_READ)) {
+    size_t done = size - cbp->b_resid;
+    for (int i = 0; i < n; i++) {
+      size_t start = i * BIO_BSIZE;
+      size_t len = (done > start) ? min(done - start, (size_t)BIO_BSIZE) : 0;
+      if (cl[i] != cbp)
+        memcpy(cl[i]->b_data, cbp->b_data + start, len);
+      bzero(cl[i]->b_data + len, BIO_BSIZE - len);
+    }
+  }
+
+  if (cbp != cl[0])
+    bio_cluster_release(cbp);
+
+  WITH_MTX_LOCK (&bcache_lock) {
+    for (int i = 0; i < n; i++) {
+      cl[i]->b_flags &= ~B_ERROR;
+      cl[i]->b_error = error;
+      if (!(op & B_READ))
+        continue;
+      if (error)
+        cl[i]->b_flags &= ~B_VALID;
+      else
+        cl[i]->b_flags |= B_VALID;
+    }
+  }
+
+  return error;
+}
+
+/* Gathers a busy dirty buffer and dirty blocks adjacent to it that are not
+ * busy into a cluster. Returns the number of buffers stored in `cl`, which are
+ * ordered by block number and all marked busy. */
+static int buf_cluster_dirty(buf_t *bp, buf_t **cl) {
+  assert(mtx_owned(&bcache_lock));
+
+  devnode_t *dev = bp->b_dev;
+  daddr_t first = bp->b_blkno;
+  int n = 0;
+
+  while (first > 0 && bp->b_blkno - first + 1 < BIO_MAXCLUSTER &&
+         buf_delwri(dev, first - 1))
+    first--;
+
+  for (daddr_t blkno = first; n < BIO_MAXCLUSTER; blkno++) {
+    buf_t *nbp = bp;
+    if (blkno != bp->b_blkno) {
+      if (!(nbp = buf_delwri(dev, blkno)))
+        break;
+      buf_acquire(nbp);
+    }
+    cl[n++] = nbp;
+  }
+
+  return n;
+}
+
+/* Marks written out buffers clean. Blocks that failed to be written stay
+ * dirty, unless the device is gone, in which case their contents are
+ * dropped. */
+static void bio_write_done(buf_t **cl, int n, int error) {
+  SCOPED_MTX_LOCK(&bcache_lock);
+
+  for (int i = 0; i < n; i++) {
+    if (error && error != ENXIO)
+      continue;
+    buf_clean(cl[i]);
+    if (error)
+      cl[i]->b_flags &= ~B_VALID;
+  }
+}
+
+/* Writes out a busy dirty buffer along with adjacent dirty blocks and
+ * releases all of them. */
+static int bio_write_cluster(buf_t *bp) {
+  buf_t *cl[BIO_MAXCLUSTER];
+  int n;
+
+  WITH_MTX_LOCK (&bcache_lock)
+    n = buf_cluster_dirty(bp, cl);
+
+  int error = bio_transfer(cl, n, 0);
+  if (error)
+    klog("Delayed write of blocks %lld-%lld failed with error %d!",
+         cl[0]->b_blkno, cl[n - 1]->b_blkno, error);
+
+  bio_write_done(cl, n, error);
+
+  for (int i = 0; i < n; i++)
+    brelse(cl[i]);
+
+  return error;
+}
+
+/* Reads a block into the cache. If the block is not cached, following `nra`
+ * blocks are read along with it, unless they're cached already. */
+static int bio_bread(devnode_t *dev, daddr_t blkno, int nra, buf_t **bpp) {
+  buf_t *cl[BIO_MAXCLUSTER];
+  buf_t *bp = getblk(dev, blkno);
+  int n = 1;
+
+  *bpp = NULL;
+
+  if (bp->b_flags & B_VALID) {
+    *bpp = bp;
+    return 0;
+  }
+
+  cl[0] = bp;
+
+  WITH_MTX_LOCK (&bcache_lock) {
+    while (n <= nra && n < BIO_MAXCLUSTER) {
+      daddr_t rablkno = blkno + n;
+      bufhashhead_t *bucket = buf_bucket(dev, rablkno);
+      buf_t *rabp;
+
+      if (dev->size && (size_t)rablkno * BIO_BSIZE >= dev->size)
+        break;
+      if (buf_incore(bucket, dev, rablkno) || !(rabp = buf_getnew()))
+        break;
+
+      buf_assign(rabp, bucket, dev, rablkno);
+      cl[n++] = rabp;
+    }
+  }
+
+  int error = bio_transfer(cl, n, B_READ);
+
+  for (int i = 1; i < n; i++)
+    brelse(cl[i]);
+
+  if (error) {
+    brelse(bp);
+    return error;
+  }
+
+  *bpp = bp;
+  return 0;
+}
+
+int bread(devnode_t *dev, daddr_t blkno, buf_t **bpp) {
+  return bio_bread(dev, blkno, 0, bpp);
+}
+
+int bwrite(buf_t *bp) {
+  int error = bio_transfer(&bp, 1, 0);
+  bio_write_done(&bp, 1, error);
+  brelse(bp);
+  return error;
+}
+
+void bdwrite(buf_t *bp) {
+  bool flush;
+
+  WITH_MTX_LOCK (&bcache_lock) {
+    if (!(bp->b_flags & B_DELWRI)) {
+      bp->b_flags |= B_DELWRI;
+      buf_ndirty++;
+    }
+    bp->b_flags |= B_VALID;
+    flush = (buf_ndirty > NDIRTY_MAX) ||
+            ((bp->b_blkno + 1) % BIO_MAXCLUSTER == 0);
+  }
+
+  if (flush)
+    bio_write_cluster(bp);
+  else
+    brelse(bp);
+}
+
+int bio_flush(devnode_t *dev) {
+  for (;;) {
+    buf_t *bp;
+    int error;
+
+    WITH_MTX_LOCK (&bcache_lock) {
+      TAILQ_FOREACH (bp, &buf_lru, b_lru) {
+        if ((dev == NULL || bp->b_dev == dev) && (bp->b_flags & B_DELWRI))
+          break;
+      }
+      if (bp)
+        buf_acquire(bp);
+    }
+
+    if (bp == NULL)
+      return 0;
+
+    /* Blocks that failed to be written are still dirty, so give up rather
+     * than trying to write them again. */
+    if ((error = bio_write_cluster(bp)))
+      return error;
+  }
+}
+
+void binvalidate(devnode_t *dev) {
+  SCOPED_MTX_LOCK(&bcache_lock);
+
+  for (int i = 0; i < BUF_HASHSIZE; i++) {
+    buf_t *bp, *next;
+    LIST_FOREACH_SAFE (bp, &buf_hashtbl[i], b_hash, next) {
+      if (bp->b_dev != dev || (bp->b_flags & B_BUSY))
+        continue;
+      buf_clean(bp);
+      LIST_REMOVE(bp, b_hash);
+      TAILQ_REMOVE(&buf_lru, bp, b_lru);
+      bp->b_dev = NULL;
+      bp->b_flags = 0;
+      buf_free(bp);
+    }
+  }
+}
+
+/* Returns the number of bytes that can be transferred within the current
+ * block, or 0 if the transfer starts at or past the end of the device. */
+static size_t bio_xfer_size(devnode_t *dev, uio_t *uio) {
+  size_t off = uio->uio_offset % BIO_BSIZE;
+  size_t n = min(BIO_BSIZE - off, uio->uio_resid);
+
+  if (dev->size == 0)
+    return n;
+  if ((size_t)uio->uio_offset >= dev->size)
+    return 0;
+  return min(n, dev->size - uio->uio_offset);
+}
+
+int bio_read(devnode_t *dev, uio_t *uio) {
+  unsigned seqcount = uio->uio_ioflags >> IO_SEQSHIFT;
+  size_t n;
+  int error = 0;
+
+  assert(uio->uio_op == UIO_READ);
+
+  if (uio->uio_offset < 0)
+    return EINVAL;
+
+  while ((n = bio_xfer_size(dev, uio))) {
+    size_t off = uio->uio_offset % BIO_BSIZE;
+    buf_t *bp;
+
+    /* Read the rest of the request in one go, and further ahead if the file
+     * is accessed sequentially. */
+    int nra = howmany(off + uio->uio_resid, BIO_BSIZE) - 1;
+    nra = max(nra, (int)min(seqcount, BIO_MAXCLUSTER - 1U));
+
+    if ((error = bio_bread(dev, uio->uio_offset / BIO_BSIZE, nra, &bp)))
+      break;
+
+    error = uiomove(bp->b_data + off, n, uio);
+    brelse(bp);
+    if (error)
+      break;
+  }
+
+  return error;
+}
+
+int bio_write(devnode_t *dev, uio_t *uio) {
+  size_t n;
+  int error = 0;
+
+  assert(uio->uio_op == UIO_WRITE);
+
+  if (uio->uio_offset < 0)
+    return EINVAL;
+
+  while ((n = bio_xfer_size(dev, uio))) {
+    daddr_t blkno = uio->uio_offset / BIO_BSIZE;
+    size_t off = uio->uio_offset % BIO_BSIZE;
+    buf_t *bp;
+
+    /* Whole block is overwritten, so there's no need to read it first. */
+    if (n == BIO_BSIZE) {
+      bp = getblk(dev, blkno);
+    } else if ((error = bread(dev, blkno, &bp))) {
+      break;
+    }
+
+    error = uiomove(bp->b_data + off, n, uio);
+
+    /* Partially overwritten block that wasn't read is garbage. */
+    if (error && !(bp->b_flags & B_VALID)) {
+      brelse(bp);
+      break;
+    }
+
+    bdwrite(bp);
+    if (error)
+      break;
+  }
+
+  return error;
+}
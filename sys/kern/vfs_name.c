@@ -124,7 +124,19 @@ static int vnr_lookup_once(vnrstate_t *vs, vnode_t **searchdir_p,
   if ((error = can_lookup(searchdir, cred)))
     return error;
 
-  if ((error = VOP_LOOKUP(searchdir, cn, &foundvn))) {
+  /* Entering a name that is about to be created is just a waste of time. */
+  bool creating = (vs->vs_op == VNR_CREATE && cn->cn_flags & CN_ISLAST);
+  unsigned gen;
+
+  if (vfs_namecache_lookup(searchdir, cn, &foundvn, &gen)) {
+    error = foundvn ? 0 : ENOENT;
+  } else {
+    error = VOP_LOOKUP(searchdir, cn, &foundvn);
+    if (!error || (error == ENOENT && !creating))
+      vfs_namecache_enter(searchdir, cn, error ? NULL : foundvn, gen);
+  }
+
+  if (error) {
     /*
      * The entry was not found in the directory. This is valid if we are
      * creating an entry and are working on the last component of the path name.
@@ -369,7 +381,7 @@ int vfs_name_in_dir(vnode_t *dv, vnode_t *v, char *buf, size_t *lastp) {
   if ((error = VOP_GETATTR(v, &va)))
     return error;
 
-  int offset = 0;
+  off_t offset = 0;
   size_t last = *lastp;
   uio_t uio;
 
@@ -381,7 +393,8 @@ int vfs_name_in_dir(vnode_t *dv, vnode_t *v, char *buf, size_t *lastp) {
     if ((error = VOP_READDIR(dv, &uio)))
       goto end;
 
-    intptr_t nread = uio.uio_offset - offset;
+    /* Directory offsets are cookies, so look at consumed space instead. */
+    intptr_t nread = PATH_MAX - uio.uio_resid;
     if (nread == 0)
       break;
 
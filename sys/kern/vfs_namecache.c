@@ -0,0 +1,193 @@
+#define KL_LOG KL_VFS
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/hash.h>
+#include <sys/libkern.h>
+#include <sys/mutex.h>
+#include <sys/pool.h>
+#include <sys/vfs.h>
+#include <sys/vnode.h>
+
+/*
+ * Name cache maps (directory vnode, path name component) pairs to vnodes found
+ * by VOP_LOOKUP, so that repeated lookups of the same path do not have to call
+ * into the filesystem. A negative entry (nc_vp == NULL) records that the name
+ * does not exist in the directory.
+ *
+ * The cache does not hold references to vnodes. Instead every entry is linked
+ * on lists of both of its vnodes and is purged before either of them is
+ * reclaimed. Filesystems (or rather their callers) must remove entries for
+ * names they unlink and for names they create to get rid of negative entries.
+ *
+ * Field markings and the corresponding locks:
+ *  (nc) namecache_lock
+ *  (!) read-only after the entry has been inserted
+ */
+
+#define NC_NAMELEN 31 /* longer names are not cached */
+#define NC_HASHSIZE 256
+#define NC_MAXENTRIES 1024
+
+typedef struct namecache {
+  LIST_ENTRY(namecache) nc_hash; /* (nc) entry on hash chain */
+  LIST_ENTRY(namecache) nc_src;  /* (nc) entry on nc_dvp->v_ncsrc list */
+  LIST_ENTRY(namecache) nc_dst;  /* (nc) entry on nc_vp->v_ncdst list */
+  TAILQ_ENTRY(namecache) nc_lru; /* (nc) entry on LRU queue */
+  vnode_t *nc_dvp;               /* (!) directory vnode */
+  vnode_t *nc_vp;                /* (!) vnode found or NULL if negative */
+  uint8_t nc_namelen;            /* (!) length of component name */
+  char nc_name[NC_NAMELEN];      /* (!) component name (not NUL-terminated) */
+} namecache_t;
+
+typedef LIST_HEAD(, namecache) nchashhead_t;
+typedef TAILQ_HEAD(, namecache) nclru_t;
+
+static POOL_DEFINE(P_NAMECACHE, "namecache", sizeof(namecache_t));
+
+static MTX_DEFINE(namecache_lock, 0);
+static nchashhead_t nc_hashtbl[NC_HASHSIZE];            /* (nc) hash chains */
+static nclru_t nc_lru = TAILQ_HEAD_INITIALIZER(nc_lru); /* (nc) LRU queue */
+static unsigned nc_numentries;                          /* (nc) # of entries */
+/* (nc) Bumped whenever an entry is removed, see vfs_namecache_enter. */
+static unsigned nc_generation;
+
+static nchashhead_t *nc_bucket(vnode_t *dv, const componentname_t *cn) {
+  uint32_t hash = hash32_buf(&dv, sizeof(vnode_t *), HASH32_BUF_INIT);
+  hash = hash32_buf(cn->cn_nameptr, cn->cn_namelen, hash);
+  return &nc_hashtbl[hash % NC_HASHSIZE];
+}
+
+static bool nc_cacheable(const componentname_t *cn) {
+  if (cn->cn_namelen > NC_NAMELEN)
+    return false;
+  /* These are handled by vfs_maybe_ascend and the filesystems themselves. */
+  return !componentname_equal(cn, ".") && !componentname_equal(cn, "..");
+}
+
+static namecache_t *nc_find(nchashhead_t *bucket, vnode_t *dv,
+                            const componentname_t *cn) {
+  assert(mtx_owned(&namecache_lock));
+
+  namecache_t *nc;
+  LIST_FOREACH (nc, bucket, nc_hash) {
+    if (nc->nc_dvp == dv && nc->nc_namelen == cn->cn_namelen &&
+        !memcmp(nc->nc_name, cn->cn_nameptr, cn->cn_namelen))
+      return nc;
+  }
+  return NULL;
+}
+
+static void nc_remove(namecache_t *nc) {
+  assert(mtx_owned(&namecache_lock));
+
+  LIST_REMOVE(nc, nc_hash);
+  LIST_REMOVE(nc, nc_src);
+  if (nc->nc_vp)
+    LIST_REMOVE(nc, nc_dst);
+  TAILQ_REMOVE(&nc_lru, nc, nc_lru);
+  nc_numentries--;
+}
+
+/* Acquire a reference to a vnode unless it is being reclaimed right now. */
+static bool nc_vhold(vnode_t *v) {
+  unsigned cnt = atomic_load(&v->v_usecnt);
+  do {
+    if (cnt == 0)
+      return false;
+  } while (!atomic_compare_exchange_weak(&v->v_usecnt, &cnt, cnt + 1));
+  return true;
+}
+
+bool vfs_namecache_lookup(vnode_t *dv, const componentname_t *cn,
+                          vnode_t **vp, unsigned *genp) {
+  SCOPED_MTX_LOCK(&namecache_lock);
+
+  *genp = nc_generation;
+
+  if (!nc_cacheable(cn))
+    return false;
+
+  namecache_t *nc = nc_find(nc_bucket(dv, cn), dv, cn);
+  if (nc == NULL)
+    return false;
+
+  if (nc->nc_vp != NULL && !nc_vhold(nc->nc_vp))
+    return false;
+
+  TAILQ_REMOVE(&nc_lru, nc, nc_lru);
+  TAILQ_INSERT_TAIL(&nc_lru, nc, nc_lru);
+  *vp = nc->nc_vp;
+  return true;
+}
+
+void vfs_namecache_enter(vnode_t *dv, const componentname_t *cn, vnode_t *vp,
+                         unsigned gen) {
+  if (!nc_cacheable(cn))
+    return;
+
+  namecache_t *nc = pool_alloc(P_NAMECACHE, M_ZERO);
+  namecache_t *victim = NULL;
+  nc->nc_dvp = dv;
+  nc->nc_vp = vp;
+  nc->nc_namelen = cn->cn_namelen;
+  memcpy(nc->nc_name, cn->cn_nameptr, cn->cn_namelen);
+
+  WITH_MTX_LOCK (&namecache_lock) {
+    nchashhead_t *bucket = nc_bucket(dv, cn);
+
+    /* Directory could have been modified since the lookup was performed. */
+    if (gen != nc_generation || nc_find(bucket, dv, cn)) {
+      victim = nc;
+      break;
+    }
+
+    if (nc_numentries == NC_MAXENTRIES) {
+      victim = TAILQ_FIRST(&nc_lru);
+      nc_remove(victim);
+    }
+
+    LIST_INSERT_HEAD(bucket, nc, nc_hash);
+    LIST_INSERT_HEAD(&dv->v_ncsrc, nc, nc_src);
+    if (vp)
+      LIST_INSERT_HEAD(&vp->v_ncdst, nc, nc_dst);
+    TAILQ_INSERT_TAIL(&nc_lru, nc, nc_lru);
+    nc_numentries++;
+  }
+
+  if (victim)
+    pool_free(P_NAMECACHE, victim);
+}
+
+void vfs_namecache_remove(vnode_t *dv, const componentname_t *cn) {
+  namecache_t *nc = NULL;
+
+  WITH_MTX_LOCK (&namecache_lock) {
+    nc_generation++;
+    if (nc_cacheable(cn) && (nc = nc_find(nc_bucket(dv, cn), dv, cn)))
+      nc_remove(nc);
+  }
+
+  if (nc)
+    pool_free(P_NAMECACHE, nc);
+}
+
+void vfs_namecache_purge(vnode_t *v) {
+  LIST_HEAD(, namecache) freed = LIST_HEAD_INITIALIZER(freed);
+  namecache_t *nc;
+
+  WITH_MTX_LOCK (&namecache_lock) {
+    while ((nc = LIST_FIRST(&v->v_ncsrc))) {
+      nc_remove(nc);
+      LIST_INSERT_HEAD(&freed, nc, nc_hash);
+    }
+    while ((nc = LIST_FIRST(&v->v_ncdst))) {
+      nc_remove(nc);
+      LIST_INSERT_HEAD(&freed, nc, nc_hash);
+    }
+  }
+
+  while ((nc = LIST_FIRST(&freed))) {
+    LIST_REMOVE(nc, nc_hash);
+    pool_free(P_NAMECACHE, nc);
+  }
+}
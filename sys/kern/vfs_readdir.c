@@ -1,6 +1,6 @@
 #include <sys/mimiker.h>
+#include <sys/libkern.h>
 #include <sys/dirent.h>
-#include <sys/malloc.h>
 #include <sys/uio.h>
 #include <sys/vnode.h>
 
@@ -16,38 +16,74 @@ uint8_t vt2dt(vnodetype_t v_type) {
   return vttodt_tab[v_type];
 }
 
-int readdir_generic(vnode_t *v, uio_t *uio, readdir_ops_t *ops) {
-  dirent_t *dir;
+/* Large enough to hold a single dirent with the longest name possible. */
+#define READDIR_BUFSIZE 512
+
+static_assert(_DIRENT_RECLEN((dirent_t *)0, MAXNAMLEN) <= READDIR_BUFSIZE,
+              "readdir buffer too small");
+
+/* Find the entry a readdir should start with given its cookie. */
+static void *readdir_seek(vnode_t *v, off_t cookie, readdir_ops_t *ops) {
+  if (cookie == 0)
+    return DIRENT_DOT;
+  if (cookie == 1)
+    return DIRENT_DOTDOT;
+  if (ops->seek)
+    return ops->seek(v, max(cookie, DIRENT_COOKIE_MIN));
+
   void *it = DIRENT_DOT;
-  off_t offset = 0;
-  int error;
-
-  /* Locate proper directory based on offset */
-  for (; it; it = ops->next(v, it)) {
-    unsigned reclen = _DIRENT_RECLEN(dir, ops->namlen_of(v, it));
-    if (offset + reclen > (unsigned)uio->uio_offset) {
-      assert(it == NULL || offset == uio->uio_offset);
-      break;
-    }
-    offset += reclen;
-  }
+  for (off_t i = 0; it && i < cookie; i++)
+    it = ops->next(v, it);
+  return it;
+}
 
-  for (; it; it = ops->next(v, it)) {
+/* Return cookie of the entry following the one identified by cookie. */
+static off_t readdir_cookie(vnode_t *v, void *next, off_t cookie,
+                            readdir_ops_t *ops) {
+  if (next == DIRENT_DOTDOT)
+    return 1;
+  if (next != DIRENT_EOF && ops->cookie_of)
+    return ops->cookie_of(v, next);
+  return cookie + 1;
+}
+
+int readdir_generic(vnode_t *v, uio_t *uio, readdir_ops_t *ops) {
+  char buf[READDIR_BUFSIZE] __aligned(sizeof(ino_t));
+  size_t len = 0;
+  off_t cookie = uio->uio_offset;
+  int error = 0;
+
+  if (cookie < 0)
+    return EINVAL;
+
+  for (void *it = readdir_seek(v, cookie, ops); it;) {
     unsigned namlen = ops->namlen_of(v, it);
-    unsigned reclen = _DIRENT_RECLEN(dir, namlen);
+    unsigned reclen = _DIRENT_RECLEN((dirent_t *)buf, namlen);
 
-    if (uio->uio_resid < reclen)
+    if (uio->uio_resid < len + reclen)
       break;
 
-    dir = kmalloc(M_TEMP, reclen, M_ZERO);
+    /* Flush the buffer if the record does not fit in. */
+    if (len + reclen > sizeof(buf)) {
+      if ((error = uiomove(buf, len, uio)))
+        return error;
+      len = 0;
+    }
+
+    dirent_t *dir = (dirent_t *)(buf + len);
+    memset(dir, 0, reclen);
     dir->d_namlen = namlen;
     dir->d_reclen = reclen;
     ops->convert(v, it, dir);
-    error = uiomove(dir, reclen, uio);
-    kfree(M_TEMP, dir);
-    if (error)
-      return error;
+    len += reclen;
+
+    it = ops->next(v, it);
+    cookie = readdir_cookie(v, it, cookie, ops);
   }
 
-  return 0;
+  if (len > 0)
+    error = uiomove(buf, len, uio);
+
+  uio->uio_offset = cookie;
+  return error;
 }
@@ -12,6 +12,7 @@
 #include <sys/libkern.h>
 #include <sys/statvfs.h>
 #include <sys/cred.h>
+#include <sys/vm_pager.h>
 
 static int vfs_nameresolveat(proc_t *p, int fdat, vnrstate_t *vs) {
   file_t *f;
@@ -48,7 +49,10 @@ static int vfs_truncate(vnode_t *v, size_t len, cred_t *cred) {
   vattr_t va;
   vattr_null(&va);
   va.va_size = len;
-  return VOP_SETATTR(v, &va, cred);
+  int error = VOP_SETATTR(v, &va, cred);
+  if (!error)
+    vnode_pager_truncate(v, len);
+  return error;
 }
 
 /* This function cleans O_CREAT in flags when file is not being created. */
@@ -80,6 +84,8 @@ static int vfs_create(proc_t *p, int fdat, char *pathname, int *flags, int mode,
     va.va_uid = p->p_cred.cr_euid;
     va.va_gid = dva.va_mode & S_ISGID ? dva.va_gid : p->p_cred.cr_egid;
     error = VOP_CREATE(vs.vs_dvp, &vs.vs_lastcn, &va, &vs.vs_vp);
+    if (!error)
+      vfs_namecache_remove(vs.vs_dvp, &vs.vs_lastcn);
     vnode_put(vs.vs_dvp);
   } else {
     if (vs.vs_vp == vs.vs_dvp)
@@ -137,8 +143,11 @@ static int vfs_open(proc_t *p, file_t *f, int fdat, char *pathname, int flags,
     if ((error = vfs_check_open(v, flags, &p->p_cred)))
       return error;
 
-  if (flags & O_TRUNC)
+  if (flags & O_TRUNC) {
+    vnode_lock(v);
     error = vfs_truncate(v, 0, &p->p_cred);
+    vnode_unlock(v);
+  }
 
   if (!error)
     error = VOP_OPEN(v, flags, f);
@@ -284,6 +293,9 @@ int do_unlinkat(proc_t *p, int fd, char *path, int flag) {
       error = VOP_REMOVE(vs.vs_dvp, vs.vs_vp, &vs.vs_lastcn);
   }
 
+  if (!error)
+    vfs_namecache_remove(vs.vs_dvp, &vs.vs_lastcn);
+
   vnode_put_both(vs.vs_vp, vs.vs_dvp);
 
 fail:
@@ -333,8 +345,10 @@ int do_mkdirat(proc_t *p, int fd, char *path, mode_t mode) {
   }
 
   error = VOP_MKDIR(vs.vs_dvp, &vs.vs_lastcn, &va, &vs.vs_vp);
-  if (!error)
+  if (!error) {
+    vfs_namecache_remove(vs.vs_dvp, &vs.vs_lastcn);
     vnode_drop(vs.vs_vp);
+  }
 
   vnode_put(vs.vs_dvp);
 
@@ -537,8 +551,10 @@ int do_symlinkat(proc_t *p, char *target, int newdirfd, char *linkpath) {
   va.va_gid = p->p_cred.cr_rgid;
 
   error = VOP_SYMLINK(vs.vs_dvp, &vs.vs_lastcn, &va, target, &vs.vs_vp);
-  if (!error)
+  if (!error) {
+    vfs_namecache_remove(vs.vs_dvp, &vs.vs_lastcn);
     vnode_drop(vs.vs_vp);
+  }
   vnode_put(vs.vs_dvp);
 
 fail:
@@ -581,8 +597,8 @@ int do_linkat(proc_t *p, int fd, char *path, int linkfd, char *linkpath,
 
   if (vs.vs_dvp->v_mount != target_vn->v_mount)
     error = EXDEV;
-  else
-    error = VOP_LINK(vs.vs_dvp, target_vn, &vs.vs_lastcn);
+  else if (!(error = VOP_LINK(vs.vs_dvp, target_vn, &vs.vs_lastcn)))
+    vfs_namecache_remove(vs.vs_dvp, &vs.vs_lastcn);
 
   vnode_put(vs.vs_dvp);
 
@@ -12,6 +12,8 @@
 #include <sys/mutex.h>
 #include <sys/condvar.h>
 #include <sys/cred.h>
+#include <sys/thread.h>
+#include <sys/vm_pager.h>
 
 static POOL_DEFINE(P_VNODE, "vnode", sizeof(vnode_t));
 
@@ -38,6 +40,7 @@ vnode_t *vnode_new(vnodetype_t type, vnodeops_t *ops, void *data) {
  * that allows sleeping. */
 
 static void vnlock_init(vnlock_t *vl) {
+  vl->vl_owner = NULL;
   mtx_init(&vl->vl_interlock, MTX_SPIN);
   cv_init(&vl->vl_cv, "vnode sleep cv");
 }
@@ -45,26 +48,31 @@ static void vnlock_init(vnlock_t *vl) {
 void vnode_lock(vnode_t *v) {
   vnlock_t *vl = &v->v_lock;
   WITH_MTX_LOCK (&vl->vl_interlock) {
-    while (vl->vl_locked)
+    while (vl->vl_owner)
       cv_wait(&vl->vl_cv, &vl->vl_interlock);
-    vl->vl_locked = true;
+    vl->vl_owner = thread_self();
   }
 }
 
 void vnode_unlock(vnode_t *v) {
   vnlock_t *vl = &v->v_lock;
   WITH_MTX_LOCK (&vl->vl_interlock) {
-    vl->vl_locked = false;
+    vl->vl_owner = NULL;
     cv_signal(&vl->vl_cv);
   }
 }
 
+bool vnode_owned(vnode_t *v) {
+  return v->v_lock.vl_owner == thread_self();
+}
+
 void vnode_hold(vnode_t *v) {
   refcnt_acquire(&v->v_usecnt);
 }
 
 void vnode_drop(vnode_t *v) {
   if (refcnt_release(&v->v_usecnt)) {
+    vfs_namecache_purge(v);
     VOP_RECLAIM(v);
     pool_free(P_VNODE, v);
   }
@@ -117,6 +125,7 @@ static int vnode_nop(vnode_t *v, ...) {
 #define vnode_reclaim_nop vnode_nop
 #define vnode_readlink_nop vnode_nop
 #define vnode_symlink_nop vnode_nop
+#define vnode_getpage_nop vnode_nop
 
 /* XXX when no v_access function don't return error */
 static int vnode_access_nop(vnode_t *v, mode_t m, cred_t *cred) {
@@ -152,6 +161,7 @@ void vnodeops_init(vnodeops_t *vops) {
   NOP_IF_NULL(vops, reclaim);
   NOP_IF_NULL(vops, readlink);
   NOP_IF_NULL(vops, symlink);
+  NOP_IF_NULL(vops, getpage);
 }
 
 void vattr_convert(vattr_t *va, stat_t *sb) {
@@ -196,7 +206,15 @@ int default_vnwrite(file_t *f, uio_t *uio) {
   int error = 0;
   vnode_lock(v);
   uio->uio_offset = f->f_offset;
+  size_t resid = uio->uio_resid;
   error = VOP_WRITE(f->f_vnode, uio);
+  /* Pages cached by vnode pager are stale now. They're updated in place rather
+   * than dropped, since they may contain changes made through shared mappings.
+   * Written range is computed from the final offset, since IO_APPEND ignores
+   * the initial one. */
+  size_t written = resid - uio->uio_resid;
+  if (written > 0)
+    vnode_pager_update(v, uio->uio_offset - written, written);
   f->f_offset = uio->uio_offset;
   vnode_unlock(v);
   return error;
@@ -258,7 +276,7 @@ int default_vnseek(file_t *f, off_t offset, int whence, off_t *newoffp) {
   }
 
   /* TODO offset can go past the end of file when it's open for writing */
-  if (offset < 0 || offset > size) {
+  if (offset < 0 || (v->v_type != V_DIR && offset > size)) {
     error = EINVAL;
     goto out;
   }
@@ -7,6 +7,8 @@
 #include <sys/vm_pager.h>
 #include <sys/vm_object.h>
 #include <sys/vm_map.h>
+#include <sys/vm_physmem.h>
+#include <sys/vnode.h>
 #include <sys/errno.h>
 #include <sys/proc.h>
 #include <sys/sched.h>
@@ -30,6 +32,8 @@ struct vm_map {
   mtx_t mtx; /* Mutex guarding vm_map structure and all its entries. */
 };
 
+typedef TAILQ_HEAD(, vm_map_entry) vm_map_entry_list_t;
+
 static POOL_DEFINE(P_VM_MAP, "vm_map", sizeof(vm_map_t));
 static POOL_DEFINE(P_VM_MAPENT, "vm_map_entry", sizeof(vm_map_entry_t));
 
@@ -54,6 +58,7 @@ void vm_map_unlock(vm_map_t *map) {
 }
 
 vm_map_t *vm_map_user(void) {
+  SCOPED_NO_PREEMPTION();
   vm_map_t *map = PCPU_GET(uspace);
   assert(map);
   return map;
@@ -67,6 +72,11 @@ vaddr_t vm_map_entry_end(vm_map_entry_t *ent) {
   return ent->end;
 }
 
+void vm_map_entry_set_offset(vm_map_entry_t *ent, vaddr_t offset) {
+  assert(page_aligned_p(offset));
+  ent->offset = offset;
+}
+
 inline vm_map_entry_t *vm_map_entry_next(vm_map_entry_t *ent) {
   return TAILQ_NEXT(ent, link);
 }
@@ -101,12 +111,36 @@ vm_map_entry_t *vm_map_entry_alloc(vm_object_t *obj, vaddr_t start, vaddr_t end,
   return ent;
 }
 
+/* Returns vnode whose pages are shared through the entry, or NULL. */
+static vnode_t *vm_map_entry_vnode(vm_map_entry_t *ent) {
+  if (!(ent->flags & VM_ENT_SHARED) || !ent->object)
+    return NULL;
+  return ent->object->vo_vnode;
+}
+
 static void vm_map_entry_free(vm_map_entry_t *ent) {
   if (ent->object)
     vm_object_drop(ent->object);
   pool_free(P_VM_MAPENT, ent);
 }
 
+/* Frees entries removed from a map. Modifications made through shared file
+ * mappings must not be lost, so they're written back first. That must be done
+ * with the map unlocked, since the file system may page fault on user memory
+ * while holding the vnode lock. */
+static void vm_map_entry_free_list(vm_map_entry_list_t *dead) {
+  vm_map_entry_t *ent, *next;
+  TAILQ_FOREACH_SAFE (ent, dead, link, next) {
+    vnode_t *vn = vm_map_entry_vnode(ent);
+    if (vn) {
+      vnode_lock(vn);
+      (void)vnode_pager_flush(vn, ent->offset, ent->end - ent->start);
+      vnode_unlock(vn);
+    }
+    vm_map_entry_free(ent);
+  }
+}
+
 vm_map_entry_t *vm_map_find_entry(vm_map_t *map, vaddr_t vaddr) {
   assert(mtx_owned(&map->mtx));
 
@@ -127,12 +161,15 @@ static void vm_map_insert_after(vm_map_t *map, vm_map_entry_t *after,
   map->nentries++;
 }
 
-static void vm_map_entry_destroy(vm_map_t *map, vm_map_entry_t *ent) {
+/* Removes entry from the map and puts it on `dead` list, which must be passed
+ * to vm_map_entry_free_list once the map is unlocked. */
+static void vm_map_entry_destroy(vm_map_t *map, vm_map_entry_t *ent,
+                                 vm_map_entry_list_t *dead) {
   assert(mtx_owned(&map->mtx));
 
   TAILQ_REMOVE(&map->entries, ent, link);
   map->nentries--;
-  vm_map_entry_free(ent);
+  TAILQ_INSERT_TAIL(dead, ent, link);
 }
 
 static inline vm_map_entry_t *vm_map_entry_copy(vm_map_entry_t *src) {
@@ -165,7 +202,8 @@ static vm_map_entry_t *vm_map_entry_split(vm_map_t *map, vm_map_entry_t *ent,
 }
 
 static int vm_map_destroy_range_nolock(vm_map_t *map, vaddr_t start,
-                                       vaddr_t end) {
+                                       vaddr_t end,
+                                       vm_map_entry_list_t *dead) {
   assert(mtx_owned(&map->mtx));
 
   /* Find first entry affected by unmapping memory. */
@@ -195,7 +233,7 @@ static int vm_map_destroy_range_nolock(vm_map_t *map, vaddr_t start,
       vm_map_entry_split(map, del, rm_end);
     }
 
-    vm_map_entry_destroy(map, del);
+    vm_map_entry_destroy(map, del, dead);
 
     if (!next)
       break;
@@ -206,17 +244,26 @@ static int vm_map_destroy_range_nolock(vm_map_t *map, vaddr_t start,
 }
 
 int vm_map_destroy_range(vm_map_t *map, vaddr_t start, vaddr_t end) {
-  SCOPED_VM_MAP_LOCK(map);
-  return vm_map_destroy_range_nolock(map, start, end);
+  vm_map_entry_list_t dead = TAILQ_HEAD_INITIALIZER(dead);
+  int error;
+
+  WITH_VM_MAP_LOCK (map)
+    error = vm_map_destroy_range_nolock(map, start, end, &dead);
+
+  vm_map_entry_free_list(&dead);
+  return error;
 }
 
 void vm_map_delete(vm_map_t *map) {
+  vm_map_entry_list_t dead = TAILQ_HEAD_INITIALIZER(dead);
+
   pmap_delete(map->pmap);
   WITH_MTX_LOCK (&map->mtx) {
     vm_map_entry_t *ent, *next;
     TAILQ_FOREACH_SAFE (ent, &map->entries, link, next)
-      vm_map_entry_destroy(map, ent);
+      vm_map_entry_destroy(map, ent, &dead);
   }
+  vm_map_entry_free_list(&dead);
   pool_free(P_VM_MAP, map);
 }
 
@@ -238,10 +285,15 @@ void vm_map_protect(vm_map_t *map, vaddr_t start, vaddr_t end, vm_prot_t prot) {
     assert((ent->start < start && ent->end <= start) ||
            (ent->end > end && ent->start >= end) ||
            (ent->start >= start && ent->end <= end));
-    if (ent->start >= start && ent->end <= end)
+    if (ent->start >= start && ent->end <= end) {
+      vm_prot_t pmap_prot = prot;
+      /* Pages of copy-on-write entries must stay read-only until written. */
+      if (ent->object && ent->object->vo_backing)
+        pmap_prot &= ~VM_PROT_WRITE;
       ent->prot = prot;
+      pmap_protect(map->pmap, ent->start, ent->end, pmap_prot);
+    }
   }
-  pmap_protect(map->pmap, start, end, prot);
 }
 
 static int vm_map_findspace_nolock(vm_map_t *map, vaddr_t /*inout*/ *start_p,
@@ -299,8 +351,10 @@ int vm_map_findspace(vm_map_t *map, vaddr_t *start_p, size_t length) {
   return vm_map_findspace_nolock(map, start_p, length, NULL);
 }
 
-int vm_map_insert(vm_map_t *map, vm_map_entry_t *ent, vm_flags_t flags) {
-  SCOPED_MTX_LOCK(&map->mtx);
+static int vm_map_insert_nolock(vm_map_t *map, vm_map_entry_t *ent,
+                                vm_flags_t flags, vm_map_entry_list_t *dead) {
+  assert(mtx_owned(&map->mtx));
+
   vm_map_entry_t *after;
   vaddr_t start = ent->start;
   size_t length = ent->end - ent->start;
@@ -308,7 +362,8 @@ int vm_map_insert(vm_map_t *map, vm_map_entry_t *ent, vm_flags_t flags) {
 
   int error;
   if ((flags & VM_FIXED) && !(flags & VM_EXCL)) {
-    if ((error = vm_map_destroy_range_nolock(map, ent->start, ent->end)))
+    if ((error =
+           vm_map_destroy_range_nolock(map, ent->start, ent->end, dead)))
       return error;
   }
 
@@ -330,27 +385,38 @@ int vm_map_insert(vm_map_t *map, vm_map_entry_t *ent, vm_flags_t flags) {
   return 0;
 }
 
-int vm_map_alloc_entry(vm_map_t *map, vaddr_t addr, size_t length,
-                       vm_prot_t prot, vm_flags_t flags,
-                       vm_map_entry_t **ent_p) {
-  if (!(flags & VM_ANON)) {
-    klog("Only anonymous memory mappings are supported!");
-    return ENOTSUP;
-  }
+int vm_map_insert(vm_map_t *map, vm_map_entry_t *ent, vm_flags_t flags) {
+  vm_map_entry_list_t dead = TAILQ_HEAD_INITIALIZER(dead);
+  int error;
+
+  WITH_MTX_LOCK (&map->mtx)
+    error = vm_map_insert_nolock(map, ent, flags, &dead);
+
+  vm_map_entry_free_list(&dead);
+  return error;
+}
 
-  if (!page_aligned_p(addr))
-    return EINVAL;
+int vm_map_alloc_entry(vm_map_t *map, vm_object_t *obj, vaddr_t offset,
+                       vaddr_t addr, size_t length, vm_prot_t prot,
+                       vm_flags_t flags, vm_map_entry_t **ent_p) {
+  assert((obj != NULL) == !(flags & VM_ANON));
+
+  if (!page_aligned_p(addr) || !page_aligned_p(offset))
+    goto einval;
 
   if (length == 0)
-    return EINVAL;
+    goto einval;
 
   if (addr != 0 && !userspace_p(addr, addr + length))
-    return EINVAL;
+    goto einval;
 
   /* Create object with a pager that supplies cleared pages on page fault. */
-  vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+  if (flags & VM_ANON)
+    obj = vm_object_alloc(VM_ANONYMOUS);
+
   vm_map_entry_t *ent =
     vm_map_entry_alloc(obj, addr, addr + length, prot, VM_ENT_SHARED);
+  ent->offset = offset;
 
   /* Given the hint try to insert the entry at given position or after it. */
   if (vm_map_insert(map, ent, flags)) {
@@ -360,6 +426,49 @@ int vm_map_alloc_entry(vm_map_t *map, vaddr_t addr, size_t length,
 
   *ent_p = ent;
   return 0;
+
+einval:
+  if (obj)
+    vm_object_drop(obj);
+  return EINVAL;
+}
+
+int vm_map_sync(vm_map_t *map, vaddr_t start, vaddr_t end) {
+  vaddr_t addr = start;
+
+  while (addr < end) {
+    vm_object_t *obj = NULL;
+    vaddr_t offset = 0;
+    size_t length = 0;
+
+    /* Do not hold the map lock while writing pages back, since the write may
+     * page fault on user memory. */
+    WITH_MTX_LOCK (&map->mtx) {
+      vm_map_entry_t *ent = vm_map_find_entry(map, addr);
+      if (!ent)
+        return ENOMEM;
+      vaddr_t sync_end = min(end, ent->end);
+      if (vm_map_entry_vnode(ent)) {
+        obj = ent->object;
+        vm_object_hold(obj);
+        offset = ent->offset + (addr - ent->start);
+        length = sync_end - addr;
+      }
+      addr = sync_end;
+    }
+
+    if (obj) {
+      vnode_t *vn = obj->vo_vnode;
+      vnode_lock(vn);
+      int error = vnode_pager_flush(vn, offset, length);
+      vnode_unlock(vn);
+      vm_object_drop(obj);
+      if (error)
+        return error;
+    }
+  }
+
+  return 0;
 }
 
 int vm_map_entry_resize(vm_map_t *map, vm_map_entry_t *ent, vaddr_t new_end) {
@@ -384,8 +493,12 @@ int vm_map_entry_resize(vm_map_t *map, vm_map_entry_t *ent, vaddr_t new_end) {
 
   ent->end = new_end;
 
-  if (ent->start == ent->end)
-    vm_map_entry_destroy(map, ent);
+  /* Empty entry maps no pages, so there's nothing to write back. */
+  if (ent->start == ent->end) {
+    TAILQ_REMOVE(&map->entries, ent, link);
+    map->nentries--;
+    vm_map_entry_free(ent);
+  }
 
   return 0;
 }
@@ -423,9 +536,17 @@ vm_map_t *vm_map_clone(vm_map_t *map) {
         vm_object_hold(it->object);
         obj = it->object;
       } else {
-        /* vm_object_clone will clone the data from the vm_object_t
-         * and will return the new object with ref_counter equal to one */
-        obj = vm_object_clone(it->object);
+        /* Private memory is shared in copy-on-write fashion. Both parent and
+         * child get a new shadow object backed by the original one, hence
+         * pages are copied lazily on the first write in `vm_page_fault`. */
+        vm_object_t *old = it->object;
+        vm_object_collapse(old);
+        it->object = vm_object_shadow(old);
+        obj = vm_object_shadow(old);
+        vm_object_drop(old);
+        /* Make sure the parent won't modify pages that are shared now. */
+        pmap_protect(map->pmap, it->start, it->end,
+                     it->prot & ~VM_PROT_WRITE);
       }
       ent = vm_map_entry_alloc(obj, it->start, it->end, it->prot, it->flags);
       ent->offset = it->offset;
@@ -437,7 +558,48 @@ vm_map_t *vm_map_clone(vm_map_t *map) {
   return new_map;
 }
 
-int vm_page_fault(vm_map_t *map, vaddr_t fault_addr, vm_prot_t fault_type) {
+/*
+ * Fault-around: besides the faulting page, map pages that are resident in
+ * the window of up to FAULT_BEHIND pages before it and FAULT_AHEAD pages
+ * after it, to save on page faults that would only find the pages in place.
+ * Upon sequential access to anonymous memory (also when it's private memory
+ * shared copy-on-write after fork) up to FAULT_ZERO pages after the faulting
+ * one, which have never been touched, get zero-filled in advance.
+ */
+#define FAULT_BEHIND 3
+#define FAULT_AHEAD 4
+#define FAULT_ZERO 4
+#define FAULT_WINDOW (FAULT_BEHIND + 1 + FAULT_AHEAD)
+
+static_assert(FAULT_ZERO <= FAULT_AHEAD, "FAULT_ZERO exceeds FAULT_AHEAD!");
+
+/* Look up page at `offset` in `obj` or its backing objects without paging it
+ * in. */
+static vm_page_t *vm_object_lookup_resident(vm_object_t *obj,
+                                            vm_offset_t offset) {
+  for (; obj; obj = obj->vo_backing) {
+    vm_page_t *pg = vm_object_find_page(obj, offset);
+    if (pg)
+      return pg;
+  }
+  return NULL;
+}
+
+/* Check if pages that are neither in `obj` nor in its backing objects are
+ * zero-filled, i.e. they can be brought in without doing any I/O. */
+static bool vm_object_zero_fill_p(vm_object_t *obj) {
+  while (obj->vo_backing)
+    obj = obj->vo_backing;
+  vm_pgr_type_t type = obj->vo_pager->pgr_type;
+  return type == VM_ANONYMOUS || type == VM_SHADOW;
+}
+
+/* Maps the faulting page if it's resident. Otherwise returns EAGAIN along with
+ * the object (with its reference counter incremented) and the offset that the
+ * page has to be brought in from. */
+static int vm_page_fault_resident(vm_map_t *map, vaddr_t fault_addr,
+                                  vm_prot_t fault_type, vm_object_t **objp,
+                                  vm_offset_t *offsetp) {
   SCOPED_VM_MAP_LOCK(map);
 
   vm_map_entry_t *ent = vm_map_find_entry(map, fault_addr);
@@ -452,12 +614,12 @@ int vm_page_fault(vm_map_t *map, vaddr_t fault_addr, vm_prot_t fault_type) {
     return EACCES;
   }
 
-  if (!(ent->prot & VM_PROT_WRITE) && (fault_type == VM_PROT_WRITE)) {
+  if (!(ent->prot & VM_PROT_WRITE) && (fault_type & VM_PROT_WRITE)) {
     klog("Cannot write to address: 0x%08lx", fault_addr);
     return EACCES;
   }
 
-  if (!(ent->prot & VM_PROT_READ) && (fault_type == VM_PROT_READ)) {
+  if (!(ent->prot & VM_PROT_READ) && (fault_type & VM_PROT_READ)) {
     klog("Cannot read from address: 0x%08lx", fault_addr);
     return EACCES;
   }
@@ -470,15 +632,76 @@ int vm_page_fault(vm_map_t *map, vaddr_t fault_addr, vm_prot_t fault_type) {
 
   vaddr_t fault_page = fault_addr & -PAGESIZE;
   vaddr_t offset = ent->offset + (fault_page - ent->start);
-  vm_page_t *frame = vm_object_find_page(ent->object, offset);
+  vm_page_t *frame = vm_object_lookup_resident(obj, offset);
 
-  if (frame == NULL)
-    frame = obj->vo_pager->pgr_fault(obj, offset);
+  if (frame == NULL) {
+    vm_object_hold(obj);
+    *objp = obj;
+    *offsetp = offset;
+    return EAGAIN;
+  }
 
-  if (frame == NULL)
-    return EFAULT;
+  /* The page comes from a backing object and may be shared with other
+   * address spaces. Copy it on write, otherwise map it read-only. */
+  if (frame->object != obj && (fault_type & VM_PROT_WRITE)) {
+    vm_page_t *new_frame = vm_page_alloc(1);
+    pmap_copy_page(frame, new_frame);
+    vm_object_add_page(obj, offset, new_frame);
+    frame = new_frame;
+  }
+
+  vaddr_t start = fault_page - min(fault_page - ent->start,
+                                   (vaddr_t)FAULT_BEHIND * PAGESIZE);
+  vaddr_t end = fault_page + min(ent->end - fault_page,
+                                 (vaddr_t)(FAULT_AHEAD + 1) * PAGESIZE);
+  size_t n = (end - start) / PAGESIZE;
+  vm_page_t *pgs[FAULT_WINDOW];
+  vm_prot_t prots[FAULT_WINDOW];
+
+  /* Previous page is in place, so memory is likely accessed sequentially.
+   * The page may be still shared with the parent of a forked process. */
+  bool sequential = fault_page > ent->start && vm_object_zero_fill_p(obj) &&
+                    vm_object_lookup_resident(obj, offset - PAGESIZE);
+
+  for (size_t i = 0; i < n; i++) {
+    vaddr_t va = start + i * PAGESIZE;
+    vm_page_t *pg = frame;
+
+    if (va != fault_page) {
+      vm_offset_t off = ent->offset + (va - ent->start);
+      pg = vm_object_lookup_resident(obj, off);
+      if (!pg && sequential && va > fault_page &&
+          va <= fault_page + FAULT_ZERO * PAGESIZE)
+        (void)obj->vo_pager->pgr_fault(obj, off, &pg);
+    }
+
+    pgs[i] = pg;
+    prots[i] = ent->prot;
+    if (pg && pg->object != obj)
+      prots[i] &= ~VM_PROT_WRITE;
+  }
 
-  pmap_enter(map->pmap, fault_page, frame, ent->prot, 0);
+  pmap_enter_many(map->pmap, start, pgs, prots, n, 0);
 
   return 0;
 }
+
+int vm_page_fault(vm_map_t *map, vaddr_t fault_addr, vm_prot_t fault_type) {
+  vm_object_t *obj;
+  vm_offset_t offset;
+  int error;
+
+  /* Pagers may sleep with a vnode locked, while a thread that holds a vnode
+   * lock may page fault on user memory. To avoid deadlock the page is brought
+   * in with the map unlocked, and the fault is handled again afterwards. */
+  while ((error = vm_page_fault_resident(map, fault_addr, fault_type, &obj,
+                                         &offset)) == EAGAIN) {
+    vm_page_t *pg;
+    error = obj->vo_pager->pgr_fault(obj, offset, &pg);
+    vm_object_drop(obj);
+    if (error)
+      return error;
+  }
+
+  return error;
+}
@@ -8,51 +8,74 @@
 
 static POOL_DEFINE(P_VMOBJ, "vm_object", sizeof(vm_object_t));
 
+static inline int vm_page_cmp(vm_page_t *a, vm_page_t *b) {
+  if (a->offset < b->offset)
+    return -1;
+  return a->offset > b->offset;
+}
+
+RB_GENERATE(vm_pagetree, vm_page, objpages, vm_page_cmp);
+
 vm_object_t *vm_object_alloc(vm_pgr_type_t type) {
   vm_object_t *obj = pool_alloc(P_VMOBJ, M_ZERO);
-  TAILQ_INIT(&obj->vo_pages);
+  RB_INIT(&obj->vo_pages);
   mtx_init(&obj->vo_lock, 0);
   obj->vo_pager = &pagers[type];
   obj->vo_refs = 1;
   return obj;
 }
 
-vm_page_t *vm_object_find_page(vm_object_t *obj, vm_offset_t offset) {
-  SCOPED_MTX_LOCK(&obj->vo_lock);
+static vm_page_t *vm_object_find_page_nolock(vm_object_t *obj,
+                                             vm_offset_t offset) {
+  assert(mtx_owned(&obj->vo_lock));
 
-  vm_page_t *pg;
-  TAILQ_FOREACH (pg, &obj->vo_pages, objpages) {
-    if (pg->offset == offset)
-      return pg;
-  }
+  vm_page_t find = {.offset = offset};
+  return RB_FIND(vm_pagetree, &obj->vo_pages, &find);
+}
 
-  return NULL;
+vm_page_t *vm_object_find_page(vm_object_t *obj, vm_offset_t offset) {
+  SCOPED_MTX_LOCK(&obj->vo_lock);
+  return vm_object_find_page_nolock(obj, offset);
 }
 
-void vm_object_add_page(vm_object_t *obj, vm_offset_t offset, vm_page_t *pg) {
-  assert(page_aligned_p(pg->offset));
+/* Returns the page already present at the offset or NULL if \a pg got
+ * inserted. */
+static vm_page_t *vm_object_insert_page_nolock(vm_object_t *obj,
+                                               vm_offset_t offset,
+                                               vm_page_t *pg) {
+  assert(mtx_owned(&obj->vo_lock));
+  assert(page_aligned_p(offset));
   /* For simplicity of implementation let's insert pages of size 1 only */
   assert(pg->size == 1);
 
-  pg->object = obj;
   pg->offset = offset;
 
-  WITH_MTX_LOCK (&obj->vo_lock) {
-    vm_page_t *it;
-    TAILQ_FOREACH (it, &obj->vo_pages, objpages) {
-      if (it->offset > pg->offset) {
-        TAILQ_INSERT_BEFORE(it, pg, objpages);
-        obj->vo_npages++;
-        return;
-      }
-      /* there must be no page at the offset! */
-      assert(it->offset != pg->offset);
-    }
+  vm_page_t *found = RB_INSERT(vm_pagetree, &obj->vo_pages, pg);
+  if (found)
+    return found;
 
-    /* offset of page is greater than the offset of any other page */
-    TAILQ_INSERT_TAIL(&obj->vo_pages, pg, objpages);
-    obj->vo_npages++;
-  }
+  pg->object = obj;
+  obj->vo_npages++;
+  return NULL;
+}
+
+static void vm_object_add_page_nolock(vm_object_t *obj, vm_offset_t offset,
+                                      vm_page_t *pg) {
+  /* there must be no page at the offset! */
+  vm_page_t *found __unused = vm_object_insert_page_nolock(obj, offset, pg);
+  assert(found == NULL);
+}
+
+void vm_object_add_page(vm_object_t *obj, vm_offset_t offset, vm_page_t *pg) {
+  SCOPED_MTX_LOCK(&obj->vo_lock);
+  vm_object_add_page_nolock(obj, offset, pg);
+}
+
+vm_page_t *vm_object_try_add_page(vm_object_t *obj, vm_offset_t offset,
+                                  vm_page_t *pg) {
+  SCOPED_MTX_LOCK(&obj->vo_lock);
+  vm_page_t *found = vm_object_insert_page_nolock(obj, offset, pg);
+  return found ? found : pg;
 }
 
 static void vm_object_remove_pages_nolock(vm_object_t *obj, vm_offset_t offset,
@@ -60,18 +83,20 @@ static void vm_object_remove_pages_nolock(vm_object_t *obj, vm_offset_t offset,
   assert(mtx_owned(&obj->vo_lock));
   assert(page_aligned_p(offset) && page_aligned_p(length));
 
-  vm_page_t *pg, *next;
-  TAILQ_FOREACH_SAFE (pg, &obj->vo_pages, objpages, next) {
-    if (pg->offset >= offset + length)
-      break;
-    if (pg->offset < offset)
-      continue;
+  vm_page_t find = {.offset = offset};
+  vm_page_t *pg = RB_NFIND(vm_pagetree, &obj->vo_pages, &find);
+
+  while (pg && pg->offset < offset + length) {
+    vm_page_t *next = RB_NEXT(vm_pagetree, &obj->vo_pages, pg);
 
+    RB_REMOVE(vm_pagetree, &obj->vo_pages, pg);
     pg->offset = 0;
     pg->object = NULL;
-    TAILQ_REMOVE(&obj->vo_pages, pg, objpages);
-    vm_page_free(pg);
+    pmap_page_remove(pg);
+    if (!(pg->flags & PG_FIXED))
+      vm_page_free(pg);
     obj->vo_npages--;
+    pg = next;
   }
 }
 
@@ -88,37 +113,81 @@ void vm_object_hold(vm_object_t *obj) {
 }
 
 void vm_object_drop(vm_object_t *obj) {
-  WITH_MTX_LOCK (&obj->vo_lock) {
-    if (!refcnt_release(&obj->vo_refs))
-      return;
+  /* Release the whole chain of backing objects iteratively, as shadow chains
+   * may be arbitrarily long. */
+  while (obj != NULL) {
+    vm_object_t *backing;
+
+    WITH_MTX_LOCK (&obj->vo_lock) {
+      if (!refcnt_release(&obj->vo_refs))
+        return;
 
-    vm_object_remove_all_pages(obj);
+      vm_object_remove_all_pages(obj);
+      backing = obj->vo_backing;
+      obj->vo_backing = NULL;
+    }
+
+    if (obj->vo_pager->pgr_free)
+      obj->vo_pager->pgr_free(obj);
+
+    pool_free(P_VMOBJ, obj);
+    obj = backing;
   }
-  pool_free(P_VMOBJ, obj);
 }
 
-vm_object_t *vm_object_clone(vm_object_t *obj) {
-  /* XXX: this function will not be used in UVM */
-  vm_object_t *new_obj = vm_object_alloc(VM_DUMMY);
-  new_obj->vo_pager = obj->vo_pager;
-
-  WITH_MTX_LOCK (&obj->vo_lock) {
-    vm_page_t *pg;
-    TAILQ_FOREACH (pg, &obj->vo_pages, objpages) {
-      vm_page_t *new_pg = vm_page_alloc(1);
-      pmap_copy_page(pg, new_pg);
-      vm_object_add_page(new_obj, pg->offset, new_pg);
+vm_object_t *vm_object_shadow(vm_object_t *obj) {
+  vm_object_t *shadow = vm_object_alloc(VM_SHADOW);
+  vm_object_hold(obj);
+  shadow->vo_backing = obj;
+  return shadow;
+}
+
+void vm_object_collapse(vm_object_t *obj) {
+  vm_object_t *backing;
+
+  /* Vnode objects are never collapsed: they serve as page cache of a file
+   * and their pages may not be ours to modify (see PG_FIXED). */
+  while ((backing = obj->vo_backing) && backing->vo_refs == 1 &&
+         backing->vo_pager->pgr_type != VM_VNODE) {
+    /* We hold the only reference to backing object, so nobody else can see
+     * its pages. Move those not shadowed by our own pages into the object. */
+    vm_pagetree_t pages;
+    vm_object_t *next;
+
+    WITH_MTX_LOCK (&backing->vo_lock) {
+      pages = backing->vo_pages;
+      RB_INIT(&backing->vo_pages);
+      backing->vo_npages = 0;
+      next = backing->vo_backing;
+      backing->vo_backing = NULL;
     }
-  }
 
-  return new_obj;
+    WITH_MTX_LOCK (&obj->vo_lock) {
+      vm_page_t *pg;
+      while ((pg = RB_MIN(vm_pagetree, &pages))) {
+        RB_REMOVE(vm_pagetree, &pages, pg);
+        if (vm_object_find_page_nolock(obj, pg->offset)) {
+          pmap_page_remove(pg);
+          pg->offset = 0;
+          pg->object = NULL;
+          vm_page_free(pg);
+        } else {
+          vm_object_add_page_nolock(obj, pg->offset, pg);
+        }
+      }
+      obj->vo_backing = next;
+    }
+
+    /* Backing object has no pages and no backing object at this point. */
+    vm_object_drop(backing);
+  }
 }
 
 void vm_object_dump(vm_object_t *obj) {
   SCOPED_MTX_LOCK(&obj->vo_lock);
 
   vm_page_t *pg;
-  TAILQ_FOREACH (pg, &obj->vo_pages, objpages) {
+  RB_FOREACH (pg, vm_pagetree, &obj->vo_pages) {
     klog("(vm-obj) offset: 0x%08lx, size: %ld", pg->offset, pg->size);
   }
 }
@@ -1,23 +1,311 @@
+#define KL_LOG KL_VM
+#include <sys/klog.h>
+#include <sys/errno.h>
+#include <sys/libkern.h>
 #include <sys/mimiker.h>
+#include <sys/mutex.h>
 #include <sys/pmap.h>
+#include <sys/uio.h>
 #include <sys/vm_object.h>
 #include <sys/vm_pager.h>
 #include <sys/vm_physmem.h>
+#include <sys/vnode.h>
 
-static vm_page_t *dummy_pager_fault(vm_object_t *obj, off_t offset) {
-  return NULL;
+static int dummy_pager_fault(vm_object_t *obj, off_t offset,
+                             vm_page_t **pgp) {
+  return EFAULT;
 }
 
-static vm_page_t *anon_pager_fault(vm_object_t *obj, off_t offset) {
+static int anon_pager_fault(vm_object_t *obj, off_t offset, vm_page_t **pgp) {
   assert(obj != NULL);
 
   vm_page_t *new_pg = vm_page_alloc(1);
   pmap_zero_page(new_pg);
   vm_object_add_page(obj, offset, new_pg);
-  return new_pg;
+  *pgp = new_pg;
+  return 0;
+}
+
+/*
+ * Shadow pager looks up the page in the chain of backing objects. The page
+ * returned may belong to one of them, so it's up to the caller to copy it
+ * before the page gets modified. Pages that have never been touched in any
+ * of anonymous objects in the chain are zero-filled in the shadow itself.
+ */
+static int shadow_pager_fault(vm_object_t *obj, off_t offset,
+                              vm_page_t **pgp) {
+  assert(obj != NULL);
+
+  vm_object_t *it = obj;
+  while (it->vo_backing) {
+    it = it->vo_backing;
+    vm_page_t *pg = vm_object_find_page(it, offset);
+    if (pg) {
+      *pgp = pg;
+      return 0;
+    }
+  }
+
+  vm_pgr_type_t type = it->vo_pager->pgr_type;
+  if (type == VM_ANONYMOUS || type == VM_SHADOW)
+    return anon_pager_fault(obj, offset, pgp);
+
+  return it->vo_pager->pgr_fault(it, offset, pgp);
+}
+
+/*
+ * Vnode pager fills pages with contents of a file. Pages are cached in
+ * a single object per vnode, so they get shared between all processes that
+ * map the file, e.g. text segments of programs started from the same file.
+ */
+
+/* Protects `vnode_t::v_object` pointer. */
+static MTX_DEFINE(vnode_pager_lock, 0);
+
+/* Vnode must be locked, so that the file doesn't get written or truncated
+ * while its page is being read. */
+static int vnode_pager_getpage(vm_object_t *obj, off_t offset,
+                               vm_page_t **pgp) {
+  vnode_t *vn = obj->vo_vnode;
+  vm_page_t *pg;
+  vattr_t va;
+  int error;
+
+  if ((error = VOP_GETATTR(vn, &va)))
+    return EIO;
+
+  /* Pages that lie entirely beyond the end of file cannot be accessed. */
+  if ((size_t)offset >= va.va_size)
+    return EIO;
+
+  /* Map the page of the filesystem itself if it lets us. The page may still
+   * be owned by an object of the vnode that is being destroyed. */
+  if (VOP_GETPAGE(vn, offset, &pg) == 0 && (!pg->object || pg->object == obj)) {
+    *pgp = vm_object_try_add_page(obj, offset, pg);
+    return 0;
+  }
+
+  pg = vm_page_alloc(1);
+  pmap_zero_page(pg);
+
+  /* Part of the last page that is beyond the end of file stays zero-filled. */
+  size_t len = min((size_t)PAGESIZE, va.va_size - offset);
+  uio_t uio =
+    UIO_SINGLE_KERNEL(UIO_READ, offset, phys_to_dmap(pg->paddr), len);
+  if ((error = VOP_READ(vn, &uio))) {
+    klog("Vnode pager failed to read page at offset %08lx (error %d)",
+         offset, error);
+    vm_page_free(pg);
+    return EIO;
+  }
+
+  /* Somebody could have brought in the page while we were reading it. */
+  *pgp = vm_object_try_add_page(obj, offset, pg);
+  if (*pgp != pg)
+    vm_page_free(pg);
+  return 0;
+}
+
+static int vnode_pager_fault(vm_object_t *obj, off_t offset,
+                             vm_page_t **pgp) {
+  vnode_t *vn = obj->vo_vnode;
+
+  /* A thread that writes to a file from a buffer that maps the file itself
+   * page faults with the vnode locked already. */
+  if (vnode_owned(vn))
+    return vnode_pager_getpage(obj, offset, pgp);
+
+  vnode_lock(vn);
+  int error = vnode_pager_getpage(obj, offset, pgp);
+  vnode_unlock(vn);
+  return error;
+}
+
+static void vnode_pager_free(vm_object_t *obj) {
+  vnode_t *vn = obj->vo_vnode;
+
+  WITH_MTX_LOCK (&vnode_pager_lock) {
+    if (vn->v_object == obj)
+      vn->v_object = NULL;
+  }
+
+  vnode_drop(vn);
+}
+
+/* Acquire a reference to an object unless it's being destroyed. */
+static bool vm_object_tryhold(vm_object_t *obj) {
+  unsigned refs = atomic_load(&obj->vo_refs);
+  while (refs > 0) {
+    if (atomic_compare_exchange_weak(&obj->vo_refs, &refs, refs + 1))
+      return true;
+  }
+  return false;
+}
+
+/* Convert a byte range of a file into a range of page offsets, clipped to
+ * the highest page offset an object can have. */
+static void vnode_pager_range(off_t offset, size_t length, vm_offset_t *start_p,
+                              vm_offset_t *end_p) {
+  *start_p = rounddown(offset, PAGESIZE);
+  *end_p = (length < (vm_offset_t)(-PAGESIZE) - offset)
+             ? roundup(offset + length, PAGESIZE)
+             : (vm_offset_t)(-PAGESIZE);
+}
+
+vm_object_t *vnode_pager_object(vnode_t *vn) {
+  SCOPED_MTX_LOCK(&vnode_pager_lock);
+
+  vm_object_t *obj = vn->v_object;
+  if (obj && vm_object_tryhold(obj))
+    return obj;
+
+  obj = vm_object_alloc(VM_VNODE);
+  vnode_hold(vn);
+  obj->vo_vnode = vn;
+  vn->v_object = obj;
+  return obj;
+}
+
+/* Returns object that caches pages of the vnode with a reference held, or
+ * NULL if there's none. */
+static vm_object_t *vnode_pager_hold(vnode_t *vn) {
+  SCOPED_MTX_LOCK(&vnode_pager_lock);
+
+  vm_object_t *obj = vn->v_object;
+  if (obj == NULL || !vm_object_tryhold(obj))
+    return NULL;
+  return obj;
+}
+
+/*
+ * Find the first page of vnode object from [start, end) range. If `modified`
+ * is set, then skip pages that haven't been modified, and clear the bit of
+ * the page found. Pages are looked up one at a time, since the object must not
+ * be locked while the file system does I/O. Pages cannot be removed from
+ * the object while the vnode is locked, so the page may be used afterwards.
+ */
+static vm_page_t *vnode_pager_lookup(vm_object_t *obj, vm_offset_t start,
+                                     vm_offset_t end, bool modified) {
+  assert(vnode_owned(obj->vo_vnode));
+
+  SCOPED_MTX_LOCK(&obj->vo_lock);
+
+  vm_page_t find = {.offset = start};
+  vm_page_t *pg = RB_NFIND(vm_pagetree, &obj->vo_pages, &find);
+
+  while (pg && pg->offset < end) {
+    if (!modified)
+      return pg;
+    if (pmap_is_modified(pg)) {
+      /* Clear the bit first, so writes performed in the meantime are noticed
+       * next time the pages get written back. */
+      pmap_clear_modified(pg);
+      return pg;
+    }
+    pg = RB_NEXT(vm_pagetree, &obj->vo_pages, pg);
+  }
+
+  return NULL;
+}
+
+void vnode_pager_update(vnode_t *vn, off_t offset, size_t length) {
+  vm_object_t *obj = vnode_pager_hold(vn);
+  if (obj == NULL)
+    return;
+
+  vm_offset_t start, end;
+  vnode_pager_range(offset, length, &start, &end);
+
+  vm_page_t *pg;
+  while ((pg = vnode_pager_lookup(obj, start, end, false))) {
+    start = pg->offset + PAGESIZE;
+
+    /* Only the part of the page that belongs to the range is read in, other
+     * data may have been modified through a shared mapping. */
+    vm_offset_t from = max((vm_offset_t)offset, pg->offset);
+    vm_offset_t to = min((vm_offset_t)offset + length, pg->offset + PAGESIZE);
+    size_t len = to - from;
+    char *data = (char *)phys_to_dmap(pg->paddr) + (from - pg->offset);
+
+    uio_t uio = UIO_SINGLE_KERNEL(UIO_READ, from, data, len);
+    int error = VOP_READ(vn, &uio);
+    if (error) {
+      klog("Vnode pager failed to update page at offset %08lx (error %d)",
+           pg->offset, error);
+      vm_object_remove_pages(obj, pg->offset, PAGESIZE);
+      continue;
+    }
+
+    /* Data beyond the end of file reads as zeros. */
+    bzero(data + len - uio.uio_resid, uio.uio_resid);
+  }
+
+  vm_object_drop(obj);
+}
+
+void vnode_pager_truncate(vnode_t *vn, size_t size) {
+  size_t tail = size & (PAGESIZE - 1);
+  if (tail)
+    vnode_pager_update(vn, size, PAGESIZE - tail);
+
+  vm_object_t *obj = vnode_pager_hold(vn);
+  if (obj == NULL)
+    return;
+
+  /* Pages that are beyond the end of file cannot be accessed anymore. */
+  vm_offset_t start, end;
+  vnode_pager_range(roundup(size, PAGESIZE), SIZE_MAX, &start, &end);
+  vm_object_remove_pages(obj, start, end - start);
+  vm_object_drop(obj);
+}
+
+/* Write back modified pages of vnode object from [start, end) range. */
+static int vnode_pager_putpages(vm_object_t *obj, vm_offset_t start,
+                                vm_offset_t end) {
+  vnode_t *vn = obj->vo_vnode;
+  vattr_t va;
+  int error;
+
+  if ((error = VOP_GETATTR(vn, &va)))
+    return error;
+
+  /* Never extend the file, only its existing contents can be mapped. */
+  if (va.va_size < end)
+    end = roundup(va.va_size, PAGESIZE);
+
+  vm_page_t *pg;
+  while ((pg = vnode_pager_lookup(obj, start, end, true))) {
+    start = pg->offset + PAGESIZE;
+
+    size_t len = min((size_t)PAGESIZE, va.va_size - pg->offset);
+    uio_t uio = UIO_SINGLE_KERNEL(UIO_WRITE, pg->offset,
+                                  phys_to_dmap(pg->paddr), len);
+    if ((error = VOP_WRITE(vn, &uio))) {
+      pmap_set_modified(pg);
+      return error;
+    }
+  }
+
+  return 0;
+}
+
+int vnode_pager_flush(vnode_t *vn, off_t offset, size_t length) {
+  vm_object_t *obj = vnode_pager_hold(vn);
+  if (obj == NULL)
+    return 0;
+
+  vm_offset_t start, end;
+  vnode_pager_range(offset, length, &start, &end);
+  int error = vnode_pager_putpages(obj, start, end);
+  vm_object_drop(obj);
+  return error;
 }
 
 vm_pager_t pagers[] = {
-  [VM_DUMMY] = {.pgr_fault = dummy_pager_fault},
-  [VM_ANONYMOUS] = {.pgr_fault = anon_pager_fault},
+  [VM_DUMMY] = {.pgr_type = VM_DUMMY, .pgr_fault = dummy_pager_fault},
+  [VM_ANONYMOUS] = {.pgr_type = VM_ANONYMOUS, .pgr_fault = anon_pager_fault},
+  [VM_SHADOW] = {.pgr_type = VM_SHADOW, .pgr_fault = shadow_pager_fault},
+  [VM_VNODE] = {.pgr_type = VM_VNODE,
+                .pgr_fault = vnode_pager_fault,
+                .pgr_free = vnode_pager_free},
 };
@@ -327,3 +327,22 @@ vm_page_t *vm_page_find(paddr_t pa) {
 
   return NULL;
 }
+
+vm_page_t *vm_page_fixed(paddr_t pa) {
+  assert(page_aligned_p(pa));
+
+  SCOPED_MTX_LOCK(&physmem_lock);
+
+  vm_physseg_t *seg_it;
+  TAILQ_FOREACH (seg_it, &seglist, seglink) {
+    if (seg_it->used && seg_it->start <= pa && pa < seg_it->end) {
+      vm_page_t *pg = &seg_it->pages[(pa - seg_it->start) / PAGESIZE];
+      /* Used pages are never merged, so each can stand for a single frame. */
+      pg->size = 1;
+      pg->flags |= PG_FIXED;
+      return pg;
+    }
+  }
+
+  return NULL;
+}
@@ -25,3 +25,13 @@ __no_profile void cpu_intr_enable(void) {
 __no_profile bool cpu_intr_disabled(void) {
   return (mips32_getsr() & SR_IE) == 0;
 }
+
+/* Config7.WII: WAIT instruction resumes on interrupt even if SR.IE = 0. */
+#define CFG7_WII 0x80000000
+
+/* Whether the processor can be woken up from WAIT by a masked interrupt is
+ * implementation dependent. If it cannot, the idle loop just polls. */
+__no_profile void cpu_idle(void) {
+  if (mips32_get_c0(MIPS_C0_REGNAME(C0_CONFIG, 7)) & CFG7_WII)
+    _mips_wait();
+}
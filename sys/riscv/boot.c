@@ -37,7 +37,7 @@
  *       - thread pointer register (`$tp`) always points to the PCPU structure
  *         of the hart,
  *       - SSCRARCH register always contains 0 when the hart operates in
- *         supervisor mode, and kernel stack pointer while in user mode.
+ *         supervisor mode, and the PCPU pointer while in user mode.
  *
  *   - setting trap vector to trap handling routine,
  *
@@ -63,6 +63,7 @@
 #include <sys/mimiker.h>
 #include <sys/pcpu.h>
 #include <sys/pmap.h>
+#include <sys/smp.h>
 #include <riscv/abi.h>
 #include <riscv/boot.h>
 #include <riscv/cpufunc.h>
@@ -75,7 +76,7 @@
 #define BOOT_PD_VADDR (DMAP_BASE + GROWKERNEL_STRIDE)
 
 static __noreturn void riscv_boot(void *dtb, paddr_t pde, paddr_t sbrk_end,
-                                  vaddr_t vma_end);
+                                  vaddr_t vma_end, register_t hartid);
 
 /*
  * Virtual memory boot data.
@@ -171,7 +172,7 @@ __boot_text static pde_t *build_page_table(vaddr_t kernel_end) {
   return pde;
 }
 
-__boot_text __noreturn void riscv_init(paddr_t dtb) {
+__boot_text __noreturn void riscv_init(register_t hartid, paddr_t dtb) {
   if (!(_eboot < _kernel_start || _kernel_end < _boot))
     halt();
 
@@ -206,14 +207,15 @@ __boot_text __noreturn void riscv_init(paddr_t dtb) {
                    "mv a1, %1\n\t"
                    "mv a2, %2\n\t"
                    "mv a3, %3\n\t"
-                   "mv sp, %4\n\t"
-                   "csrw satp, %5\n\t"
+                   "mv a4, %4\n\t"
+                   "mv sp, %5\n\t"
+                   "csrw satp, %6\n\t"
                    "sfence.vma\n\t"
                    "1: j 1b" /* triggers instruction fetch page fault */
                    :
                    : "r"(dtb_va), "r"(pde), "r"(sbrk_end), "r"(vma_end),
-                     "r"(boot_sp), "r"(satp)
-                   : "a0", "a1", "a2", "a3");
+                     "r"(hartid), "r"(boot_sp), "r"(satp)
+                   : "a0", "a1", "a2", "a3", "a4");
   __unreachable();
 }
 
@@ -227,9 +229,9 @@ extern void cpu_exception_handler(void);
 extern void *board_stack(void);
 extern void __noreturn board_init(void);
 
+/* NOTE: `$tp` must already point to the PCPU structure of the hart. */
 static void configure_cpu(void) {
   /* Set initial register values. */
-  __set_tp();
   csr_write(sscratch, 0);
 
   /*
@@ -247,9 +249,12 @@ static void configure_cpu(void) {
 }
 
 static __noreturn void riscv_boot(void *dtb, paddr_t pde, paddr_t sbrk_end,
-                                  vaddr_t vma_end) {
+                                  vaddr_t vma_end, register_t hartid) {
+  __set_tp();
   configure_cpu();
 
+  PCPU_SET(hartid, hartid);
+
   boot_sbrk_end = sbrk_end;
 
 #if KASAN
@@ -273,6 +278,15 @@ static __noreturn void riscv_boot(void *dtb, paddr_t pde, paddr_t sbrk_end,
   __unreachable();
 }
 
+__noreturn void riscv_ap_boot(void) {
+  configure_cpu();
+
+  /* Device interrupts are handled by the boot hart. */
+  csr_set(sie, SIE_SSIE | SIE_STIE);
+
+  init_ap();
+}
+
 /* TODO(MichalBlk): remove those after architecture split of dbg debug scripts.
  */
 typedef struct {
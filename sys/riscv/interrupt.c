@@ -13,3 +13,9 @@ __no_profile bool cpu_intr_disabled(void) {
   register_t sstatus = csr_read(sstatus);
   return (sstatus & SSTATUS_SIE) == 0;
 }
+
+__no_profile void cpu_idle(void) {
+  /* WFI resumes on pending interrupt enabled in `sie`, regardless of
+   * `sstatus.SIE`. */
+  __asm __volatile("wfi" ::: "memory");
+}
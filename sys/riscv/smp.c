@@ -0,0 +1,88 @@
+#define KL_LOG KL_INIT
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/errno.h>
+#include <sys/fdt.h>
+#include <sys/libkern.h>
+#include <sys/pcpu.h>
+#include <sys/pmap.h>
+#include <sys/_pmap.h>
+#include <sys/smp.h>
+#include <sys/thread.h>
+#include <riscv/boot.h>
+#include <riscv/sbi.h>
+#include <riscv/vm_param.h>
+
+extern char _start_ap[];
+
+/* Without `volatile` the compiler would compute the physical address of
+ * `_start_ap` (placed in the boot segment) relative to PC. */
+static volatile paddr_t ap_entry = (paddr_t)_start_ap;
+
+/* Harts are started one at a time, so a single set of arguments suffices. */
+static ap_boot_args_t ap_args;
+
+static bool hart_usable(phandle_t node) {
+  char status[16];
+
+  /* Harts without MMU (e.g. monitor cores) cannot run the kernel. */
+  if (!FDT_hasprop(node, "mmu-type"))
+    return false;
+
+  ssize_t len = FDT_getprop(node, "status", (void *)status, sizeof(status));
+  return len < 0 || !strncmp(status, "okay", len);
+}
+
+/* Finds the identifier of `cpu`-th usable hart, not counting the boot one. */
+static int hart_lookup(int cpu, u_long *hartidp) {
+  phandle_t cpus = FDT_finddevice("/cpus");
+  if (cpus == FDT_NODEV)
+    return ENODEV;
+
+  for (phandle_t node = FDT_child(cpus); node != FDT_NODEV;
+       node = FDT_peer(node)) {
+    if (strncmp(FDT_getname(node), "cpu@", 4) || !hart_usable(node))
+      continue;
+
+    pcell_t reg;
+    if (FDT_getencprop(node, "reg", &reg, sizeof(reg)) != sizeof(reg))
+      continue;
+    if (reg == _pcpu_data[0].hartid)
+      continue;
+
+    if (--cpu == 0) {
+      *hartidp = reg;
+      return 0;
+    }
+  }
+
+  return ENODEV;
+}
+
+int smp_md_start_ap(int cpu) {
+  pcpu_t *pc = &_pcpu_data[cpu];
+  u_long hartid;
+  int error;
+
+  if (!sbi_probe_extension(SBI_EXT_ID_HSM))
+    return ENODEV;
+
+  if ((error = hart_lookup(cpu, &hartid)))
+    return error;
+
+  pc->hartid = hartid;
+
+  ap_args = (ap_boot_args_t){
+    .sp = (register_t)pc->curthread->td_uctx,
+    .tp = (register_t)pc,
+    .satp = pmap_kernel()->md.satp,
+    .entry = (register_t)riscv_ap_boot,
+  };
+  atomic_thread_fence(memory_order_seq_cst);
+
+  if (sbi_hsm_hart_start(hartid, ap_entry, PHYSADDR(&ap_args)))
+    return ENXIO;
+
+  klog("Started hart %lu as CPU %d", hartid, cpu);
+  return 0;
+}
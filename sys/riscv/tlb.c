@@ -1,5 +1,7 @@
 #include <sys/klog.h>
+#include <sys/pcpu.h>
 #include <riscv/pmap.h>
+#include <riscv/sbi.h>
 
 /*
  * NOTE: the `sfence.vma` instruction has multiple variants
@@ -8,12 +10,28 @@
  * variants, e.g. an `sfence.vma` with arguments executed on
  * the VexRiscv softcore results in an illegal instruction exception.
  * Thereby, Mimiker relies on the generic flush without any arguments.
+ *
+ * Other harts are asked to flush their TLBs through SBI RFENCE extension.
  */
 
+static void tlb_shootdown(void) {
+  u_long mask = 0;
+  int self = PCPU_GET(cpuid);
+
+  for (int cpu = 0; cpu < ncpus; cpu++)
+    if (cpu != self)
+      mask |= 1UL << _pcpu_data[cpu].hartid;
+
+  if (mask)
+    sbi_remote_sfence_vma(&mask, 0, 0);
+}
+
 void tlb_invalidate(vaddr_t va __unused, asid_t asid __unused) {
   __asm __volatile("sfence.vma" ::: "memory");
+  tlb_shootdown();
 }
 
 void tlb_invalidate_asid(asid_t asid __unused) {
   __asm __volatile("sfence.vma" ::: "memory");
+  tlb_shootdown();
 }
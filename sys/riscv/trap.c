@@ -140,7 +140,10 @@ static void user_trap_handler(ctx_t *ctx) {
     case SCAUSE_STORE_PAGE_FAULT:
       klog("%s at %p, caused by reference to %lx!", exceptions[code], epc,
            vaddr);
-      if ((error = pmap_fault_handler(ctx, vaddr, exc_access(code))))
+      error = pmap_fault_handler(ctx, vaddr, exc_access(code));
+      if (error == EIO)
+        sig_trap(SIGBUS, BUS_OBJERR, (void *)vaddr, code);
+      else if (error)
         sig_trap(SIGSEGV, error == EFAULT ? SEGV_MAPERR : SEGV_ACCERR,
                  (void *)vaddr, code);
       break;
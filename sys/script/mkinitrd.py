@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+#
+# Packs a directory tree into a cpio archive (SVR4 format with checksums)
+# to be used as initial ramdisk.
+#
+# Contents of regular files that span at least a page are placed at page
+# aligned offsets, so that the kernel can map them into user space directly
+# from the ramdisk. Padding is put at the end of the file name, which is
+# terminated with NUL anyway, so the archive can be read by any cpio tool.
+#
+# With --compress the archive is split into page sized blocks, each of them
+# compressed on its own with LZ4, so that the kernel can decompress them
+# lazily when they're first accessed. The image starts with a header followed
+# by offsets of blocks (see `initrd_zhdr_t` in sys/kern/initrd.c).
+
+import argparse
+import io
+import os
+import stat
+import struct
+
+MAGIC = b'070702'
+TRAILER = 'TRAILER!!!'
+HDRSIZE = 110
+
+ZMAGIC = b'MIMIRDZ\0'
+LZ4_MINMATCH = 4
+LZ4_MAXDIST = 65535
+# The last match must start at least 12 bytes before the end of block
+# and the last 5 bytes are always literals.
+LZ4_MFLIMIT = 12
+LZ4_LASTLITERALS = 5
+
+
+def align(n, a):
+    return (n + a - 1) & -a
+
+
+class Archive():
+    def __init__(self, out, pagesize):
+        self.out = out
+        self.pagesize = pagesize
+        self.offset = 0
+        self.ino = 0
+
+    def write(self, data):
+        self.out.write(data)
+        self.offset += len(data)
+
+    def add(self, name, data, mode=0, nlink=1, mtime=0, dev=0, rdev=0):
+        name = name.encode() + b'\0'
+        namesize = len(name)
+
+        # Pad the name so that file contents start at page boundary.
+        if stat.S_ISREG(mode) and len(data) >= self.pagesize:
+            start = align(self.offset + HDRSIZE + namesize, self.pagesize)
+            namesize = start - self.offset - HDRSIZE
+
+        self.ino += 1
+        fields = [self.ino, mode, 0, 0, nlink, mtime, len(data),
+                  os.major(dev), os.minor(dev), os.major(rdev), os.minor(rdev),
+                  namesize, sum(data) & 0xffffffff]
+        self.write(MAGIC + b''.join(b'%08X' % f for f in fields))
+        self.write(name.ljust(namesize, b'\0'))
+        self.write(bytes(align(self.offset, 4) - self.offset))
+        self.write(data)
+        self.write(bytes(align(self.offset, 4) - self.offset))
+
+    def add_file(self, name, path):
+        st = os.lstat(path)
+        data = b''
+        if stat.S_ISREG(st.st_mode):
+            with open(path, 'rb') as f:
+                data = f.read()
+        elif stat.S_ISLNK(st.st_mode):
+            data = os.readlink(path).encode()
+        self.add(name, data, st.st_mode, st.st_nlink, int(st.st_mtime),
+                 st.st_dev, st.st_rdev)
+
+    def finish(self):
+        self.add(TRAILER, b'')
+
+
+def lz4_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def lz4_sequence(out, literals, dist=0, mlen=0):
+    nlit = len(literals)
+    mlen = mlen - LZ4_MINMATCH if dist else 0
+    out.append(min(nlit, 15) << 4 | min(mlen, 15))
+    if nlit >= 15:
+        lz4_length(out, nlit - 15)
+    out += literals
+    if dist:
+        out += struct.pack('<H', dist)
+        if mlen >= 15:
+            lz4_length(out, mlen - 15)
+
+
+def lz4_compress(src):
+    # Greedy matching of 4-byte sequences, which skips faster through data
+    # that doesn't compress, just like the reference implementation does.
+    out = bytearray()
+    table = {}
+    anchor = i = misses = 0
+    limit = len(src) - LZ4_MFLIMIT
+    while i < limit:
+        key = src[i:i + LZ4_MINMATCH]
+        ref = table.get(key)
+        table[key] = i
+        if ref is None or i - ref > LZ4_MAXDIST:
+            misses += 1
+            i += 1 + (misses >> 6)
+            continue
+        mlen = LZ4_MINMATCH
+        maxlen = len(src) - LZ4_LASTLITERALS - i
+        while mlen < maxlen and src[ref + mlen] == src[i + mlen]:
+            mlen += 1
+        lz4_sequence(out, src[anchor:i], i - ref, mlen)
+        i = anchor = i + mlen
+        misses = 0
+    lz4_sequence(out, src[anchor:])
+    return bytes(out)
+
+
+def compress(data, blksize):
+    # Blocks that don't get smaller are stored as they are.
+    blocks = []
+    for start in range(0, len(data), blksize):
+        block = data[start:start + blksize]
+        packed = lz4_compress(block)
+        blocks.append(packed if len(packed) < len(block) else block)
+
+    offset = len(ZMAGIC) + 16 + 4 * (len(blocks) + 1)
+    offsets = []
+    for block in blocks:
+        offsets.append(offset)
+        offset += len(block)
+    offsets.append(offset)
+
+    header = ZMAGIC + struct.pack('<IIQ', blksize, len(blocks), len(data))
+    return header + struct.pack('<%dI' % len(offsets), *offsets) + \
+        b''.join(blocks)
+
+
+def walk(root):
+    # Same order as `find . | sort`, so parents come before their children.
+    paths = ['.']
+    for dirpath, dirnames, filenames in os.walk(root):
+        for name in dirnames + filenames:
+            path = os.path.relpath(os.path.join(dirpath, name), root)
+            if not name.endswith('.dbg'):
+                paths.append(path)
+    return sorted(paths)
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(
+        description='Build initial ramdisk image.')
+    parser.add_argument('root', help='Directory to be archived.')
+    parser.add_argument('image', help='Output file.')
+    parser.add_argument('-p', '--pagesize', type=int, default=4096,
+                        help='Alignment of file contents and block size.')
+    parser.add_argument('-c', '--compress', action='store_true',
+                        help='Compress the archive with LZ4.')
+    args = parser.parse_args()
+
+    out = io.BytesIO()
+    archive = Archive(out, args.pagesize)
+    for path in walk(args.root):
+        archive.add_file(path, os.path.join(args.root, path))
+    archive.finish()
+
+    data = out.getvalue()
+    image = compress(data, args.pagesize) if args.compress else data
+    with open(args.image, 'wb') as f:
+        f.write(image)
+
+    print('%s: %d bytes, archive of %d bytes' % (
+        args.image, len(image), len(data)))
@@ -0,0 +1,285 @@
+#include <sys/bio.h>
+#include <sys/devfs.h>
+#include <sys/errno.h>
+#include <sys/file.h>
+#include <sys/ktest.h>
+#include <sys/libkern.h>
+#include <sys/sched.h>
+#include <sys/thread.h>
+#include <sys/uio.h>
+
+#define TESTDISK_NBLOCKS 256
+
+/* More blocks than the buffer cache can hold at once. */
+#define LRU_NBLOCKS 128
+
+static unsigned nreads;  /* number of blocks read from the test disk */
+static unsigned nxfers;  /* number of `d_strategy` calls */
+static size_t last_xfer; /* number of blocks in the last transfer */
+static bool fail_writes; /* if set, writes fail with EIO */
+
+/* First byte of each block written to the test disk. */
+static uint8_t written[TESTDISK_NBLOCKS];
+
+/* Every byte of block n of the test disk equals n modulo 256. Only the first
+ * byte of written blocks is recorded. */
+static void testdisk_strategy(buf_t *bp) {
+  size_t nblks = bp->b_bcount / BIO_BSIZE;
+  uint8_t *data = bp->b_data;
+  int error = 0;
+
+  nxfers++;
+  last_xfer = nblks;
+
+  if (bp->b_flags & B_READ) {
+    for (size_t i = 0; i < nblks; i++)
+      memset(data + i * BIO_BSIZE, bp->b_blkno + i, BIO_BSIZE);
+    nreads += nblks;
+  } else if (fail_writes) {
+    error = EIO;
+  } else {
+    for (size_t i = 0; i < nblks; i++)
+      written[bp->b_blkno + i] = data[i * BIO_BSIZE];
+  }
+
+  biodone(bp, error);
+}
+
+static void testdisk_reset(void) {
+  nreads = 0;
+  nxfers = 0;
+  last_xfer = 0;
+  fail_writes = false;
+  bzero(written, sizeof(written));
+}
+
+static devops_t testdisk_ops = {
+  .d_type = DT_DISK,
+  .d_strategy = testdisk_strategy,
+};
+
+static devnode_t testdisk = {
+  .ops = &testdisk_ops,
+  .size = TESTDISK_NBLOCKS * BIO_BSIZE,
+};
+
+static bool block_valid(buf_t *bp, daddr_t blkno) {
+  uint8_t *data = bp->b_data;
+
+  if (!(bp->b_flags & B_VALID))
+    return false;
+  for (size_t i = 0; i < BIO_BSIZE; i++)
+    if (data[i] != (uint8_t)blkno)
+      return false;
+  return true;
+}
+
+static int test_bio_getblk(void) {
+  buf_t *bp, *bp2;
+
+  testdisk_reset();
+
+  /* Block is not cached, so it must be read from the disk. */
+  assert(bread(&testdisk, 1, &bp) == 0);
+  assert(nreads == 1);
+  assert(block_valid(bp, 1));
+  brelse(bp);
+
+  /* Now it's cached, so the same buffer is returned without any I/O. */
+  bp2 = getblk(&testdisk, 1);
+  assert(bp2 == bp);
+  assert(block_valid(bp2, 1));
+  assert(nreads == 1);
+  brelse(bp2);
+
+  /* A miss in getblk returns a buffer with no valid contents. */
+  bp = getblk(&testdisk, 2);
+  assert(bp != bp2);
+  assert(bp->b_blkno == 2);
+  assert(!(bp->b_flags & B_VALID));
+  brelse(bp);
+  assert(nreads == 1);
+
+  binvalidate(&testdisk);
+  return KTEST_SUCCESS;
+}
+
+static int test_bio_lru(void) {
+  buf_t *bp;
+
+  testdisk_reset();
+
+  for (daddr_t blkno = 0; blkno < LRU_NBLOCKS; blkno++) {
+    assert(bread(&testdisk, blkno, &bp) == 0);
+    brelse(bp);
+  }
+  assert(nreads == LRU_NBLOCKS);
+
+  /* The most recently used block is still cached... */
+  assert(bread(&testdisk, LRU_NBLOCKS - 1, &bp) == 0);
+  assert(block_valid(bp, LRU_NBLOCKS - 1));
+  brelse(bp);
+  assert(nreads == LRU_NBLOCKS);
+
+  /* ... but the least recently used one got recycled. */
+  assert(bread(&testdisk, 0, &bp) == 0);
+  assert(block_valid(bp, 0));
+  brelse(bp);
+  assert(nreads == LRU_NBLOCKS + 1);
+
+  binvalidate(&testdisk);
+  return KTEST_SUCCESS;
+}
+
+static buf_t *busy_bp;
+static volatile bool busy_acquired;
+
+static void busy_routine(void *arg) {
+  buf_t *bp = getblk(&testdisk, 0);
+  assert(bp == busy_bp);
+  assert(block_valid(bp, 0));
+  busy_acquired = true;
+  brelse(bp);
+}
+
+static int test_bio_busy(void) {
+  busy_acquired = false;
+  testdisk_reset();
+
+  assert(bread(&testdisk, 0, &busy_bp) == 0);
+
+  thread_t *td =
+    thread_create("test-bio-busy", busy_routine, NULL, prio_kthread(0));
+  sched_add(td);
+
+  /* Wait until the thread goes to sleep on the busy buffer. */
+  while (!td_is_sleeping(td))
+    thread_yield();
+  assert(!busy_acquired);
+
+  brelse(busy_bp);
+  thread_join(td);
+
+  assert(busy_acquired);
+  assert(nreads == 1);
+
+  binvalidate(&testdisk);
+  return KTEST_SUCCESS;
+}
+
+static uint8_t iobuf[2 * BIO_BSIZE];
+
+static int test_bio_readahead(void) {
+  buf_t *bp;
+
+  testdisk_reset();
+
+  /* Remaining blocks of a request are read along with the first one. */
+  uio_t uio = UIO_SINGLE_KERNEL(UIO_READ, 0, iobuf, sizeof(iobuf));
+  assert(bio_read(&testdisk, &uio) == 0);
+  assert(nxfers == 1 && last_xfer == 2);
+  assert(iobuf[0] == 0 && iobuf[BIO_BSIZE] == 1);
+
+  /* Sequential reader gets a whole cluster read ahead. */
+  uio = UIO_SINGLE_KERNEL(UIO_READ, 2 * BIO_BSIZE, iobuf, BIO_BSIZE);
+  uio.uio_ioflags |= IO_SEQMAX << IO_SEQSHIFT;
+  assert(bio_read(&testdisk, &uio) == 0);
+  assert(nxfers == 2 && last_xfer == BIO_MAXCLUSTER);
+  assert(iobuf[0] == 2);
+
+  /* Blocks read ahead are cached. */
+  for (daddr_t blkno = 3; blkno < BIO_MAXCLUSTER + 2; blkno++) {
+    assert(bread(&testdisk, blkno, &bp) == 0);
+    assert(block_valid(bp, blkno));
+    brelse(bp);
+  }
+  assert(nxfers == 2);
+  assert(nreads == BIO_MAXCLUSTER + 2);
+
+  binvalidate(&testdisk);
+  return KTEST_SUCCESS;
+}
+
+/* Fills a buffer with the contents that block `blkno` has on the disk and
+ * marks it dirty. */
+static void write_block(daddr_t blkno) {
+  buf_t *bp = getblk(&testdisk, blkno);
+  memset(bp->b_data, blkno, BIO_BSIZE);
+  bdwrite(bp);
+}
+
+static int test_bio_delwri(void) {
+  buf_t *bp;
+
+  testdisk_reset();
+
+  write_block(40);
+  assert(nxfers == 0);
+
+  /* Dirty block is served from the cache. */
+  assert(bread(&testdisk, 40, &bp) == 0);
+  assert(block_valid(bp, 40));
+  assert(bp->b_flags & B_DELWRI);
+  brelse(bp);
+  assert(nxfers == 0);
+
+  assert(bio_flush(&testdisk) == 0);
+  assert(nxfers == 1 && written[40] == 40);
+
+  /* Nothing is left to write. */
+  assert(bio_flush(&testdisk) == 0);
+  assert(nxfers == 1);
+
+  binvalidate(&testdisk);
+  return KTEST_SUCCESS;
+}
+
+static int test_bio_cluster(void) {
+  testdisk_reset();
+
+  /* Blocks are not written out until an aligned cluster is completed... */
+  for (daddr_t blkno = BIO_MAXCLUSTER; blkno < 2 * BIO_MAXCLUSTER - 1; blkno++)
+    write_block(blkno);
+  assert(nxfers == 0);
+
+  /* ... and then they all go out in a single transfer. */
+  write_block(2 * BIO_MAXCLUSTER - 1);
+  assert(nxfers == 1 && last_xfer == BIO_MAXCLUSTER);
+  for (daddr_t blkno = BIO_MAXCLUSTER; blkno < 2 * BIO_MAXCLUSTER; blkno++)
+    assert(written[blkno] == blkno);
+
+  binvalidate(&testdisk);
+  return KTEST_SUCCESS;
+}
+
+static int test_bio_write_error(void) {
+  buf_t *bp;
+
+  testdisk_reset();
+
+  write_block(50);
+  fail_writes = true;
+  assert(bio_flush(&testdisk) == EIO);
+
+  /* Data that could not be written is kept dirty. */
+  bp = getblk(&testdisk, 50);
+  assert(block_valid(bp, 50));
+  assert(bp->b_flags & B_DELWRI);
+  assert(bp->b_error == EIO);
+  brelse(bp);
+
+  fail_writes = false;
+  assert(bio_flush(&testdisk) == 0);
+  assert(written[50] == 50);
+
+  binvalidate(&testdisk);
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(bio_getblk, test_bio_getblk, 0);
+KTEST_ADD(bio_lru, test_bio_lru, 0);
+KTEST_ADD(bio_busy, test_bio_busy, 0);
+KTEST_ADD(bio_readahead, test_bio_readahead, 0);
+KTEST_ADD(bio_delwri, test_bio_delwri, 0);
+KTEST_ADD(bio_cluster, test_bio_cluster, 0);
+KTEST_ADD(bio_write_error, test_bio_write_error, 0);
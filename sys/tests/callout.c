@@ -103,7 +103,107 @@ static int test_callout_drain(void) {
   return KTEST_SUCCESS;
 }
 
+/* This test verifies that direct callouts are called from clock interrupt. */
+static void callout_direct(void *arg) {
+  assert(intr_disabled());
+  counter++;
+}
+
+static int test_callout_direct(void) {
+  const int N = 10;
+
+  callout_t callout;
+  callout_setup_direct(&callout, callout_direct, NULL);
+
+  counter = 0;
+
+  for (int i = 0; i < N; i++) {
+    callout_schedule(&callout, 1);
+    callout_drain(&callout);
+  }
+
+  assert(counter == N);
+
+  return KTEST_SUCCESS;
+}
+
+/* This test checks that callouts beyond the first level of timing wheel
+ * are not called too early when they get cascaded to lower levels. */
+#define CASCADE_N 4
+static systime_t cascade_delay[CASCADE_N] = {300, 5, 70, 130};
+
+static void callout_cascaded(void *arg) {
+  systime_t deadline = (systime_t)(intptr_t)arg;
+  assert(getsystime() >= deadline);
+  counter++;
+}
+
+static volatile bool on_time;
+
+/* Direct callout runs in the same tick the wheel processes it. */
+static void callout_on_time(void *arg) {
+  systime_t deadline = (systime_t)(intptr_t)arg;
+  on_time = getsystime() == deadline;
+}
+
+static int test_callout_cascade(void) {
+  callout_t callouts[CASCADE_N + 1];
+  systime_t now = getsystime();
+
+  counter = 0;
+  on_time = false;
+
+  for (int i = 0; i < CASCADE_N; i++) {
+    systime_t deadline = now + cascade_delay[i];
+    callout_setup(&callouts[i], callout_cascaded, (void *)(intptr_t)deadline);
+    callout_schedule_abs(&callouts[i], deadline);
+  }
+
+  /* Deadline at the beginning of a second level bucket is reached right when
+   * the bucket gets cascaded. */
+  systime_t aligned = (now + 128) & ~(systime_t)63;
+  callout_setup_direct(&callouts[CASCADE_N], callout_on_time,
+                       (void *)(intptr_t)aligned);
+  callout_schedule_abs(&callouts[CASCADE_N], aligned);
+
+  for (int i = 0; i <= CASCADE_N; i++)
+    callout_drain(&callouts[i]);
+
+  assert(counter == CASCADE_N);
+  assert(on_time);
+
+  return KTEST_SUCCESS;
+}
+
+/* This test checks that the earliest pending callout is found, so that an idle
+ * processor doesn't sleep through its deadline. */
+#define NEXT_N 3
+static systime_t next_delay[NEXT_N] = {50, 130, 5000};
+
+static int test_callout_next_event(void) {
+  callout_t callouts[NEXT_N];
+  systime_t now = getsystime();
+  systime_t next;
+
+  for (int i = 0; i < NEXT_N; i++) {
+    callout_setup(&callouts[i], callout_increment, NULL);
+    callout_schedule_abs(&callouts[i], now + next_delay[i]);
+  }
+
+  /* Other callouts may be pending, so an earlier event may be reported. */
+  for (int i = 0; i < NEXT_N; i++) {
+    assert(callout_next_event(&next));
+    assert(next <= now + next_delay[i]);
+    callout_stop(&callouts[i]);
+  }
+
+  return KTEST_SUCCESS;
+}
+
 KTEST_ADD(callout_simple, test_callout_simple, 0);
 KTEST_ADD(callout_order, test_callout_order, 0);
 KTEST_ADD(callout_stop, test_callout_stop, 0);
 KTEST_ADD(callout_drain, test_callout_drain, 0);
+KTEST_ADD(callout_direct, test_callout_direct, 0);
+KTEST_ADD(callout_cascade, test_callout_cascade, 0);
+KTEST_ADD(callout_next_event, test_callout_next_event, 0);
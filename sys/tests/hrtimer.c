@@ -0,0 +1,121 @@
+#include <sys/klog.h>
+#include <sys/libkern.h>
+#include <sys/hrtimer.h>
+#include <sys/sleepq.h>
+#include <sys/time.h>
+#include <sys/ktest.h>
+#include <sys/errno.h>
+#include <sys/interrupt.h>
+
+/* Time [us] between deadlines of consecutive timers in the order test. */
+#define ORDER_STEP_US 50
+
+#define ORDER_N 10
+static int order[ORDER_N] = {2, 5, 4, 6, 9, 0, 8, 1, 3, 7};
+static volatile int current;
+
+static void hrtimer_ordered(void *arg) {
+  int ord = (intptr_t)arg;
+  assert(current == ord);
+  /* All timers run in interrupt context of a single processor. */
+  current++;
+}
+
+/* Timers with deadlines closer than a clock tick must expire in order. */
+static int test_hrtimer_order(void) {
+  hrtimer_t timers[ORDER_N];
+  bintime_t step = HZ2BT(1000000 / ORDER_STEP_US);
+
+  for (int i = 0; i < ORDER_N; i++)
+    hrtimer_setup(&timers[i], hrtimer_ordered, (void *)(intptr_t)order[i],
+                  HRT_DIRECT);
+  current = 0;
+
+  WITH_INTR_DISABLED {
+    bintime_t now = binuptime();
+    for (int i = 0; i < ORDER_N; i++) {
+      bintime_t deadline = bintime_mul(step, order[i] + 1);
+      bintime_add(&deadline, &now);
+      hrtimer_start(&timers[i], deadline);
+    }
+  }
+
+  for (int i = 0; i < ORDER_N; i++)
+    hrtimer_drain(&timers[i]);
+
+  assert(current == ORDER_N);
+
+  return KTEST_SUCCESS;
+}
+
+/* Sleep duration [us] in the sleep test, which is well below a clock tick. */
+#define SLEEP_US 200
+#define SLEEP_N 50
+
+/* Timed sleep must never time out before the deadline. Report how late
+ * on average the thread wakes up, which shows clock hardware accuracy. */
+static int test_hrtimer_sleep(void) {
+  static int wchan;
+  bintime_t delay = HZ2BT(1000000 / SLEEP_US);
+  bintime_t late = {};
+
+  for (int i = 0; i < SLEEP_N; i++) {
+    bintime_t deadline = binuptime();
+    bintime_add(&deadline, &delay);
+
+    int error = sleepq_wait_until(&wchan, NULL, NULL, deadline);
+    bintime_t now = binuptime();
+
+    assert(error == ETIMEDOUT);
+    assert(bintime_cmp(&now, &deadline, >=));
+
+    bintime_sub(&now, &deadline);
+    bintime_add(&late, &now);
+  }
+
+  timespec_t ts;
+  bt2ts(&late, &ts);
+  long us = ((long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000) / SLEEP_N;
+  klog("Sleeps of %d us are late by %ld us on average", SLEEP_US, us);
+
+  return KTEST_SUCCESS;
+}
+
+/* Period [us] and number of expirations of the timer in the periodic test. */
+#define PERIODIC_US 500
+#define PERIODIC_N 20
+
+static hrtimer_t periodic_timer;
+static volatile int periodic_count;
+
+/* Runs in hrtimer thread, which may be on another processor than the one the
+ * timer was armed on. */
+static void hrtimer_periodic(void *arg) {
+  bintime_t deadline = periodic_timer.ht_time;
+  bintime_t period = HZ2BT(1000000 / PERIODIC_US);
+
+  if (++periodic_count == PERIODIC_N)
+    return;
+
+  bintime_add(&deadline, &period);
+  assert(hrtimer_reschedule(&periodic_timer, deadline));
+}
+
+/* Timer rearmed by its function keeps expiring until the function stops
+ * rearming it, and only then it can be drained. */
+static int test_hrtimer_periodic(void) {
+  bintime_t deadline = binuptime();
+
+  periodic_count = 0;
+  hrtimer_setup(&periodic_timer, hrtimer_periodic, NULL, 0);
+  hrtimer_start(&periodic_timer, deadline);
+  hrtimer_drain(&periodic_timer);
+
+  assert(periodic_count == PERIODIC_N);
+
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(hrtimer_order, test_hrtimer_order, 0);
+KTEST_ADD(hrtimer_sleep, test_hrtimer_sleep, 0);
+KTEST_ADD(hrtimer_periodic, test_hrtimer_periodic, 0);
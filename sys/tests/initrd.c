@@ -0,0 +1,229 @@
+#include <sys/mimiker.h>
+#include <sys/cred.h>
+#include <sys/errno.h>
+#include <sys/exec_elf.h>
+#include <sys/klog.h>
+#include <sys/initrd.h>
+#include <sys/ktest.h>
+#include <sys/libkern.h>
+#include <sys/lz4.h>
+#include <sys/malloc.h>
+#include <sys/pmap.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/vfs.h>
+#include <sys/vm.h>
+#include <sys/vnode.h>
+
+typedef struct lz4_vector {
+  const char *src; /* LZ4 block */
+  size_t srclen;
+  const char *dst; /* decompressed data (NULL if `src` is malformed) */
+  size_t dstlen;
+} lz4_vector_t;
+
+#define LZ4_VEC(src, dst)                                                      \
+  { src, sizeof(src) - 1, dst, sizeof(dst) - 1 }
+#define LZ4_BAD(src)                                                           \
+  { src, sizeof(src) - 1, NULL, 0 }
+
+/* Match overlapping its own output, followed by the last literals. */
+static const char lz4_overlap[] = "\x35"
+                                  "abc\x03\x00\x10!";
+
+static const lz4_vector_t lz4_vectors[] = {
+  /* literals only */
+  LZ4_VEC("\x50"
+          "Hello",
+          "Hello"),
+  /* length of literals continued in the next byte */
+  LZ4_VEC("\xf0\x03"
+          "abcdefghijklmnopqr",
+          "abcdefghijklmnopqr"),
+  LZ4_VEC(lz4_overlap, "abcabcabcabc!"),
+  /* run of a single byte with match length continued in the next byte */
+  LZ4_VEC("\x1fx\x01\x00\x05", "xxxxxxxxxxxxxxxxxxxxxxxxx"),
+  /* literals past the end of input */
+  LZ4_BAD("\x50"
+          "ab"),
+  /* length that never ends */
+  LZ4_BAD("\xf0\xff"),
+  /* truncated match offset */
+  LZ4_BAD("\x14"
+          "a\x01"),
+  /* zero match offset */
+  LZ4_BAD("\x14"
+          "a\x00\x00"),
+  /* match before the start of output */
+  LZ4_BAD("\x14"
+          "a\x02\x00"),
+};
+
+static int test_lz4(void) {
+  char buf[64];
+  size_t len;
+
+  for (size_t i = 0; i < __arraycount(lz4_vectors); i++) {
+    const lz4_vector_t *v = &lz4_vectors[i];
+    len = sizeof(buf);
+    int error = lz4_decompress(v->src, v->srclen, buf, &len);
+    if (v->dst == NULL) {
+      assert(error == EINVAL);
+    } else {
+      assert(error == 0);
+      assert(len == v->dstlen);
+      assert(memcmp(buf, v->dst, len) == 0);
+    }
+  }
+
+  /* Output that doesn't fit into the buffer. */
+  len = sizeof("abcabcabcabc!") - 2;
+  assert(lz4_decompress(lz4_overlap, sizeof(lz4_overlap) - 1, buf, &len) ==
+         EINVAL);
+
+  return KTEST_SUCCESS;
+}
+
+static int test_initrd_lookup(void) {
+  static const struct {
+    const char *path;
+    int error;
+    vnodetype_t type;
+  } lookups[] = {
+    {"/", 0, V_DIR},
+    {"/bin", 0, V_DIR},
+    {"/bin/utest", 0, V_REG},
+    {"/bin/cat", 0, V_REG},
+    {"/bin/ls", 0, V_REG},
+    /* Names that are prefixes or extensions of existing ones. */
+    {"/bi", ENOENT},
+    {"/bin/uts", ENOENT},
+    {"/bin/utestx", ENOENT},
+    /* Existing name in another directory. */
+    {"/utest", ENOENT},
+    {"/usr/utest", ENOENT},
+  };
+  cred_t *cred = cred_self();
+
+  for (size_t i = 0; i < __arraycount(lookups); i++) {
+    vnode_t *v;
+    int error = vfs_namelookup(lookups[i].path, &v, cred);
+    assert(error == lookups[i].error);
+    if (error)
+      continue;
+    assert(v->v_type == lookups[i].type);
+    vnode_drop(v);
+  }
+
+  return KTEST_SUCCESS;
+}
+
+/* Reads up to `len` bytes at `off` and returns the number of bytes read. */
+static size_t read_at(vnode_t *v, off_t off, void *buf, size_t len) {
+  uio_t uio = UIO_SINGLE_KERNEL(UIO_READ, off, buf, len);
+  int error = VOP_READ(v, &uio);
+  assert(error == 0);
+  return len - uio.uio_resid;
+}
+
+#define READ_SKEW 1000
+
+/* Every byte of a (possibly compressed) file must be the same no matter if
+ * it's read page by page, across page boundaries, or through a mapped page. */
+static int test_initrd_read(void) {
+  uint8_t *blk = kmalloc(M_TEMP, 2 * PAGESIZE, 0);
+  uint8_t *buf = kmalloc(M_TEMP, PAGESIZE, 0);
+  vnode_t *v;
+  vattr_t va;
+
+  assert(vfs_namelookup("/bin/utest", &v, cred_self()) == 0);
+  assert(VOP_GETATTR(v, &va) == 0);
+  assert(va.va_size > 2 * PAGESIZE);
+
+  assert(read_at(v, 0, buf, SELFMAG) == SELFMAG);
+  assert(memcmp(buf, ELFMAG, SELFMAG) == 0);
+
+  for (size_t off = 0; off + 2 * PAGESIZE <= va.va_size; off += PAGESIZE) {
+    assert(read_at(v, off, blk, PAGESIZE) == PAGESIZE);
+    assert(read_at(v, off + PAGESIZE, blk + PAGESIZE, PAGESIZE) == PAGESIZE);
+
+    assert(read_at(v, off + READ_SKEW, buf, PAGESIZE) == PAGESIZE);
+    assert(memcmp(buf, blk + READ_SKEW, PAGESIZE) == 0);
+
+    vm_page_t *pg;
+    if (VOP_GETPAGE(v, off, &pg) == 0)
+      assert(memcmp(phys_to_dmap(pg->paddr), blk, PAGESIZE) == 0);
+  }
+
+  /* Reads are cut short at the end of file. */
+  off_t last = va.va_size - READ_SKEW;
+  size_t tail = PAGESIZE + READ_SKEW;
+  assert(read_at(v, last - PAGESIZE, blk, 2 * PAGESIZE) == tail);
+  assert(read_at(v, last, buf, PAGESIZE) == READ_SKEW);
+  assert(memcmp(buf, blk + PAGESIZE, READ_SKEW) == 0);
+  assert(read_at(v, va.va_size, buf, PAGESIZE) == 0);
+
+  vnode_drop(v);
+  kfree(M_TEMP, buf);
+  kfree(M_TEMP, blk);
+  return KTEST_SUCCESS;
+}
+
+static const char *bench_files[] = {"/bin/ksh",   "/bin/ls",        "/bin/cat",
+                                    "/bin/utest", "/usr/bin/login", NULL};
+
+/* Reads all files from the list and returns time it took in microseconds. */
+static long initrd_bench(void *buf, size_t *totalp) {
+  cred_t *cred = cred_self();
+  size_t total = 0;
+
+  bintime_t start = binuptime();
+  for (const char **path = bench_files; *path; path++) {
+    vnode_t *v;
+    if (vfs_namelookup(*path, &v, cred))
+      continue;
+
+    for (off_t off = 0;; off += PAGESIZE) {
+      uio_t uio = UIO_SINGLE_KERNEL(UIO_READ, off, buf, PAGESIZE);
+      int error = VOP_READ(v, &uio);
+      assert(error == 0);
+      size_t len = PAGESIZE - uio.uio_resid;
+      if (len == 0)
+        break;
+      total += len;
+    }
+
+    vnode_drop(v);
+  }
+  bintime_t elapsed = binuptime();
+  bintime_sub(&elapsed, &start);
+
+  *totalp = total;
+  return bt2ns(&elapsed) / 1000;
+}
+
+/* The first pass also decompresses blocks of compressed ramdisk that haven't
+ * been accessed yet, the second one reads blocks that are already there. */
+static int test_initrd_bench(void) {
+  void *buf = kmalloc(M_TEMP, PAGESIZE, 0);
+  size_t total;
+
+  /* Tests are started right before init would be, so time since boot is
+   * a handy measure of how long the system takes to boot. */
+  bintime_t now = binuptime();
+  klog("initrd_bench started %ld ms after boot", bt2ns(&now) / 1000000);
+
+  long cold = initrd_bench(buf, &total);
+  long warm = initrd_bench(buf, &total);
+  klog("initrd image of %lu bytes: read %lu bytes in %ld us (first pass), "
+       "%ld us (second pass)",
+       ramdisk_get_size(), total, cold, warm);
+
+  kfree(M_TEMP, buf);
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(lz4, test_lz4, 0);
+KTEST_ADD(initrd_lookup, test_initrd_lookup, 0);
+KTEST_ADD(initrd_read, test_initrd_read, 0);
+KTEST_ADD(initrd_bench, test_initrd_bench, 0);
@@ -1,7 +1,9 @@
+#include <sys/klog.h>
 #include <sys/libkern.h>
 #include <sys/malloc.h>
 #include <sys/pool.h>
 #include <sys/ktest.h>
+#include <sys/time.h>
 
 typedef enum {
   PALLOC_TEST_REGULAR,    /* regular test */
@@ -51,6 +53,81 @@ static int test_pool_alloc_doublefree(void) {
   return test_pool_alloc(PALLOC_TEST_DOUBLEFREE);
 }
 
+static int test_pool_reclaim(void) {
+  const int N = 512;
+  void **item = kmalloc(M_TEST, sizeof(void *) * N, 0);
+
+  pool_t *slab = pool_create("test slab", 64, .flags = POOL_NOCACHE);
+  pool_t *cache = pool_create("test cache", 64);
+
+  for (int i = 0; i < N; i++)
+    item[i] = pool_alloc(slab, 0);
+  size_t npages = slab->pp_npages;
+  for (int i = 0; i < N; i++)
+    pool_free(slab, item[i]);
+  /* Empty slabs are kept until the pool is drained. */
+  assert(slab->pp_npages == npages);
+  pool_drain(slab);
+  assert(slab->pp_npages == 0);
+
+  for (int i = 0; i < N; i++)
+    item[i] = pool_alloc(cache, 0);
+  for (int i = 0; i < N; i++)
+    pool_free(cache, item[i]);
+  /* Items cached in magazines keep some slabs in use. The thread may have
+   * migrated, so other CPUs may still cache up to two magazines each. */
+  pool_drain(cache);
+  assert(cache->pp_nused <= (size_t)(ncpus - 1) * 2 * POOL_MAGAZINE_SIZE);
+  if (ncpus == 1)
+    assert(cache->pp_npages == 0);
+
+  pool_destroy(slab);
+  pool_destroy(cache);
+  kfree(M_TEST, item);
+  return KTEST_SUCCESS;
+}
+
+#define BENCH_PAIRS 200000
+#define BENCH_BATCH 32
+
+/* Returns number of alloc/free pairs per second. */
+static long pool_bench(pool_t *pool, int batch) {
+  void *items[BENCH_BATCH];
+
+  bintime_t start = binuptime();
+  for (int n = 0; n < BENCH_PAIRS; n += batch) {
+    for (int i = 0; i < batch; i++)
+      items[i] = pool_alloc(pool, 0);
+    for (int i = 0; i < batch; i++)
+      pool_free(pool, items[i]);
+  }
+  bintime_t elapsed = binuptime();
+  bintime_sub(&elapsed, &start);
+
+  uint64_t ns = bt2ns(&elapsed);
+  return (uint64_t)BENCH_PAIRS * 1000000000 / max(ns, (uint64_t)1);
+}
+
+/* Compares throughput of slab layer and magazine layer. */
+static int test_pool_alloc_bench(void) {
+  pool_t *slab = pool_create("bench slab", 64, .flags = POOL_NOCACHE);
+  pool_t *cache = pool_create("bench cache", 64);
+
+  for (int batch = 1; batch <= BENCH_BATCH; batch *= BENCH_BATCH) {
+    long slab_rate = pool_bench(slab, batch);
+    long cache_rate = pool_bench(cache, batch);
+    klog("pool_alloc/pool_free pairs per second (batch of %d): "
+         "%ld without magazines, %ld with magazines",
+         batch, slab_rate, cache_rate);
+  }
+
+  pool_destroy(slab);
+  pool_destroy(cache);
+  return KTEST_SUCCESS;
+}
+
 KTEST_ADD(pool_alloc_regular, test_pool_alloc_regular, 0);
 KTEST_ADD(pool_alloc_corruption, test_pool_alloc_corruption, KTEST_FLAG_BROKEN);
 KTEST_ADD(pool_alloc_doublefree, test_pool_alloc_doublefree, KTEST_FLAG_BROKEN);
+KTEST_ADD(pool_reclaim, test_pool_reclaim, 0);
+KTEST_ADD(pool_alloc_bench, test_pool_alloc_bench, 0);
@@ -0,0 +1,70 @@
+#include <sys/klog.h>
+#include <sys/ktest.h>
+#include <sys/mimiker.h>
+#include <sys/runq.h>
+#include <sys/thread.h>
+
+static runq_t rq;
+static thread_t tds[6];
+
+/* Threads 0-2 share a queue, 3 and 4 go to the first and the last one,
+ * 5 goes to a queue in the upper half of a status word. */
+static const prio_t tds_prio[] = {
+  [0] = 8 * RQ_PPQ,
+  [1] = 8 * RQ_PPQ + 1,
+  [2] = 8 * RQ_PPQ + RQ_PPQ - 1,
+  [3] = 0,
+  [4] = (RQ_NQS - 1) * RQ_PPQ,
+  [5] = 40 * RQ_PPQ,
+};
+
+/* Chooses a thread, checks it's the expected one and takes it off `rq`. */
+static void choose_and_remove(int i) {
+  thread_t *td = runq_choose(&rq);
+  assert(td == &tds[i]);
+  runq_remove(&rq, td);
+}
+
+static bool runq_empty(void) {
+  for (unsigned i = 0; i < RQB_LEN; i++)
+    if (rq.rq_status[i])
+      return false;
+  return runq_choose(&rq) == NULL;
+}
+
+static int test_runq(void) {
+  runq_init(&rq);
+  assert(runq_empty());
+
+  for (size_t i = 0; i < __arraycount(tds); i++) {
+    tds[i].td_prio = tds_prio[i];
+    runq_add(&rq, &tds[i]);
+  }
+
+  /* The highest priority queue goes first. */
+  choose_and_remove(3);
+
+  /* Threads of the same queue are chosen in FIFO order, regardless of
+   * their priorities within the queue. */
+  choose_and_remove(0);
+
+  /* Thread added to a non-empty queue goes to its end. */
+  runq_add(&rq, &tds[0]);
+  choose_and_remove(1);
+  choose_and_remove(2);
+  choose_and_remove(0);
+
+  /* The queue became empty, so its status bit got cleared. */
+  assert(!(rq.rq_status[0] & (1UL << 8)));
+  choose_and_remove(5);
+
+  /* Removing a thread from the middle of the run queue. */
+  runq_add(&rq, &tds[3]);
+  runq_remove(&rq, &tds[3]);
+  choose_and_remove(4);
+
+  assert(runq_empty());
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(runq, test_runq, 0);
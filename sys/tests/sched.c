@@ -1,97 +1,123 @@
-#include <sys/libkern.h>
 #include <sys/klog.h>
-#include <sys/time.h>
-#include <sys/thread.h>
-#include <sys/sched.h>
-#include <sys/vm_map.h>
-#include <sys/vm_pager.h>
 #include <sys/ktest.h>
+#include <sys/mimiker.h>
+#include <sys/pcpu.h>
+#include <sys/sched.h>
+#include <sys/thread.h>
+#include <sys/time.h>
+
+/* Number of times each thread gives up the processor. */
+#define BENCH_YIELDS 100
+#define BENCH_MAX_THREADS 256
 
-#if 0
-static void demo_thread_1(void) {
-  while (true) {
-    bintime_t start = binuptime();
-    klog("[%8zu] Running '%s' thread.", (size_t)bt2st(start),
-         thread_self()->td_name);
-    bintime_t now = binuptime();
-    while (bt2st(now) < bt2st(start) + 20)
-      now = binuptime();
+static thread_t *threads[BENCH_MAX_THREADS];
+
+static void yield_thread(void *arg) {
+  for (int i = 0; i < BENCH_YIELDS; i++)
+    thread_yield();
+}
+
+/* Returns average time [ns] between context switches with `n` threads
+ * yielding the processor to one another. */
+static uint64_t sched_bench(int n) {
+  /* The lowest priority puts threads on the last run queue, which is
+   * the worst case for run queue lookup. The threads won't run before
+   * the test thread blocks in `thread_join`. */
+  for (int i = 0; i < n; i++) {
+    threads[i] = thread_create("sched-bench", yield_thread, NULL,
+                               prio_uthread(PRIO_MIN));
+    sched_add(threads[i]);
   }
+
+  bintime_t start = binuptime();
+  for (int i = 0; i < n; i++)
+    thread_join(threads[i]);
+  bintime_t elapsed = binuptime();
+  bintime_sub(&elapsed, &start);
+
+  return bt2ns(&elapsed) / ((uint64_t)n * BENCH_YIELDS);
 }
 
-static void demo_thread_2(void) {
-  klog("Running '%s' thread. Let's yield!", thread_self()->td_name);
-  sched_yield();
-  demo_thread_1();
+/* Measures context switch latency as the number of runnable threads grows.
+ * With constant time run queue selection it should stay roughly the same. */
+static int test_sched_switch_bench(void) {
+  for (int n = 4; n <= BENCH_MAX_THREADS; n *= 4) {
+    uint64_t ns = sched_bench(n);
+    klog("%d runnable threads on %d CPU(s): %lu ns per context switch", n,
+         ncpus, (u_long)ns);
+  }
+
+  return KTEST_SUCCESS;
 }
 
-void main(void) {
-  thread_t *t1 = thread_create("t1", demo_thread_1, NULL);
-  thread_t *t2 = thread_create("t2", demo_thread_1, NULL);
-  thread_t *t3 = thread_create("t3", demo_thread_1, NULL);
-  thread_t *t4 = thread_create("t4", demo_thread_2, NULL);
-  thread_t *t5 = thread_create("t5", demo_thread_2, NULL);
+/* Time [ms] the processor is waited for before a test gives up. */
+#define SMP_TIMEOUT 1000
 
-  sched_add(t1);
-  sched_add(t2);
-  sched_add(t3);
-  sched_add(t4);
-  sched_add(t5);
+static volatile bool kicked;
 
-  sched_run();
+static void kicked_thread(void *arg) {
+  kicked = true;
 }
-#endif
-
-#if 0
-static struct {
-  intptr_t start, end;
-} range[] = {
-  {0xd0000000, 0xd0001000}, {0x1000000, 0x1001000}, {0x2000000, 0x2001000}};
-
-static void test_thread(void *p) {
-  int *ptr = p;
-  klog("ptr: %p", ptr);
-  while (1) {
-    *ptr = *ptr + 1;
-    klog("thread: %s, val: %d", thread_self()->td_name, *ptr);
-    sched_yield();
+
+/* A thread of lower priority than the current one must be picked up by
+ * another processor, which is kicked out of its idle loop by an IPI. */
+static int test_sched_kick_idle(void) {
+  if (ncpus == 1)
+    return KTEST_SUCCESS;
+
+  kicked = false;
+  thread_t *td = thread_create("sched-kick", kicked_thread, NULL,
+                               prio_uthread(PRIO_MIN));
+
+  WITH_NO_PREEMPTION {
+    systime_t deadline = getsystime() + SMP_TIMEOUT;
+    sched_add(td);
+    while (!kicked && getsystime() < deadline)
+      continue;
   }
+
+  assert(kicked);
+  thread_join(td);
+  return KTEST_SUCCESS;
 }
 
-static int test_sched(void) {
-  thread_t *t1 =
-    thread_create("kernel-thread-1", test_thread, (void *)range[0].start);
-  thread_t *t3 =
-    thread_create("user-thread-1", test_thread, (void *)range[1].start);
-  thread_t *t4 =
-    thread_create("user-thread-2", test_thread, (void *)range[2].start);
-
-  vm_map_entry_t *entry1 =
-    vm_map_add_entry(get_kernel_vm_map(), range[0].start, range[0].end,
-                     VM_PROT_READ | VM_PROT_WRITE);
-  entry1->object = default_pager->pgr_alloc();
-
-  t3->td_uspace = vm_map_new();
-  vm_map_entry_t *entry2 = vm_map_add_entry(
-    t3->td_uspace, range[1].start, range[1].end, VM_PROT_READ | VM_PROT_WRITE);
-  entry2->object = default_pager->pgr_alloc();
-
-  t4->td_uspace = vm_map_new();
-  vm_map_entry_t *entry3 = vm_map_add_entry(
-    t4->td_uspace, range[2].start, range[2].end, VM_PROT_READ | VM_PROT_WRITE);
-  entry3->object = default_pager->pgr_alloc();
-
-  vm_map_dump(get_kernel_vm_map());
-  vm_map_dump(t3->td_uspace);
-  vm_map_dump(t4->td_uspace);
-
-  sched_add(t1);
-  sched_add(t3);
-  sched_add(t4);
-
-  sched_run();
-  return KTEST_FAILURE;
+#define SPREAD_THREADS 16
+/* Time [ms] each thread keeps its processor busy. */
+#define SPREAD_BUSY 10
+
+static volatile atomic_int spread_done;
+static volatile atomic_uint spread_cpus;
+
+static void spread_thread(void *arg) {
+  systime_t deadline = getsystime() + SPREAD_BUSY;
+  while (getsystime() < deadline)
+    continue;
+  atomic_fetch_or(&spread_cpus, 1U << PCPU_GET(cpuid));
+  atomic_fetch_add(&spread_done, 1);
+}
+
+/* Threads taken off the shared run queue by all processors must run to
+ * completion. If there's more than one processor, the work should not be
+ * done by a single one. */
+static int test_sched_runq_spread(void) {
+  spread_done = 0;
+  spread_cpus = 0;
+
+  for (int i = 0; i < SPREAD_THREADS; i++) {
+    threads[i] =
+      thread_create("sched-spread", spread_thread, NULL, prio_kthread(0));
+    sched_add(threads[i]);
+  }
+
+  for (int i = 0; i < SPREAD_THREADS; i++)
+    thread_join(threads[i]);
+
+  assert(spread_done == SPREAD_THREADS);
+  if (ncpus > 1)
+    assert(spread_cpus & (spread_cpus - 1));
+  return KTEST_SUCCESS;
 }
 
-KTEST_ADD(sched, test_sched, KTEST_FLAG_NORETURN);
-#endif
+KTEST_ADD(sched_switch_bench, test_sched_switch_bench, 0);
+KTEST_ADD(sched_kick_idle, test_sched_kick_idle, 0);
+KTEST_ADD(sched_runq_spread, test_sched_runq_spread, 0);
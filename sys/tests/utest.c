@@ -78,6 +78,10 @@ UTEST_ADD(mmap_fixed_excl);
 UTEST_ADD(mmap_fixed_replace);
 UTEST_ADD(mmap_fixed_replace_many_1);
 UTEST_ADD(mmap_fixed_replace_many_2);
+UTEST_ADD(mmap_file_private);
+UTEST_ADD(mmap_file_shared);
+UTEST_ADD(mmap_file_access);
+UTEST_ADD(mmap_file_eof);
 UTEST_ADD(sbrk);
 UTEST_ADD(sbrk_sigsegv);
 UTEST_ADD(misbehave);
@@ -110,6 +114,8 @@ UTEST_ADD(signal_handler_mask);
 UTEST_ADD(fork_wait);
 UTEST_ADD(fork_signal);
 UTEST_ADD(fork_sigchld_ignored);
+UTEST_ADD(fork_cow);
+UTEST_ADD(fork_exec_latency);
 
 UTEST_ADD(lseek_basic);
 UTEST_ADD(lseek_errors);
@@ -134,6 +140,8 @@ UTEST_ADD(vfs_trunc);
 UTEST_ADD(vfs_symlink);
 UTEST_ADD(vfs_link);
 UTEST_ADD(vfs_chmod);
+UTEST_ADD(vfs_dir_many);
+UTEST_ADD(vfs_getdents_resume);
 
 UTEST_ADD(wait_basic);
 UTEST_ADD(wait_nohang);
@@ -7,6 +7,7 @@
 #include <sys/ktest.h>
 #include <sys/proc.h>
 #include <sys/cred.h>
+#include <sys/devfs.h>
 
 static bool fsname_of(vnode_t *v, const char *fsname) {
   return strncmp(v->v_mount->mnt_vfc->vfc_name, fsname, strlen(fsname)) == 0;
@@ -58,3 +59,46 @@ static int test_vfs(void) {
 }
 
 KTEST_ADD(vfs, test_vfs, 0);
+
+static int test_vfs_namecache(void) {
+  vnode_t *v, *v2;
+  devfs_node_t *d, *d2;
+  int error;
+  cred_t *cred = cred_self();
+
+  error = devfs_makedir(NULL, "nctest", &d);
+  assert(error == 0);
+
+  /* The second lookup must be answered by a negative name cache entry. */
+  error = vfs_namelookup("/dev/nctest/subdir", &v, cred);
+  assert(error == ENOENT);
+  error = vfs_namelookup("/dev/nctest/subdir", &v, cred);
+  assert(error == ENOENT);
+
+  /* ... which must be gone once the name gets created. */
+  error = devfs_makedir(d, "subdir", &d2);
+  assert(error == 0);
+  error = vfs_namelookup("/dev/nctest/subdir", &v, cred);
+  assert(error == 0);
+  error = vfs_namelookup("/dev/nctest/subdir", &v2, cred);
+  assert(error == 0 && v == v2);
+  /* Name cache does not hold references to vnodes. */
+  assert(v->v_usecnt == 3);
+  vnode_drop(v);
+  vnode_drop(v2);
+
+  /* Removed names must not be found anymore. */
+  error = devfs_unlink(d2);
+  assert(error == 0);
+  error = vfs_namelookup("/dev/nctest/subdir", &v, cred);
+  assert(error == ENOENT);
+
+  error = devfs_unlink(d);
+  assert(error == 0);
+  error = vfs_namelookup("/dev/nctest", &v, cred);
+  assert(error == ENOENT);
+
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(vfs_namecache, test_vfs_namecache, 0);
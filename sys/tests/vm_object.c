@@ -0,0 +1,107 @@
+#include <sys/klog.h>
+#include <sys/mimiker.h>
+#include <sys/vm_pager.h>
+#include <sys/vm_object.h>
+#include <sys/vm_map.h>
+#include <sys/ktest.h>
+#include <sys/sched.h>
+#include <sys/proc.h>
+#include <sys/time.h>
+
+#ifdef __riscv
+#include <riscv/cpufunc.h>
+#endif
+
+/* Number of pages resident in the object at the end of the test. */
+#if __SIZEOF_POINTER__ == 4
+#define NPAGES 8192
+#else
+#define NPAGES 32768
+#endif
+
+#define NSTEPS 8
+
+static int test_vm_object_many_pages(void) {
+  /* Temporary user-space map is stored in our process, so we must not be
+   * switched to another process. See vm_map.c test for details. */
+  SCOPED_NO_PREEMPTION();
+  proc_t *p = proc_self();
+
+  vm_map_t *orig = vm_map_user();
+  p->p_uspace = vm_map_new();
+  vm_map_activate(p->p_uspace);
+
+  const vaddr_t start = 0x1000000;
+  const vaddr_t end = start + NPAGES * PAGESIZE;
+
+  vm_object_t *obj = vm_object_alloc(VM_ANONYMOUS);
+  vm_object_hold(obj);
+  vm_map_entry_t *ent = vm_map_entry_alloc(
+    obj, start, end, VM_PROT_READ | VM_PROT_WRITE, VM_ENT_PRIVATE);
+  int error = vm_map_insert(p->p_uspace, ent, VM_FIXED);
+  assert(error == 0);
+
+#ifdef __riscv
+  enter_user_access();
+#endif
+
+  /* Fault in pages in increasing order of addresses, since inserting a page
+   * past all pages already in the object used to be the most costly. Report
+   * the average cost of a fault for each batch of pages, which must not grow
+   * with the number of resident pages. */
+  vaddr_t va = start;
+  for (int i = 0; i < NSTEPS; i++) {
+    vaddr_t batch_end = va + NPAGES / NSTEPS * PAGESIZE;
+    bintime_t before = binuptime();
+    for (; va < batch_end; va += PAGESIZE)
+      *(volatile int *)va = va;
+    bintime_t elapsed = binuptime();
+    bintime_sub(&elapsed, &before);
+    klog("%ld resident pages: %ld ns per fault", obj->vo_npages,
+         bt2ns(&elapsed) / (NPAGES / NSTEPS));
+  }
+
+  /* Ensure faults have not mixed up contents of pages. */
+  for (va = start; va < end; va += PAGESIZE)
+    assert(*(volatile int *)va == (int)va);
+
+#ifdef __riscv
+  exit_user_access();
+#endif
+
+  assert(obj->vo_npages == NPAGES);
+
+  /* Pages must be visited in order of their offsets. */
+  vm_offset_t offset = 0;
+  vm_page_t *pg;
+  RB_FOREACH (pg, vm_pagetree, &obj->vo_pages) {
+    assert(pg->offset == offset);
+    offset += PAGESIZE;
+  }
+
+  bintime_t before = binuptime();
+  for (offset = 0; offset < NPAGES * PAGESIZE; offset += PAGESIZE)
+    assert(vm_object_find_page(obj, offset) != NULL);
+  bintime_t elapsed = binuptime();
+  bintime_sub(&elapsed, &before);
+  klog("%ld resident pages: %ld ns per lookup", obj->vo_npages,
+       bt2ns(&elapsed) / NPAGES);
+
+  /* Punch a hole after every page left in the object. */
+  for (offset = PAGESIZE; offset < NPAGES * PAGESIZE; offset += 2 * PAGESIZE)
+    vm_object_remove_pages(obj, offset, PAGESIZE);
+  assert(obj->vo_npages == NPAGES / 2);
+  assert(vm_object_find_page(obj, 0) != NULL);
+  assert(vm_object_find_page(obj, PAGESIZE) == NULL);
+
+  vm_object_drop(obj);
+  vm_map_delete(p->p_uspace);
+
+  /* Restore original vm_map */
+  p->p_uspace = orig;
+  vm_map_activate(orig);
+
+  return KTEST_SUCCESS;
+}
+
+KTEST_ADD(vm_object_many_pages, test_vm_object_many_pages, 0);